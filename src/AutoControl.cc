@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "AutoControl.hh"
+
+#include <math.h>
+#include <string.h>
+
+
+AutoControl::AutoControl(Grabber* grabber) {
+	mGrabber = grabber;
+	mAutoExposure = false;
+	mAutoWhiteBalance = false;
+	mTargetLuma = AUTOCONTROL_TARGET_LUMA;
+	mMinIntervalUs = (unsigned long long) (1e6f / AUTOCONTROL_MAX_RATE);
+	mRowStep = FRAMESTATS_ROW_STEP;
+	mColStep = FRAMESTATS_COL_STEP;
+	mHaveLast = false;
+	mLastUs = 0;
+	for (unsigned int i=0; i< GRABBER_CTRL_NONE; i++) {
+		mPending[i] = false;
+		mRequested[i] = 0;
+	}
+	pthread_mutex_init(&mStatsLock, NULL);
+	mHaveStats = false;
+	memset(&mStats, 0, sizeof(FrameStats));
+}
+
+
+AutoControl::~AutoControl() {
+	pthread_mutex_destroy(&mStatsLock);
+}
+
+
+bool AutoControl::set_auto_exposure(bool enable, float targetLuma) {
+	if (enable) {
+		if (mGrabber->get_ctrl_data(GRABBER_CTRL_EXPOSURE)==NULL and mGrabber->get_ctrl_data(GRABBER_CTRL_GAIN)==NULL) return false;
+		if (mGrabber->get_ctrl_value(GRABBER_CTRL_AUTOGAIN) > 0) mGrabber->set_ctrl_value(GRABBER_CTRL_AUTOGAIN, 0);
+		if (targetLuma < 1) targetLuma = 1;
+		if (targetLuma > 254) targetLuma = 254;
+		mTargetLuma = targetLuma;
+	}
+	mAutoExposure = enable;
+	return true;
+}
+
+
+bool AutoControl::set_auto_white_balance(bool enable) {
+	if (enable) {
+		if (mGrabber->get_ctrl_data(GRABBER_CTRL_RED_BALANCE)==NULL and mGrabber->get_ctrl_data(GRABBER_CTRL_BLUE_BALANCE)==NULL) return false;
+		if (mGrabber->get_ctrl_value(GRABBER_CTRL_AUTO_WHITE_BALANCE) > 0) mGrabber->set_ctrl_value(GRABBER_CTRL_AUTO_WHITE_BALANCE, 0);
+	}
+	mAutoWhiteBalance = enable;
+	return true;
+}
+
+
+void AutoControl::set_max_rate(float hz) {
+	mMinIntervalUs = (hz > 0) ? (unsigned long long) (1e6f / hz) : 0;
+}
+
+
+void AutoControl::set_sampling(unsigned int rowStep, unsigned int colStep) {
+	mRowStep = rowStep;
+	mColStep = colStep;
+}
+
+
+bool AutoControl::get_last_stats(FrameStats& stats) {
+	pthread_mutex_lock(&mStatsLock);
+	bool have = mHaveStats;
+	if (have) stats = mStats;
+	pthread_mutex_unlock(&mStatsLock);
+	return have;
+}
+
+
+bool AutoControl::internal_settled(const PixelBuffer* pb, GrabberControlID id) {
+	if (!mPending[id]) return true;
+	if (!(pb->meta.ctrlValid & (1u << id))) {
+		// the grabber doesn't track this control: rely on the rate bound
+		mPending[id] = false;
+		return true;
+	}
+	if (pb->meta.ctrl[id]!=mRequested[id]) return false;
+	mPending[id] = false;
+	return true;
+}
+
+
+float AutoControl::internal_scale(GrabberControlID id, float factor) {
+	const GrabberControlData* data = mGrabber->get_ctrl_data(id);
+	if (data==NULL) return 1;
+	int step = (data->step > 0) ? data->step : 1;
+	// exposure, gain and balances are taken as linear: a control at 0 starts from one step
+	int value = data->value;
+	float base = (value > step) ? (float) value : (float) step;
+	float wanted = base * factor;
+	if (wanted < data->min) wanted = data->min;
+	if (wanted > data->max) wanted = data->max;
+	int newValue = data->min + (int) floorf((wanted - data->min) / step + 0.5f) * step;
+	if (newValue > data->max) newValue -= step;
+	if (newValue==value) return 1;
+	if (!mGrabber->set_ctrl_value(id, (short) newValue)) return 1;
+	mPending[id] = true;
+	mRequested[id] = newValue;
+	return (float) ((newValue > step) ? newValue : step) / base;
+}
+
+
+void AutoControl::internal_exposure(const FrameStats& stats) {
+	float mean = (stats.meanLuma > 1) ? stats.meanLuma : 1;
+	float ev = log2f(mTargetLuma / mean);
+	if (stats.histSamples and stats.hist[FRAMESTATS_BINS - 1] > AUTOCONTROL_CLIP_FRACTION * stats.histSamples) {
+		// highlights are clipped: the mean underestimates the scene, step down whatever it says
+		if (ev > -0.25f) ev = -0.25f;
+	}
+	if (fabsf(ev) < AUTOCONTROL_DEADBAND_EV) return;
+	ev *= AUTOCONTROL_DAMPING;
+	if (ev > 1) ev = 1;
+	if (ev < -1) ev = -1;
+	float factor = exp2f(ev);
+	// brighter: exposure (less noise) then gain; darker: gain then exposure
+	GrabberControlID first = (factor > 1) ? GRABBER_CTRL_EXPOSURE : GRABBER_CTRL_GAIN;
+	GrabberControlID second = (factor > 1) ? GRABBER_CTRL_GAIN : GRABBER_CTRL_EXPOSURE;
+	float applied = internal_scale(first, factor);
+	float left = factor / applied;
+	if (fabsf(log2f(left)) >= AUTOCONTROL_DEADBAND_EV * AUTOCONTROL_DAMPING) internal_scale(second, left);
+}
+
+
+void AutoControl::internal_white_balance(const FrameStats& stats) {
+	if (!stats.color) return;
+	const float* m = stats.mean;
+	if (m[FRAMESTATS_R] < 1 or m[FRAMESTATS_G] < 1 or m[FRAMESTATS_B] < 1) return;
+	// gray world: damped (square root) ratio of green to red and blue
+	float red = m[FRAMESTATS_G] / m[FRAMESTATS_R];
+	float blue = m[FRAMESTATS_G] / m[FRAMESTATS_B];
+	if (fabsf(red - 1) > AUTOCONTROL_DEADBAND_WB) internal_scale(GRABBER_CTRL_RED_BALANCE, powf(red, AUTOCONTROL_DAMPING));
+	if (fabsf(blue - 1) > AUTOCONTROL_DEADBAND_WB) internal_scale(GRABBER_CTRL_BLUE_BALANCE, powf(blue, AUTOCONTROL_DAMPING));
+}
+
+
+void AutoControl::frame_grabbed(PixelBuffer* pb) {
+	if (!mAutoExposure and !mAutoWhiteBalance) return;
+
+	// rate bound: picture timestamps, every frame when they are missing
+	unsigned long long nowUs = (unsigned long long) pb->sec * 1000000ULL + pb->usec;
+	if (pb->sec > 0 and mHaveLast and nowUs < mLastUs + mMinIntervalUs) return;
+
+	// statistics of pictures exposed with old values would make the loop overshoot
+	static const GrabberControlID driven[4] = { GRABBER_CTRL_EXPOSURE, GRABBER_CTRL_GAIN, GRABBER_CTRL_RED_BALANCE, GRABBER_CTRL_BLUE_BALANCE };
+	bool settled = true;
+	for (unsigned int i=0; i< 4; i++) if (!internal_settled(pb, driven[i])) settled = false;
+	if (!settled) return;
+
+	FrameStats stats;
+	if (!frame_stats(pb, stats, mRowStep, mColStep)) return;
+	pthread_mutex_lock(&mStatsLock);
+	mStats = stats;
+	mHaveStats = true;
+	pthread_mutex_unlock(&mStatsLock);
+
+	if (mAutoExposure) internal_exposure(stats);
+	if (mAutoWhiteBalance) internal_white_balance(stats);
+	mHaveLast = true;
+	mLastUs = nowUs;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef AutoControl_HH
+#define AutoControl_HH
+
+#include <pthread.h>
+
+#include "Debug.hh"
+#include "FrameSink.hh"
+#include "FrameStats.hh"
+#include "Grabber.hh"
+#include "GrabberControlData.hh"
+
+/*
+  AutoControl runs auto exposure and auto white balance in software for cameras whose own
+  are poor or missing, from the FrameStats of the grabbed pictures (add it to the grabber
+  with Grabber::add_sink()).
+
+  - exposure: the luma mean is brought to a target, exposure first and gain when exposure
+    is at its max (gain is lowered first when the picture is too bright); pictures with
+    too many saturated samples count as too bright whatever their mean
+  - white balance: gray world, red and blue balance bring the red and blue means to the green one
+
+  Controls only move at a bounded rate, by a fraction of the error (at most one stop per step),
+  and never while the frames still show the previous request: set the pipeline depth of the
+  sensor with Grabber::set_ctrl_latency() so that PixelBuffer::meta.ctrl tells when it is in effect.
+*/
+
+// defaults
+#define AUTOCONTROL_TARGET_LUMA 110.0f		// [0,255]
+#define AUTOCONTROL_MAX_RATE 8.0f		// control updates per second
+#define AUTOCONTROL_DEADBAND_EV 0.1f		// exposure errors under this (in stops) are left alone
+#define AUTOCONTROL_DAMPING 0.6f		// fraction of the error corrected per step
+#define AUTOCONTROL_DEADBAND_WB 0.02f		// relative red/blue to green differences left alone
+#define AUTOCONTROL_CLIP_FRACTION 0.02f		// histogram samples in the top bin that make a picture too bright
+
+
+class AutoControl : public FrameSink {
+public:
+	AutoControl(Grabber* grabber);
+	~AutoControl();
+
+	// enabling turns the driver's own auto gain/white balance off when it has them
+	// return false when the grabber has none of the controls needed
+	bool set_auto_exposure(bool enable, float targetLuma = AUTOCONTROL_TARGET_LUMA);
+	bool set_auto_white_balance(bool enable);
+
+	// bound on control updates per second (from the picture timestamps)
+	void set_max_rate(float hz);
+	// statistics subsampling, see frame_stats()
+	void set_sampling(unsigned int rowStep, unsigned int colStep);
+
+	// statistics of the last picture looked at; false before the first one
+	bool get_last_stats(FrameStats& stats);
+
+	// FrameSink
+	void frame_grabbed(PixelBuffer* pb);
+
+private:
+	// true when the frame shows the last value requested for id (or nothing tells it doesn't)
+	bool internal_settled(const PixelBuffer* pb, GrabberControlID id);
+	// multiply control id by factor (clamped to its range and step)
+	// returns the factor actually applied, 1 when the control didn't change
+	float internal_scale(GrabberControlID id, float factor);
+
+	void internal_exposure(const FrameStats& stats);
+	void internal_white_balance(const FrameStats& stats);
+
+	Grabber* mGrabber;			// not owned
+	bool mAutoExposure;
+	bool mAutoWhiteBalance;
+	float mTargetLuma;
+	unsigned long long mMinIntervalUs;
+	unsigned int mRowStep;
+	unsigned int mColStep;
+
+	bool mHaveLast;				// an update ran, at mLastUs
+	unsigned long long mLastUs;
+	bool mPending[GRABBER_CTRL_NONE];	// a value was requested and no frame showed it yet
+	int mRequested[GRABBER_CTRL_NONE];
+
+	pthread_mutex_t mStatsLock;		// mStats is written by the grabbing thread
+	bool mHaveStats;
+	FrameStats mStats;
+};
+
+#endif /*AutoControl_HH*/
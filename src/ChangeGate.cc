@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "ChangeGate.hh"
+
+#include <string.h>
+
+#include "Grabber_Helpers.hh"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// luma of the even columns of a line: n samples out of a line with luma every STEP bytes from OFFSET
+template <unsigned int STEP, unsigned int OFFSET>
+static void change_decimate_row(const unsigned char* line, unsigned char* dst, unsigned int n) {
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	if (STEP==1) {
+		// 32 pixels -> 16 samples: low byte of every 16 bit word
+		const __m128i low = _mm_set1_epi16(0x00FF);
+		for (; i + 16 <= n; i += 16) {
+			__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*) (line + 2*i)), low);
+			__m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*) (line + 2*i + 16)), low);
+			_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(a, b));
+		}
+	}
+	else if (STEP==2) {
+		// 64 bytes (32 pixels) -> 16 samples: byte OFFSET of every 32 bit word
+		const __m128i low = _mm_set1_epi32(0xFF);
+		for (; i + 16 <= n; i += 16) {
+			const unsigned char* p = line + 4*i;
+			__m128i a = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*) p), 8*OFFSET), low);
+			__m128i b = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*) (p + 16)), 8*OFFSET), low);
+			__m128i c = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*) (p + 32)), 8*OFFSET), low);
+			__m128i d = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*) (p + 48)), 8*OFFSET), low);
+			_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+		}
+	}
+#endif
+	for (; i< n; i++) dst[i] = line[2*i*STEP + OFFSET];
+}
+
+
+// decimate every sampled row of a picture in ChangeGate::mCurrent and compare it with the reference;
+// instantiated per format by pixelbuffer_dispatch()
+struct ChangeKernel {
+	ChangeGate* gate;
+	bool done;
+
+	template <PixelBufferFormat F> void run(PixelBuffer* pb) {
+		typedef FormatTraits<F> T;
+		if (T::lumaStep==0) return;					// no addressable luma in this format
+		unsigned int stride = pixelbuffer_stride(pb);
+		if (pb->length < stride * (pb->height - 1) + T::line_length0(pb->width)) return;
+		gate->internal_layout(pb);
+		const unsigned char* base = (const unsigned char*) pb->buf;
+		for (unsigned int r=0; r< gate->mRows; r++) {
+			const unsigned char* line = base + (r * gate->mRowStep) * stride;
+			change_decimate_row<T::lumaStep, T::lumaOffset>(line, &gate->mCurrent[r * gate->mCols], gate->mCols);
+			if (gate->mHaveReference) gate->internal_compare_row(r);
+		}
+		done = true;
+	}
+};
+
+
+ChangeGate::ChangeGate(unsigned int tileSize, unsigned int threshold, unsigned int rowStep) {
+	mTileSize = (tileSize < 32) ? 32 : tileSize & ~31u;
+	mThreshold = threshold;
+	mRowStep = rowStep ? rowStep : 1;
+	mMinTiles = 1;
+	mFmt = PIXELBUFFER_FMT_NONE;
+	mWidth = 0;
+	mHeight = 0;
+	mCols = 0;
+	mRows = 0;
+	mTilesX = 0;
+	mTilesY = 0;
+	mHaveReference = false;
+	pthread_mutex_init(&mTilesLock, NULL);
+	mHaveChanged = false;
+	mChangedTilesX = 0;
+	mChangedWidth = 0;
+	mChangedHeight = 0;
+	mPassed = 0;
+	mGated = 0;
+}
+
+
+ChangeGate::~ChangeGate() {
+	pthread_mutex_destroy(&mTilesLock);
+}
+
+
+void ChangeGate::reset(void) {
+	mHaveReference = false;
+}
+
+
+void ChangeGate::internal_layout(const PixelBuffer* pb) {
+	if (pb->fmt==mFmt and pb->width==mWidth and pb->height==mHeight) return;
+	mFmt = pb->fmt;
+	mWidth = pb->width;
+	mHeight = pb->height;
+	mCols = mWidth / 2;
+	mRows = (mHeight + mRowStep - 1) / mRowStep;
+	mTilesX = (mWidth + mTileSize - 1) / mTileSize;
+	mTilesY = (mHeight + mTileSize - 1) / mTileSize;
+	mCurrent.assign(mCols * mRows, 0);
+	mReference.assign(mCols * mRows, 0);
+	mTileSad.assign(mTilesX * mTilesY, 0);
+	mTileSamples.assign(mTilesX * mTilesY, 0);
+	mHaveReference = false;
+}
+
+
+void ChangeGate::internal_compare_row(unsigned int r) {
+	const unsigned char* cur = &mCurrent[r * mCols];
+	const unsigned char* ref = &mReference[r * mCols];
+	unsigned int tileCols = mTileSize / 2;
+	unsigned int ty = (r * mRowStep) / mTileSize;
+	unsigned int* sad = &mTileSad[ty * mTilesX];
+	unsigned int* samples = &mTileSamples[ty * mTilesX];
+	for (unsigned int tx=0; tx< mTilesX; tx++) {
+		unsigned int x0 = tx * tileCols;
+		unsigned int x1 = x0 + tileCols;
+		if (x1 > mCols) x1 = mCols;
+		unsigned int x = x0;
+		unsigned int s = 0;
+#if defined(__SSE2__)
+		__m128i acc = _mm_setzero_si128();
+		for (; x + 16 <= x1; x += 16)
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*) (cur + x)), _mm_loadu_si128((const __m128i*) (ref + x))));
+		s = (unsigned int) (_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#endif
+		for (; x< x1; x++) s += (cur[x] > ref[x]) ? cur[x] - ref[x] : ref[x] - cur[x];
+		sad[tx] += s;
+		samples[tx] += x1 - x0;
+	}
+}
+
+
+int ChangeGate::process(PixelBuffer* pb) {
+	if (pb==NULL or pb->buf==NULL or pb->width < 2 or pb->height==0) return -1;
+	if (mHaveReference and (pb->fmt!=mFmt or pb->width!=mWidth or pb->height!=mHeight)) mHaveReference = false;
+	if (!mTileSad.empty()) {
+		memset(&mTileSad[0], 0, mTileSad.size() * sizeof(unsigned int));
+		memset(&mTileSamples[0], 0, mTileSamples.size() * sizeof(unsigned int));
+	}
+
+	ChangeKernel k;
+	k.gate = this;
+	k.done = false;
+	if (!pixelbuffer_dispatch(pb, k) or !k.done) return -1;
+
+	unsigned int numTiles = mTilesX * mTilesY;
+	std::vector<unsigned char> changed(numTiles, 1);
+	unsigned int numChanged = numTiles;
+	if (mHaveReference) {
+		numChanged = 0;
+		for (unsigned int t=0; t< numTiles; t++) {
+			changed[t] = (mTileSad[t] > mThreshold * mTileSamples[t]);
+			numChanged += changed[t];
+		}
+	}
+
+	// the reference follows the tiles that changed
+	unsigned int tileCols = mTileSize / 2;
+	for (unsigned int r=0; r< mRows; r++) {
+		unsigned int ty = (r * mRowStep) / mTileSize;
+		for (unsigned int tx=0; tx< mTilesX; tx++) {
+			if (!changed[ty * mTilesX + tx]) continue;
+			unsigned int x0 = tx * tileCols;
+			unsigned int x1 = x0 + tileCols;
+			if (x1 > mCols) x1 = mCols;
+			memcpy(&mReference[r * mCols + x0], &mCurrent[r * mCols + x0], x1 - x0);
+		}
+	}
+	mHaveReference = true;
+
+	pthread_mutex_lock(&mTilesLock);
+	mChanged.swap(changed);
+	mChangedTilesX = mTilesX;
+	mChangedWidth = mWidth;
+	mChangedHeight = mHeight;
+	mHaveChanged = true;
+	pthread_mutex_unlock(&mTilesLock);
+
+	pb->meta.changedTiles = (numChanged >= mMinTiles) ? numChanged : 0;
+	pb->meta.valid |= FRAME_META_CHANGE;
+	return numChanged;
+}
+
+
+bool ChangeGate::get_changed_tiles(std::vector<ChangeTile>& tiles) {
+	tiles.clear();
+	pthread_mutex_lock(&mTilesLock);
+	bool have = mHaveChanged;
+	for (unsigned int t=0; t< mChanged.size(); t++) {
+		if (!mChanged[t]) continue;
+		ChangeTile tile;
+		tile.x = (t % mChangedTilesX) * mTileSize;
+		tile.y = (t / mChangedTilesX) * mTileSize;
+		tile.width = (tile.x + mTileSize > mChangedWidth) ? mChangedWidth - tile.x : mTileSize;
+		tile.height = (tile.y + mTileSize > mChangedHeight) ? mChangedHeight - tile.y : mTileSize;
+		tiles.push_back(tile);
+	}
+	pthread_mutex_unlock(&mTilesLock);
+	return have;
+}
+
+
+void ChangeGate::add_sink(FrameSink* sink) {
+	if (sink==NULL) return;
+	for (unsigned int i=0; i< mSinks.size(); i++) if (mSinks[i]==sink) return;	// already registered
+	mSinks.push_back(sink);
+}
+
+
+void ChangeGate::remove_sink(FrameSink* sink) {
+	for (unsigned int i=0; i< mSinks.size(); i++) {
+		if (mSinks[i]==sink) { mSinks.erase(mSinks.begin()+i); return; }
+	}
+}
+
+
+void ChangeGate::frame_grabbed(PixelBuffer* pb) {
+	int changed = process(pb);
+	// pictures we can't look at are passed on: the gate only holds back what it knows is static
+	if (changed==0 or (changed > 0 and pb->meta.changedTiles==0)) {
+		mGated++;
+		return;
+	}
+	mPassed++;
+	for (unsigned int i=0; i< mSinks.size(); i++) mSinks[i]->frame_grabbed(pb);
+}
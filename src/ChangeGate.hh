@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef ChangeGate_HH
+#define ChangeGate_HH
+
+#include <pthread.h>
+#include <vector>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FrameSink.hh"
+#include "FormatTraits.hh"
+
+/*
+  ChangeGate tells pictures where something changed from static ones, tile by tile, so that
+  analytics can skip static pictures or look only at their changed tiles.
+
+  Each picture is reduced to the luma of its even columns on every rowStep-th row, read straight
+  from the grabbed buffer (YUYV, UYVY, GREY, planar and semi planar YUV: no conversion), and
+  compared to a reference of the same size: a tile whose mean absolute difference is above the
+  threshold has changed. The reference of a tile is refreshed only when the tile changes, so slow
+  drifts add up until they count as a change.
+
+  As a FrameSink it fills meta.changedTiles of every picture and passes only the changed ones
+  on to the sinks added to it (the gate sits between a grabber and the sinks it protects).
+*/
+
+// defaults
+#define CHANGEGATE_TILE_SIZE 32		// pixels, a multiple of 32
+#define CHANGEGATE_THRESHOLD 8		// mean absolute luma difference [0,255] of a changed tile
+#define CHANGEGATE_ROW_STEP 2
+
+// a tile of the last picture
+struct ChangeTile {
+	unsigned int x;			// pixels
+	unsigned int y;
+	unsigned int width;		// smaller on the right and bottom edges
+	unsigned int height;
+};
+
+class ChangeGate : public FrameSink {
+public:
+	ChangeGate(unsigned int tileSize = CHANGEGATE_TILE_SIZE, unsigned int threshold = CHANGEGATE_THRESHOLD,
+		   unsigned int rowStep = CHANGEGATE_ROW_STEP);
+	~ChangeGate();
+
+	// compare pb with the reference and fill pb->meta.changedTiles
+	// returns the number of changed tiles (every tile for the first picture and after a format change)
+	// -1 for formats without addressable luma
+	int process(PixelBuffer* pb);
+
+	// pictures with less than minTiles changed tiles count as static (noise, a leaf...)
+	void set_min_tiles(unsigned int minTiles) { mMinTiles = minTiles ? minTiles : 1; }
+
+	// forget the reference: the next picture is all changed
+	void reset(void);
+
+	// tiles of the last picture that changed; false before the first picture
+	bool get_changed_tiles(std::vector<ChangeTile>& tiles);
+
+	unsigned long long get_passed(void) const { return mPassed; }
+	unsigned long long get_gated(void) const { return mGated; }
+
+	// sinks that only see changed pictures (not owned: remove them before deleting them)
+	void add_sink(FrameSink* sink);
+	void remove_sink(FrameSink* sink);
+
+	// FrameSink: process() and pass changed pictures on
+	void frame_grabbed(PixelBuffer* pb);
+
+private:
+	friend struct ChangeKernel;
+
+	// make the decimated buffers fit pb (and drop the reference when they didn't)
+	void internal_layout(const PixelBuffer* pb);
+	// sums of absolute differences of decimated row r against the reference, added to mTileSad
+	void internal_compare_row(unsigned int r);
+
+	unsigned int mTileSize;
+	unsigned int mThreshold;
+	unsigned int mRowStep;
+	unsigned int mMinTiles;
+
+	// decimated pictures: mRows rows of mCols samples
+	PixelBufferFormat mFmt;
+	unsigned int mWidth;
+	unsigned int mHeight;
+	unsigned int mCols;
+	unsigned int mRows;
+	unsigned int mTilesX;
+	unsigned int mTilesY;
+	bool mHaveReference;
+	std::vector<unsigned char> mCurrent;
+	std::vector<unsigned char> mReference;
+	std::vector<unsigned int> mTileSad;
+	std::vector<unsigned int> mTileSamples;
+
+	pthread_mutex_t mTilesLock;		// mChanged is read from other threads by get_changed_tiles()
+	std::vector<unsigned char> mChanged;	// per tile of the last picture
+	unsigned int mChangedTilesX;		// geometry of the picture mChanged describes
+	unsigned int mChangedWidth;
+	unsigned int mChangedHeight;
+	bool mHaveChanged;
+
+	std::vector<FrameSink*> mSinks;
+	unsigned long long mPassed;
+	unsigned long long mGated;
+};
+
+#endif /*ChangeGate_HH*/
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "ClockCorrelator.hh"
+
+#include <stdlib.h>
+
+
+static inline long long clockcorr_now(clockid_t clock) {
+	timespec ts;
+	clock_gettime(clock, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+ClockCorrelator::ClockCorrelator(clockid_t target) {
+	mTarget = target;
+	mDriverClock = CLOCK_MONOTONIC;
+	mMinDelayNs = 0;
+	reset();
+}
+
+
+void ClockCorrelator::reset(void) {
+	mNumDelay = 0;
+	mNextDelay = 0;
+	mBlockCount = 0;
+	mDelayFit.valid = false;
+	mNumReads = 0;
+	mNextRead = 0;
+	mLastReadNs = 0;
+	mReadFit.valid = false;
+}
+
+
+void ClockCorrelator::set_target_clock(clockid_t target) {
+	if (target==mTarget) return;
+	mTarget = target;
+	mNumReads = 0;
+	mNextRead = 0;
+	mLastReadNs = 0;
+	mReadFit.valid = false;
+}
+
+
+void ClockCorrelator::set_driver_clock(int clock) {
+	if (clock==mDriverClock) return;
+	mDriverClock = clock;
+	mNumDelay = 0;
+	mNextDelay = 0;
+	mBlockCount = 0;
+	mDelayFit.valid = false;
+}
+
+
+// least squares line through the points, x and y taken relative to their means (ns values
+// don't fit the mantissa of a double)
+void ClockCorrelator::internal_fit(const Point* points, unsigned int n, long long minSpanNs, Fit& fit) {
+	fit.valid = (n > 0);
+	if (n==0) return;
+	long long sumX = 0, sumY = 0;
+	for (unsigned int i=0; i< n; i++) {
+		sumX += (points[i].x - points[0].x);
+		sumY += (points[i].y - points[0].y);
+	}
+	fit.x0 = points[0].x + sumX / n;
+	fit.y0 = points[0].y + sumY / n;
+
+	double sxx = 0, sxy = 0;
+	long long minX = points[0].x, maxX = points[0].x;
+	for (unsigned int i=0; i< n; i++) {
+		if (points[i].x < minX) minX = points[i].x;
+		if (points[i].x > maxX) maxX = points[i].x;
+		double dx = (double) (points[i].x - fit.x0);
+		double dy = (double) (points[i].y - fit.y0);
+		sxx += dx * dx;
+		sxy += dx * dy;
+	}
+	fit.slope = (sxx > 0 and maxX - minX >= minSpanNs) ? sxy / sxx : 0;
+
+	fit.error = 0;
+	for (unsigned int i=0; i< n; i++) {
+		long long residual = llabs(points[i].y - internal_offset(fit, points[i].x)) + points[i].spread;
+		if (residual > fit.error) fit.error = residual;
+	}
+}
+
+
+long long ClockCorrelator::internal_offset(const Fit& fit, long long x) {
+	return fit.y0 + (long long) (fit.slope * (double) (x - fit.x0));
+}
+
+
+void ClockCorrelator::internal_read_clocks(long long monoNs) {
+	if (mTarget==CLOCK_MONOTONIC) return;
+	if (mLastReadNs!=0 and monoNs - mLastReadNs < CLOCKCORR_READ_PERIOD_NS) return;
+	mLastReadNs = monoNs;
+
+	// a preemption between the reads shows up as a wide bracket: keep the narrowest of a few
+	Point best;
+	best.spread = -1;
+	for (unsigned int i=0; i< 3; i++) {
+		long long m0 = clockcorr_now(CLOCK_MONOTONIC);
+		long long t = clockcorr_now(mTarget);
+		long long m1 = clockcorr_now(CLOCK_MONOTONIC);
+		if (best.spread < 0 or m1 - m0 < best.spread) {
+			best.x = m0 + (m1 - m0) / 2;
+			best.y = t - best.x;
+			best.spread = (m1 - m0) / 2;
+		}
+	}
+	mReads[mNextRead] = best;
+	mNextRead = (mNextRead + 1) % CLOCKCORR_POINTS;
+	if (mNumReads < CLOCKCORR_POINTS) mNumReads++;
+	internal_fit(mReads, mNumReads, 2 * CLOCKCORR_READ_PERIOD_NS, mReadFit);
+}
+
+
+void ClockCorrelator::add_sample(long long driverNs, long long arrivalNs) {
+	internal_read_clocks(arrivalNs);
+	if (mDriverClock==CLOCK_MONOTONIC or mDriverClock==mTarget) return;	// nothing to estimate
+
+	Point p;
+	p.x = driverNs;
+	p.y = arrivalNs - driverNs - mMinDelayNs;
+	p.spread = 0;
+	if (mBlockCount==0 or p.y < mBlockMin.y) mBlockMin = p;
+	mBlockCount++;
+
+	if (mBlockCount==CLOCKCORR_BLOCK) {
+		mDelay[mNextDelay] = mBlockMin;
+		mNextDelay = (mNextDelay + 1) % CLOCKCORR_POINTS;
+		if (mNumDelay < CLOCKCORR_POINTS) mNumDelay++;
+		mBlockCount = 0;
+		internal_fit(mDelay, mNumDelay, CLOCKCORR_READ_PERIOD_NS, mDelayFit);
+	}
+	else if (mNumDelay==0) internal_fit(&mBlockMin, 1, 0, mDelayFit);		// until the first block is complete
+}
+
+
+bool ClockCorrelator::internal_driver_to_mono(long long driverNs, long long& monoNs, long long& errorNs) {
+	if (mDriverClock==CLOCK_MONOTONIC) {
+		monoNs = driverNs;
+		errorNs = 0;
+		return true;
+	}
+	if (!mDelayFit.valid) return false;
+	monoNs = driverNs + internal_offset(mDelayFit, driverNs);
+	errorNs = mDelayFit.error;
+	return true;
+}
+
+
+bool ClockCorrelator::correct(long long driverNs, long long& targetNs, unsigned long long& uncertaintyNs) {
+	if (mDriverClock==mTarget) {
+		targetNs = driverNs;
+		uncertaintyNs = 0;
+		return true;
+	}
+	long long monoNs, errorNs;
+	if (!internal_driver_to_mono(driverNs, monoNs, errorNs)) return false;
+	if (mTarget==CLOCK_MONOTONIC) {
+		targetNs = monoNs;
+		uncertaintyNs = errorNs;
+		return true;
+	}
+	if (!mReadFit.valid) return false;
+	targetNs = monoNs + internal_offset(mReadFit, monoNs);
+	uncertaintyNs = errorNs + mReadFit.error;
+	return true;
+}
+
+
+double ClockCorrelator::get_drift_ppm(void) const {
+	double slope = 0;
+	if (mDriverClock!=CLOCK_MONOTONIC and mDriverClock!=mTarget and mDelayFit.valid) slope += mDelayFit.slope;
+	if (mDriverClock!=mTarget and mTarget!=CLOCK_MONOTONIC and mReadFit.valid) slope += mReadFit.slope;
+	return slope * 1e6;
+}
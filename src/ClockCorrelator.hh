@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef ClockCorrelator_HH
+#define ClockCorrelator_HH
+
+#include <time.h>
+
+#include "Debug.hh"
+
+/*
+  ClockCorrelator turns driver timestamps into a common clock (CLOCK_REALTIME or CLOCK_TAI,
+  to line up frames of several hosts and sensors) with an error bound, without stamping
+  frames when the application gets them (which adds the processing latency as jitter).
+
+  Two mappings are estimated, both as offset + drift fitted on recent samples:
+  - driver clock -> CLOCK_MONOTONIC: exact when the driver says which clock it uses
+    (V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC, or the target clock itself); otherwise every frame gives
+    a pair (driver timestamp, CLOCK_MONOTONIC when it was dequeued): the difference is the
+    offset plus a transfer delay that is never negative, so only the least delayed sample of
+    every CLOCKCORR_BLOCK frames is fitted (min-delay filter). The smallest transfer delay
+    itself can't be seen and stays in the offset (see set_min_delay()).
+  - CLOCK_MONOTONIC -> target clock: read about every CLOCKCORR_READ_PERIOD_NS as
+    monotonic/target/monotonic, keeping the read with the shortest bracket of three tries;
+    the fit follows NTP (or PTP) slewing the target clock.
+
+  The uncertainty of a corrected timestamp is the worst residual of both fits plus half the
+  bracket of the clock reads.
+*/
+
+// frames per min-delay block
+#define CLOCKCORR_BLOCK 16
+// points (blocks, clock reads) in each fit
+#define CLOCKCORR_POINTS 16
+// time between two reads of the target clock
+#define CLOCKCORR_READ_PERIOD_NS 1000000000LL
+
+
+class ClockCorrelator {
+public:
+	ClockCorrelator(clockid_t target = CLOCK_REALTIME);
+
+	// forget every sample (ie. after the driver restarted streaming)
+	void reset(void);
+
+	void set_target_clock(clockid_t target);
+	clockid_t get_target_clock(void) const { return mTarget; }
+
+	// clock of the driver timestamps: CLOCK_MONOTONIC, CLOCK_REALTIME... or -1 when unknown (estimated)
+	void set_driver_clock(int clock);
+	// known smallest transfer delay (driver timestamp -> dequeue) taken out of estimated offsets
+	void set_min_delay(long long ns) { mMinDelayNs = ns; }
+
+	// a frame stamped driverNs by the driver was dequeued at arrivalNs (CLOCK_MONOTONIC)
+	void add_sample(long long driverNs, long long arrivalNs);
+
+	// driverNs in the target clock; false until there are samples
+	bool correct(long long driverNs, long long& targetNs, unsigned long long& uncertaintyNs);
+
+	// drift of the driver clock against the target clock (parts per million)
+	double get_drift_ppm(void) const;
+
+private:
+	struct Point {
+		long long x;			// source clock
+		long long y;			// offset to the destination clock
+		long long spread;		// uncertainty of y
+	};
+	struct Fit {
+		bool valid;
+		long long x0;			// mean x and y of the points
+		long long y0;
+		double slope;			// offset change per ns of x (drift)
+		long long error;		// worst residual + spread
+	};
+
+	// drift is only fitted on points at least minSpanNs apart (0 before)
+	static void internal_fit(const Point* points, unsigned int n, long long minSpanNs, Fit& fit);
+	static long long internal_offset(const Fit& fit, long long x);
+	void internal_read_clocks(long long monoNs);
+	bool internal_driver_to_mono(long long driverNs, long long& monoNs, long long& errorNs);
+
+	clockid_t mTarget;
+	int mDriverClock;
+	long long mMinDelayNs;
+
+	// driver -> monotonic (unknown driver clock)
+	Point mDelay[CLOCKCORR_POINTS];		// least delayed sample of the last blocks (circular)
+	unsigned int mNumDelay;
+	unsigned int mNextDelay;
+	Point mBlockMin;			// of the block being filled
+	unsigned int mBlockCount;
+	Fit mDelayFit;
+
+	// monotonic -> target
+	Point mReads[CLOCKCORR_POINTS];
+	unsigned int mNumReads;
+	unsigned int mNextRead;
+	long long mLastReadNs;
+	Fit mReadFit;
+};
+
+#endif /*ClockCorrelator_HH*/
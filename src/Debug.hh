@@ -78,4 +78,13 @@
 #endif
 
 
+// ******************************
+//  TRACE
+//  [record binary events of the capture path (QBUF, DQBUF, errors, drops...) in per thread
+//   rings, see Trace.hh; recording starts only once gTraceEnabled is set, comment only the
+//   #define to compile the trace points out]
+#undef Grabber_Trace
+#define Grabber_Trace
+
+
 #endif /*Debug_HH*/
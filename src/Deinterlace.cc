@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "Deinterlace.hh"
+
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// line kernels: n bytes of the lines above (a), current (c) and below (b)
+// averages round up like pavgb so that the SSE2 and the plain versions give the same bytes
+
+// d = (a + b) / 2
+static inline void deint_line_bob(unsigned char* d, const unsigned char* a, const unsigned char* b, unsigned int n) {
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+		_mm_storeu_si128((__m128i*) (d + i), _mm_avg_epu8(va, vb));
+	}
+#endif
+	for (; i< n; i++) d[i] = (unsigned char) ((a[i] + b[i] + 1) >> 1);
+}
+
+
+// d = ((a + b) / 2 + c) / 2, about (a + 2c + b) / 4
+static inline void deint_line_blend(unsigned char* d, const unsigned char* a, const unsigned char* c,
+				    const unsigned char* b, unsigned int n) {
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+		__m128i vc = _mm_loadu_si128((const __m128i*) (c + i));
+		_mm_storeu_si128((__m128i*) (d + i), _mm_avg_epu8(_mm_avg_epu8(va, vb), vc));
+	}
+#endif
+	for (; i< n; i++) d[i] = (unsigned char) ((((a[i] + b[i] + 1) >> 1) + c[i] + 1) >> 1);
+}
+
+
+// d = c where |c - p| <= thr (static), (a + b) / 2 elsewhere
+static inline void deint_line_motion(unsigned char* d, const unsigned char* a, const unsigned char* c,
+				     const unsigned char* b, const unsigned char* p, unsigned int n, unsigned char thr) {
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	const __m128i vthr = _mm_set1_epi8((char) thr);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+		__m128i vc = _mm_loadu_si128((const __m128i*) (c + i));
+		__m128i vp = _mm_loadu_si128((const __m128i*) (p + i));
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(vc, vp), _mm_subs_epu8(vp, vc));
+		__m128i still = _mm_cmpeq_epi8(_mm_subs_epu8(diff, vthr), zero);
+		__m128i interp = _mm_avg_epu8(va, vb);
+		_mm_storeu_si128((__m128i*) (d + i), _mm_or_si128(_mm_and_si128(still, vc), _mm_andnot_si128(still, interp)));
+	}
+#endif
+	for (; i< n; i++) {
+		int diff = c[i] - p[i];
+		if (diff < 0) diff = -diff;
+		d[i] = (diff <= thr) ? c[i] : (unsigned char) ((a[i] + b[i] + 1) >> 1);
+	}
+}
+
+
+// offset in the buffer of row r of a plane; sequential fields store a whole field after the other
+static inline unsigned int deint_row_offset(const PixelPlane& pl, unsigned int field, unsigned int r) {
+	unsigned int row = r;
+	if (field==V4L2_FIELD_SEQ_TB) row = (r & 1) ? (pl.rows + 1) / 2 + r / 2 : r / 2;
+	else if (field==V4L2_FIELD_SEQ_BT) row = (r & 1) ? r / 2 : pl.rows / 2 + r / 2;
+	return pl.offset + row * pl.stride;
+}
+
+
+// band-safe: rows [y0, y1) of the outputs only read the same rows of the previous picture
+// and rows y0-1 .. y1 of src
+class DeinterlaceKernel : public BandKernel {
+public:
+	DeinterlaceKernel(Deinterlacer* owner, PixelBuffer* dst0, PixelBuffer* dst1, bool frameRate) {
+		mOwner = owner;
+		mDst[0] = dst0;
+		mDst[1] = dst1;
+		mFrameRate = frameRate;
+	}
+
+	bool band_safe(void) const { return true; }
+	void process_band(PixelBuffer* pb, unsigned int y0, unsigned int y1);
+
+private:
+	Deinterlacer* mOwner;
+	PixelBuffer* mDst[2];
+	bool mFrameRate;
+};
+
+
+void DeinterlaceKernel::process_band(PixelBuffer* pb, unsigned int y0, unsigned int y1) {
+	Deinterlacer* d = mOwner;
+	const unsigned char* src = (const unsigned char*) pb->buf;
+	unsigned char* prev = d->mPrev.empty() ? NULL : &d->mPrev[0];
+	bool motion = (d->mMode==DEINTERLACE_MOTION_ADAPTIVE);
+	bool blend = (d->mMode==DEINTERLACE_BLEND and mFrameRate);
+
+	for (unsigned int p=0; p< d->mNumPlanes; p++) {
+		const PixelPlane& pl = d->mPlanes[p];
+		unsigned int round = (1u << pl.vShift) - 1;
+		unsigned int r0 = (y0 + round) >> pl.vShift;
+		unsigned int r1 = (y1 + round) >> pl.vShift;
+		if (r1 > pl.rows) r1 = pl.rows;
+
+		for (unsigned int r=r0; r< r1; r++) {
+			// missing neighbours at the picture edges are mirrored
+			unsigned int ra = (r > 0) ? r - 1 : (pl.rows > 1 ? 1 : 0);
+			unsigned int rb = (r + 1 < pl.rows) ? r + 1 : (r > 0 ? r - 1 : 0);
+			const unsigned char* a = src + deint_row_offset(pl, d->mField, ra);
+			const unsigned char* c = src + deint_row_offset(pl, d->mField, r);
+			const unsigned char* b = src + deint_row_offset(pl, d->mField, rb);
+			unsigned char* prevLine = prev ? prev + pl.offset + r * pl.stride : NULL;
+
+			for (unsigned int k=0; k< 2; k++) {
+				if (mDst[k]==NULL) continue;
+				unsigned char* out = (unsigned char*) mDst[k]->buf + pl.offset + r * pl.stride;
+				// kept field: the first one at frame rate, one each at field rate
+				unsigned int keep = (k==0) ? d->mFirstParity : 1 - d->mFirstParity;
+
+				if (blend) deint_line_blend(out, a, c, b, pl.lineBytes);
+				else if ((r & 1)==keep) memcpy(out, c, pl.lineBytes);
+				else if (motion and d->mHavePrev) deint_line_motion(out, a, c, b, prevLine, pl.lineBytes, d->mThreshold);
+				else deint_line_bob(out, a, b, pl.lineBytes);
+			}
+			if (motion and prevLine) memcpy(prevLine, c, pl.lineBytes);
+		}
+	}
+}
+
+
+Deinterlacer::Deinterlacer(FrameExecutor* executor, DeinterlaceMode mode, unsigned char motionThreshold) {
+	mExecutor = executor;
+	mMode = mode;
+	mThreshold = motionThreshold;
+	mDefaultField = V4L2_FIELD_INTERLACED;
+	mField = V4L2_FIELD_NONE;
+	mFirstParity = 0;
+	mNumPlanes = 0;
+	mLastUs = 0;
+	mPeriodUs = 0;
+	reset();
+}
+
+
+bool Deinterlacer::supported(PixelBufferFormat fmt) {
+	const PixelFormatInfo* info = pixel_format_info(fmt);
+	// every byte of a line has the same meaning in the lines above and below: any 8 bit YUV layout works
+	return (info and info->family==PIXEL_FAMILY_YUV);
+}
+
+
+void Deinterlacer::set_mode(DeinterlaceMode mode) {
+	if (mode!=mMode) mHavePrev = false;
+	mMode = mode;
+}
+
+
+void Deinterlacer::reset(void) {
+	mHavePrev = false;
+	mPrevFmt = PIXELBUFFER_FMT_NONE;
+	mPrevWidth = 0;
+	mPrevHeight = 0;
+	mPrevStride = 0;
+	mLastUs = 0;
+	mPeriodUs = 0;
+}
+
+
+bool Deinterlacer::internal_setup(const PixelBuffer* src, PixelBuffer* dst0, PixelBuffer* dst1) {
+	if (src==NULL or src->buf==NULL or dst0==NULL or dst0->buf==NULL) return false;
+	if (dst1 and dst1->buf==NULL) return false;
+	if (!supported(src->fmt)) return false;
+
+	mNumPlanes = pixelbuffer_planes(src, mPlanes);
+	if (mNumPlanes==0) return false;
+
+	mField = (src->meta.valid & FRAME_META_DRIVER) ? src->meta.field : mDefaultField;
+	if (mField==V4L2_FIELD_ANY) mField = mDefaultField;
+	switch (mField) {
+		case V4L2_FIELD_NONE:
+			mFirstParity = 0;
+			break;
+		case V4L2_FIELD_INTERLACED:
+			// the order depends on the standard: NTSC sends the bottom field first, the others the top one
+			mFirstParity = (src->height==480 or src->height==486) ? 1 : 0;
+			break;
+		case V4L2_FIELD_INTERLACED_TB:
+		case V4L2_FIELD_SEQ_TB:
+			mFirstParity = 0;
+			break;
+		case V4L2_FIELD_INTERLACED_BT:
+		case V4L2_FIELD_SEQ_BT:
+			mFirstParity = 1;
+			break;
+		default:
+			// single fields (TOP, BOTTOM, ALTERNATE) are half pictures: not handled here
+			return false;
+	}
+
+	// the previous picture is only good for motion detection if it is described the same way
+	if (src->fmt!=mPrevFmt or src->width!=mPrevWidth or src->height!=mPrevHeight or pixelbuffer_stride(src)!=mPrevStride) {
+		mHavePrev = false;
+		mPrevFmt = src->fmt;
+		mPrevWidth = src->width;
+		mPrevHeight = src->height;
+		mPrevStride = pixelbuffer_stride(src);
+	}
+	if (mMode==DEINTERLACE_MOTION_ADAPTIVE and mPrev.size() < src->length) {
+		mPrev.resize(src->length);
+		mHavePrev = false;
+	}
+
+	// frame period, for the timestamp of the second field
+	if (src->sec > 0) {
+		long long now = (long long) src->sec * 1000000 + src->usec;
+		if (mLastUs > 0 and now > mLastUs and now - mLastUs < 1000000) mPeriodUs = now - mLastUs;
+		mLastUs = now;
+	}
+	return true;
+}
+
+
+void Deinterlacer::internal_run(const PixelBuffer* src, PixelBuffer* dst0, PixelBuffer* dst1, bool frameRate) {
+	DeinterlaceKernel kernel(this, dst0, dst1, frameRate);
+	PixelBuffer* in = const_cast<PixelBuffer*>(src);		// kernels only read it
+	if (mExecutor) mExecutor->run(in, kernel);
+	else kernel.process_band(in, 0, src->height);
+	if (mMode==DEINTERLACE_MOTION_ADAPTIVE) mHavePrev = true;
+}
+
+
+void Deinterlacer::internal_finish(const PixelBuffer* src, PixelBuffer* dst) {
+	dst->fmt = src->fmt;
+	dst->width = src->width;
+	dst->height = src->height;
+	dst->stride = src->stride;
+	dst->length = src->length;
+	dst->sec = src->sec;
+	dst->usec = src->usec;
+	dst->meta = src->meta;
+	dst->meta.field = V4L2_FIELD_NONE;
+	dst->meta.stream = NULL;					// stays with the grabbed buffer
+	dst->meta.streamLength = 0;
+}
+
+
+bool Deinterlacer::process(const PixelBuffer* src, PixelBuffer* dst) {
+	if (!internal_setup(src, dst, NULL)) return false;
+
+	if (mField==V4L2_FIELD_NONE) {
+		memcpy(dst->buf, src->buf, src->length);
+		mHavePrev = false;
+	} else {
+		internal_run(src, dst, NULL, true);
+	}
+	internal_finish(src, dst);
+	return true;
+}
+
+
+bool Deinterlacer::process_fields(const PixelBuffer* src, PixelBuffer* first, PixelBuffer* second) {
+	if (second==NULL) return false;
+	if (!internal_setup(src, first, second)) return false;
+	if (mField==V4L2_FIELD_NONE) return false;
+
+	internal_run(src, first, second, false);
+	internal_finish(src, first);
+	internal_finish(src, second);
+
+	if (src->sec > 0 and mPeriodUs > 0) {
+		long long t = (long long) src->sec * 1000000 + src->usec + mPeriodUs / 2;
+		second->sec = (time_t) (t / 1000000);
+		second->usec = (suseconds_t) (t % 1000000);
+	}
+	return true;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef Deinterlace_HH
+#define Deinterlace_HH
+
+#include <vector>
+#include <stddef.h>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FormatTraits.hh"
+#include "Grabber_Helpers.hh"
+#include "FrameExecutor.hh"
+
+/*
+  Deinterlacing of pictures grabbed from interlaced sources (analog capture cards...),
+  done on the grabbed YUV data before any conversion.
+
+  - DEINTERLACE_BOB: the lines of one field are kept, the others are the average of the lines
+    above and below
+  - DEINTERLACE_BLEND: every line is blended with its neighbours (1/4, 1/2, 1/4): no combing,
+    no flicker, but moving objects get a ghost
+  - DEINTERLACE_MOTION_ADAPTIVE: like bob, but where the missing line didn't change since the
+    previous picture (difference <= motionThreshold) the line of the other field is kept
+    (full vertical resolution on static parts)
+
+  process() gives one picture per grabbed frame, process_fields() one per field (twice the
+  frame rate). The field layout and order come from pb->meta.field (the v4l2_field the driver
+  returned with the buffer, see FRAME_META_DRIVER) or, when the grabber doesn't set it
+  (V4L1, read() io), from set_default_field().
+
+  Lines are processed as bytes, plane by plane: packed formats (YUYV, UYVY) keep their layout,
+  chroma planes of 4:2:0 and 4:1:0 formats are taken as alternate lines of the two fields too.
+  Bands run on a FrameExecutor when one is given.
+*/
+
+enum DeinterlaceMode {
+	DEINTERLACE_BOB,
+	DEINTERLACE_BLEND,
+	DEINTERLACE_MOTION_ADAPTIVE
+};
+
+// default for motionThreshold (on 8 bit samples)
+#define DEINTERLACE_MOTION_THRESHOLD 10
+
+
+class Deinterlacer {
+public:
+	// executor: bands are processed on its threads (NULL: by the caller only)
+	Deinterlacer(FrameExecutor* executor = NULL, DeinterlaceMode mode = DEINTERLACE_MOTION_ADAPTIVE,
+		     unsigned char motionThreshold = DEINTERLACE_MOTION_THRESHOLD);
+
+	// YUV formats (GREY YUYV UYVY Y41P YV12 YU12 YVU9 YUV9 422P 411P NV12 NV21)
+	static bool supported(PixelBufferFormat fmt);
+
+	void set_mode(DeinterlaceMode mode);
+	DeinterlaceMode get_mode(void) const { return mMode; }
+	void set_motion_threshold(unsigned char threshold) { mThreshold = threshold; }
+
+	// v4l2_field used for pictures without driver metadata (default V4L2_FIELD_INTERLACED)
+	void set_default_field(unsigned int field) { mDefaultField = field; }
+
+	// one progressive picture per frame in dst (progressive frames are just copied)
+	// dst->buf must hold src->length bytes; dst description, timestamp and metadata are set from src
+	// returns false for unsupported formats or fields, short buffers
+	bool process(const PixelBuffer* src, PixelBuffer* dst);
+
+	// one progressive picture per field, in temporal order: first gets the timestamp of src,
+	// second half a frame period later (period measured on the previous frames)
+	// returns false also for progressive frames
+	bool process_fields(const PixelBuffer* src, PixelBuffer* first, PixelBuffer* second);
+
+	// forget the previous picture (ie. after a format or input change)
+	void reset(void);
+
+private:
+	// sets mLayout, mFirstParity; false when the field can't be deinterlaced
+	bool internal_setup(const PixelBuffer* src, PixelBuffer* dst0, PixelBuffer* dst1);
+	void internal_run(const PixelBuffer* src, PixelBuffer* dst0, PixelBuffer* dst1, bool frameRate);
+	void internal_finish(const PixelBuffer* src, PixelBuffer* dst);
+
+	friend class DeinterlaceKernel;
+
+	FrameExecutor* mExecutor;
+	DeinterlaceMode mMode;
+	unsigned char mThreshold;
+	unsigned int mDefaultField;
+
+	unsigned int mField;			// v4l2_field of the picture being processed
+	unsigned int mFirstParity;		// 0 when the top field (even lines) comes first
+	unsigned int mNumPlanes;
+	PixelPlane mPlanes[3];
+
+	std::vector<unsigned char> mPrev;	// previous picture, stored interleaved (motion adaptive)
+	bool mHavePrev;
+	PixelBufferFormat mPrevFmt;		// description of the previous picture
+	unsigned int mPrevWidth;
+	unsigned int mPrevHeight;
+	unsigned int mPrevStride;
+
+	long long mLastUs;			// timestamp of the previous frame
+	long long mPeriodUs;			// last frame period (0 unknown)
+};
+
+#endif /*Deinterlace_HH*/
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include "FormatTraits.hh"
+
+#include <assert.h>
+
+// indexed by PixelBufferFormat: PIXELBUFFER_FORMAT_LIST follows the order of the enum
+static const PixelFormatInfo gPixelFormats[] = {
+	{ PIXELBUFFER_FMT_NONE, 0, PIXEL_V4L1_NONE, PIXEL_FAMILY_NONE, 0, 0, 0, 0, 0, 0, 0 },
+#define PIXELBUFFER_FORMAT_INFO(F, FOURCC, V4L1, FAMILY, PLANES, BPP0, BPPC, HSHIFT, VSHIFT, LSTEP, LOFF) \
+	{ F, FOURCC, V4L1, FAMILY, PLANES, BPP0, BPPC, HSHIFT, VSHIFT, LSTEP, LOFF },
+	PIXELBUFFER_FORMAT_LIST(PIXELBUFFER_FORMAT_INFO)
+#undef PIXELBUFFER_FORMAT_INFO
+};
+
+static const unsigned int gNumPixelFormats = sizeof(gPixelFormats) / sizeof(gPixelFormats[0]);
+
+
+const PixelFormatInfo* pixel_format_info(PixelBufferFormat fmt) {
+	if (fmt==PIXELBUFFER_FMT_NONE or (unsigned int) fmt >= gNumPixelFormats) return NULL;
+	assert(gPixelFormats[fmt].fmt == fmt);		// PIXELBUFFER_FORMAT_LIST out of enum order?
+	return &gPixelFormats[fmt];
+}
+
+
+PixelBufferFormat pixel_format_from_v4l2(unsigned int fourcc) {
+	for (unsigned int i = 1; i < gNumPixelFormats; i++)
+		if (gPixelFormats[i].v4l2Fourcc == fourcc) return gPixelFormats[i].fmt;
+	return PIXELBUFFER_FMT_NONE;
+}
+
+
+PixelBufferFormat pixel_format_from_v4l1(unsigned int palette) {
+	if (palette==PIXEL_V4L1_NONE) return PIXELBUFFER_FMT_NONE;
+	for (unsigned int i = 1; i < gNumPixelFormats; i++)
+		if (gPixelFormats[i].v4l1Palette == palette) return gPixelFormats[i].fmt;
+	return PIXELBUFFER_FMT_NONE;
+}
+
+
+unsigned int pixel_format_plane_length(const PixelFormatInfo* info, unsigned int p, unsigned int w, unsigned int h) {
+	if (info==NULL or p >= info->numPlanes) return 0;
+	if (p==0) return ((w*info->bitsPerPixel0 + 7) / 8) * h;
+	unsigned int cw = (w + (1u << info->chromaHShift) - 1) >> info->chromaHShift;
+	unsigned int ch = (h + (1u << info->chromaVShift) - 1) >> info->chromaVShift;
+	return ((cw*info->bitsPerSampleC + 7) / 8) * ch;
+}
+
+
+unsigned int pixel_format_length(const PixelFormatInfo* info, unsigned int w, unsigned int h) {
+	if (info==NULL) return 0;
+	unsigned int len = 0;
+	for (unsigned int p = 0; p < info->numPlanes; p++) len += pixel_format_plane_length(info, p, w, h);
+	return len;
+}
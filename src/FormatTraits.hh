@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#ifndef FormatTraits_HH
+#define FormatTraits_HH
+
+#include "PixelBuffer.hh"
+
+/*
+  Everything the grabbers need to know about a PixelBufferFormat, in one place.
+
+  PIXELBUFFER_FORMAT_LIST is the only description of the formats: it expands both to the
+  runtime table returned by pixel_format_info() (used by pixelbuffer_length() and by the
+  v4l1/v4l2 code mappers) and to one FormatTraits<F> specialization per format, whose
+  members are compile time constants. Processing code written as
+	template <PixelBufferFormat F> void run(PixelBuffer* pb)
+  and called through pixelbuffer_dispatch() gets a copy of its inner loops for every format,
+  with strides, steps and plane sizes known to the compiler: no format test in the loops.
+
+  Memory layout of a picture w x h:
+  - plane 0 is full resolution, bitsPerPixel0 bits per pixel (whole picture for packed formats)
+  - planes 1 and 2 (if any) follow plane 0 and are subsampled by 1<<chromaHShift horizontally
+    and 1<<chromaVShift vertically, bitsPerSampleC bits per sample
+    (NV12/NV21 have a single chroma plane with interleaved 16 bits CbCr samples)
+  - lumaStep/lumaOffset locate the luma byte of each pixel in plane 0 for YUV formats
+    (lumaStep 0: luma can't be addressed with a constant step, ie. Y41P, RGB, Bayer)
+*/
+
+enum PixelFormatFamily {
+	PIXEL_FAMILY_NONE,
+	PIXEL_FAMILY_RGB,
+	PIXEL_FAMILY_BAYER,
+	PIXEL_FAMILY_YUV
+};
+
+#define PIXEL_FOURCC(a,b,c,d) \
+	((unsigned int)(a) | ((unsigned int)(b) << 8) | ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
+// v4l1 palettes (VIDEO_PALETTE_* from linux/videodev.h, gone from recent kernels headers)
+#define PIXEL_V4L1_NONE		0
+#define PIXEL_V4L1_GREY		1
+#define PIXEL_V4L1_RGB565	3
+#define PIXEL_V4L1_RGB24	4
+#define PIXEL_V4L1_RGB32	5
+#define PIXEL_V4L1_RGB555	6
+#define PIXEL_V4L1_YUYV		8
+#define PIXEL_V4L1_UYVY		9
+#define PIXEL_V4L1_YUV420	10
+#define PIXEL_V4L1_YUV422P	13
+#define PIXEL_V4L1_YUV411P	14
+
+//  X(fmt, v4l2 fourcc, v4l1 palette, family, planes, bitsPerPixel0, bitsPerSampleC, chromaHShift, chromaVShift, lumaStep, lumaOffset)
+#define PIXELBUFFER_FORMAT_LIST(X) \
+	X(PIXELBUFFER_FMT_RGB1, PIXEL_FOURCC('R','G','B','1'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_RGB,   1,  8,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_RGBO, PIXEL_FOURCC('R','G','B','O'), PIXEL_V4L1_RGB555,  PIXEL_FAMILY_RGB,   1, 16,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_RGBP, PIXEL_FOURCC('R','G','B','P'), PIXEL_V4L1_RGB565,  PIXEL_FAMILY_RGB,   1, 16,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_R444, PIXEL_FOURCC('R','4','4','4'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_RGB,   1, 16,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_RGBQ, PIXEL_FOURCC('R','G','B','Q'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_RGB,   1, 16,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_RGBR, PIXEL_FOURCC('R','G','B','R'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_RGB,   1, 16,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_BGR3, PIXEL_FOURCC('B','G','R','3'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_RGB,   1, 24,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_RGB3, PIXEL_FOURCC('R','G','B','3'), PIXEL_V4L1_RGB24,   PIXEL_FAMILY_RGB,   1, 24,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_BGR4, PIXEL_FOURCC('B','G','R','4'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_RGB,   1, 32,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_RGB4, PIXEL_FOURCC('R','G','B','4'), PIXEL_V4L1_RGB32,   PIXEL_FAMILY_RGB,   1, 32,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_BA81, PIXEL_FOURCC('B','A','8','1'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_BAYER, 1,  8,  0, 0, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_GREY, PIXEL_FOURCC('G','R','E','Y'), PIXEL_V4L1_GREY,    PIXEL_FAMILY_YUV,   1,  8,  0, 0, 0, 1, 0) \
+	X(PIXELBUFFER_FMT_YUYV, PIXEL_FOURCC('Y','U','Y','V'), PIXEL_V4L1_YUYV,    PIXEL_FAMILY_YUV,   1, 16,  0, 1, 0, 2, 0) \
+	X(PIXELBUFFER_FMT_UYVY, PIXEL_FOURCC('U','Y','V','Y'), PIXEL_V4L1_UYVY,    PIXEL_FAMILY_YUV,   1, 16,  0, 1, 0, 2, 1) \
+	X(PIXELBUFFER_FMT_Y41P, PIXEL_FOURCC('Y','4','1','P'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_YUV,   1, 12,  0, 2, 0, 0, 0) \
+	X(PIXELBUFFER_FMT_YV12, PIXEL_FOURCC('Y','V','1','2'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_YUV,   3,  8,  8, 1, 1, 1, 0) \
+	X(PIXELBUFFER_FMT_YU12, PIXEL_FOURCC('Y','U','1','2'), PIXEL_V4L1_YUV420,  PIXEL_FAMILY_YUV,   3,  8,  8, 1, 1, 1, 0) \
+	X(PIXELBUFFER_FMT_YVU9, PIXEL_FOURCC('Y','V','U','9'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_YUV,   3,  8,  8, 2, 2, 1, 0) \
+	X(PIXELBUFFER_FMT_YUV9, PIXEL_FOURCC('Y','U','V','9'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_YUV,   3,  8,  8, 2, 2, 1, 0) \
+	X(PIXELBUFFER_FMT_422P, PIXEL_FOURCC('4','2','2','P'), PIXEL_V4L1_YUV422P, PIXEL_FAMILY_YUV,   3,  8,  8, 1, 0, 1, 0) \
+	X(PIXELBUFFER_FMT_411P, PIXEL_FOURCC('4','1','1','P'), PIXEL_V4L1_YUV411P, PIXEL_FAMILY_YUV,   3,  8,  8, 2, 0, 1, 0) \
+	X(PIXELBUFFER_FMT_NV12, PIXEL_FOURCC('N','V','1','2'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_YUV,   2,  8, 16, 1, 1, 1, 0) \
+	X(PIXELBUFFER_FMT_NV21, PIXEL_FOURCC('N','V','2','1'), PIXEL_V4L1_NONE,    PIXEL_FAMILY_YUV,   2,  8, 16, 1, 1, 1, 0)
+
+
+// runtime description of a format (one entry per PixelBufferFormat, see pixel_format_info())
+struct PixelFormatInfo {
+	PixelBufferFormat fmt;
+	unsigned int v4l2Fourcc;
+	unsigned int v4l1Palette;	// PIXEL_V4L1_NONE if v4l1 has no such palette
+	PixelFormatFamily family;
+	unsigned char numPlanes;
+	unsigned char bitsPerPixel0;
+	unsigned char bitsPerSampleC;
+	unsigned char chromaHShift;
+	unsigned char chromaVShift;
+	unsigned char lumaStep;
+	unsigned char lumaOffset;
+};
+
+// NULL for PIXELBUFFER_FMT_NONE (and bad values)
+const PixelFormatInfo* pixel_format_info(PixelBufferFormat fmt);
+
+// reverse lookups; PIXELBUFFER_FMT_NONE when unknown
+PixelBufferFormat pixel_format_from_v4l2(unsigned int fourcc);
+PixelBufferFormat pixel_format_from_v4l1(unsigned int palette);
+
+// bytes of plane p (0 = luma/packed) and of the whole picture; 0 for unknown formats
+unsigned int pixel_format_plane_length(const PixelFormatInfo* info, unsigned int p, unsigned int w, unsigned int h);
+unsigned int pixel_format_length(const PixelFormatInfo* info, unsigned int w, unsigned int h);
+
+
+// compile time description of a format
+template <PixelBufferFormat F> struct FormatTraits;
+
+#define PIXELBUFFER_FORMAT_TRAITS(F, FOURCC, V4L1, FAMILY, PLANES, BPP0, BPPC, HSHIFT, VSHIFT, LSTEP, LOFF) \
+template <> struct FormatTraits<F> {								\
+	static const PixelBufferFormat fmt = F;							\
+	static const PixelFormatFamily family = FAMILY;						\
+	static const unsigned int numPlanes = PLANES;						\
+	static const unsigned int bitsPerPixel0 = BPP0;						\
+	static const unsigned int bitsPerSampleC = BPPC;					\
+	static const unsigned int chromaHShift = HSHIFT;					\
+	static const unsigned int chromaVShift = VSHIFT;					\
+	static const unsigned int lumaStep = LSTEP;						\
+	static const unsigned int lumaOffset = LOFF;						\
+	static const bool planar = (PLANES > 1);						\
+	static unsigned int line_length0(unsigned int w) { return (w*BPP0 + 7) / 8; }		\
+	static unsigned int chroma_width(unsigned int w) { return (w + (1u << HSHIFT) - 1) >> HSHIFT; }	\
+	static unsigned int chroma_height(unsigned int h) { return (h + (1u << VSHIFT) - 1) >> VSHIFT; }	\
+	static unsigned int line_lengthC(unsigned int w) { return (chroma_width(w)*BPPC + 7) / 8; }	\
+	static unsigned int plane_length(unsigned int p, unsigned int w, unsigned int h) {	\
+		if (p==0) return line_length0(w) * h;						\
+		if (p >= PLANES) return 0;							\
+		return line_lengthC(w) * chroma_height(h);					\
+	}											\
+	static unsigned int plane_offset(unsigned int p, unsigned int w, unsigned int h) {	\
+		unsigned int off = 0;								\
+		for (unsigned int i = 0; i < p; i++) off += plane_length(i, w, h);		\
+		return off;									\
+	}											\
+	static unsigned int length(unsigned int w, unsigned int h) { return plane_offset(PLANES, w, h); }	\
+};
+
+PIXELBUFFER_FORMAT_LIST(PIXELBUFFER_FORMAT_TRAITS)
+
+
+// calls kernel.template run<F>(pb) with F = pb->fmt as a template argument
+// Kernel must have: template <PixelBufferFormat F> void run(PixelBuffer* pb);
+// returns false (and does nothing) for PIXELBUFFER_FMT_NONE
+template <class Kernel>
+bool pixelbuffer_dispatch(PixelBuffer* pb, Kernel& kernel) {
+	switch (pb->fmt) {
+#define PIXELBUFFER_FORMAT_DISPATCH_CASE(F, FOURCC, V4L1, FAMILY, PLANES, BPP0, BPPC, HSHIFT, VSHIFT, LSTEP, LOFF) \
+	case (F) : { kernel.template run<F>(pb); return true; }
+	PIXELBUFFER_FORMAT_LIST(PIXELBUFFER_FORMAT_DISPATCH_CASE)
+#undef PIXELBUFFER_FORMAT_DISPATCH_CASE
+	default : return false;
+	}
+}
+
+#endif /*FormatTraits_HH*/
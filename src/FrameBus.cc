@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include "FrameBus.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// every slot starts with a FrameBusSlot padded to FRAMEBUS_SLOT_HDR_SIZE bytes, then the picture
+#define FRAMEBUS_SLOT_HDR_SIZE	64
+#define FRAMEBUS_HDR_SIZE	4096
+
+static inline FrameBusSlot* framebus_slot(const FrameBusHeader* h, unsigned int i) {
+	return (FrameBusSlot*) ((char*)h + FRAMEBUS_HDR_SIZE + i*h->slotStride);
+}
+
+static inline char* framebus_slot_data(FrameBusSlot* slot) {
+	return ((char*)slot) + FRAMEBUS_SLOT_HDR_SIZE;
+}
+
+static long framebus_futex(volatile unsigned int* addr, int op, unsigned int val, const timespec* timeout) {
+	// shared futex (no FUTEX_PRIVATE_FLAG): waiters live in other processes
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+
+FrameBus::FrameBus(unsigned int numSlots, unsigned int slotDataSize, const std::string& name) {
+	mNumSlots = numSlots;
+	mSlotDataSize = slotDataSize;
+	mName = name;
+	mFd = -1;
+	mMap = MAP_FAILED;
+	mMapSize = 0;
+	mHeader = NULL;
+}
+
+
+FrameBus::~FrameBus() {
+	internal_reset();
+}
+
+
+bool FrameBus::init(void) {
+	if (mFd!=-1) internal_reset();
+	if (mNumSlots < 2 or mSlotDataSize==0) {
+		FRAMEBUS_WARNING("bad ring geometry\n");
+		return false;
+	}
+	assert(sizeof(FrameBusHeader) <= FRAMEBUS_HDR_SIZE);
+	assert(sizeof(FrameBusSlot) <= FRAMEBUS_SLOT_HDR_SIZE);
+
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long stride = FRAMEBUS_SLOT_HDR_SIZE + mSlotDataSize;
+	stride = ((stride + page - 1) / page) * page;				// page align slots
+	mMapSize = FRAMEBUS_HDR_SIZE + stride * mNumSlots;
+
+	mFd = memfd_create(mName.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (mFd==-1) {
+		FRAMEBUS_WARNING("memfd_create failed\n");
+		return false;
+	}
+	if (ftruncate(mFd, mMapSize)==-1) {
+		FRAMEBUS_WARNING("ftruncate failed\n");
+		internal_reset();
+		return false;
+	}
+	// readers may trust the size: nobody can shrink the memfd under their mapping
+	if (fcntl(mFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)==-1) {
+		FRAMEBUS_WARNING("sealing failed\n");
+		internal_reset();
+		return false;
+	}
+
+	mMap = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, 0);
+	if (mMap==MAP_FAILED) {
+		FRAMEBUS_WARNING("mmap failed\n");
+		internal_reset();
+		return false;
+	}
+
+	mHeader = (FrameBusHeader*) mMap;					// memfd is zero filled: all seqs are 0
+	mHeader->version = FRAMEBUS_VERSION;
+	mHeader->numSlots = mNumSlots;
+	mHeader->slotDataSize = mSlotDataSize;
+	mHeader->slotStride = stride;
+	mHeader->writeSeq = 0;
+	mHeader->numWaiters = 0;
+	mHeader->published = 0;
+	__atomic_store_n(&mHeader->magic, FRAMEBUS_MAGIC, __ATOMIC_RELEASE);	// header is valid from now on
+	return true;
+}
+
+
+bool FrameBus::publish(const PixelBuffer* pb) {
+	if (mHeader==NULL or pb==NULL or pb->buf==NULL) return false;
+	if (pb->length > mSlotDataSize) {
+		FRAMEBUS_WARNING("picture doesn't fit in a slot\n");
+		return false;
+	}
+
+	unsigned long long n = mHeader->published;				// only the producer writes it
+	FrameBusSlot* slot = framebus_slot(mHeader, n % mNumSlots);
+
+	__atomic_store_n(&slot->seq, 2*n + 1, __ATOMIC_RELAXED);		// odd: slot is being written
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->frame  = n;
+	slot->length = pb->length;
+	slot->width  = pb->width;
+	slot->height = pb->height;
+	slot->stride = pb->stride;
+	slot->fmt    = pb->fmt;
+	slot->sec    = pb->sec;
+	slot->usec   = pb->usec;
+	memcpy (framebus_slot_data(slot), pb->buf, pb->length);
+
+	__atomic_store_n(&slot->seq, 2*n + 2, __ATOMIC_RELEASE);		// even: picture n is complete
+	__atomic_store_n(&mHeader->published, n + 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&mHeader->writeSeq, 1, __ATOMIC_SEQ_CST);
+
+	// syscall only when some reader sleeps
+	if (__atomic_load_n(&mHeader->numWaiters, __ATOMIC_SEQ_CST) > 0)
+		framebus_futex(&mHeader->writeSeq, FUTEX_WAKE, INT_MAX, NULL);
+	return true;
+}
+
+
+void FrameBus::frame_grabbed(PixelBuffer* pb) {
+	publish(pb);
+}
+
+
+unsigned long long FrameBus::get_published(void) const {
+	if (mHeader==NULL) return 0;
+	return __atomic_load_n(&mHeader->published, __ATOMIC_ACQUIRE);
+}
+
+
+void FrameBus::internal_reset(void) {
+	if (mMap!=MAP_FAILED) munmap(mMap, mMapSize);
+	if (mFd!=-1) close(mFd);
+	mMap = MAP_FAILED;
+	mMapSize = 0;
+	mHeader = NULL;
+	mFd = -1;
+}
+
+
+
+FrameBusReader::FrameBusReader() {
+	mFd = -1;
+	mMap = MAP_FAILED;
+	mMapSize = 0;
+	mHeader = NULL;
+	mNext = 0;
+	mSkipped = 0;
+}
+
+
+FrameBusReader::~FrameBusReader() {
+	detach();
+}
+
+
+bool FrameBusReader::attach(int fd) {
+	detach();
+	mFd = dup(fd);
+	if (mFd==-1) return false;
+
+	// map the header alone first to learn the ring geometry
+	void* hdr = mmap(NULL, FRAMEBUS_HDR_SIZE, PROT_READ, MAP_SHARED, mFd, 0);
+	if (hdr==MAP_FAILED) { detach(); return false; }
+	FrameBusHeader* h = (FrameBusHeader*) hdr;
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE)!=FRAMEBUS_MAGIC or h->version!=FRAMEBUS_VERSION) {
+		munmap(hdr, FRAMEBUS_HDR_SIZE);
+		detach();
+		return false;
+	}
+	size_t size = FRAMEBUS_HDR_SIZE + h->slotStride * h->numSlots;
+	munmap(hdr, FRAMEBUS_HDR_SIZE);
+
+	// readers write numWaiters, so the mapping must be writable
+	mMap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+	if (mMap==MAP_FAILED) { detach(); return false; }
+	mMapSize = size;
+	mHeader = (FrameBusHeader*) mMap;
+
+	unsigned long long pub = __atomic_load_n(&mHeader->published, __ATOMIC_ACQUIRE);
+	mNext = (pub > 0) ? pub - 1 : 0;					// start from the newest picture
+	mSkipped = 0;
+	return true;
+}
+
+
+void FrameBusReader::detach(void) {
+	if (mMap!=MAP_FAILED) munmap((void*)mMap, mMapSize);
+	if (mFd!=-1) close(mFd);
+	mFd = -1;
+	mMap = MAP_FAILED;
+	mMapSize = 0;
+	mHeader = NULL;
+}
+
+
+bool FrameBusReader::next(FrameBusView& view, int timeoutMs) {
+	if (mHeader==NULL) return false;
+
+	timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	if (timeoutMs > 0) {
+		deadline.tv_sec += timeoutMs / 1000;
+		deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+	}
+
+	const unsigned int numSlots = mHeader->numSlots;
+	while (true) {
+		unsigned int w = __atomic_load_n(&mHeader->writeSeq, __ATOMIC_SEQ_CST);
+		unsigned long long pub = __atomic_load_n(&mHeader->published, __ATOMIC_SEQ_CST);
+
+		if (mNext >= pub) {
+			// nothing new: sleep on writeSeq
+			if (timeoutMs==0) return false;
+			timespec rel, *relPtr = NULL;
+			if (timeoutMs > 0) {
+				timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				long long ns = (deadline.tv_sec - now.tv_sec) * 1000000000LL + (deadline.tv_nsec - now.tv_nsec);
+				if (ns <= 0) return false;
+				rel.tv_sec = ns / 1000000000LL;
+				rel.tv_nsec = ns % 1000000000LL;
+				relPtr = &rel;
+			}
+			__atomic_add_fetch(&mHeader->numWaiters, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&mHeader->published, __ATOMIC_SEQ_CST) <= mNext)
+				framebus_futex(&mHeader->writeSeq, FUTEX_WAIT, w, relPtr);	// returns at once if writeSeq != w
+			__atomic_sub_fetch(&mHeader->numWaiters, 1, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		// too slow: jump to the newest picture rather than chasing the producer
+		if (pub - mNext > numSlots - 1) {
+			mSkipped += (pub - 1) - mNext;
+			mNext = pub - 1;
+		}
+
+		FrameBusSlot* slot = framebus_slot(mHeader, mNext % numSlots);
+		unsigned long long s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (s1 != 2*mNext + 2) {			// overwritten (or being overwritten) meanwhile
+			mSkipped++;
+			mNext++;
+			continue;
+		}
+
+		view.data   = framebus_slot_data(slot);
+		view.length = slot->length;
+		view.width  = slot->width;
+		view.height = slot->height;
+		view.stride = slot->stride;
+		view.fmt    = slot->fmt;
+		view.sec    = slot->sec;
+		view.usec   = slot->usec;
+		view.frame  = mNext;
+		view.seq    = s1;
+		view.slot   = mNext % numSlots;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != s1) {	// lapped while copying the description
+			mSkipped++;
+			mNext++;
+			continue;
+		}
+		mNext++;
+		return true;
+	}
+}
+
+
+bool FrameBusReader::release(const FrameBusView& view) const {
+	if (mHeader==NULL) return false;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&framebus_slot(mHeader, view.slot)->seq, __ATOMIC_RELAXED) == view.seq;
+}
+
+
+
+int frame_bus_send_fd(int unixSock, int fd) {
+	char dummy = 'F';
+	iovec iov;
+	iov.iov_base = &dummy;
+	iov.iov_len = 1;
+
+	char ctrl[CMSG_SPACE(sizeof(int))];
+	memset (ctrl, 0, sizeof(ctrl));
+	msghdr msg;
+	memset (&msg, 0, sizeof(msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy (CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(unixSock, &msg, 0) < 0) return -1;
+	return 0;
+}
+
+
+int frame_bus_recv_fd(int unixSock) {
+	char dummy;
+	iovec iov;
+	iov.iov_base = &dummy;
+	iov.iov_len = 1;
+
+	char ctrl[CMSG_SPACE(sizeof(int))];
+	msghdr msg;
+	memset (&msg, 0, sizeof(msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	if (recvmsg(unixSock, &msg, MSG_CMSG_CLOEXEC) <= 0) return -1;
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg==NULL or cmsg->cmsg_level!=SOL_SOCKET or cmsg->cmsg_type!=SCM_RIGHTS) return -1;
+	int fd;
+	memcpy (&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#ifndef FrameBus_HH
+#define FrameBus_HH
+
+#include <string>
+#include <sys/types.h>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FrameSink.hh"
+
+/*
+  FrameBus publishes grabbed pictures in a ring of slots living in a memfd, so that other
+  processes (recorder, analytics, preview...) can map the same memory and read every
+  picture in place, without a copy through a socket.
+
+  memfd layout:
+  +----------------+--------------------+----------------------+-----+
+  | FrameBusHeader | slot 0 (hdr+data)  | slot 1 (hdr+data)    | ... |
+  +----------------+--------------------+----------------------+-----+
+
+  - the producer never waits for readers: picture n goes in slot n%numSlots, whatever is there
+  - every slot is protected by a sequence number (a seqlock): odd while the producer writes it,
+    2*(n+1) once picture n is complete; a reader checks it before and after using the data
+  - readers that fall more than numSlots-1 pictures behind are moved to the newest picture
+    (the skipped pictures are counted) instead of slowing down the producer
+  - readers sleep on a futex on FrameBusHeader::writeSeq, the producer only issues
+    FUTEX_WAKE when somebody is sleeping
+
+  The memfd is passed to reader processes with frame_bus_send_fd()/frame_bus_recv_fd()
+  (SCM_RIGHTS over a unix socket) or by opening /proc/<producer pid>/fd/<get_fd()>.
+*/
+
+#define FRAMEBUS_MAGIC		((unsigned int) 0x46427573)	// 'FBus'
+#define FRAMEBUS_VERSION	((unsigned int) 1)
+
+// FrameBus logging helpers
+#define FRAMEBUS_WARNING_PREFIX	(" * WARNING - frame_bus - ")
+
+// Used to be implemented using ACE helpers - need to switch to something else
+#define FRAMEBUS_WARNING(x) {}
+
+
+struct FrameBusHeader {
+	unsigned int magic;		// FRAMEBUS_MAGIC
+	unsigned int version;		// FRAMEBUS_VERSION
+	unsigned int numSlots;		// number of slots in the ring
+	unsigned int slotDataSize;	// max picture length a slot can hold
+	unsigned long slotStride;	// bytes between two slot headers (page aligned)
+
+	volatile unsigned int writeSeq;		// futex word: bumped after every publish
+	volatile unsigned int numWaiters;	// readers sleeping on writeSeq
+	volatile unsigned long long published;	// number of pictures published so far
+};
+
+struct FrameBusSlot {
+	volatile unsigned long long seq;	// seqlock, see above
+	unsigned long long frame;		// picture number (0 based)
+
+	// copy of the PixelBuffer description
+	unsigned long length;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	PixelBufferFormat fmt;
+	long sec;
+	long usec;
+};
+
+// a picture as seen by a reader: data points straight into the shared mapping
+struct FrameBusView {
+	const void* data;
+	unsigned long length;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	PixelBufferFormat fmt;
+	long sec;
+	long usec;
+
+	unsigned long long frame;	// picture number
+	unsigned long long seq;		// slot seq when the view was taken (used by FrameBusReader::release())
+	unsigned int slot;
+};
+
+
+// producer side
+class FrameBus : public FrameSink {
+public:
+	// numSlots pictures of at most slotDataSize bytes each
+	FrameBus(unsigned int numSlots, unsigned int slotDataSize, const std::string& name = "framebus");
+	~FrameBus();
+
+	// create and map the memfd; returns false on failure
+	bool init(void);
+
+	// copy pb in the next slot and wake up readers
+	// returns false when pb doesn't fit in a slot or the bus was not inited
+	bool publish(const PixelBuffer* pb);
+
+	// FrameSink: publish every grabbed picture
+	void frame_grabbed(PixelBuffer* pb);
+
+	// memfd to hand to readers (-1 if not inited)
+	int get_fd(void) const { return mFd; }
+	unsigned long long get_published(void) const;
+
+private:
+	void internal_reset(void);
+
+	unsigned int mNumSlots;
+	unsigned int mSlotDataSize;
+	std::string mName;
+
+	int mFd;			// memfd
+	void* mMap;			// whole mapping
+	size_t mMapSize;
+	FrameBusHeader* mHeader;
+};
+
+
+// consumer side (any process)
+class FrameBusReader {
+public:
+	FrameBusReader();
+	~FrameBusReader();
+
+	// map a bus from its memfd; the reader keeps its own dup() of fd
+	// returns false when fd doesn't contain a FrameBus
+	bool attach(int fd);
+	void detach(void);
+
+	// wait (at most timeoutMs, -1 = forever) for the next picture and fill view
+	// returns false on timeout or if the reader isn't attached
+	bool next(FrameBusView& view, int timeoutMs);
+
+	// call when done with view; returns true if the data was not overwritten while in use
+	// (when false the picture must be discarded: the producer lapped the reader)
+	bool release(const FrameBusView& view) const;
+
+	// pictures this reader missed because it was too slow
+	unsigned long long get_skipped(void) const { return mSkipped; }
+
+private:
+	int mFd;
+	const void* mMap;
+	size_t mMapSize;
+	FrameBusHeader* mHeader;
+
+	unsigned long long mNext;	// next picture number we want
+	unsigned long long mSkipped;
+};
+
+
+// pass a bus memfd to another process over a connected AF_UNIX socket
+// both return -1 on failure (send returns 0 on success, recv the received fd)
+int frame_bus_send_fd(int unixSock, int fd);
+int frame_bus_recv_fd(int unixSock);
+
+#endif /*FrameBus_HH*/
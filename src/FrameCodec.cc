@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "FrameCodec.hh"
+
+#include <string.h>
+
+#define FRAMECODEC_ESCAPE	12		// unary codes this long are followed by the raw residual
+#define FRAMECODEC_MAX_K	7		// Rice parameters are coded in 3 bits
+#define FRAMECODEC_BAND_RAW	0		// first byte of a band
+#define FRAMECODEC_BAND_RICE	1
+
+
+// a component (Y, U, V, R...) as a set of samples step bytes apart in the lines of a plane
+struct CodecComponent {
+	unsigned int plane;
+	unsigned int offset;		// of the first sample in a line
+	unsigned int step;
+	unsigned int width;		// samples per line
+	unsigned int vShift;		// lines of the component = lines of the picture >> vShift
+};
+
+struct CodecLayout {
+	unsigned int numComps;
+	CodecComponent comps[4];
+	unsigned int planeBase[3];
+	unsigned int planeStride[3];
+	unsigned int height;
+};
+
+
+static void codec_add_comp(CodecLayout& l, unsigned int plane, unsigned int offset, unsigned int step, unsigned int lineBytes, unsigned int vShift) {
+	CodecComponent& c = l.comps[l.numComps++];
+	c.plane = plane;
+	c.offset = offset;
+	c.step = step;
+	c.width = (lineBytes - offset + step - 1) / step;
+	c.vShift = vShift;
+}
+
+
+static bool codec_layout(PixelBufferFormat fmt, unsigned int w, unsigned int h, unsigned int stride, size_t length, CodecLayout& l) {
+	PixelBuffer pb;						// only the description is looked at
+	pb.fmt = fmt;
+	pb.width = w;
+	pb.height = h;
+	pb.stride = stride;
+	pb.length = length;
+	PixelPlane planes[3];
+	unsigned int numPlanes = pixelbuffer_planes(&pb, planes);
+	if (numPlanes==0) return false;
+	const PixelFormatInfo* info = pixel_format_info(fmt);
+	unsigned int line0 = planes[0].lineBytes;
+	unsigned int lineC = (numPlanes > 1) ? planes[1].lineBytes : 0;
+
+	l.height = h;
+	for (unsigned int p=0; p< 3; p++) {
+		l.planeBase[p] = (p < numPlanes) ? planes[p].offset : 0;
+		l.planeStride[p] = (p < numPlanes) ? planes[p].stride : 0;
+	}
+
+	l.numComps = 0;
+	switch (fmt) {
+	case (PIXELBUFFER_FMT_YUYV) :
+	case (PIXELBUFFER_FMT_UYVY) : {
+		unsigned int cOff = info->lumaOffset ? 0 : 1;
+		codec_add_comp(l, 0, info->lumaOffset, 2, line0, 0);
+		codec_add_comp(l, 0, cOff, 4, line0, 0);
+		codec_add_comp(l, 0, cOff + 2, 4, line0, 0);
+		break;
+	}
+	case (PIXELBUFFER_FMT_RGB3) :
+	case (PIXELBUFFER_FMT_BGR3) :
+	case (PIXELBUFFER_FMT_RGB4) :
+	case (PIXELBUFFER_FMT_BGR4) : {
+		unsigned int bpp = info->bitsPerPixel0 / 8;
+		for (unsigned int i=0; i< bpp; i++) codec_add_comp(l, 0, i, bpp, line0, 0);
+		break;
+	}
+	case (PIXELBUFFER_FMT_NV12) :
+	case (PIXELBUFFER_FMT_NV21) : {
+		codec_add_comp(l, 0, 0, 1, line0, 0);
+		codec_add_comp(l, 1, 0, 2, lineC, info->chromaVShift);
+		codec_add_comp(l, 1, 1, 2, lineC, info->chromaVShift);
+		break;
+	}
+	default : {
+		// GREY, planar YUV: every plane is a component; others are coded as plain bytes
+		codec_add_comp(l, 0, 0, 1, line0, 0);
+		for (unsigned int p=1; p< info->numPlanes; p++) codec_add_comp(l, p, 0, 1, lineC, info->chromaVShift);
+		break;
+	}
+	}
+	return true;
+}
+
+
+// lines [r0, r1) of component c for the band of picture lines [y0, y1)
+static inline void codec_comp_rows(const CodecComponent& c, unsigned int y0, unsigned int y1, unsigned int& r0, unsigned int& r1) {
+	unsigned int round = (1u << c.vShift) - 1;
+	r0 = (y0 + round) >> c.vShift;
+	r1 = (y1 + round) >> c.vShift;
+}
+
+
+// bytes a band of bandRows lines may need while being coded
+static size_t codec_band_capacity(const CodecLayout& l, unsigned int bandRows) {
+	size_t cap = 1 + 8;
+	for (unsigned int i=0; i< l.numComps; i++) {
+		size_t rows = (bandRows >> l.comps[i].vShift) + 1;
+		cap += rows * (1 + ((size_t) l.comps[i].width * (FRAMECODEC_ESCAPE + 8) + 7) / 8);
+	}
+	return cap;
+}
+
+
+// LOCO-I median edge detector
+static inline unsigned int codec_med(unsigned int a, unsigned int b, unsigned int c) {
+	unsigned int mn = (a < b) ? a : b;
+	unsigned int mx = (a < b) ? b : a;
+	if (c >= mx) return mn;
+	if (c <= mn) return mx;
+	return a + b - c;
+}
+
+
+// residuals (zig-zagged) of a line of width samples STEP bytes apart; up is the line above (NULL on the
+// first line of a band: then samples are predicted from the left one only)
+// returns the sum of the residuals
+template <unsigned int STEP>
+static unsigned long long codec_residual_row(const unsigned char* p, const unsigned char* up, unsigned int width, unsigned char* z) {
+	unsigned long long sum = 0;
+	unsigned int prev = up ? up[0] : 0;
+	for (unsigned int i=0; i< width; i++) {
+		unsigned int x = p[i*STEP];
+		unsigned int pred;
+		if (up==NULL or i==0) pred = (i==0) ? prev : p[(i-1)*STEP];
+		else pred = codec_med(p[(i-1)*STEP], up[i*STEP], up[(i-1)*STEP]);
+		int e = (signed char) (unsigned char) (x - pred);
+		z[i] = (unsigned char) (((unsigned int) e << 1) ^ (unsigned int) (e >> 31));	// zig-zag
+		sum += z[i];
+	}
+	return sum;
+}
+
+
+static unsigned long long codec_residual_row(const unsigned char* p, const unsigned char* up, unsigned int width, unsigned int step, unsigned char* z) {
+	switch (step) {
+	case (1) : return codec_residual_row<1>(p, up, width, z);
+	case (2) : return codec_residual_row<2>(p, up, width, z);
+	case (3) : return codec_residual_row<3>(p, up, width, z);
+	case (4) : return codec_residual_row<4>(p, up, width, z);
+	default : return 0;
+	}
+}
+
+
+struct CodecBitWriter {
+	unsigned char* out;
+	unsigned long long acc;
+	unsigned int bits;
+
+	inline void put(unsigned int value, unsigned int n) {		// n <= 32
+		acc |= (unsigned long long) value << bits;
+		bits += n;
+		if (bits >= 32) {
+			out[0] = (unsigned char) acc;
+			out[1] = (unsigned char) (acc >> 8);
+			out[2] = (unsigned char) (acc >> 16);
+			out[3] = (unsigned char) (acc >> 24);
+			out += 4;
+			acc >>= 32;
+			bits -= 32;
+		}
+	}
+	inline void flush(void) {
+		while (bits > 0) {
+			*out++ = (unsigned char) acc;
+			acc >>= 8;
+			bits = (bits > 8) ? bits - 8 : 0;
+		}
+	}
+};
+
+
+struct CodecBitReader {
+	const unsigned char* in;
+	const unsigned char* end;
+	unsigned long long acc;
+	unsigned int bits;
+	unsigned long long consumed;		// bits used so far (refill() reads zeros past the end)
+
+	inline void refill(void) {
+		while (bits <= 56) {
+			if (in < end) acc |= (unsigned long long) (*in++) << bits;
+			bits += 8;
+		}
+	}
+	inline unsigned int peek32(void) {
+		if (bits < 32) refill();
+		return (unsigned int) acc;
+	}
+	inline void skip(unsigned int n) {
+		acc >>= n;
+		bits -= n;
+		consumed += n;
+	}
+};
+
+
+static size_t codec_encode_band(const CodecLayout& l, const unsigned char* src, unsigned int y0, unsigned int y1, unsigned char* out, unsigned char* z) {
+	CodecBitWriter bw;
+	bw.out = out + 1;
+	bw.acc = 0;
+	bw.bits = 0;
+	size_t rawBytes = 0;
+
+	for (unsigned int ci=0; ci< l.numComps; ci++) {
+		const CodecComponent& c = l.comps[ci];
+		unsigned int stride = l.planeStride[c.plane];
+		unsigned int r0, r1;
+		codec_comp_rows(c, y0, y1, r0, r1);
+		for (unsigned int r = r0; r < r1; r++) {
+			const unsigned char* p = src + l.planeBase[c.plane] + r*stride + c.offset;
+			unsigned long long sum = codec_residual_row(p, (r==r0) ? NULL : p - stride, c.width, c.step, z);
+			unsigned int k = 0;
+			while (k < FRAMECODEC_MAX_K and ((unsigned long long) c.width << (k+1)) <= sum) k++;
+			bw.put(k, 3);
+			unsigned int mask = (1u << k) - 1;
+			for (unsigned int i=0; i< c.width; i++) {
+				unsigned int q = z[i] >> k;
+				if (q < FRAMECODEC_ESCAPE) bw.put(((z[i] & mask) << (q+1)) | ((1u << q) - 1), q + 1 + k);
+				else bw.put(((unsigned int) z[i] << FRAMECODEC_ESCAPE) | ((1u << FRAMECODEC_ESCAPE) - 1), FRAMECODEC_ESCAPE + 8);
+			}
+			rawBytes += c.width;
+		}
+	}
+	bw.flush();
+	size_t len = bw.out - out;
+	if (len <= 1 + rawBytes) {
+		out[0] = FRAMECODEC_BAND_RICE;
+		return len;
+	}
+
+	// noise doesn't compress: store samples as they are
+	out[0] = FRAMECODEC_BAND_RAW;
+	unsigned char* o = out + 1;
+	for (unsigned int ci=0; ci< l.numComps; ci++) {
+		const CodecComponent& c = l.comps[ci];
+		unsigned int r0, r1;
+		codec_comp_rows(c, y0, y1, r0, r1);
+		for (unsigned int r = r0; r < r1; r++) {
+			const unsigned char* p = src + l.planeBase[c.plane] + r*l.planeStride[c.plane] + c.offset;
+			for (unsigned int i=0; i< c.width; i++, p += c.step) *o++ = *p;
+		}
+	}
+	return o - out;
+}
+
+
+// decode a line coded by codec_encode_band() (see codec_residual_row() for p, up)
+template <unsigned int STEP>
+static void codec_decode_row(CodecBitReader& br, unsigned char* p, const unsigned char* up, unsigned int width) {
+	unsigned int k = br.peek32() & 7;
+	br.skip(3);
+	unsigned int mask = (1u << k) - 1;
+	unsigned int prev = up ? up[0] : 0;
+	for (unsigned int i=0; i< width; i++) {
+		unsigned int v = br.peek32();
+		unsigned int q = (~v) ? __builtin_ctz(~v) : 32;		// unary part: trailing ones
+		unsigned int zz;
+		if (q < FRAMECODEC_ESCAPE) {
+			zz = (q << k) | ((v >> (q+1)) & mask);
+			br.skip(q + 1 + k);
+		}
+		else {
+			zz = (v >> FRAMECODEC_ESCAPE) & 0xFF;
+			br.skip(FRAMECODEC_ESCAPE + 8);
+		}
+		unsigned int pred;
+		if (up==NULL or i==0) pred = (i==0) ? prev : p[(i-1)*STEP];
+		else pred = codec_med(p[(i-1)*STEP], up[i*STEP], up[(i-1)*STEP]);
+		p[i*STEP] = (unsigned char) (pred + ((zz >> 1) ^ -(zz & 1)));
+	}
+}
+
+
+static bool codec_decode_band(const CodecLayout& l, const unsigned char* in, size_t len, unsigned char* dst, unsigned int y0, unsigned int y1) {
+	if (len < 1) return false;
+
+	if (in[0]==FRAMECODEC_BAND_RAW) {
+		const unsigned char* s = in + 1;
+		const unsigned char* end = in + len;
+		for (unsigned int ci=0; ci< l.numComps; ci++) {
+			const CodecComponent& c = l.comps[ci];
+			unsigned int r0, r1;
+			codec_comp_rows(c, y0, y1, r0, r1);
+			for (unsigned int r = r0; r < r1; r++) {
+				if ((size_t) (end - s) < c.width) return false;
+				unsigned char* p = dst + l.planeBase[c.plane] + r*l.planeStride[c.plane] + c.offset;
+				for (unsigned int i=0; i< c.width; i++, p += c.step) *p = *s++;
+			}
+		}
+		return true;
+	}
+	if (in[0]!=FRAMECODEC_BAND_RICE) return false;
+
+	CodecBitReader br;
+	br.in = in + 1;
+	br.end = in + len;
+	br.acc = 0;
+	br.bits = 0;
+	br.consumed = 0;
+	for (unsigned int ci=0; ci< l.numComps; ci++) {
+		const CodecComponent& c = l.comps[ci];
+		unsigned int stride = l.planeStride[c.plane];
+		unsigned int r0, r1;
+		codec_comp_rows(c, y0, y1, r0, r1);
+		for (unsigned int r = r0; r < r1; r++) {
+			unsigned char* p = dst + l.planeBase[c.plane] + r*stride + c.offset;
+			const unsigned char* up = (r==r0) ? NULL : p - stride;
+			switch (c.step) {
+			case (1) : codec_decode_row<1>(br, p, up, c.width); break;
+			case (2) : codec_decode_row<2>(br, p, up, c.width); break;
+			case (3) : codec_decode_row<3>(br, p, up, c.width); break;
+			case (4) : codec_decode_row<4>(br, p, up, c.width); break;
+			default : return false;
+			}
+		}
+	}
+	return br.consumed <= (unsigned long long) (len - 1) * 8;		// else the band was truncated
+}
+
+
+// codes (or decodes) the bands of a picture that start in [y0, y1)
+class CodecBandKernel : public BandKernel {
+public:
+	CodecBandKernel(const CodecLayout& layout, unsigned int bandRows) : mLayout(layout) {
+		mBandRows = bandRows;
+		mEncodeOut = NULL;
+		mCapacity = 0;
+		mLengths = NULL;
+		mData = NULL;
+		mEnds = NULL;
+		mFailed = false;
+	}
+
+	bool band_safe(void) const { return true; }
+
+	void process_band(PixelBuffer* pb, unsigned int y0, unsigned int y1) {
+		unsigned int h = mLayout.height;
+		std::vector<unsigned char> z;					// residuals of a line
+		if (mEncodeOut) {
+			for (unsigned int i=0; i< mLayout.numComps; i++) if (z.size() < mLayout.comps[i].width) z.resize(mLayout.comps[i].width);
+		}
+
+		for (unsigned int b = (y0 + mBandRows - 1) / mBandRows; b*mBandRows < y1; b++) {
+			unsigned int by0 = b*mBandRows;
+			unsigned int by1 = (by0 + mBandRows < h) ? by0 + mBandRows : h;
+			if (mEncodeOut) {
+				mLengths[b] = codec_encode_band(mLayout, (const unsigned char*) pb->buf, by0, by1, mEncodeOut + b*mCapacity, &z[0]);
+			}
+			else {
+				unsigned int begin = b ? mEnds[b-1] : 0;
+				if (!codec_decode_band(mLayout, mData + begin, mEnds[b] - begin, (unsigned char*) pb->buf, by0, by1)) mFailed = true;
+			}
+		}
+	}
+
+	// encoding: band b goes at out + b*capacity, its length in lengths[b]
+	void set_encode(unsigned char* out, size_t capacity, unsigned int* lengths) {
+		mEncodeOut = out;
+		mCapacity = capacity;
+		mLengths = lengths;
+	}
+	// decoding: band payloads start at data, band b ends at data + ends[b]
+	void set_decode(const unsigned char* data, const unsigned int* ends) {
+		mData = data;
+		mEnds = ends;
+	}
+	bool failed(void) const { return mFailed; }
+
+private:
+	CodecLayout mLayout;
+	unsigned int mBandRows;
+	unsigned char* mEncodeOut;
+	size_t mCapacity;
+	unsigned int* mLengths;
+	const unsigned char* mData;
+	const unsigned int* mEnds;
+	volatile bool mFailed;
+};
+
+
+FrameCodec::FrameCodec(FrameExecutor* executor, unsigned int bandRows) {
+	mExecutor = executor;
+	mBandRows = (bandRows + 3) & ~3u;			// multiple of every chroma vertical subsampling
+	if (mBandRows==0) mBandRows = FRAMECODEC_BAND_ROWS;
+}
+
+
+bool FrameCodec::encode(PixelBuffer* pb, std::vector<unsigned char>& out) {
+	CodecLayout l;
+	if (pb==NULL or pb->buf==NULL or !codec_layout(pb->fmt, pb->width, pb->height, pixelbuffer_stride(pb), pb->length, l)) {
+		FRAMECODEC_WARNING("unsupported picture\n");
+		return false;
+	}
+	unsigned int numBands = (pb->height + mBandRows - 1) / mBandRows;
+	size_t capacity = codec_band_capacity(l, mBandRows);
+	mScratch.resize(numBands * capacity);
+	mBandLengths.assign(numBands, 0);
+
+	CodecBandKernel kernel(l, mBandRows);
+	kernel.set_encode(&mScratch[0], capacity, &mBandLengths[0]);
+	if (mExecutor) mExecutor->run(pb, kernel);
+	else kernel.process_band(pb, 0, pb->height);
+
+	size_t total = 0;
+	for (unsigned int b=0; b< numBands; b++) total += mBandLengths[b];
+	size_t headerBytes = sizeof(FrameCodecHeader) + numBands * sizeof(unsigned int);
+	out.resize(headerBytes + total);
+
+	FrameCodecHeader hdr;
+	memset(&hdr, 0, sizeof(FrameCodecHeader));
+	hdr.magic = FRAMECODEC_MAGIC;
+	hdr.version = FRAMECODEC_VERSION;
+	hdr.fmt = pb->fmt;
+	hdr.width = pb->width;
+	hdr.height = pb->height;
+	hdr.stride = pixelbuffer_stride(pb);
+	hdr.length = pb->length;
+	hdr.bandRows = mBandRows;
+	hdr.numBands = numBands;
+	hdr.sec = pb->sec;
+	hdr.usec = pb->usec;
+	memcpy(&out[0], &hdr, sizeof(FrameCodecHeader));
+
+	unsigned int* ends = (unsigned int*) &out[sizeof(FrameCodecHeader)];
+	unsigned char* payload = &out[headerBytes];
+	size_t pos = 0;
+	for (unsigned int b=0; b< numBands; b++) {
+		memcpy(payload + pos, &mScratch[b * capacity], mBandLengths[b]);
+		pos += mBandLengths[b];
+		ends[b] = (unsigned int) pos;
+	}
+	return true;
+}
+
+
+bool frame_codec_read_header(const void* data, size_t len, FrameCodecHeader& hdr) {
+	if (data==NULL or len < sizeof(FrameCodecHeader)) return false;
+	memcpy(&hdr, data, sizeof(FrameCodecHeader));
+	if (hdr.magic!=FRAMECODEC_MAGIC or hdr.version!=FRAMECODEC_VERSION) return false;
+	if (hdr.bandRows==0 or hdr.numBands != (hdr.height + hdr.bandRows - 1) / hdr.bandRows) return false;
+	size_t headerBytes = sizeof(FrameCodecHeader) + (size_t) hdr.numBands * sizeof(unsigned int);
+	if (len < headerBytes) return false;
+	// band ends must grow and stay in the stream
+	const unsigned int* ends = (const unsigned int*) ((const unsigned char*) data + sizeof(FrameCodecHeader));
+	unsigned int prev = 0;
+	for (unsigned int b=0; b< hdr.numBands; b++) {
+		if (ends[b] < prev) return false;
+		prev = ends[b];
+	}
+	return prev <= len - headerBytes;
+}
+
+
+// layout of a stream for dst; sets dst description from the header
+static bool codec_prepare_dst(const FrameCodecHeader& hdr, PixelBuffer* dst, CodecLayout& l) {
+	if (dst==NULL or dst->buf==NULL or dst->length < hdr.length) return false;
+	if (!codec_layout((PixelBufferFormat) hdr.fmt, hdr.width, hdr.height, hdr.stride, hdr.length, l)) return false;
+	dst->fmt = (PixelBufferFormat) hdr.fmt;
+	dst->width = hdr.width;
+	dst->height = hdr.height;
+	dst->stride = hdr.stride;
+	dst->length = hdr.length;
+	dst->sec = hdr.sec;
+	dst->usec = hdr.usec;
+	return true;
+}
+
+
+bool FrameCodec::decode(const void* data, size_t len, PixelBuffer* dst) {
+	FrameCodecHeader hdr;
+	CodecLayout l;
+	if (!frame_codec_read_header(data, len, hdr) or !codec_prepare_dst(hdr, dst, l)) {
+		FRAMECODEC_WARNING("bad stream or destination\n");
+		return false;
+	}
+	const unsigned int* ends = (const unsigned int*) ((const unsigned char*) data + sizeof(FrameCodecHeader));
+	CodecBandKernel kernel(l, hdr.bandRows);
+	kernel.set_decode((const unsigned char*) data + sizeof(FrameCodecHeader) + hdr.numBands * sizeof(unsigned int), ends);
+	if (mExecutor) mExecutor->run(dst, kernel);
+	else kernel.process_band(dst, 0, dst->height);
+	return !kernel.failed();
+}
+
+
+bool frame_codec_decode_band(const void* data, size_t len, unsigned int band, PixelBuffer* dst) {
+	FrameCodecHeader hdr;
+	CodecLayout l;
+	if (!frame_codec_read_header(data, len, hdr) or band >= hdr.numBands or !codec_prepare_dst(hdr, dst, l)) return false;
+	const unsigned int* ends = (const unsigned int*) ((const unsigned char*) data + sizeof(FrameCodecHeader));
+	const unsigned char* payload = (const unsigned char*) data + sizeof(FrameCodecHeader) + hdr.numBands * sizeof(unsigned int);
+	unsigned int begin = band ? ends[band-1] : 0;
+	unsigned int y0 = band * hdr.bandRows;
+	unsigned int y1 = (y0 + hdr.bandRows < hdr.height) ? y0 + hdr.bandRows : hdr.height;
+	return codec_decode_band(l, payload + begin, ends[band] - begin, (unsigned char*) dst->buf, y0, y1);
+}
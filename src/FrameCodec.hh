@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef FrameCodec_HH
+#define FrameCodec_HH
+
+#include <vector>
+#include <stddef.h>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FormatTraits.hh"
+#include "Grabber_Helpers.hh"
+#include "FrameExecutor.hh"
+
+/*
+  Lossless compression of PixelBuffers for recording.
+
+  - the picture is cut in bands of bandRows rows; every band is coded on its own, so bands
+    are coded/decoded in parallel (FrameExecutor) and any band can be decoded alone
+  - inside a band, samples are coded one component at a time (Y, U, V or R, G, B planes are
+    separated even for packed formats like YUYV or RGB3; formats without a known component
+    layout are coded as plain bytes)
+  - each sample is predicted from its neighbours (left on the first row of a band, the LOCO-I
+    median of left, above and upper-left on the others) and the residual is Rice coded with a
+    parameter chosen per row
+  - a band that doesn't get smaller is stored raw: the stream is never much bigger than the picture
+
+  Stream layout (host byte order):
+  +------------------+---------------------------+--------+--------+-----+
+  | FrameCodecHeader | band end offsets (u32 * n) | band 0 | band 1 | ... |
+  +------------------+---------------------------+--------+--------+-----+
+  Padding bytes at the end of lines (stride larger than the line) are not stored.
+*/
+
+#define FRAMECODEC_MAGIC	((unsigned int) 0x63644346)	// 'FCdc'
+#define FRAMECODEC_VERSION	((unsigned int) 1)
+
+// rows per band (a multiple of every chroma vertical subsampling)
+#define FRAMECODEC_BAND_ROWS	32
+
+// FrameCodec logging helpers
+#define FRAMECODEC_WARNING_PREFIX	(" * WARNING - frame_codec - ")
+
+// Used to be implemented using ACE helpers - need to switch to something else
+#define FRAMECODEC_WARNING(x) {}
+
+
+struct FrameCodecHeader {
+	unsigned int magic;		// FRAMECODEC_MAGIC
+	unsigned int version;		// FRAMECODEC_VERSION
+	unsigned int fmt;		// PixelBufferFormat
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;		// stride of the coded picture (decoded pictures get the same)
+	unsigned int length;		// length of the coded picture
+	unsigned int bandRows;
+	unsigned int numBands;
+	unsigned int reserved;
+	long long sec;			// timestamp
+	long long usec;
+};
+
+
+class FrameCodec {
+public:
+	// executor: bands are coded on its threads (NULL: by the caller only)
+	FrameCodec(FrameExecutor* executor = NULL, unsigned int bandRows = FRAMECODEC_BAND_ROWS);
+
+	// replace out with the coded picture; false for unknown formats or short buffers
+	bool encode(PixelBuffer* pb, std::vector<unsigned char>& out);
+
+	// decode a whole stream in dst: dst->buf must hold at least FrameCodecHeader::length bytes
+	// (see frame_codec_read_header()); dst description and timestamp are set from the stream
+	bool decode(const void* data, size_t len, PixelBuffer* dst);
+
+private:
+	FrameExecutor* mExecutor;
+	unsigned int mBandRows;
+
+	std::vector<unsigned char> mScratch;	// one fixed size area per band while encoding
+	std::vector<unsigned int> mBandLengths;
+};
+
+
+// check a stream and read its header
+bool frame_codec_read_header (const void* data, size_t len, FrameCodecHeader& hdr);
+
+// decode only band b (rows [b*bandRows, (b+1)*bandRows) ) of a stream in dst
+// dst must already describe the picture (ie. after frame_codec_read_header())
+bool frame_codec_decode_band (const void* data, size_t len, unsigned int band, PixelBuffer* dst);
+
+#endif /*FrameCodec_HH*/
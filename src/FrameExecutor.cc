@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include "FrameExecutor.hh"
+
+static inline unsigned long long band_range(unsigned int begin, unsigned int end) {
+	return ((unsigned long long) end << 32) | begin;
+}
+
+static inline unsigned int band_range_begin(unsigned long long r) { return (unsigned int) (r & 0xFFFFFFFFULL); }
+static inline unsigned int band_range_end(unsigned long long r) { return (unsigned int) (r >> 32); }
+
+
+FrameExecutor::FrameExecutor(unsigned int numThreads, const std::vector<int>& cpus, unsigned int bandBytes) {
+	mNumThreads = numThreads;
+	mCpus = cpus;
+	mBandBytes = bandBytes ? bandBytes : FRAME_EXECUTOR_BAND_BYTES;
+	mStarted = false;
+	mGeneration = 0;
+	mQuit = false;
+	mActive = 0;
+	mJobPb = NULL;
+	mJobKernel = NULL;
+	mJobBandRows = 0;
+	mBandsLeft = 0;
+	pthread_mutex_init(&mLock, NULL);
+	pthread_cond_init(&mWake, NULL);
+	pthread_cond_init(&mDone, NULL);
+
+	for (unsigned int i=0; i<= mNumThreads; i++) {
+		WorkerSlot* slot = new WorkerSlot();
+		slot->range = band_range(0, 0);
+		slot->owner = this;
+		slot->index = i;
+		mSlots.push_back(slot);
+	}
+}
+
+
+FrameExecutor::~FrameExecutor() {
+	internal_stop();
+	for (unsigned int i=0; i< mSlots.size(); i++) delete mSlots[i];
+	mSlots.clear();
+	pthread_cond_destroy(&mDone);
+	pthread_cond_destroy(&mWake);
+	pthread_mutex_destroy(&mLock);
+}
+
+
+bool FrameExecutor::init(void) {
+	if (mStarted) return true;
+	mQuit = false;
+	for (unsigned int i=0; i< mNumThreads; i++) {
+		mSlots[i]->generation = mGeneration;		// a job posted before the thread runs must not be missed
+		if (pthread_create(&mSlots[i]->thread, NULL, worker_main, mSlots[i])!=0) {
+			mNumThreads = i;				// join the ones we got
+			mStarted = true;
+			internal_stop();
+			return false;
+		}
+		if (mCpus.size()) {
+			std::vector<int> cpu(1, mCpus[i % mCpus.size()]);
+			grabber_thread_set_affinity(mSlots[i]->thread, cpu);
+		}
+		grabber_thread_set_name(mSlots[i]->thread, "frame-exec");
+	}
+	mStarted = true;
+	return true;
+}
+
+
+void FrameExecutor::internal_stop(void) {
+	pthread_mutex_lock(&mLock);
+	mQuit = true;
+	pthread_cond_broadcast(&mWake);
+	pthread_mutex_unlock(&mLock);
+	if (mStarted) {
+		for (unsigned int i=0; i< mNumThreads; i++) pthread_join(mSlots[i]->thread, NULL);
+	}
+	mStarted = false;
+}
+
+
+unsigned int FrameExecutor::get_band_rows(const PixelBuffer* pb) const {
+	unsigned int align = 1;
+	const PixelFormatInfo* info = pixel_format_info(pb->fmt);
+	if (info) align = 1u << info->chromaVShift;		// a band never splits a chroma row
+
+	unsigned int stride = pixelbuffer_stride(pb);
+	unsigned int rows = stride ? mBandBytes / stride : pb->height;
+	rows -= rows % align;
+	if (rows < align) rows = align;
+	return rows;
+}
+
+
+void FrameExecutor::run(PixelBuffer* pb, BandKernel& kernel) {
+	if (pb==NULL or pb->height==0) return;
+	if (!mStarted or mNumThreads==0 or !kernel.band_safe()) {
+		kernel.process_band(pb, 0, pb->height);
+		return;
+	}
+
+	unsigned int rows = get_band_rows(pb);
+	unsigned int numBands = (pb->height + rows - 1) / rows;
+	if (numBands < 2) {
+		kernel.process_band(pb, 0, pb->height);
+		return;
+	}
+
+	// contiguous shares: neighbouring bands stay on the same core as long as nobody steals
+	unsigned int numSlots = mNumThreads + 1;
+	for (unsigned int i=0; i< numSlots; i++) {
+		unsigned int b = (unsigned int) (((unsigned long long) numBands * i) / numSlots);
+		unsigned int e = (unsigned int) (((unsigned long long) numBands * (i+1)) / numSlots);
+		mSlots[i]->range = band_range(b, e);
+	}
+
+	pthread_mutex_lock(&mLock);
+	mJobPb = pb;
+	mJobKernel = &kernel;
+	mJobBandRows = rows;
+	mBandsLeft = numBands;
+	mActive = mNumThreads;
+	mGeneration++;
+	pthread_cond_broadcast(&mWake);
+	pthread_mutex_unlock(&mLock);
+
+	internal_work(mNumThreads);					// the caller uses the last slot
+
+	// wait for the last bands and for every worker to leave the job
+	pthread_mutex_lock(&mLock);
+	while (mBandsLeft!=0 or mActive!=0) pthread_cond_wait(&mDone, &mLock);
+	mJobPb = NULL;
+	mJobKernel = NULL;
+	pthread_mutex_unlock(&mLock);
+}
+
+
+void* FrameExecutor::worker_main(void* arg) {
+	WorkerSlot* slot = (WorkerSlot*) arg;
+	FrameExecutor* ex = slot->owner;
+	unsigned int seen = slot->generation;
+
+	pthread_mutex_lock(&ex->mLock);
+	while (true) {
+		while (!ex->mQuit and ex->mGeneration==seen) pthread_cond_wait(&ex->mWake, &ex->mLock);
+		if (ex->mQuit) break;
+		seen = ex->mGeneration;
+		pthread_mutex_unlock(&ex->mLock);
+
+		ex->internal_work(slot->index);
+
+		pthread_mutex_lock(&ex->mLock);
+		ex->mActive--;
+		if (ex->mActive==0) pthread_cond_signal(&ex->mDone);
+	}
+	pthread_mutex_unlock(&ex->mLock);
+	return NULL;
+}
+
+
+void FrameExecutor::internal_work(unsigned int self) {
+	unsigned int band;
+	while (internal_pop(self, band) or internal_steal(self, band)) {
+		unsigned int y0 = band * mJobBandRows;
+		unsigned int y1 = y0 + mJobBandRows;
+		if (y1 > mJobPb->height) y1 = mJobPb->height;
+		mJobKernel->process_band(mJobPb, y0, y1);
+
+		if (__sync_sub_and_fetch(&mBandsLeft, 1)==0) {
+			pthread_mutex_lock(&mLock);
+			pthread_cond_signal(&mDone);
+			pthread_mutex_unlock(&mLock);
+		}
+	}
+}
+
+
+bool FrameExecutor::internal_pop(unsigned int self, unsigned int& band) {
+	WorkerSlot* slot = mSlots[self];
+	while (true) {
+		unsigned long long r = slot->range;
+		unsigned int b = band_range_begin(r), e = band_range_end(r);
+		if (b >= e) return false;
+		if (__sync_bool_compare_and_swap(&slot->range, r, band_range(b+1, e))) {
+			band = b;
+			return true;
+		}
+	}
+}
+
+
+bool FrameExecutor::internal_steal(unsigned int self, unsigned int& band) {
+	unsigned int numSlots = mSlots.size();
+	for (unsigned int k=1; k< numSlots; k++) {
+		WorkerSlot* victim = mSlots[(self + k) % numSlots];
+		while (true) {
+			unsigned long long r = victim->range;
+			unsigned int b = band_range_begin(r), e = band_range_end(r);
+			if (b >= e) break;						// nothing to steal here
+			unsigned int take = (e - b + 1) / 2;			// the back half
+			unsigned int newEnd = e - take;
+			if (__sync_bool_compare_and_swap(&victim->range, r, band_range(b, newEnd))) {
+				// keep the first stolen band, the rest becomes our range (others may steal it back)
+				__atomic_store_n(&mSlots[self]->range, band_range(newEnd + 1, e), __ATOMIC_SEQ_CST);
+				band = newEnd;
+				return true;
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#ifndef FrameExecutor_HH
+#define FrameExecutor_HH
+
+#include <pthread.h>
+#include <vector>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FormatTraits.hh"
+#include "Grabber_Helpers.hh"
+#include "ThreadHelpers.hh"
+
+// default size of a band of rows: about the L2 share of one core
+#define FRAME_EXECUTOR_BAND_BYTES (256*1024)
+
+
+// a per-picture operation that can be split in bands of rows
+class BandKernel {
+public:
+	virtual ~BandKernel() {}
+
+	// true when process_band() can run at the same time on disjoint row ranges of a picture
+	// (kernels that aren't band-safe always get the whole picture in a single call)
+	virtual bool band_safe(void) const { return false; }
+
+	// process rows [y0, y1) of pb (y0 and y1 are multiples of the chroma vertical subsampling)
+	virtual void process_band(PixelBuffer* pb, unsigned int y0, unsigned int y1) = 0;
+};
+
+
+/*
+  Runs a BandKernel over a picture on a set of worker threads.
+  The picture is cut in bands of about bandBytes (using pb->stride and the format's chroma
+  subsampling so that bands never share a chroma row); every thread starts with a contiguous
+  share of the bands and, when done with it, steals half of the remaining bands of another
+  thread. The calling thread works too: run() returns when every band was processed.
+*/
+class FrameExecutor {
+public:
+	// numThreads workers besides the caller of run() (0: run() does everything itself)
+	// cpus: workers are pinned round robin to these cpus (empty: no pinning)
+	FrameExecutor(unsigned int numThreads, const std::vector<int>& cpus = std::vector<int>(),
+		      unsigned int bandBytes = FRAME_EXECUTOR_BAND_BYTES);
+	~FrameExecutor();
+
+	// start worker threads; returns false if they couldn't be created
+	bool init(void);
+
+	// process the whole picture with kernel; not reentrant (one run() at a time)
+	void run(PixelBuffer* pb, BandKernel& kernel);
+
+	unsigned int get_num_threads(void) const { return mNumThreads; }
+
+	// rows per band that run() would use for pb
+	unsigned int get_band_rows(const PixelBuffer* pb) const;
+
+private:
+	struct WorkerSlot {
+		volatile unsigned long long range;	// bands [low 32 bits, high 32 bits) still to do
+		pthread_t thread;
+		FrameExecutor* owner;
+		unsigned int index;
+		unsigned int generation;		// last job seen by the worker
+		char pad[64];				// keep ranges of different threads on different cache lines
+	};
+
+	static void* worker_main(void* arg);
+	void internal_work(unsigned int self);
+	bool internal_pop(unsigned int self, unsigned int& band);
+	bool internal_steal(unsigned int self, unsigned int& band);
+	void internal_stop(void);
+
+	unsigned int mNumThreads;
+	std::vector<int> mCpus;
+	unsigned int mBandBytes;
+
+	std::vector<WorkerSlot*> mSlots;	// mNumThreads workers + 1 for the caller of run()
+	bool mStarted;
+
+	pthread_mutex_t mLock;
+	pthread_cond_t mWake;			// workers wait here for a new job
+	pthread_cond_t mDone;			// run() waits here for the end of a job
+	unsigned int mGeneration;		// bumped at every job
+	bool mQuit;
+	unsigned int mActive;			// workers still inside the current job
+
+	// current job
+	PixelBuffer* mJobPb;
+	BandKernel* mJobKernel;
+	unsigned int mJobBandRows;
+	volatile unsigned int mBandsLeft;
+};
+
+#endif /*FrameExecutor_HH*/
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "FrameIntegrity.hh"
+
+#include <string.h>
+
+#include "Grabber_Helpers.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define FRAME_INTEGRITY_X86
+#endif
+
+// a row is constant when it repeats itself every FRAME_INTEGRITY_PERIOD bytes:
+// 12 covers pixels of 1, 2, 3 and 4 bytes and the YUYV/UYVY macropixel
+#define FRAME_INTEGRITY_PERIOD 12
+
+
+// reflected 0x1EDC6F41, eight bytes at a time (table k: a byte followed by k zero bytes)
+static unsigned int crc32c_table[8][256];
+
+static void crc32c_init_table(void) {
+	for (unsigned int i=0; i< 256; i++) {
+		unsigned int c = i;
+		for (unsigned int k=0; k< 8; k++) c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+		crc32c_table[0][i] = c;
+	}
+	for (unsigned int i=0; i< 256; i++) {
+		for (unsigned int k=1; k< 8; k++) crc32c_table[k][i] = (crc32c_table[k-1][i] >> 8) ^ crc32c_table[0][crc32c_table[k-1][i] & 0xFF];
+	}
+}
+
+
+static unsigned int crc32c_sw(unsigned int crc, const unsigned char* p, size_t len) {
+	for (; len >= 8; len -= 8, p += 8) {
+		unsigned int lo, hi;
+		memcpy(&lo, p, 4);					// little endian
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+		crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+		      crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+		      crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+		      crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+	}
+	for (; len > 0; len--, p++) crc = crc32c_table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+
+#if defined(FRAME_INTEGRITY_X86)
+// the crc32 instruction (SSE4.2), built whatever the -m flags and only called when the cpu has it
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_hw(unsigned int crc, const unsigned char* p, size_t len) {
+#if defined(__x86_64__)
+	unsigned long long c = crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		unsigned long long v;
+		memcpy(&v, p, 8);
+		c = _mm_crc32_u64(c, v);
+	}
+	crc = (unsigned int) c;
+#endif
+	for (; len >= 4; len -= 4, p += 4) {
+		unsigned int v;
+		memcpy(&v, p, 4);
+		crc = _mm_crc32_u32(crc, v);
+	}
+	for (; len > 0; len--, p++) crc = _mm_crc32_u8(crc, *p);
+	return crc;
+}
+#endif
+
+
+// 0: not chosen yet, 1: tables, 2: crc32 instruction
+// (whoever gets here first makes the same choice: no lock needed)
+static volatile int crc32c_impl = 0;
+
+unsigned int crc32c(unsigned int crc, const void* data, size_t len) {
+	if (crc32c_impl==0) {
+		crc32c_init_table();
+		int impl = 1;
+#if defined(FRAME_INTEGRITY_X86)
+		if (__builtin_cpu_supports("sse4.2")) impl = 2;
+#endif
+		__atomic_store_n(&crc32c_impl, impl, __ATOMIC_RELEASE);
+	}
+	const unsigned char* p = (const unsigned char*) data;
+#if defined(FRAME_INTEGRITY_X86)
+	if (crc32c_impl==2) return ~crc32c_hw(~crc, p, len);
+#endif
+	return ~crc32c_sw(~crc, p, len);
+}
+
+
+FrameIntegrity::FrameIntegrity(unsigned int rowStep) {
+	mRowStep = rowStep ? rowStep : 1;
+	reset();
+}
+
+
+void FrameIntegrity::reset(void) {
+	mHavePrevious = false;
+	mPreviousHash = 0;
+	mPreviousLength = 0;
+	mRepeatRun = 0;
+}
+
+
+unsigned int FrameIntegrity::check(const PixelBuffer* pb, unsigned int& hash) {
+	unsigned int issues = 0;
+	hash = 0;
+	PixelPlane planes[3];
+	unsigned int numPlanes = (pb->buf!=NULL) ? pixelbuffer_planes(pb, planes) : 0;
+	if (numPlanes==0) return 0;						// nothing we know how to look at
+
+	// the driver says how much it wrote; the format says how much it should have
+	const PixelPlane& last = planes[numPlanes - 1];
+	unsigned int expected = last.offset + last.stride * (last.rows - 1) + last.lineBytes;
+	if ((pb->meta.valid & FRAME_META_DRIVER) and pb->meta.bytesused!=0 and pb->meta.bytesused < expected) issues |= FRAME_INTEGRITY_SHORT;
+
+	const unsigned char* base = (const unsigned char*) pb->buf;
+	const PixelPlane& y = planes[0];
+	unsigned int period = (y.lineBytes >= 2 * FRAME_INTEGRITY_PERIOD) ? FRAME_INTEGRITY_PERIOD : 0;
+	bool constant = (period!=0);
+	const unsigned char* first = base;
+	unsigned int crc = 0;
+	unsigned int hashed = 0;
+	for (unsigned int row=0; row< y.rows; row += mRowStep) {
+		const unsigned char* line = base + row * y.stride;
+		crc = crc32c(crc, line, y.lineBytes);
+		hashed += y.lineBytes;
+		// constant: the line repeats its first period bytes, which are those of the first line
+		if (constant and (memcmp(line, line + period, y.lineBytes - period)!=0 or memcmp(line, first, period)!=0)) constant = false;
+	}
+	hash = crc;
+	if (constant) issues |= FRAME_INTEGRITY_CONSTANT;
+
+	// a constant picture repeats by nature: only a varying one stuck in place is a stall
+	if (!constant and mHavePrevious and hashed==mPreviousLength and crc==mPreviousHash) {
+		issues |= FRAME_INTEGRITY_REPEATED;
+		mRepeatRun++;
+	}
+	else mRepeatRun = 0;
+	mHavePrevious = true;
+	mPreviousHash = crc;
+	mPreviousLength = hashed;
+	return issues;
+}
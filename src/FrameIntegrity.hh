@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef FrameIntegrity_HH
+#define FrameIntegrity_HH
+
+#include <stddef.h>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+
+/*
+  FrameIntegrity catches pictures a wedged or flaky device hands out as good ones:
+  - repeated: same content as the previous picture (the camera keeps returning one buffer
+    with advancing timestamps)
+  - constant: every sampled row holds one pixel value (all black, all green...)
+  - short: the driver filled less than the format needs (FrameMetadata::bytesused)
+  It looks at every rowStep-th row of plane 0 only: a CRC32C of those rows (the SSE4.2 crc32
+  instruction when the cpu has it) stands for the picture, so a repeat changing only unsampled rows goes unnoticed.
+*/
+
+// FrameMetadata::integrity flags
+#define FRAME_INTEGRITY_REPEATED	((unsigned int) 1 )
+#define FRAME_INTEGRITY_CONSTANT	((unsigned int) 1 << 1 )
+#define FRAME_INTEGRITY_SHORT		((unsigned int) 1 << 2 )
+
+// default rows between two sampled rows
+#define FRAME_INTEGRITY_ROW_STEP 8
+
+// CRC32C (Castagnoli) of len bytes at data, continuing crc (0 to start)
+unsigned int crc32c(unsigned int crc, const void* data, size_t len);
+
+class FrameIntegrity {
+public:
+	FrameIntegrity(unsigned int rowStep = FRAME_INTEGRITY_ROW_STEP);
+
+	// FRAME_INTEGRITY_* issues of pb (0 when it looks fine); hash gets the CRC32C of its sampled rows
+	unsigned int check(const PixelBuffer* pb, unsigned int& hash);
+
+	// consecutive repeated pictures up to the last check() (a stall when it keeps growing)
+	unsigned int get_repeat_run(void) const { return mRepeatRun; }
+
+	// forget the previous picture (ie. after a format change)
+	void reset(void);
+
+private:
+	unsigned int mRowStep;
+	bool mHavePrevious;
+	unsigned int mPreviousHash;
+	unsigned int mPreviousLength;		// bytes hashed, so that a format change isn't a repeat
+	unsigned int mRepeatRun;
+};
+
+#endif /*FrameIntegrity_HH*/
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "FrameMailbox.hh"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAMEMAILBOX_INDEX_MASK	((unsigned int) 3)
+#define FRAMEMAILBOX_FRESH	((unsigned int) 1 << 2)
+
+
+FrameMailbox::FrameMailbox() {
+	unsigned int mMaxWidth = 0;		// used by PIXELBUFFERCLEARSTRUCT
+	unsigned int mMaxHeight = 0;
+	for (unsigned int i=0; i<3; i++) {
+		PixelBuffer* pb = &mSlots[i];
+		PIXELBUFFERCLEARSTRUCT(pb);
+		mCapacity[i] = 0;
+	}
+	mWrite = 0;
+	mMiddle = 1;
+	mRead = 2;
+	mHaveRead = false;
+	mPublished = 0;
+	mOverwritten = 0;
+}
+
+
+FrameMailbox::~FrameMailbox() {
+	for (unsigned int i=0; i<3; i++) {
+		if (mSlots[i].buf!=NULL) free(mSlots[i].buf);
+	}
+}
+
+
+bool FrameMailbox::internal_copy(unsigned int slot, const PixelBuffer* pb) {
+	PixelBuffer* dst = &mSlots[slot];
+	if (mCapacity[slot] < pb->length) {
+		// the consumer never touches the producer slot: it can be reallocated here
+		void* buf = realloc(dst->buf, pb->length);
+		if (buf==NULL) return false;
+		dst->buf = buf;
+		mCapacity[slot] = pb->length;
+	}
+	memcpy(dst->buf, pb->buf, pb->length);
+	dst->length = pb->length;
+	dst->width = pb->width;
+	dst->height = pb->height;
+	dst->stride = pb->stride;
+	dst->fmt = pb->fmt;
+	dst->sec = pb->sec;
+	dst->usec = pb->usec;
+	dst->meta = pb->meta;
+	dst->meta.valid &= ~FRAME_META_STREAM;		// the metadata stream buffer belongs to the grabber
+	dst->meta.stream = NULL;
+	dst->meta.streamLength = 0;
+	dst->locks = 0;
+	return true;
+}
+
+
+bool FrameMailbox::publish(const PixelBuffer* pb) {
+	if (pb==NULL or pb->buf==NULL) return false;
+	if (!internal_copy(mWrite, pb)) return false;
+
+	// release: the picture must be visible before the slot becomes the middle one
+	unsigned int old = __atomic_exchange_n(&mMiddle, mWrite | FRAMEMAILBOX_FRESH, __ATOMIC_ACQ_REL);
+	if (old & FRAMEMAILBOX_FRESH) __atomic_add_fetch(&mOverwritten, 1, __ATOMIC_RELAXED);
+	mWrite = old & FRAMEMAILBOX_INDEX_MASK;
+	__atomic_add_fetch(&mPublished, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+
+void FrameMailbox::frame_grabbed(PixelBuffer* pb) {
+	publish(pb);
+}
+
+
+const PixelBuffer* FrameMailbox::get_latest(bool* isNew) {
+	bool fresh = false;
+	if (__atomic_load_n(&mMiddle, __ATOMIC_RELAXED) & FRAMEMAILBOX_FRESH) {
+		// acquire: pairs with the producer's exchange
+		unsigned int old = __atomic_exchange_n(&mMiddle, mRead, __ATOMIC_ACQ_REL);
+		mRead = old & FRAMEMAILBOX_INDEX_MASK;
+		mHaveRead = true;
+		fresh = true;
+	}
+	if (isNew) *isNew = fresh;
+	if (!mHaveRead) return NULL;
+	return &mSlots[mRead];
+}
+
+
+unsigned long long FrameMailbox::get_published(void) const {
+	return __atomic_load_n(&mPublished, __ATOMIC_RELAXED);
+}
+
+
+unsigned long long FrameMailbox::get_overwritten(void) const {
+	return __atomic_load_n(&mOverwritten, __ATOMIC_RELAXED);
+}
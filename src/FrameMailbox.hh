@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef FrameMailbox_HH
+#define FrameMailbox_HH
+
+#include "PixelBuffer.hh"
+#include "FrameSink.hh"
+
+/*
+  FrameMailbox keeps the newest grabbed picture for a consumer that only ever wants the
+  latest one (preview, UI...) without holding grabber buffers while it works on it.
+
+  Pictures are copied in three slots owned by the mailbox (a triple buffer):
+  - the producer (the thread running grab()) writes its slot, then swaps it with the middle one
+  - the consumer swaps its slot with the middle one only when the middle one holds a newer picture
+  Both swaps are a single atomic exchange: neither side ever waits for the other, the consumer
+  never sees a half written picture and the producer overwrites pictures nobody read yet.
+
+  One producer and one consumer thread; for more consumers use one mailbox each.
+*/
+
+class FrameMailbox : public FrameSink {
+public:
+	FrameMailbox();
+	~FrameMailbox();
+
+	// producer: copy pb in the mailbox
+	// returns false when memory for the picture couldn't be allocated
+	bool publish(const PixelBuffer* pb);
+
+	// FrameSink: publish every grabbed picture
+	void frame_grabbed(PixelBuffer* pb);
+
+	// consumer: returns the newest picture (NULL before the first one)
+	// the PixelBuffer belongs to the mailbox and stays unchanged until the next get_latest()
+	// isNew (when not NULL) tells if it wasn't returned before
+	const PixelBuffer* get_latest(bool* isNew = NULL);
+
+	unsigned long long get_published(void) const;
+	// pictures overwritten before the consumer took them
+	unsigned long long get_overwritten(void) const;
+
+private:
+	// copy pb in slot, growing its memory if needed
+	bool internal_copy(unsigned int slot, const PixelBuffer* pb);
+
+	PixelBuffer mSlots[3];
+	size_t mCapacity[3];		// bytes allocated for mSlots[i].buf
+
+	// slot index of the middle buffer (bits 0-1) | FRAMEMAILBOX_FRESH when it wasn't taken yet
+	volatile unsigned int mMiddle;
+	unsigned int mWrite;		// producer slot (producer only)
+	unsigned int mRead;		// consumer slot (consumer only)
+	bool mHaveRead;			// consumer got at least one picture
+
+	volatile unsigned long long mPublished;
+	volatile unsigned long long mOverwritten;
+};
+
+#endif /*FrameMailbox_HH*/
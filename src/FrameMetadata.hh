@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef FrameMetadata_HH
+#define FrameMetadata_HH
+
+#include "GrabberControlData.hh"
+
+// what a FrameMetadata holds (FrameMetadata::valid)
+#define FRAME_META_DRIVER	((unsigned int) 1 )		// sequence, flags, field and bytesused come from the driver
+#define FRAME_META_TIMECODE	((unsigned int) 1 << 1 )	// tc* hold the driver timecode
+#define FRAME_META_STREAM	((unsigned int) 1 << 2 )	// stream points to the metadata stream buffer of the frame
+#define FRAME_META_CLOCK	((unsigned int) 1 << 3 )	// clockNs holds the timestamp in GrabberInitData::correctedClock
+#define FRAME_META_INTEGRITY	((unsigned int) 1 << 4 )	// integrity and hash were computed (GrabberInitData::integrityRowStep)
+#define FRAME_META_CHANGE	((unsigned int) 1 << 5 )	// changedTiles was computed by a ChangeGate
+
+// per frame metadata, filled by the grabber together with the pixels (PixelBuffer::meta)
+struct FrameMetadata {
+	unsigned int valid;		// FRAME_META_* flags
+
+	unsigned long long frame;	// frame number counted by the grabber from the first grab, dropped frames included
+
+	// driver data (v4l2_buffer)
+	unsigned int sequence;
+	unsigned int flags;		// V4L2_BUF_FLAG_*
+	unsigned int field;		// v4l2_field
+	unsigned int bytesused;
+
+	unsigned int tcType;		// V4L2_TC_TYPE_*
+	unsigned int tcFlags;
+	unsigned char tcFrames;
+	unsigned char tcSeconds;
+	unsigned char tcMinutes;
+	unsigned char tcHours;
+
+	// controls in effect when the frame was exposed (see Grabber::set_ctrl_latency())
+	unsigned int ctrlValid;		// bit (1 << GrabberControlID) is set when ctrl[GrabberControlID] is known
+	int ctrl[GRABBER_CTRL_NONE];
+
+	// buffer of the driver metadata stream (V4L2_BUF_TYPE_META_CAPTURE) nearest to this frame
+	// owned by the grabber, valid as long as the PixelBuffer
+	const void* stream;
+	unsigned int streamLength;
+
+	// driver timestamp in a common clock (see ClockCorrelator.hh): true time is clockNs +- clockUncertaintyNs
+	long long clockNs;
+	unsigned long long clockUncertaintyNs;
+
+	// FRAME_INTEGRITY_* issues of the picture and CRC32C of its sampled rows (see FrameIntegrity.hh)
+	unsigned int integrity;
+	unsigned int hash;
+
+	// tiles that changed since the reference of a ChangeGate (0: static picture, see ChangeGate.hh)
+	unsigned int changedTiles;
+};
+
+// reset a FrameMetadata passed as ptr x
+#define FRAMEMETADATACLEARSTRUCT(x) x->valid = 0;	\
+	x->frame = 0;					\
+	x->sequence = 0;				\
+	x->flags = 0;					\
+	x->field = 0;					\
+	x->bytesused = 0;				\
+	x->ctrlValid = 0;				\
+	x->stream = NULL;				\
+	x->streamLength = 0;				\
+	x->clockNs = 0;					\
+	x->clockUncertaintyNs = 0;			\
+	x->integrity = 0;				\
+	x->hash = 0;					\
+	x->changedTiles = 0;
+
+#endif /*FrameMetadata_HH*/
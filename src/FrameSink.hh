@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#ifndef FrameSink_HH
+#define FrameSink_HH
+
+#include "PixelBuffer.hh"
+
+// A FrameSink receives every PixelBuffer a Grabber fills, right after the grab and
+// before the buffer can be handed out by get_last_grabbed().
+// Sinks are called from the thread that runs grab(), in the order they were added;
+// they must not keep the PixelBuffer* (the grabber requeues it on the next grab()):
+// whatever is needed after frame_grabbed() returns has to be copied, or the buffer locked.
+class FrameSink {
+public:
+	virtual ~FrameSink() {}
+
+	virtual void frame_grabbed(PixelBuffer* pb) = 0;
+
+	// the grabber found every buffer locked: sinks that keep pictures locked give back whatever
+	// they are done with, so that grabbing doesn't wait for a frame_grabbed() that can't come
+	virtual void buffers_exhausted(void) {}
+};
+
+#endif /*FrameSink_HH*/
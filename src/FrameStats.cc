@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "FrameStats.hh"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// channel of every byte of a line, repeating every period bytes (-1: not counted)
+struct StatsPattern {
+	unsigned int period;
+	int channel[4];
+	unsigned int histOffset;	// first luma (green) byte of the line and bytes between two of them
+	unsigned int histStep;		// (histStep 0: no histogram samples on this line)
+};
+
+
+static void stats_set(StatsPattern& p, unsigned int period, int c0, int c1, int c2, int c3,
+		      unsigned int histOffset, unsigned int histStep) {
+	p.period = period;
+	p.channel[0] = c0;
+	p.channel[1] = c1;
+	p.channel[2] = c2;
+	p.channel[3] = c3;
+	p.histOffset = histOffset;
+	p.histStep = histStep;
+}
+
+
+// layout of a line of plane of fmt (odd: the line is odd, for Bayer pictures)
+static bool stats_pattern(PixelBufferFormat fmt, unsigned int plane, bool odd, StatsPattern& p) {
+	const int Y = FRAMESTATS_Y, U = FRAMESTATS_U, V = FRAMESTATS_V;
+	const int R = FRAMESTATS_R, G = FRAMESTATS_G, B = FRAMESTATS_B;
+	switch (fmt) {
+	case (PIXELBUFFER_FMT_GREY) : stats_set(p, 1, Y, -1, -1, -1, 0, 1); return true;
+	case (PIXELBUFFER_FMT_YUYV) : stats_set(p, 4, Y, U, Y, V, 0, 2); return true;
+	case (PIXELBUFFER_FMT_UYVY) : stats_set(p, 4, U, Y, V, Y, 1, 2); return true;
+	case (PIXELBUFFER_FMT_YU12) :
+	case (PIXELBUFFER_FMT_YUV9) :
+	case (PIXELBUFFER_FMT_422P) :
+	case (PIXELBUFFER_FMT_411P) :
+		if (plane==0) stats_set(p, 1, Y, -1, -1, -1, 0, 1);
+		else stats_set(p, 1, (plane==1) ? U : V, -1, -1, -1, 0, 0);
+		return true;
+	case (PIXELBUFFER_FMT_YV12) :
+	case (PIXELBUFFER_FMT_YVU9) :
+		if (plane==0) stats_set(p, 1, Y, -1, -1, -1, 0, 1);
+		else stats_set(p, 1, (plane==1) ? V : U, -1, -1, -1, 0, 0);
+		return true;
+	case (PIXELBUFFER_FMT_NV12) :
+		if (plane==0) stats_set(p, 1, Y, -1, -1, -1, 0, 1);
+		else stats_set(p, 2, U, V, -1, -1, 0, 0);
+		return true;
+	case (PIXELBUFFER_FMT_NV21) :
+		if (plane==0) stats_set(p, 1, Y, -1, -1, -1, 0, 1);
+		else stats_set(p, 2, V, U, -1, -1, 0, 0);
+		return true;
+	case (PIXELBUFFER_FMT_BA81) :					// BGGR
+		if (!odd) stats_set(p, 2, B, G, -1, -1, 1, 2);
+		else stats_set(p, 2, G, R, -1, -1, 0, 2);
+		return true;
+	case (PIXELBUFFER_FMT_RGB3) : stats_set(p, 3, R, G, B, -1, 1, 3); return true;
+	case (PIXELBUFFER_FMT_BGR3) : stats_set(p, 3, B, G, R, -1, 1, 3); return true;
+	case (PIXELBUFFER_FMT_RGB4) : stats_set(p, 4, -1, R, G, B, 2, 4); return true;
+	case (PIXELBUFFER_FMT_BGR4) : stats_set(p, 4, B, G, R, -1, 1, 4); return true;
+	default : return false;
+	}
+}
+
+
+bool frame_stats_supported(PixelBufferFormat fmt) {
+	StatsPattern p;
+	return stats_pattern(fmt, 0, false, p);
+}
+
+
+// sums[j] += bytes j, j+period, j+2*period... of line[0, n)
+static void stats_sum_line(const unsigned char* line, unsigned int n, unsigned int period, unsigned long long sums[4]) {
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	// blocks of 16 bytes (48 for 3 bytes pixels: the pattern repeats every 3 registers)
+	const unsigned int regs = (period==3) ? 3 : 1;
+	__m128i masks[3][4];
+	__m128i acc[4];
+	const __m128i zero = _mm_setzero_si128();
+	for (unsigned int j=0; j< period; j++) {
+		for (unsigned int r=0; r< regs; r++) {
+			unsigned char m[16];
+			for (unsigned int k=0; k< 16; k++) m[k] = ((r * 16 + k) % period == j) ? 0xFF : 0;
+			masks[r][j] = _mm_loadu_si128((const __m128i*) m);
+		}
+		acc[j] = zero;
+	}
+	// psadbw of 16 bytes against 0 adds them in two 64 bit halves: no overflow on any line
+	for (; i + 16 * regs <= n; i += 16 * regs) {
+		for (unsigned int r=0; r< regs; r++) {
+			__m128i v = _mm_loadu_si128((const __m128i*) (line + i + 16 * r));
+			for (unsigned int j=0; j< period; j++) acc[j] = _mm_add_epi64(acc[j], _mm_sad_epu8(_mm_and_si128(v, masks[r][j]), zero));
+		}
+	}
+	for (unsigned int j=0; j< period; j++) {
+		unsigned long long half[2];
+		_mm_storeu_si128((__m128i*) half, acc[j]);
+		sums[j] += half[0] + half[1];
+	}
+#endif
+	for (; i< n; i++) sums[i % period] += line[i];
+}
+
+
+bool frame_stats(const PixelBuffer* pb, FrameStats& stats, unsigned int rowStep, unsigned int colStep) {
+	memset(&stats, 0, sizeof(FrameStats));
+	if (pb==NULL or pb->buf==NULL) return false;
+	StatsPattern pattern[2];
+	if (!stats_pattern(pb->fmt, 0, false, pattern[0])) return false;
+	PixelPlane planes[3];
+	unsigned int numPlanes = pixelbuffer_planes(pb, planes);
+	if (numPlanes==0) return false;
+
+	bool bayer = (pb->fmt==PIXELBUFFER_FMT_BA81);
+	if (rowStep==0) rowStep = 1;
+	if (colStep==0) colStep = 1;
+	if (bayer and (rowStep & 1)) rowStep++;				// keep both line kinds
+
+	unsigned long long sums[FRAMESTATS_CHANNELS];
+	unsigned long long counts[FRAMESTATS_CHANNELS];
+	memset(sums, 0, sizeof(sums));
+	memset(counts, 0, sizeof(counts));
+	unsigned int hist[4][FRAMESTATS_BINS];				// interleaved: consecutive samples don't wait on the same counter
+	memset(hist, 0, sizeof(hist));
+
+	const unsigned char* base = (const unsigned char*) pb->buf;
+	for (unsigned int p=0; p< numPlanes; p++) {
+		const PixelPlane& pl = planes[p];
+		stats_pattern(pb->fmt, p, false, pattern[0]);
+		stats_pattern(pb->fmt, p, true, pattern[1]);
+		// sampled picture rows y (and y+1 for Bayer), as rows of this plane
+		for (unsigned int y=0; y< pb->height; y += rowStep) {
+			for (unsigned int k=0; k< (bayer ? 2u : 1u); k++) {
+				unsigned int row = (y + k) >> pl.vShift;
+				if (row >= pl.rows) break;
+				const StatsPattern& pt = pattern[row & 1];
+				const unsigned char* line = base + pl.offset + row * pl.stride;
+
+				unsigned long long lineSums[4] = { 0, 0, 0, 0 };
+				stats_sum_line(line, pl.lineBytes, pt.period, lineSums);
+				for (unsigned int j=0; j< pt.period; j++) {
+					if (pt.channel[j] < 0) continue;
+					sums[pt.channel[j]] += lineSums[j];
+					counts[pt.channel[j]] += (pl.lineBytes + pt.period - 1 - j) / pt.period;
+				}
+
+				if (pt.histStep==0) continue;
+				unsigned int step = pt.histStep * colStep;
+				unsigned int n = 0;
+				for (unsigned int x = pt.histOffset; x < pl.lineBytes; x += step, n++)
+					hist[n & 3][line[x] * FRAMESTATS_BINS / 256]++;
+				stats.histSamples += n;
+			}
+		}
+	}
+
+	for (unsigned int b=0; b< FRAMESTATS_BINS; b++) stats.hist[b] = hist[0][b] + hist[1][b] + hist[2][b] + hist[3][b];
+	for (unsigned int c=0; c< FRAMESTATS_CHANNELS; c++) stats.mean[c] = counts[c] ? (float) sums[c] / (float) counts[c] : 0;
+
+	if (counts[FRAMESTATS_Y]) {
+		stats.meanLuma = stats.mean[FRAMESTATS_Y];
+		stats.color = (counts[FRAMESTATS_U] and counts[FRAMESTATS_V]);
+		if (stats.color) {
+			// BT.601, limited range
+			float y = 1.164f * (stats.mean[FRAMESTATS_Y] - 16.0f);
+			float cb = stats.mean[FRAMESTATS_U] - 128.0f;
+			float cr = stats.mean[FRAMESTATS_V] - 128.0f;
+			float rgb[3] = { y + 1.596f * cr, y - 0.391f * cb - 0.813f * cr, y + 2.018f * cb };
+			for (unsigned int c=0; c< 3; c++) {
+				if (rgb[c] < 0) rgb[c] = 0;
+				if (rgb[c] > 255) rgb[c] = 255;
+				stats.mean[FRAMESTATS_R + c] = rgb[c];
+			}
+		}
+	}
+	else {
+		stats.color = true;
+		stats.meanLuma = (stats.mean[FRAMESTATS_R] + 2 * stats.mean[FRAMESTATS_G] + stats.mean[FRAMESTATS_B]) / 4;
+	}
+	return true;
+}
+
+
+unsigned int frame_stats_percentile(const FrameStats& stats, float fraction) {
+	if (stats.histSamples==0) return 0;
+	unsigned long long wanted = (unsigned long long) (fraction * stats.histSamples);
+	unsigned long long seen = 0;
+	for (unsigned int b=0; b< FRAMESTATS_BINS; b++) {
+		seen += stats.hist[b];
+		if (seen > wanted) return (b + 1) * 256 / FRAMESTATS_BINS - 1;
+	}
+	return 255;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef FrameStats_HH
+#define FrameStats_HH
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FormatTraits.hh"
+#include "Grabber_Helpers.hh"
+
+/*
+  Picture statistics for exposure and white balance, computed straight on the grabbed buffer
+  (YUV, Bayer BGGR or 24/32 bits RGB) on a subset of its rows:
+  - channel means over every sampled row (SSE2 sums of absolute differences on masked bytes)
+  - a histogram of luma (green for RGB and Bayer) over every colStep-th sample of those rows
+  Means of YUV pictures are also given as RGB (BT.601, which is linear: the RGB of the mean
+  is the mean of the RGB).
+*/
+
+#define FRAMESTATS_BINS 64
+
+// default subsampling
+#define FRAMESTATS_ROW_STEP 4
+#define FRAMESTATS_COL_STEP 4
+
+enum FrameStatsChannel {
+	FRAMESTATS_Y,
+	FRAMESTATS_U,
+	FRAMESTATS_V,
+	FRAMESTATS_R,
+	FRAMESTATS_G,
+	FRAMESTATS_B,
+	FRAMESTATS_CHANNELS
+};
+
+struct FrameStats {
+	unsigned int hist[FRAMESTATS_BINS];	// luma (or green) samples per bin of 256/FRAMESTATS_BINS levels
+	unsigned int histSamples;
+	float mean[FRAMESTATS_CHANNELS];	// [0,255]
+	bool color;				// mean[R,G,B] are known (not for GREY)
+	float meanLuma;				// Y for YUV, (R+2G+B)/4 for RGB and Bayer
+};
+
+// formats frame_stats() works on
+bool frame_stats_supported (PixelBufferFormat fmt);
+
+// statistics of every rowStep-th row of pb (rowStep is rounded up to even for Bayer pictures)
+// returns false for unsupported formats or buffers too short for their format
+bool frame_stats (const PixelBuffer* pb, FrameStats& stats,
+		  unsigned int rowStep = FRAMESTATS_ROW_STEP, unsigned int colStep = FRAMESTATS_COL_STEP);
+
+// level [0,255] under which fraction (0..1) of the histogram samples are
+unsigned int frame_stats_percentile (const FrameStats& stats, float fraction);
+
+#endif /*FrameStats_HH*/
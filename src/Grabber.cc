@@ -23,12 +23,49 @@
 
 #include "Grabber.hh"
 
-Grabber::Grabber(GrabberInitData* initData) {
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+
+Grabber::Grabber(GrabberInitData* initData) : mIntegrity(initData->integrityRowStep) {
 	mPathToDev = "";			// set path to dev file
 	mPathToDev += initData->pathToDev;
 
 	mMaxWidth = initData->maxWidth;		// max image's width
 	mMaxHeight = initData->maxHeight;	// max image's height
+
+	mLoop = NULL;
+	mRing = initData->ioRing;
+	mUringFd = -1;
+	mUringInFlight = 0;
+	mUringGrabbed = 0;
+	mUringFailed = false;
+
+	mOverrunPolicy = initData->overrunPolicy;
+	mOverrunTimeoutUs = initData->overrunTimeoutUs;
+	GRABBERSTATSCLEARSTRUCT(mStats);
+	mFrameCount = 0;
+	mStalled = false;
+	mHaveSequence = false;
+	mLastSequence = 0;
+	mTimestampClock = CLOCK_MONOTONIC;
+	mDriverClock = CLOCK_MONOTONIC;
+	mCorrelate = (initData->correctedClock!=-1);
+	if (mCorrelate) mClock.set_target_clock(initData->correctedClock);
+	mCheckIntegrity = (initData->integrityRowStep!=0);
+	mFrameRate = initData->frameRate;
+	internal_set_decimation(mFrameRate, 0);			// v4l2 asks the driver first in init()
+
+	pthread_mutex_init(&mOrderLock, NULL);
+	pthread_mutex_init(&mSinksLock, NULL);
+	mThreadConfig = initData->captureThread;
+	mThreadRunning = false;
+	mThreadStop = false;
+	memset(&mThreadStats, 0, sizeof(GrabberThreadStats));
+	memset(mCtrlTrack, 0, sizeof(mCtrlTrack));
 }
 
 
@@ -39,6 +76,8 @@ Grabber::~Grabber() {
 		mGrabberControls.erase (mGrabberControls.begin());
 	}
 	mBuffersOrder.clear();
+	pthread_mutex_destroy(&mOrderLock);
+	pthread_mutex_destroy(&mSinksLock);
 }
 
 
@@ -57,22 +96,577 @@ int Grabber::get_ctrl_value (GrabberControlID id) {
 }
 
 
+unsigned int Grabber::grab_all(std::vector<PixelBuffer*>& frames, bool) {
+	frames.clear();
+	unsigned long long grabbed = GRABBERSTATSGET(mStats.framesGrabbed);
+	grab();
+	if (GRABBERSTATSGET(mStats.framesGrabbed)!=grabbed) {
+		PixelBuffer* pb = get_last_grabbed();
+		if (pb) frames.push_back(pb);
+	}
+	return frames.size();
+}
+
+
 PixelBuffer* Grabber::get_last_grabbed()  {
+	return internal_last_grabbed(0);
+}
+
+
+PixelBuffer* Grabber::acquire_last_grabbed(unsigned int lock) {
+	if (lock==0) return NULL;
+	return internal_last_grabbed(lock);
+}
+
+
+PixelBuffer* Grabber::internal_last_grabbed(unsigned int lock) {
 	// search the most recent PixelBuffer without locks
 	//  ! if mBuffersOrder.size()==0 than (mBuffersOrder.begin()==mBuffersOrder.end()) and while loop is jumped
-	pbIter=mBuffersOrder.begin();
 	// -1 at beginning of list means PixelBuffers are not valid
+	pthread_mutex_lock(&mOrderLock);
+	pbIter=mBuffersOrder.begin();
 	while ( pbIter!=mBuffersOrder.end()) {
 		if (*pbIter == -1) { pbIter++; continue; }
-		if ( !PIXELBUFFERISLOCKED(mPixelBuffers[*pbIter])) return mPixelBuffers[*pbIter];
+		// with a lock to set, test and set at once: the grabber may be queueing the same buffer
+		if ( (lock==0) ? !PIXELBUFFERISLOCKED(mPixelBuffers[*pbIter]) : PIXELBUFFERTRYLOCK(mPixelBuffers[*pbIter], lock) ) {
+			GRABBER_TRACE(TRACE_EV_HANDOUT, *pbIter, 0);
+			PixelBuffer* pb = mPixelBuffers[*pbIter];
+			pthread_mutex_unlock(&mOrderLock);
+			return pb;
+		}
+		GRABBER_TRACE(TRACE_EV_LOCKED, *pbIter, 0);
 		pbIter++; //  inc iterator
 	}
+	pthread_mutex_unlock(&mOrderLock);
 	// if we get here all PixelBuffers had locks, sorry...
 	GRABBER_WARNING("no pixbuf available\n");
 	return NULL;
 }
 
 
+PixelBuffer* Grabber::get_latest(unsigned int maxAgeUs) {
+	return internal_latest(maxAgeUs, 0);
+}
+
+
+PixelBuffer* Grabber::acquire_latest(unsigned int maxAgeUs, unsigned int lock) {
+	if (lock==0) return NULL;
+	return internal_latest(maxAgeUs, lock);
+}
+
+
+PixelBuffer* Grabber::internal_latest(unsigned int maxAgeUs, unsigned int lock) {
+	PixelBuffer* pb = internal_last_grabbed(lock);
+	if (pb==NULL) return NULL;
+
+	timespec now;
+	clock_gettime(mTimestampClock, &now);
+	long long ageUs = ((long long) now.tv_sec - pb->sec) * 1000000LL + (now.tv_nsec/1000 - pb->usec);
+	if (pb->sec==0 or ageUs > (long long) maxAgeUs) {
+		if (lock!=0) CLEARPIXELBUFFERFLAG(pb, lock);
+		GRABBERSTATSADD(mStats.staleRefused, 1);			// consumers' threads count this one
+		GRABBER_TRACE(TRACE_EV_DROP, TRACE_DROP_STALE, (unsigned long long) ageUs);
+		return NULL;
+	}
+	return pb;
+}
+
+
+void Grabber::internal_add_buffer(PixelBuffer* pb) {
+	pthread_mutex_lock(&mOrderLock);
+	mPixelBuffers.push_back(pb);				// may move the vector: nobody must be indexing it
+	mBuffersOrder.push_back(-1);				// keep mBuffersOrder.size() = mPixelBuffers.size()
+	pthread_mutex_unlock(&mOrderLock);
+}
+
+
+void Grabber::internal_invalidate_frames(void) {
+	pthread_mutex_lock(&mOrderLock);
+	mBuffersOrder.assign(mPixelBuffers.size(), -1);		// -1 means that PixelBuffers are not yet valid
+	pthread_mutex_unlock(&mOrderLock);
+}
+
+
+std::vector<PixelBuffer*> Grabber::internal_take_buffers(void) {
+	std::vector<PixelBuffer*> pixelBuffers;
+	pthread_mutex_lock(&mOrderLock);
+	mBuffersOrder.clear();					// avoid grabber to give away a bad PixelBuffer
+	pixelBuffers.swap(mPixelBuffers);
+	pthread_mutex_unlock(&mOrderLock);
+	return pixelBuffers;
+}
+
+
+void Grabber::set_overrun_policy(GrabberOverrunPolicy policy, unsigned int timeoutUs) {
+	mOverrunPolicy = policy;
+	mOverrunTimeoutUs = timeoutUs;
+}
+
+
+GrabberStats Grabber::get_stats(void) const {
+	GrabberStats stats;
+	GRABBERSTATSCOPY(mStats, stats);
+	return stats;
+}
+
+
+void Grabber::reset_stats(void) {
+	GRABBERSTATSCLEARSTRUCT(mStats);
+}
+
+
+bool Grabber::set_frame_rate(float fps) {
+	if (fps < 0) return false;
+	mFrameRate = fps;
+	internal_set_decimation(fps, 0);
+	return true;
+}
+
+
+void Grabber::internal_set_decimation(float fps, float driverFps) {
+	// a driver already close enough to the rate needs no help
+	if (fps <= 0 or (driverFps > 0 and driverFps <= fps * 1.05f)) mDecimateUs = 0;
+	else mDecimateUs = (long long) (1000000.0f / fps + 0.5f);
+	mDecimateNextUs = 0;
+}
+
+
+bool Grabber::internal_decimate(time_t sec, suseconds_t usec) {
+	if (mDecimateUs==0) return false;
+	long long t = (long long) sec * 1000000 + usec;
+	// frames come at the driver's interval: take the first one at or after the due time
+	// (with a little slack for timestamp jitter); due times advance by mDecimateUs so the
+	// mean rate is exact even when the driver's rate isn't a multiple of ours
+	if (mDecimateNextUs!=0 and t < mDecimateNextUs - mDecimateUs / 16) {
+		GRABBERSTATSADD(mStats.decimated, 1);
+		mFrameCount++;
+		GRABBER_TRACE(TRACE_EV_DROP, TRACE_DROP_DECIMATED, 1);
+		return true;
+	}
+	if (mDecimateNextUs==0 or t - mDecimateNextUs > mDecimateUs) mDecimateNextUs = t;	// first frame or after a stall
+	mDecimateNextUs += mDecimateUs;
+	return false;
+}
+
+
+void Grabber::add_sink(FrameSink* sink) {
+	if (sink==NULL) return;
+	pthread_mutex_lock(&mSinksLock);
+	bool registered = false;
+	for (unsigned int i=0; i< mSinks.size(); i++) if (mSinks[i]==sink) registered = true;
+	if (!registered) mSinks.push_back(sink);
+	pthread_mutex_unlock(&mSinksLock);
+}
+
+
+void Grabber::remove_sink(FrameSink* sink) {
+	pthread_mutex_lock(&mSinksLock);
+	for (unsigned int i=0; i< mSinks.size(); i++) {
+		if (mSinks[i]==sink) { mSinks.erase(mSinks.begin()+i); break; }
+	}
+	pthread_mutex_unlock(&mSinksLock);
+}
+
+
+void Grabber::set_ctrl_latency(GrabberControlID id, unsigned int frames) {
+	if (id >= GRABBER_CTRL_NONE) return;
+	pthread_mutex_lock(&mOrderLock);
+	mCtrlTrack[id].latency = frames;
+	pthread_mutex_unlock(&mOrderLock);
+}
+
+
+unsigned long long Grabber::internal_next_frame(void) const {
+	return mFrameCount;
+}
+
+
+void Grabber::internal_ctrl_applied(int ctrlIndex, int newValue) {
+	GrabberControlID id = mGrabberControls[ctrlIndex]->ID;
+	if (id >= GRABBER_CTRL_NONE) return;
+	pthread_mutex_lock(&mOrderLock);
+	CtrlTrack& track = mCtrlTrack[id];
+	if (!track.known) {						// so far the value the grabber read at init
+		track.known = true;
+		track.value = mGrabberControls[ctrlIndex]->value;
+	}
+	if (track.numPending==GRABBER_CTRL_MAX_PENDING) {		// too many changes in flight: the oldest is surely in effect
+		track.value = track.pending[0].value;
+		for (unsigned int i=1; i< track.numPending; i++) track.pending[i-1] = track.pending[i];
+		track.numPending--;
+	}
+	track.pending[track.numPending].value = newValue;
+	track.pending[track.numPending].fromFrame = internal_next_frame() + track.latency;
+	track.numPending++;
+	pthread_mutex_unlock(&mOrderLock);
+}
+
+
+void Grabber::internal_frame_grabbed(int index) {
+	PixelBuffer* pb = mPixelBuffers[index];
+	pb->meta.frame = internal_next_frame();
+
+	if (mCorrelate) {
+		// we get here right after the dequeue: that's the arrival time of the picture
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long driverNs = (long long) pb->sec * 1000000000LL + (long long) pb->usec * 1000;
+		mClock.set_driver_clock(mDriverClock);
+		mClock.add_sample(driverNs, (long long) now.tv_sec * 1000000000LL + now.tv_nsec);
+		pb->meta.valid &= ~FRAME_META_CLOCK;
+		if (pb->sec!=0 and mClock.correct(driverNs, pb->meta.clockNs, pb->meta.clockUncertaintyNs)) pb->meta.valid |= FRAME_META_CLOCK;
+	}
+
+	if (mCheckIntegrity) {
+		pb->meta.integrity = mIntegrity.check(pb, pb->meta.hash);
+		pb->meta.valid |= FRAME_META_INTEGRITY;
+		if (pb->meta.integrity & FRAME_INTEGRITY_REPEATED) GRABBERSTATSADD(mStats.framesRepeated, 1);
+		if (pb->meta.integrity & FRAME_INTEGRITY_CONSTANT) GRABBERSTATSADD(mStats.framesConstant, 1);
+		if (pb->meta.integrity & FRAME_INTEGRITY_SHORT) GRABBERSTATSADD(mStats.framesShort, 1);
+	}
+
+	pthread_mutex_lock(&mOrderLock);
+	mBuffersOrder.remove(index);			// its previous picture is gone: not to be handed out while sinks work on it
+	// controls in effect for this frame
+	pb->meta.ctrlValid = 0;
+	for (unsigned int i=0; i< mGrabberControls.size(); i++) {
+		GrabberControlID id = mGrabberControls[i]->ID;
+		if (id >= GRABBER_CTRL_NONE) continue;
+		CtrlTrack& track = mCtrlTrack[id];
+		if (!track.known) pb->meta.ctrl[id] = mGrabberControls[i]->value;
+		else {
+			while (track.numPending > 0 and track.pending[0].fromFrame <= pb->meta.frame) {
+				track.value = track.pending[0].value;
+				for (unsigned int j=1; j< track.numPending; j++) track.pending[j-1] = track.pending[j];
+				track.numPending--;
+			}
+			pb->meta.ctrl[id] = track.value;
+		}
+		pb->meta.ctrlValid |= 1u << id;
+	}
+	pthread_mutex_unlock(&mOrderLock);
+	GRABBERSTATSADD(mStats.framesGrabbed, 1);
+	mFrameCount++;
+
+	// sinks may complete pb->meta: they run before the picture can be handed out
+	pthread_mutex_lock(&mSinksLock);
+	for (unsigned int i=0; i< mSinks.size(); i++) mSinks[i]->frame_grabbed(pb);
+	pthread_mutex_unlock(&mSinksLock);
+
+	pthread_mutex_lock(&mOrderLock);
+	mBuffersOrder.push_front(index);		// say to the grabber what is the actual PixelBuffer
+	if (mBuffersOrder.size() > mPixelBuffers.size()) mBuffersOrder.pop_back();	// never more entries than PixelBuffers
+	pthread_mutex_unlock(&mOrderLock);
+}
+
+
+bool Grabber::start_capture_thread(void) {
+	if (mThreadRunning) {
+		pthread_mutex_lock(&mOrderLock);
+		bool gaveUp = mThreadStats.stoppedOnError;
+		pthread_mutex_unlock(&mOrderLock);
+		if (!gaveUp) return true;
+		stop_capture_thread();					// reap the thread that stopped on errors and start over
+	}
+	pthread_mutex_lock(&mOrderLock);
+	mThreadStats.stoppedOnError = false;
+	pthread_mutex_unlock(&mOrderLock);
+	mThreadStop = false;
+	if (pthread_create(&mThread, NULL, internal_capture_thread, this)!=0) {
+		GRABBER_WARNING("couldn't create capture thread\n");
+		return false;
+	}
+	mThreadRunning = true;
+	return true;
+}
+
+
+void Grabber::stop_capture_thread(void) {
+	if (!mThreadRunning) return;
+	__atomic_store_n(&mThreadStop, true, __ATOMIC_RELEASE);
+	pthread_join(mThread, NULL);
+	mThreadRunning = false;
+}
+
+
+GrabberThreadStats Grabber::get_thread_stats(void) {
+	pthread_mutex_lock(&mOrderLock);
+	GrabberThreadStats stats = mThreadStats;
+	pthread_mutex_unlock(&mOrderLock);
+	return stats;
+}
+
+
+void* Grabber::internal_capture_thread(void* arg) {
+	((Grabber*) arg)->internal_capture_loop();
+	return NULL;
+}
+
+
+void Grabber::internal_capture_loop(void) {
+	bool applied = grabber_thread_apply_config(mThreadConfig);
+	if (mThreadConfig.name.size()!=0) grabber_trace_set_thread_name(mThreadConfig.name.c_str());
+	pthread_mutex_lock(&mOrderLock);
+	mThreadStats.configApplied = applied;
+	pthread_mutex_unlock(&mOrderLock);
+
+	unsigned int errors = 0;
+	while (!__atomic_load_n(&mThreadStop, __ATOMIC_ACQUIRE)) {
+		unsigned long long grabbed = GRABBERSTATSGET(mStats.framesGrabbed);
+		unsigned long long ioErrors = GRABBERSTATSGET(mStats.ioErrors);
+		grab();
+		if (GRABBERSTATSGET(mStats.framesGrabbed)==grabbed) {
+			// spinning here would starve (real-time policies) the consumers that must release buffers
+			if (GRABBERSTATSGET(mStats.ioErrors)!=ioErrors) errors++;
+			if (errors >= GRABBER_THREAD_MAX_ERRORS) {
+				GRABBER_WARNING("capture thread stopped: grab() keeps failing\n");
+				pthread_mutex_lock(&mOrderLock);
+				mThreadStats.stoppedOnError = true;
+				pthread_mutex_unlock(&mOrderLock);
+				return;
+			}
+			internal_capture_idle(errors);
+			continue;
+		}
+		errors = 0;
+
+		// wakeup latency: from the driver timestamp of the picture to now
+		timespec now;
+		clock_gettime(mTimestampClock, &now);
+		rusage usage;
+		bool haveUsage = getrusage(RUSAGE_THREAD, &usage)==0;
+
+		pthread_mutex_lock(&mOrderLock);
+		if (mBuffersOrder.size()!=0 and mBuffersOrder.front()!=-1) {
+			const PixelBuffer* pb = mPixelBuffers[mBuffersOrder.front()];
+			long long latencyNs = ((long long) now.tv_sec - pb->sec) * 1000000000LL + now.tv_nsec - (long long) pb->usec * 1000;
+			if (pb->sec!=0 and latencyNs >= 0) {
+				mThreadStats.frames++;
+				mThreadStats.lastWakeupNs = latencyNs;
+				mThreadStats.sumWakeupNs += latencyNs;
+				if ((unsigned long long) latencyNs > mThreadStats.maxWakeupNs) mThreadStats.maxWakeupNs = latencyNs;
+			}
+		}
+		if (haveUsage) {
+			mThreadStats.voluntarySwitches = usage.ru_nvcsw;
+			mThreadStats.involuntarySwitches = usage.ru_nivcsw;
+		}
+		pthread_mutex_unlock(&mOrderLock);
+	}
+}
+
+
+void Grabber::internal_capture_idle(unsigned int errors) {
+	// a quarter of the frame interval: the deadline period, else the rate asked, else a guess
+	long long waitUs = GRABBER_THREAD_IDLE_US;
+	if (mThreadConfig.dlPeriodNs!=0) waitUs = mThreadConfig.dlPeriodNs / 4000;
+	else if (mFrameRate > 0) waitUs = (long long) (250000.0f / mFrameRate);
+	if (waitUs < 100) waitUs = 100;
+
+	if (errors > 0) {							// back off while the driver fails
+		waitUs *= errors;
+		if (waitUs > 1000000) waitUs = 1000000;
+	}
+	else {
+		int fd = get_poll_fd();
+		if (fd>=0 and arm()) {						// a buffer is queued: the driver tells when a picture is ready
+			pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			int ret;
+			do {
+				ret = poll(&pfd, 1, (int) ((4 * waitUs + 999) / 1000));
+			} while (ret<0 and errno==EINTR);
+			if (ret > 0 and !(pfd.revents & (POLLERR | POLLNVAL))) return;
+		}
+	}
+	usleep(waitUs);							// consumers release buffers without telling us
+}
+
+
+void Grabber::internal_buffers_exhausted(void) {
+	pthread_mutex_lock(&mSinksLock);
+	for (unsigned int i=0; i< mSinks.size(); i++) mSinks[i]->buffers_exhausted();
+	pthread_mutex_unlock(&mSinksLock);
+}
+
+
+void Grabber::internal_count_stall(void) {
+	if (mStalled) return;
+	mStalled = true;
+	GRABBERSTATSADD(mStats.droppedNewest, 1);
+	mFrameCount++;
+	GRABBER_TRACE(TRACE_EV_DROP, TRACE_DROP_NO_BUFFER, 1);
+}
+
+
+int Grabber::internal_get_free_buffer(void) {
+	unsigned int waitedUs = 0;
+	bool askedSinks = false;
+	while (true) {
+		for (unsigned int index = 0; index < mPixelBuffers.size(); index++) {
+			// if PixelBuffer has some locks than don't touch it (a consumer may be taking it right now)
+			if ( PIXELBUFFERTRYLOCK(mPixelBuffers[index],PIXEL_BUFFER_INUSE_GRABBER_Q) ) {
+				mStalled = false;
+				return index;
+			}
+		}
+		if (!askedSinks) {						// sinks may hold some (ie. devices reading them in place)
+			askedSinks = true;
+			internal_buffers_exhausted();
+			continue;
+		}
+		if (mOverrunPolicy!=GRABBER_OVERRUN_BLOCK or mPixelBuffers.size()==0) break;
+		if (mOverrunTimeoutUs!=0 and waitedUs >= mOverrunTimeoutUs) {
+			GRABBERSTATSADD(mStats.droppedTimeout, 1);
+			GRABBER_TRACE(TRACE_EV_DROP, TRACE_DROP_TIMEOUT, waitedUs);
+			return -1;
+		}
+		usleep(100);						// consumers release buffers without telling us
+		waitedUs += 100;
+		if (waitedUs % 1000 == 0) askedSinks = false;		// sinks don't: ask them again every ms
+	}
+	// every buffer is held by consumers: the incoming picture is lost
+	internal_count_stall();
+	return -1;
+}
+
+
+bool Grabber::internal_wait_readable(int fd) {
+	if (mOverrunPolicy!=GRABBER_OVERRUN_BLOCK or mOverrunTimeoutUs==0) return true;
+	pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int timeoutMs = (mOverrunTimeoutUs + 999) / 1000;
+	int ret;
+	do {
+		ret = poll(&pfd, 1, timeoutMs);
+	} while (ret<0 and errno==EINTR);
+	if (ret==0) {
+		GRABBERSTATSADD(mStats.droppedTimeout, 1);
+		GRABBER_TRACE(TRACE_EV_DROP, TRACE_DROP_TIMEOUT, mOverrunTimeoutUs);
+		return false;
+	}
+	return true;							// on poll() errors let the IO call report them
+}
+
+
+void Grabber::internal_stamp_now(int index) {
+	timespec now;
+	clock_gettime(mTimestampClock, &now);
+	mDriverClock = mTimestampClock;
+	mPixelBuffers[index]->sec = now.tv_sec;
+	mPixelBuffers[index]->usec = now.tv_nsec / 1000;
+}
+
+
+void Grabber::internal_account_sequence(unsigned int sequence) {
+	if (mHaveSequence and sequence - mLastSequence > 1) {
+		GRABBERSTATSADD(mStats.droppedNewest, sequence - mLastSequence - 1);
+		mFrameCount += sequence - mLastSequence - 1;
+		GRABBER_TRACE(TRACE_EV_DROP, TRACE_DROP_DRIVER, sequence - mLastSequence - 1);
+	}
+	mHaveSequence = true;
+	mLastSequence = sequence;
+}
+
+
+bool Grabber::internal_uring_start(int fd) {
+	if (mRing==NULL or !mRing->is_inited() or fd<0) return false;
+	mUringReqs.resize(mPixelBuffers.size());
+	for (unsigned int i=0; i< mUringReqs.size(); i++) {
+		mUringReqs[i].client = this;
+		mUringReqs[i].tag = i;
+	}
+	mUringFd = fd;
+	mUringInFlight = 0;
+	return true;
+}
+
+
+void Grabber::internal_uring_queue_reads(void) {
+	if (mUringFd==-1 or mUringFailed) return;
+	for (unsigned int i=0; i< mPixelBuffers.size(); i++) {
+		// in flight already or held by somebody
+		if ( !PIXELBUFFERTRYLOCK(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_Q) ) continue;
+		if (!mRing->queue_read(mUringFd, mPixelBuffers[i]->buf, mPixelBuffers[i]->length, &mUringReqs[i])) {
+			CLEARPIXELBUFFERFLAG(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_Q);
+			GRABBER_WARNING("io_uring submission queue full\n");
+			break;
+		}
+		mUringInFlight++;
+		GRABBER_TRACE(TRACE_EV_QBUF, i, 0);
+	}
+}
+
+
+bool Grabber::internal_uring_grab(void) {
+	mUringFailed = false;					// try again: the error may be gone
+	internal_uring_queue_reads();
+	if (mUringInFlight==0) {
+		internal_count_stall();
+		return false;
+	}
+	mStalled = false;
+	mUringGrabbed = 0;
+	int timeoutMs = -1;
+	if (mOverrunPolicy==GRABBER_OVERRUN_BLOCK and mOverrunTimeoutUs!=0) timeoutMs = (mOverrunTimeoutUs + 999) / 1000;
+	// completions of other grabbers sharing the ring are dispatched to them meanwhile
+	while (mUringGrabbed==0 and mUringInFlight > 0 and !mUringFailed) {
+		int ret = mRing->run(timeoutMs);
+		if (ret < 0) {
+			GRABBER_WARNING("io_uring wait failed\n");
+			return false;
+		}
+		if (ret==0 and timeoutMs!=-1 and mUringGrabbed==0) {
+			GRABBERSTATSADD(mStats.droppedTimeout, 1);
+			GRABBER_TRACE(TRACE_EV_DROP, TRACE_DROP_TIMEOUT, mOverrunTimeoutUs);
+			return false;
+		}
+	}
+	return mUringGrabbed > 0;
+}
+
+
+void Grabber::internal_uring_stop(void) {
+	if (mUringFd==-1) return;
+	mUringFd = -1;						// io_completed() doesn't requeue from now on
+	for (unsigned int i=0; i< mPixelBuffers.size(); i++) {
+		if (GETPIXELBUFFERFLAG(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_Q)) mRing->queue_cancel(&mUringReqs[i]);
+	}
+	while (mUringInFlight > 0) {
+		if (mRing->run(100) < 0) break;
+	}
+	mUringReqs.clear();
+}
+
+
+void Grabber::io_completed(unsigned int tag, int res) {
+	if (tag >= mPixelBuffers.size()) return;
+	mUringInFlight--;
+	CLEARPIXELBUFFERFLAG(mPixelBuffers[tag],PIXEL_BUFFER_INUSE_GRABBER_Q);
+	if (mUringFd==-1) return;				// stopping
+	if (res <= 0) {							// error or end of file: requeueing would just fail again
+		GRABBERSTATSADD(mStats.ioErrors, 1);
+		mUringFailed = true;
+		GRABBER_TRACE(TRACE_EV_ERRNO, __LINE__, -res);
+		GRABBER_WARNING("io_uring read() error\n");
+		return;
+	}
+	else {
+		GRABBER_TRACE(TRACE_EV_READ, tag, 0);
+		internal_stamp_now(tag);				// read() carries no timestamp: use completion time
+		if (!internal_decimate(mPixelBuffers[tag]->sec, mPixelBuffers[tag]->usec)) {
+			internal_frame_grabbed(tag);
+			mUringGrabbed++;
+		}
+	}
+	internal_uring_queue_reads();				// keep the driver busy
+}
+
+
 int Grabber::find_ctrl_index(GrabberControlID id)  {
 	for (int i= 0; i< mGrabberControls.size(); i++) {
 		if (mGrabberControls[i]->ID == id) return i;
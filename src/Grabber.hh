@@ -27,20 +27,41 @@
 #include <iostream>
 #include <vector>
 #include <list>
+#include <time.h>
+#include <pthread.h>
 
 #include "Debug.hh"
+#include "Trace.hh"
 #include "PixelBuffer.hh"
 #include "CropData.hh"
 #include "GrabberControlData.hh"
 #include "GrabberInitData.hh"
+#include "GrabberReconfig.hh"
+#include "GrabberStats.hh"
+#include "FrameSink.hh"
+#include "IOUring.hh"
+#include "ClockCorrelator.hh"
+#include "FrameIntegrity.hh"
+#include "GrabberAwait.hh"
 
+class GrabberLoop;
+
+
+// control changes not in effect yet remembered for each control
+#define GRABBER_CTRL_MAX_PENDING 4
+
+// capture thread: when grab() gets nothing (consumers hold every buffer, driver errors) it waits a quarter
+// of the frame interval (GRABBER_THREAD_IDLE_US when the interval is unknown) before trying again,
+// longer after each error; after GRABBER_THREAD_MAX_ERRORS failing grab() in a row the thread stops
+#define GRABBER_THREAD_IDLE_US 5000
+#define GRABBER_THREAD_MAX_ERRORS 50
 
 #define GRABBER_WARNING_PREFIX	(" * WARNING - Grabber - ")
 
 // Used to be implemented using ACE helpers - need to switch to something else
 #define GRABBER_WARNING(x)
 
-class Grabber {
+class Grabber : public IOUringClient {
 public:
 	Grabber(GrabberInitData* initData);
 	~Grabber();
@@ -57,8 +78,56 @@ public:
 	// init device
 	virtual bool init(void) = 0;
 
+	// event driven grabbing (see GrabberLoop.hh): when get_poll_fd() polls readable, grab() won't block
+	// -1 when the io method can't be polled (v4l1 mmap, read() through an io_uring)
+	virtual int get_poll_fd(void) { return -1; }
+	// get ready for the next picture before polling (v4l2 streaming: queue the free buffers)
+	// returns false when the fd can't signal anything yet (ie. consumers hold every buffer)
+	virtual bool arm(void) { return true; }
+#if defined(__cpp_impl_coroutine)
+	// C++20: PixelBuffer* pb = co_await grabber.next_frame(); (in a GrabberLoop, see GrabberAwait.hh)
+	GrabberNextFrame next_frame(void) { return GrabberNextFrame(this); }
+#endif
+
+	// grab every picture the driver has ready (at least one: waits like grab() for the first)
+	// frames gets them oldest first (see their timestamps), the newest is also get_last_grabbed()
+	// with releaseOlder only the newest is kept: the others go straight back to the driver (GrabberStats::droppedOldest)
+	// like get_last_grabbed() pictures are reused by the next grab unless locked; returns frames.size()
+	// (io methods without a driver queue grab one picture: there is nothing older, releaseOlder is ignored)
+	virtual unsigned int grab_all(std::vector<PixelBuffer*>& frames, bool releaseOlder = false);
+
 	PixelBuffer* get_last_grabbed(void);
 
+	// like get_last_grabbed() but refuses (returns NULL) a picture older than maxAgeUs microseconds
+	// or without timestamp: after a stall no frame is better than an old one
+	PixelBuffer* get_latest(unsigned int maxAgeUs);
+
+	// from other threads than the grabbing one: like get_last_grabbed() / get_latest() but the picture is
+	// handed out with lock (ie. PIXEL_BUFFER_INUSE_IMG_PROC) already set, so the grabber can't reuse it
+	// before the caller gives it back with CLEARPIXELBUFFERFLAG(pb, lock)
+	PixelBuffer* acquire_last_grabbed(unsigned int lock);
+	PixelBuffer* acquire_latest(unsigned int maxAgeUs, unsigned int lock);
+
+	// clock of PixelBuffer timestamps (CLOCK_MONOTONIC unless the driver stamps with wall clock time)
+	clockid_t get_timestamp_clock(void) const { return mTimestampClock; }
+	// driver -> GrabberInitData::correctedClock estimation (drift...); NULL when not used
+	const ClockCorrelator* get_clock_correlator(void) const { return mCorrelate ? &mClock : NULL; }
+
+	// overrun policy and frame counters (see GrabberStats.hh)
+	void set_overrun_policy(GrabberOverrunPolicy policy, unsigned int timeoutUs);
+	// a copy: the grabbing thread keeps counting meanwhile (reset_stats() may be called from any thread)
+	GrabberStats get_stats(void) const;
+	// number of PixelBuffers in use (may change while grabbing, see GrabberInitData::autoTuneBuffers)
+	unsigned int get_num_buffers(void) const { return mPixelBuffers.size(); }
+	void reset_stats(void);
+
+	// frames per second grabbed (0: whatever the driver gives)
+	// devices that can change their frame interval are asked to (v4l2 VIDIOC_S_PARM), the others keep
+	// streaming at their rate and the grabber skips frames as soon as they are dequeued (GrabberStats::decimated)
+	// returns false for a negative rate or when the device was lost (reset) while asking for it
+	virtual bool set_frame_rate(float fps);
+	float get_frame_rate(void) const { return mFrameRate; }
+
 	// set value for ctrl with id GrabberControlID
 	// returns false when request doesn't succed (this may happen when some kernel events rise for example or crls isn't supported)
 	virtual bool set_ctrl_value(GrabberControlID id, short newValue) = 0;
@@ -76,9 +145,101 @@ public:
 	// get actual format
 	virtual PixelBufferFormat get_format(void) = 0;
 
+	// change format, size, crop and frame rate of an inited grabber without closing the device:
+	// controls, ctrl latencies, sinks and stats are kept, buffers are reused when they are big enough
+	// call it between two grabs (stop the capture thread first); buffers held by consumers are waited for
+	// returns false when some request wasn't taken (what the driver did take stays) or the device can't do it
+	virtual bool reconfigure(const GrabberReconfig &) { return false; }
+
+	// frames between set_ctrl_value() and the first frame exposed with the new value (sensor pipeline depth)
+	// used to fill PixelBuffer::meta.ctrl; 0 (default) means the next frame grabbed
+	void set_ctrl_latency(GrabberControlID id, unsigned int frames);
+
+	// run grab() in a loop in a thread of its own, set up as GrabberInitData::captureThread says
+	// acquire_last_grabbed()/acquire_latest() and sinks can then be used from other threads
+	// stop waits for the running grab() to return (bound it with GRABBER_OVERRUN_BLOCK and a timeout)
+	// the thread stops by itself when grab() keeps failing (GrabberThreadStats::stoppedOnError): start restarts it
+	bool start_capture_thread(void);
+	void stop_capture_thread(void);
+	GrabberThreadStats get_thread_stats(void);
+
+	// register/unregister a FrameSink that sees every grabbed PixelBuffer (see FrameSink.hh)
+	// the grabber doesn't own sinks: remove them before deleting them
+	// from any thread but not from a sink's callbacks: they wait for the sinks being called, so that
+	// a removed sink is not called anymore once remove_sink() returns
+	void add_sink(FrameSink* sink);
+	void remove_sink(FrameSink* sink);
+
 protected:
+	friend class GrabberLoop;
+	friend bool grabber_loop_wait(Grabber* grabber, GrabberLoopWaiter* w);
+
 	int find_ctrl_index(GrabberControlID id);//returns the index of ctrl with GrabberControlID -id- if found; else returns -1
 
+	// inherited classes change mPixelBuffers and mBuffersOrder only through these, under mOrderLock:
+	// other threads look for pictures in them meanwhile
+	// append pb (not valid yet) to mPixelBuffers
+	void internal_add_buffer(PixelBuffer* pb);
+	// no PixelBuffer holds a valid picture anymore (ie. their format changed)
+	void internal_invalidate_frames(void);
+	// empty mPixelBuffers and mBuffersOrder and give the PixelBuffers to the caller, that frees them
+	// (waiting first for their locks to go: consumers may still have one)
+	std::vector<PixelBuffer*> internal_take_buffers(void);
+
+	// the newest picture without locks, with lock set when not 0 (see acquire_last_grabbed())
+	PixelBuffer* internal_last_grabbed(unsigned int lock);
+	PixelBuffer* internal_latest(unsigned int maxAgeUs, unsigned int lock);
+
+	// inherited classes call this once mPixelBuffers[index] holds a new picture (timestamp included):
+	// makes index the head of mBuffersOrder and passes the PixelBuffer to the sinks
+	void internal_frame_grabbed(int index);
+
+	// inherited classes call this from set_ctrl_value() once the driver took newValue, before updating mGrabberControls
+	void internal_ctrl_applied(int ctrlIndex, int newValue);
+	// frame number (PixelBuffer::meta.frame) the next grabbed frame will have
+	// counted apart from mStats so that frame numbers never go back; whatever skips a frame bumps mFrameCount with its stat
+	unsigned long long internal_next_frame(void) const;
+
+	// returns the index of a PixelBuffer without locks and flags it PIXEL_BUFFER_INUSE_GRABBER_Q
+	// with GRABBER_OVERRUN_BLOCK waits for consumers to release one; on failure returns -1 and counts the drop
+	// (once per stall: until a buffer is free again the driver's sequence gaps tell what was lost)
+	int internal_get_free_buffer(void);
+	// every buffer is locked: let the sinks give back the ones they are done with (see FrameSink::buffers_exhausted())
+	void internal_buffers_exhausted(void);
+	// count a picture lost because consumers hold every buffer, once per stall; a free buffer ends the stall
+	void internal_count_stall(void);
+	// with GRABBER_OVERRUN_BLOCK waits at most mOverrunTimeoutUs for fd to have a picture: false (counted) on timeout
+	// other policies return true and let the IO block as before
+	bool internal_wait_readable(int fd);
+	// timestamps mPixelBuffers[index] now, for IO methods whose driver gives no timestamp
+	void internal_stamp_now(int index);
+	// frame sequence numbers from the driver: gaps are frames it dropped for lack of a queued buffer
+	void internal_account_sequence(unsigned int sequence);
+
+	// keep at most fps frames per second (0: all of them); the driver already gives driverFps (0: unknown)
+	void internal_set_decimation(float fps, float driverFps);
+	// true (counted) when a picture with this timestamp must be skipped to keep the decimated rate
+	bool internal_decimate(time_t sec, suseconds_t usec);
+
+	// read() IO through GrabberInitData::ioRing: a read is kept in flight on every free PixelBuffer
+	// start returns false when there is no ring to use (then grab with plain read())
+	bool internal_uring_start(int fd);
+	void internal_uring_queue_reads(void);
+	// waits until at least one of our reads completed: false on timeout or when a read failed
+	// (failed reads are counted in GrabberStats::ioErrors and aren't requeued before the next call)
+	bool internal_uring_grab(void);
+	// cancel and reap our in-flight reads: must be called before freeing mPixelBuffers
+	void internal_uring_stop(void);
+	bool internal_uring_in_use(void) const { return mUringFd!=-1; }
+
+	// IOUringClient
+	void io_completed(unsigned int tag, int res);
+
+	static void* internal_capture_thread(void* arg);
+	void internal_capture_loop(void);
+	// capture thread: wait before trying grab() again, errors is the number of failing grab() in a row
+	void internal_capture_idle(unsigned int errors);
+
 
 	//
 	// members
@@ -94,6 +255,56 @@ protected:
 	std::list<int>::const_iterator pbIter;	// an iterator for mBuffersOrder
 
 	std::vector <GrabberControlData*> mGrabberControls;
+	std::vector <FrameSink*> mSinks;		// not owned, see add_sink()
+	pthread_mutex_t mSinksLock;			// mSinks, held while sinks are called (the capture thread calls them)
+	GrabberLoop* mLoop;				// loop driving this grabber (set by GrabberLoop::add())
+
+	IOUring* mRing;					// not owned, see GrabberInitData::ioRing
+	std::vector <IOUringRequest> mUringReqs;	// one per PixelBuffer (tag = index)
+	int mUringFd;					// device fd when reads go through mRing, else -1
+	unsigned int mUringInFlight;
+	unsigned int mUringGrabbed;			// frames completed since internal_uring_grab() started
+	bool mUringFailed;				// a read failed since internal_uring_grab() started
+
+	GrabberOverrunPolicy mOverrunPolicy;
+	unsigned int mOverrunTimeoutUs;			// 0 means wait forever
+	GrabberStats mStats;
+	unsigned long long mFrameCount;			// frames grabbed, dropped or decimated so far (meta.frame): reset_stats() keeps it
+	bool mStalled;					// every buffer was held by consumers at the last try
+	bool mHaveSequence;				// mLastSequence is valid
+	unsigned int mLastSequence;
+	clockid_t mTimestampClock;
+	int mDriverClock;				// clock of the driver timestamps, -1 unknown (ie. copied from another device)
+	bool mCorrelate;				// fill meta.clockNs through mClock
+	ClockCorrelator mClock;
+	bool mCheckIntegrity;				// fill meta.integrity through mIntegrity
+	FrameIntegrity mIntegrity;
+
+	float mFrameRate;				// see set_frame_rate()
+	long long mDecimateUs;				// frame interval kept by decimation, 0 when off
+	long long mDecimateNextUs;			// timestamp the next kept frame should have (0 before the first)
+
+	// control values in effect (see set_ctrl_latency()), under mOrderLock
+	struct CtrlPending {
+		int value;
+		unsigned long long fromFrame;			// first frame exposed with value
+	};
+	struct CtrlTrack {
+		bool known;					// value is the one in effect
+		int value;
+		unsigned int latency;
+		unsigned int numPending;
+		CtrlPending pending[GRABBER_CTRL_MAX_PENDING];	// oldest first
+	};
+	CtrlTrack mCtrlTrack[GRABBER_CTRL_NONE];
+
+	pthread_mutex_t mOrderLock;			// mBuffersOrder and mPixelBuffers are changed by the grabbing thread while others read them
+	GrabberThreadConfig mThreadConfig;
+	pthread_t mThread;
+	bool mThreadRunning;
+	volatile bool mThreadStop;
+	GrabberThreadStats mThreadStats;		// under mOrderLock
+
 	std::string mPathToDev;		// path to device: ie. /dev/video0
 	unsigned int mMaxWidth;		// max image's width for this grabber
 	unsigned int mMaxHeight;	// max image's height for this grabber
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef GrabberAwait_HH
+#define GrabberAwait_HH
+
+#include "PixelBuffer.hh"
+
+class Grabber;
+
+// A GrabberLoopWaiter is told once about the next picture of a grabber driven by a GrabberLoop
+// (see grabber_loop_wait()). It's called from the thread running the loop, right after the grab:
+// like a FrameSink it must not keep the PixelBuffer* past the next grab of the same grabber.
+class GrabberLoopWaiter {
+public:
+	virtual ~GrabberLoopWaiter() {}
+
+	// pb is NULL when the grabber left the loop (or the loop was destroyed) before a picture came
+	virtual void frame_ready(Grabber* grabber, PixelBuffer* pb) = 0;
+};
+
+// register w for the next picture of grabber in the GrabberLoop it was added to
+// returns false (w won't be called) when grabber isn't in a loop
+bool grabber_loop_wait(Grabber* grabber, GrabberLoopWaiter* w);
+
+
+#if defined(__cpp_impl_coroutine)
+/*
+  C++20 coroutines on top of GrabberLoop: a coroutine running on the loop thread can write
+
+	PixelBuffer* pb = co_await grabber.next_frame();
+
+  and be resumed by the loop when the picture is there (NULL if the grabber isn't in a loop or
+  leaves it). Many cameras and processing steps interleave on the loop thread without a
+  blocked thread per device. GrabberTask is a minimal fire-and-forget coroutine type for that.
+*/
+#include <coroutine>
+#include <exception>
+
+class GrabberNextFrame : public GrabberLoopWaiter {
+public:
+	GrabberNextFrame(Grabber* grabber) { mGrabber = grabber; mPb = NULL; }
+
+	bool await_ready(void) const noexcept { return false; }
+	// not in a loop: don't suspend, next_frame() gives NULL
+	bool await_suspend(std::coroutine_handle<> h) { mHandle = h; return grabber_loop_wait(mGrabber, this); }
+	PixelBuffer* await_resume(void) const noexcept { return mPb; }
+
+	void frame_ready(Grabber*, PixelBuffer* pb) { mPb = pb; mHandle.resume(); }
+
+private:
+	Grabber* mGrabber;
+	PixelBuffer* mPb;
+	std::coroutine_handle<> mHandle;
+};
+
+// starts right away, runs until its first co_await and frees itself when it returns
+struct GrabberTask {
+	struct promise_type {
+		GrabberTask get_return_object(void) noexcept { return GrabberTask(); }
+		std::suspend_never initial_suspend(void) noexcept { return std::suspend_never(); }
+		std::suspend_never final_suspend(void) noexcept { return std::suspend_never(); }
+		void return_void(void) noexcept {}
+		void unhandled_exception(void) noexcept { std::terminate(); }
+	};
+};
+#endif /*__cpp_impl_coroutine*/
+
+#endif /*GrabberAwait_HH*/
@@ -27,8 +27,39 @@
 
 #include <string>
 #include "PixelBuffer.hh"
+#include "GrabberStats.hh"
+#include "ThreadHelpers.hh"
+
+class IOUring;
+
+// how consumers touch grabbed pictures (see GrabberInitData::bufferAccess): v4l2 mmap streaming skips
+// the cache maintenance that isn't needed (V4L2_BUF_FLAG_NO_CACHE_*) when the driver allows it
+enum GrabberBufferAccess {
+	GRABBER_ACCESS_CPU_READWRITE,	// pictures are read and written in place by the cpu: full cache maintenance
+	GRABBER_ACCESS_CPU_READ,	// pictures are only read by the cpu: caches aren't cleaned when buffers go back to the driver
+	GRABBER_ACCESS_DMA		// pictures are only handed to other devices (M2M_Device, V4L2_OutputDevice): no cache maintenance
+};
 
 struct GrabberInitData {
+	GrabberInitData() {
+		maxWidth = 0;
+		maxHeight = 0;
+		maxNumBuffers = 4;
+		fmt = PIXELBUFFER_FMT_NONE;
+		ioRing = NULL;
+		overrunPolicy = GRABBER_OVERRUN_DROP_NEWEST;
+		overrunTimeoutUs = 0;
+		autoTuneBuffers = false;
+		minNumBuffers = 2;
+		targetDropRate = 0.001f;
+		frameRate = 0.0f;
+		correctedClock = -1;
+		integrityRowStep = 0;
+		prefaultBuffers = false;
+		hugePageBuffers = false;
+		bufferAccess = GRABBER_ACCESS_CPU_READWRITE;
+	}
+
 	// *** standard grabber init data ***
 	std::string pathToDev;	// path to device: ie. /dev/video0
 
@@ -36,8 +67,29 @@ struct GrabberInitData {
 	unsigned int maxHeight;	// max image's height we want to grab
 
 	// *** v4lx devices init data ***
+	std::string pathToMetaDev;	// v4l2: metadata capture node of the same sensor (ie. /dev/video1 for uvc), empty for none
 	unsigned int maxNumBuffers;	// limit to the max number of PixelBuffer(s) that can be allocated by the grabber
 	// ie. webcams work better with many buffers, but many buffers means much memory
+	bool autoTuneBuffers;		// v4l2 streaming: start with minNumBuffers and grow (up to maxNumBuffers) or shrink the
+	unsigned int minNumBuffers;	// buffer set while grabbing, so that drops stay under targetDropRate with as little memory as possible
+	float targetDropRate;		// dropped frames / frames
+	bool prefaultBuffers;		// map streaming buffers with MAP_POPULATE and touch malloc'd ones when they are allocated:
+					// no page faults on the first frames of a stream
+	bool hugePageBuffers;		// malloc'd buffers (ptrs and read() IO) are huge page aligned and madvise(MADV_HUGEPAGE)'d
+	GrabberBufferAccess bufferAccess;	// cache maintenance hints for mmap streaming (see GrabberBufferAccess)
+	float frameRate;		// frames per second wanted, 0 for the driver's rate (see Grabber::set_frame_rate())
+	int correctedClock;		// CLOCK_REALTIME, CLOCK_TAI...: every frame gets its driver timestamp in this
+					// clock in meta.clockNs (see ClockCorrelator.hh); -1 for none
+	unsigned int integrityRowStep;	// flag repeated, constant and short pictures in meta.integrity and GrabberStats
+					// hashing every integrityRowStep-th row (see FrameIntegrity.hh); 0 for none
+
+	GrabberThreadConfig captureThread;	// used when the grabber runs in its own thread (Grabber::start_capture_thread())
+
+	IOUring* ioRing;	// when read() IO is used, keep reads in flight on all buffers through this ring
+	// (not owned, must be inited; may be shared by many grabbers driven from one thread, see IOUring.hh)
+
+	GrabberOverrunPolicy overrunPolicy;	// what to drop when frames come faster than they are released (see GrabberStats.hh)
+	unsigned int overrunTimeoutUs;		// max wait of grab() with GRABBER_OVERRUN_BLOCK (0 waits forever)
 
 
 	/* TODO: */
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "GrabberLoop.hh"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// while a grabber can't be armed (consumers hold all its buffers) the loop looks again this often
+#define GRABBERLOOP_REARM_MS 10
+
+
+bool grabber_loop_wait(Grabber* grabber, GrabberLoopWaiter* w) {
+	if (grabber==NULL or grabber->mLoop==NULL) return false;
+	return grabber->mLoop->wait_frame(grabber, w);
+}
+
+
+GrabberLoop::GrabberLoop() {
+	mEpollFd = -1;
+	mWakeFd = -1;
+	mStop = false;
+}
+
+
+GrabberLoop::~GrabberLoop() {
+	while (mEntries.size()!=0) remove(mEntries.back().grabber);
+	if (mWakeFd!=-1) close(mWakeFd);
+	if (mEpollFd!=-1) close(mEpollFd);
+}
+
+
+bool GrabberLoop::init(void) {
+	if (mEpollFd!=-1) return true;
+	mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (mEpollFd==-1) {
+		GRABBERLOOP_WARNING("epoll_create1 failed\n");
+		return false;
+	}
+	mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;						// NULL is the wakeup fd
+	if (mWakeFd==-1 or epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &ev)==-1) {
+		GRABBERLOOP_WARNING("eventfd failed\n");
+		if (mWakeFd!=-1) close(mWakeFd);
+		close(mEpollFd);
+		mWakeFd = -1;
+		mEpollFd = -1;
+		return false;
+	}
+	return true;
+}
+
+
+int GrabberLoop::internal_find(Grabber* grabber) const {
+	for (unsigned int i=0; i< mEntries.size(); i++) if (mEntries[i].grabber==grabber) return i;
+	return -1;
+}
+
+
+bool GrabberLoop::add(Grabber* grabber) {
+	if (mEpollFd==-1 or grabber==NULL or grabber->mLoop!=NULL) return false;
+	int fd = grabber->get_poll_fd();
+	if (fd==-1) return false;
+
+	Entry e;
+	e.grabber = grabber;
+	e.fd = fd;
+	e.armed = false;
+	mEntries.push_back(e);
+	grabber->mLoop = this;
+	return true;
+}
+
+
+void GrabberLoop::remove(Grabber* grabber) {
+	int index = internal_find(grabber);
+	if (index < 0) return;
+	if (mEntries[index].armed) epoll_ctl(mEpollFd, EPOLL_CTL_DEL, mEntries[index].fd, NULL);
+	std::vector<GrabberLoopWaiter*> waiters;
+	waiters.swap(mEntries[index].waiters);
+	mEntries.erase(mEntries.begin() + index);
+	grabber->mLoop = NULL;
+	for (unsigned int i=0; i< waiters.size(); i++) waiters[i]->frame_ready(grabber, NULL);
+}
+
+
+bool GrabberLoop::wait_frame(Grabber* grabber, GrabberLoopWaiter* w) {
+	int index = internal_find(grabber);
+	if (index < 0 or w==NULL) return false;
+	mEntries[index].waiters.push_back(w);
+	return true;
+}
+
+
+void GrabberLoop::internal_arm(Entry& e) {
+	bool ready = e.grabber->arm();
+	if (ready==e.armed) return;
+	// a v4l2 fd without queued buffers polls as an error: keep it out of epoll until it can be armed
+	if (ready) {
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = e.grabber;
+		if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, e.fd, &ev)==-1) {
+			GRABBERLOOP_WARNING("epoll_ctl failed\n");
+			return;
+		}
+	}
+	else epoll_ctl(mEpollFd, EPOLL_CTL_DEL, e.fd, NULL);
+	e.armed = ready;
+}
+
+
+void GrabberLoop::internal_dispatch(unsigned int index) {
+	Grabber* grabber = mEntries[index].grabber;
+	PixelBuffer* pb = grabber->get_last_grabbed();
+	// waiters may wait again (or remove grabbers) from frame_ready(): call a copy of the list
+	std::vector<GrabberLoopWaiter*> waiters;
+	waiters.swap(mEntries[index].waiters);
+	for (unsigned int i=0; i< waiters.size(); i++) waiters[i]->frame_ready(grabber, pb);
+}
+
+
+int GrabberLoop::run_once(int timeoutMs) {
+	if (mEpollFd==-1) return -1;
+	bool allArmed = true;
+	for (unsigned int i=0; i< mEntries.size(); i++) {
+		internal_arm(mEntries[i]);
+		if (!mEntries[i].armed) allArmed = false;
+	}
+	if (!allArmed and (timeoutMs < 0 or timeoutMs > GRABBERLOOP_REARM_MS)) timeoutMs = GRABBERLOOP_REARM_MS;
+
+	epoll_event events[GRABBERLOOP_MAX_EVENTS];
+	int n = epoll_wait(mEpollFd, events, GRABBERLOOP_MAX_EVENTS, timeoutMs);
+	if (n < 0) return (errno==EINTR) ? 0 : -1;
+
+	int grabbed = 0;
+	for (int i=0; i< n; i++) {
+		if (events[i].data.ptr==NULL) {
+			unsigned long long count;
+			if (read(mWakeFd, &count, sizeof(count)) < 0) {}	// just empty it
+			continue;
+		}
+		Grabber* grabber = (Grabber*) events[i].data.ptr;
+		int index = internal_find(grabber);			// a waiter may have removed it
+		if (index < 0) continue;
+		if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+			GRABBERLOOP_WARNING("device error: grabber removed\n");
+			remove(grabber);
+			continue;
+		}
+		unsigned long long before = grabber->get_stats().framesGrabbed;
+		grabber->grab();
+		if (grabber->get_stats().framesGrabbed==before) continue;	// decimated, or failed
+		grabbed++;
+		index = internal_find(grabber);				// sinks may have changed the loop
+		if (index >= 0) internal_dispatch(index);
+	}
+	return grabbed;
+}
+
+
+void GrabberLoop::run(void) {
+	mStop = false;
+	while (!mStop) {
+		if (run_once(-1) < 0) break;
+	}
+}
+
+
+void GrabberLoop::stop(void) {
+	mStop = true;
+	unsigned long long one = 1;
+	if (mWakeFd!=-1 and write(mWakeFd, &one, sizeof(one)) < 0) GRABBERLOOP_WARNING("eventfd write failed\n");
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef GrabberLoop_HH
+#define GrabberLoop_HH
+
+#include <vector>
+
+#include "Debug.hh"
+#include "Grabber.hh"
+#include "GrabberAwait.hh"
+
+/*
+  GrabberLoop drives many grabbers from one thread with epoll: grab() is only called on a
+  grabber whose device fd says a picture is ready, so it never blocks, and whoever waits
+  for that grabber (GrabberLoopWaiter, or a coroutine doing co_await grabber.next_frame())
+  runs right after it.
+
+  Grabbers need a pollable fd (Grabber::get_poll_fd()): v4l2 streaming and read() io, v4l1
+  read() io. Before waiting, the loop arms them (Grabber::arm(): v4l2 queues its free buffers).
+  Every grabber in the loop is grabbed when ready, waited for or not, so sinks and
+  get_last_grabbed() keep working as with a capture thread.
+
+  A loop (and its grabbers and waiters) belongs to the thread calling run()/run_once();
+  stop() may be called from any thread.
+*/
+
+// GrabberLoop logging helpers
+#define GRABBERLOOP_WARNING_PREFIX	(" * WARNING - grabber_loop - ")
+
+// Used to be implemented using ACE helpers - need to switch to something else
+#define GRABBERLOOP_WARNING(x) {}
+
+// max events taken from epoll per wait
+#define GRABBERLOOP_MAX_EVENTS 32
+
+
+class GrabberLoop {
+public:
+	GrabberLoop();
+	~GrabberLoop();
+
+	// create the epoll instance; returns false on failure
+	bool init(void);
+
+	// grabber must be inited and in no other loop (remove it before deleting it)
+	// returns false if it has no pollable fd
+	bool add(Grabber* grabber);
+	// waiters of grabber are called with a NULL picture
+	void remove(Grabber* grabber);
+
+	// register w for the next picture of grabber (see grabber_loop_wait())
+	bool wait_frame(Grabber* grabber, GrabberLoopWaiter* w);
+
+	// wait up to timeoutMs (-1 forever) and grab every ready grabber
+	// returns the number of pictures grabbed, -1 on error
+	int run_once(int timeoutMs);
+
+	// run_once() until stop()
+	void run(void);
+	// make run() return (any thread)
+	void stop(void);
+
+private:
+	struct Entry {
+		Grabber* grabber;
+		int fd;
+		bool armed;			// fd is in epoll
+		std::vector<GrabberLoopWaiter*> waiters;
+	};
+
+	int internal_find(Grabber* grabber) const;
+	void internal_arm(Entry& e);
+	void internal_dispatch(unsigned int index);
+
+	int mEpollFd;
+	int mWakeFd;				// eventfd for stop()
+	volatile bool mStop;
+	std::vector<Entry> mEntries;
+};
+
+#endif /*GrabberLoop_HH*/
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef GrabberReconfig_HH
+#define GrabberReconfig_HH
+
+#include "PixelBuffer.hh"
+#include "CropData.hh"
+
+// what Grabber::reconfigure() changes on an inited grabber: every field left to its default is kept as it is
+struct GrabberReconfig {
+	GrabberReconfig() {
+		fmt = PIXELBUFFER_FMT_NONE;
+		width = 0;
+		height = 0;
+		setCrop = false;
+		crop.left = crop.top = crop.width = crop.height = 0;
+		frameRate = -1.0f;
+	}
+
+	PixelBufferFormat fmt;		// new pixel format, PIXELBUFFER_FMT_NONE keeps the current one
+	unsigned int width, height;	// new picture size, 0 keeps the current width / height
+	bool setCrop;			// apply crop (the driver may adjust it, as with Grabber::set_crop())
+	CropData crop;
+	float frameRate;		// as Grabber::set_frame_rate(), negative keeps the current rate
+};
+
+#endif /*GrabberReconfig_HH*/
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef GrabberStats_HH
+#define GrabberStats_HH
+
+// what a grabber does when it cannot keep every frame (see GrabberInitData::overrunPolicy)
+enum GrabberOverrunPolicy {
+	GRABBER_OVERRUN_DROP_OLDEST,	// frames waiting in the driver queue are skipped so that grab() returns the newest one
+	GRABBER_OVERRUN_DROP_NEWEST,	// frames are taken in order: new frames are lost while no buffer is free
+	GRABBER_OVERRUN_BLOCK		// grab() waits up to overrunTimeoutUs for a free buffer and for the picture
+};
+
+// frame counters of a grabber, see Grabber::get_stats()
+struct GrabberStats {
+	unsigned long long framesGrabbed;	// pictures passed to the grabber (and to its sinks)
+	unsigned long long droppedOldest;	// frames skipped because a newer one was already available (DROP_OLDEST)
+	unsigned long long droppedNewest;	// frames lost because no buffer was free (driver sequence gaps included)
+	unsigned long long droppedTimeout;	// grab() calls that gave up after overrunTimeoutUs (BLOCK)
+	unsigned long long staleRefused;	// get_latest() calls refused because the newest frame was too old
+	unsigned long long decimated;		// frames skipped to keep the rate asked with Grabber::set_frame_rate()
+	unsigned long long ioErrors;		// reads / dequeues the driver failed (grab() on a device not inited included)
+	// pictures flagged by the integrity check (GrabberInitData::integrityRowStep, see FrameIntegrity.hh)
+	unsigned long long framesRepeated;	// same content as the previous one
+	unsigned long long framesConstant;	// a single pixel value
+	unsigned long long framesShort;		// partially written by the driver
+};
+
+// capture thread figures, see Grabber::get_thread_stats()
+struct GrabberThreadStats {
+	bool configApplied;			// the whole GrabberInitData::captureThread could be applied
+	long voluntarySwitches;			// context switches of the capture thread (getrusage())
+	long involuntarySwitches;		// times it was preempted: jitter comes from here
+	unsigned long long frames;		// frames whose wakeup latency was measured
+	unsigned long long lastWakeupNs;	// driver timestamp -> grab() returned
+	unsigned long long maxWakeupNs;
+	unsigned long long sumWakeupNs;		// mean = sumWakeupNs / frames
+	bool stoppedOnError;			// the thread gave up after GRABBER_THREAD_MAX_ERRORS failing grab() in a row
+};
+
+// the grabbing thread bumps the counters while other threads read or reset them: every access is atomic
+#define GRABBERSTATSADD(x,n) __atomic_fetch_add(&(x), (unsigned long long) (n), __ATOMIC_RELAXED)
+#define GRABBERSTATSGET(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define GRABBERSTATSSET(x,n) __atomic_store_n(&(x), (unsigned long long) (n), __ATOMIC_RELAXED)
+
+#define GRABBERSTATSCLEARSTRUCT(x) GRABBERSTATSSET(x.framesGrabbed, 0);	\
+	GRABBERSTATSSET(x.droppedOldest, 0);		\
+	GRABBERSTATSSET(x.droppedNewest, 0);		\
+	GRABBERSTATSSET(x.droppedTimeout, 0);		\
+	GRABBERSTATSSET(x.staleRefused, 0);		\
+	GRABBERSTATSSET(x.decimated, 0);		\
+	GRABBERSTATSSET(x.ioErrors, 0);			\
+	GRABBERSTATSSET(x.framesRepeated, 0);		\
+	GRABBERSTATSSET(x.framesConstant, 0);		\
+	GRABBERSTATSSET(x.framesShort, 0);
+
+// copy of the counters of x into y, each one read atomically
+#define GRABBERSTATSCOPY(x,y) y.framesGrabbed = GRABBERSTATSGET(x.framesGrabbed);	\
+	y.droppedOldest = GRABBERSTATSGET(x.droppedOldest);	\
+	y.droppedNewest = GRABBERSTATSGET(x.droppedNewest);	\
+	y.droppedTimeout = GRABBERSTATSGET(x.droppedTimeout);	\
+	y.staleRefused = GRABBERSTATSGET(x.staleRefused);	\
+	y.decimated = GRABBERSTATSGET(x.decimated);		\
+	y.ioErrors = GRABBERSTATSGET(x.ioErrors);		\
+	y.framesRepeated = GRABBERSTATSGET(x.framesRepeated);	\
+	y.framesConstant = GRABBERSTATSGET(x.framesConstant);	\
+	y.framesShort = GRABBERSTATSGET(x.framesShort);
+
+#endif /*GrabberStats_HH*/
@@ -24,42 +24,97 @@
 
 #include "Grabber_Helpers.hh"
 
+#include <string.h>
+
 unsigned int pixelbuffer_length(PixelBufferFormat fmt, unsigned int w, unsigned int h) {
-	/* 1 byte per pixel formats */
-	if ( (fmt == PIXELBUFFER_FMT_RGB1) or
-	     (fmt == PIXELBUFFER_FMT_BA81) or
-	     (fmt == PIXELBUFFER_FMT_GREY)   ) return (int) ( w*h );
-
-	/* 2 byte per pixel formats */
-	if ( (fmt == PIXELBUFFER_FMT_RGBO) or
-	     (fmt == PIXELBUFFER_FMT_RGBP) or
-	     (fmt == PIXELBUFFER_FMT_R444) or
-	     (fmt == PIXELBUFFER_FMT_RGBQ) or
-	     (fmt == PIXELBUFFER_FMT_RGBR) or
-	     (fmt == PIXELBUFFER_FMT_YUYV) or
-	     (fmt == PIXELBUFFER_FMT_UYVY) or
-	     (fmt == PIXELBUFFER_FMT_YV12) or
-	     (fmt == PIXELBUFFER_FMT_YU12) or
-	     (fmt == PIXELBUFFER_FMT_422P)   ) return (int) ( w*h*2 );
-
-	/* 3 byte per 2 pixels formats */
-	if ( (fmt == PIXELBUFFER_FMT_Y41P) or
-	     (fmt == PIXELBUFFER_FMT_YVU9) or
-	     (fmt == PIXELBUFFER_FMT_YUV9) or
-	     (fmt == PIXELBUFFER_FMT_411P) or
-	     (fmt == PIXELBUFFER_FMT_NV12) or
-	     (fmt == PIXELBUFFER_FMT_NV21)   ) return (int) ( ((w*h*3)/2)+1 );
-
-	/* 3 byte per pixel formats */
-	if ( (fmt == PIXELBUFFER_FMT_BGR3) or
-	     (fmt == PIXELBUFFER_FMT_RGB3)   ) return (int) ( w*h*3 );
-
-	/* 4 byte per pixel formats */
-	if ( (fmt == PIXELBUFFER_FMT_BGR4) or
-	     (fmt == PIXELBUFFER_FMT_RGB4)   ) return (int) ( w*h*4 );
-
-	/* if we get here fmt is of un-handled type */
-	return 0;
+	// 0 if fmt is of un-handled type
+	return pixel_format_length(pixel_format_info(fmt), w, h);
+}
+
+
+unsigned int pixelbuffer_stride(const PixelBuffer* pb) {
+	if (pb->stride) return pb->stride;
+	const PixelFormatInfo* info = pixel_format_info(pb->fmt);
+	if (info==NULL) return 0;
+	return (pb->width*info->bitsPerPixel0 + 7) / 8;
+}
+
+
+unsigned int pixelbuffer_planes(const PixelBuffer* pb, PixelPlane planes[3]) {
+	const PixelFormatInfo* info = pixel_format_info(pb->fmt);
+	if (info==NULL or pb->width==0 or pb->height==0) return 0;
+	unsigned int line0 = pixel_format_plane_length(info, 0, pb->width, 1);
+	unsigned int stride = pixelbuffer_stride(pb);
+	if (stride < line0) return 0;
+
+	planes[0].offset = 0;
+	planes[0].stride = stride;
+	planes[0].lineBytes = line0;
+	planes[0].rows = pb->height;
+	planes[0].vShift = 0;
+	unsigned int end = stride * (pb->height - 1) + line0;
+	for (unsigned int p=1; p< info->numPlanes; p++) {
+		planes[p].lineBytes = pixel_format_plane_length(info, p, pb->width, 1);
+		planes[p].stride = (unsigned int) (((unsigned long long) stride * planes[p].lineBytes) / line0);
+		planes[p].rows = (pb->height + (1u << info->chromaVShift) - 1) >> info->chromaVShift;
+		planes[p].vShift = info->chromaVShift;
+		planes[p].offset = planes[p-1].offset + planes[p-1].stride * planes[p-1].rows;
+		end = planes[p].offset + planes[p].stride * (planes[p].rows - 1) + planes[p].lineBytes;
+	}
+	if (pb->length < end) return 0;
+	return info->numPlanes;
+}
+
+
+bool pixelbuffer_copy(const PixelBuffer* src, PixelBuffer* dst) {
+	if (src->fmt!=dst->fmt or src->width!=dst->width or src->height!=dst->height) return false;
+	PixelPlane from[3], to[3];
+	unsigned int numPlanes = pixelbuffer_planes(src, from);
+	if (numPlanes==0 or pixelbuffer_planes(dst, to)!=numPlanes) return false;
+	if (pixelbuffer_stride(src)==pixelbuffer_stride(dst)) {			// same layout: a single copy
+		unsigned int end = to[numPlanes-1].offset + to[numPlanes-1].stride * (to[numPlanes-1].rows - 1) + to[numPlanes-1].lineBytes;
+		memcpy(dst->buf, src->buf, end);
+		return true;
+	}
+	for (unsigned int p=0; p< numPlanes; p++) {
+		const unsigned char* s = (const unsigned char*) src->buf + from[p].offset;
+		unsigned char* d = (unsigned char*) dst->buf + to[p].offset;
+		for (unsigned int row=0; row< from[p].rows; row++)
+			memcpy(d + row * to[p].stride, s + row * from[p].stride, from[p].lineBytes);
+	}
+	return true;
+}
+
+
+// luma sum over the picture; instantiated per format by pixelbuffer_dispatch()
+struct LumaMeanKernel {
+	unsigned long long sum;
+	unsigned long long count;
+
+	template <PixelBufferFormat F> void run(PixelBuffer* pb) {
+		typedef FormatTraits<F> T;
+		if (T::lumaStep==0) return;					// no addressable luma in this format
+		unsigned int stride = pixelbuffer_stride(pb);
+		if (pb->height==0 or stride < T::line_length0(pb->width)) return;
+		if (pb->length < stride * (pb->height - 1) + T::line_length0(pb->width)) return;
+		const unsigned char* line = (const unsigned char*) pb->buf + T::lumaOffset;
+		for (unsigned int y = 0; y < pb->height; y++, line += stride) {
+			unsigned int s = 0;
+			for (unsigned int x = 0; x < pb->width; x++) s += line[x*T::lumaStep];
+			sum += s;
+		}
+		count = (unsigned long long) pb->width * pb->height;
+	}
+};
+
+
+int pixelbuffer_luma_mean(PixelBuffer* pb) {
+	if (pb==NULL or pb->buf==NULL) return -1;
+	LumaMeanKernel k;
+	k.sum = 0;
+	k.count = 0;
+	if (!pixelbuffer_dispatch(pb, k) or k.count==0) return -1;
+	return (int) (k.sum / k.count);
 }
 
 #ifdef Grabber_Verbose
@@ -30,9 +30,33 @@
 #include "Debug.hh"
 #include "GrabberControlData.hh"
 #include "PixelBuffer.hh"
+#include "FormatTraits.hh"
 
 unsigned int pixelbuffer_length (PixelBufferFormat fmt, unsigned int w, unsigned int h);
 
+// bytes between two lines of plane 0 (pb->stride, or the packed line length when the grabber left it to 0)
+unsigned int pixelbuffer_stride (const PixelBuffer* pb);
+
+// where the lines of a plane are in a PixelBuffer
+struct PixelPlane {
+	unsigned int offset;		// of the first line in pb->buf
+	unsigned int stride;		// bytes between two lines
+	unsigned int lineBytes;		// bytes of picture data in a line
+	unsigned int rows;
+	unsigned int vShift;		// rows = picture rows >> vShift (rounded up)
+};
+
+// planes of pb (chroma planes are strided like plane 0, in proportion to their line length)
+// returns the number of planes, 0 for unknown formats or buffers too short for them
+unsigned int pixelbuffer_planes (const PixelBuffer* pb, PixelPlane planes[3]);
+
+// copy the picture in src into dst, line by line (same format and size, any strides)
+// returns false when they don't match or a buffer is too short
+bool pixelbuffer_copy (const PixelBuffer* src, PixelBuffer* dst);
+
+// mean luma [0,255] of a YUV PixelBuffer; -1 for formats without addressable luma
+int pixelbuffer_luma_mean (PixelBuffer* pb);
+
 #ifdef Grabber_Verbose
 std::string pixelbuffer_fmt_to_string(PixelBufferFormat fmt);
 std::string grabber_ctrl_data_to_string (GrabberControlData* gData);
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "HistoryRing.hh"
+
+#include <string.h>
+#include <sys/mman.h>
+
+
+HistoryRing::HistoryRing(const HistoryRingConfig& config) {
+	mConfig = config;
+	if (mConfig.maxFrames==0) mConfig.maxFrames = 1;
+	mArena = NULL;
+	mArenaSize = 0;
+	mWritePos = 0;
+	mFirst = 0;
+	mCount = 0;
+	mFirstId = 0;
+
+	pthread_mutex_init(&mLock, NULL);
+	pthread_cond_init(&mCond, NULL);
+	mThreadRunning = false;
+	mFlushing = false;
+	mOut = NULL;
+	mPinFirst = 0;
+	mPinEnd = 0;
+	mPostActive = false;
+	mPostUs = 0;
+	mPostUntilUs = 0;
+	mFlushOk = true;
+	memset(&mStats, 0, sizeof(HistoryRingStats));
+}
+
+
+HistoryRing::~HistoryRing() {
+	pthread_mutex_lock(&mLock);
+	mPostActive = false;					// the flush ends with what it has
+	pthread_cond_signal(&mCond);
+	pthread_mutex_unlock(&mLock);
+	internal_join();
+
+	if (mArena) munmap(mArena, mArenaSize);
+	pthread_cond_destroy(&mCond);
+	pthread_mutex_destroy(&mLock);
+}
+
+
+bool HistoryRing::init(void) {
+	if (mArena) return true;
+	mArenaSize = (mConfig.maxBytes + HISTORYRING_ALIGN - 1) & ~((size_t) HISTORYRING_ALIGN - 1);
+	if (mArenaSize==0) return false;
+
+	// touched once here: grabbing never takes a page fault on the arena
+	void* arena = mmap(NULL, mArenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (arena==MAP_FAILED) {
+		HISTORYRING_WARNING("mmap failed\n");
+		mArenaSize = 0;
+		return false;
+	}
+	if (mConfig.lockMemory and mlock(arena, mArenaSize)!=0) HISTORYRING_WARNING("mlock failed\n");
+	mArena = (unsigned char*) arena;
+	mEntries.resize(mConfig.maxFrames);
+	return true;
+}
+
+
+void HistoryRing::internal_evict_oldest(void) {
+	mFirst = (mFirst + 1) % mEntries.size();
+	mCount--;
+	mFirstId++;
+	mStats.evicted++;
+}
+
+
+bool HistoryRing::internal_reserve(size_t size, size_t& offset) {
+	while (true) {
+		if (mCount==0) {
+			mWritePos = 0;
+			offset = 0;
+			return true;
+		}
+		size_t tail = mEntries[mFirst].offset;
+		if (mCount < mEntries.size()) {
+			if (mWritePos > tail) {
+				// used: [tail, mWritePos); free: the end of the arena, then [0, tail)
+				if (mWritePos + size <= mArenaSize) { offset = mWritePos; return true; }
+				if (size <= tail) { mWritePos = 0; offset = 0; return true; }
+			}
+			else if (mWritePos + size <= tail) {
+				// wrapped: free is [mWritePos, tail)
+				offset = mWritePos;
+				return true;
+			}
+		}
+		if (internal_pinned(mFirstId)) return false;
+		internal_evict_oldest();
+	}
+}
+
+
+bool HistoryRing::store(PixelBuffer* pb) {
+	if (mArena==NULL or pb==NULL or pb->buf==NULL) return false;
+
+	// the producer is the only user of mCoded
+	const void* data = pb->buf;
+	size_t dataLength = pb->length;
+	unsigned int flags = 0;
+	if (mConfig.codec) {
+		if (!mConfig.codec->encode(pb, mCoded)) {
+			pthread_mutex_lock(&mLock);
+			mStats.droppedTooBig++;
+			pthread_mutex_unlock(&mLock);
+			return false;
+		}
+		data = &mCoded[0];
+		dataLength = mCoded.size();
+		flags |= HISTORY_RECORD_CODED;
+	}
+	size_t size = (dataLength + HISTORYRING_ALIGN - 1) & ~((size_t) HISTORYRING_ALIGN - 1);
+
+	long long timeUs = (long long) pb->sec * 1000000 + pb->usec;
+
+	pthread_mutex_lock(&mLock);
+	if (mPostActive and mPostUntilUs!=0 and timeUs > mPostUntilUs) {
+		mPostActive = false;					// the flush got every picture it wanted
+		pthread_cond_signal(&mCond);
+	}
+	size_t offset = 0;
+	if (size > mArenaSize or size==0) {
+		mStats.droppedTooBig++;
+		pthread_mutex_unlock(&mLock);
+		return false;
+	}
+	if (!internal_reserve(size, offset)) {
+		mStats.droppedPinned++;
+		pthread_mutex_unlock(&mLock);
+		return false;
+	}
+	pthread_mutex_unlock(&mLock);
+
+	// the reserved room belongs to no entry: the flush thread never looks at it
+	memcpy(mArena + offset, data, dataLength);
+
+	pthread_mutex_lock(&mLock);
+	Entry& e = mEntries[(mFirst + mCount) % mEntries.size()];
+	e.offset = offset;
+	e.size = size;
+	e.timeUs = timeUs;
+	e.record.magic = HISTORYRING_MAGIC;
+	e.record.flags = flags;
+	e.record.fmt = pb->fmt;
+	e.record.width = pb->width;
+	e.record.height = pb->height;
+	e.record.stride = pb->stride;
+	e.record.length = pb->length;
+	e.record.dataLength = dataLength;
+	e.record.frame = pb->meta.frame;
+	e.record.sec = pb->sec;
+	e.record.usec = pb->usec;
+	mCount++;
+	mWritePos = offset + size;
+	mStats.stored++;
+	unsigned long long id = mFirstId + mCount - 1;
+
+	// time limit
+	if (mConfig.maxDurationUs!=0) {
+		while (mCount > 1 and !internal_pinned(mFirstId) and
+		       e.timeUs - mEntries[mFirst].timeUs > (long long) mConfig.maxDurationUs) internal_evict_oldest();
+	}
+
+	// pictures after a trigger() go to the same file
+	if (mPostActive) {
+		if (mPostUntilUs==0) mPostUntilUs = e.timeUs + (long long) mPostUs;
+		if (e.timeUs <= mPostUntilUs) mPinEnd = id + 1;
+		else mPostActive = false;
+		pthread_cond_signal(&mCond);
+	}
+	pthread_mutex_unlock(&mLock);
+	return true;
+}
+
+
+void HistoryRing::frame_grabbed(PixelBuffer* pb) {
+	store(pb);
+}
+
+
+bool HistoryRing::trigger(const std::string& path, unsigned long long postTriggerUs) {
+	if (mArena==NULL) return false;
+	pthread_mutex_lock(&mLock);
+	bool busy = mFlushing;
+	pthread_mutex_unlock(&mLock);
+	if (busy) return false;
+	internal_join();						// the previous flush is over
+
+	FILE* out = fopen(path.c_str(), "wb");
+	if (out==NULL) {
+		HISTORYRING_WARNING("cannot create file\n");
+		return false;
+	}
+
+	pthread_mutex_lock(&mLock);
+	mOut = out;
+	mFlushing = true;
+	mFlushOk = true;
+	mPinFirst = mFirstId;
+	mPinEnd = mFirstId + mCount;
+	mPostActive = (postTriggerUs!=0);
+	mPostUs = postTriggerUs;
+	mPostUntilUs = (mCount!=0) ? internal_entry(mPinEnd - 1).timeUs + (long long) postTriggerUs : 0;
+	pthread_mutex_unlock(&mLock);
+
+	if (pthread_create(&mThread, NULL, flush_main, this)!=0) {
+		HISTORYRING_WARNING("couldn't create flush thread\n");
+		pthread_mutex_lock(&mLock);
+		mPinFirst = mPinEnd = 0;
+		mPostActive = false;
+		mFlushing = false;
+		mOut = NULL;
+		pthread_mutex_unlock(&mLock);
+		fclose(out);
+		return false;
+	}
+	mThreadRunning = true;
+	return true;
+}
+
+
+void* HistoryRing::flush_main(void* arg) {
+	((HistoryRing*) arg)->internal_flush();
+	return NULL;
+}
+
+
+void HistoryRing::internal_flush(void) {
+	pthread_mutex_lock(&mLock);
+	while (true) {
+		if (mPinFirst < mPinEnd) {
+			// pinned entries are never evicted nor overwritten: write them without the lock
+			Entry e = internal_entry(mPinFirst);
+			pthread_mutex_unlock(&mLock);
+			bool ok = (fwrite(&e.record, sizeof(HistoryRecord), 1, mOut) == 1);
+			ok = ok and (fwrite(mArena + e.offset, 1, e.record.dataLength, mOut) == e.record.dataLength);
+			pthread_mutex_lock(&mLock);
+			if (!ok) {
+				mFlushOk = false;
+				break;
+			}
+			mStats.flushedFrames++;
+			mPinFirst++;						// the producer may take its room again
+			continue;
+		}
+		if (!mPostActive) break;
+		pthread_cond_wait(&mCond, &mLock);
+	}
+	mPinFirst = mPinEnd = 0;
+	mPostActive = false;
+	pthread_mutex_unlock(&mLock);
+
+	if (fclose(mOut)!=0) mFlushOk = false;
+	pthread_mutex_lock(&mLock);
+	mOut = NULL;
+	if (!mFlushOk) mStats.flushErrors++;
+	mFlushing = false;
+	pthread_mutex_unlock(&mLock);
+}
+
+
+void HistoryRing::internal_join(void) {
+	if (!mThreadRunning) return;
+	pthread_join(mThread, NULL);
+	mThreadRunning = false;
+}
+
+
+bool HistoryRing::flush_running(void) {
+	pthread_mutex_lock(&mLock);
+	bool running = mFlushing;
+	pthread_mutex_unlock(&mLock);
+	return running;
+}
+
+
+bool HistoryRing::wait_flush(void) {
+	internal_join();
+	return mFlushOk;
+}
+
+
+unsigned int HistoryRing::get_num_frames(void) {
+	pthread_mutex_lock(&mLock);
+	unsigned int count = mCount;
+	pthread_mutex_unlock(&mLock);
+	return count;
+}
+
+
+unsigned long long HistoryRing::get_span_us(void) {
+	pthread_mutex_lock(&mLock);
+	unsigned long long span = 0;
+	if (mCount > 1) span = internal_entry(mFirstId + mCount - 1).timeUs - mEntries[mFirst].timeUs;
+	pthread_mutex_unlock(&mLock);
+	return span;
+}
+
+
+HistoryRingStats HistoryRing::get_stats(void) {
+	pthread_mutex_lock(&mLock);
+	HistoryRingStats stats = mStats;
+	pthread_mutex_unlock(&mLock);
+	return stats;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef HistoryRing_HH
+#define HistoryRing_HH
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FrameSink.hh"
+#include "FrameCodec.hh"
+
+/*
+  HistoryRing keeps the last seconds of a grabber in memory ("black box"), so that the
+  pictures before an alarm can be saved when it happens.
+
+  - pictures (raw, or FrameCodec streams when a codec is given) are copied one after the other
+    in a single arena allocated once: nothing is allocated while grabbing
+  - the oldest pictures are dropped when the arena is full or when they are older than
+    maxDurationUs than the newest one
+  - trigger() saves what is in the ring (and, optionally, what comes in the next postTriggerUs)
+    to a file from a thread of its own; the pictures still to be written are pinned: the
+    producer never overwrites them, new pictures that would need their room are dropped
+
+  File layout: a sequence of records, oldest first
+  +--------------------+------------------------------+--------------------+-----
+  | HistoryRecord      | data (dataLength bytes)      | HistoryRecord      | ...
+  +--------------------+------------------------------+--------------------+-----
+  data is the picture (length bytes, stride as in the record) or, with HISTORY_RECORD_CODED,
+  a FrameCodec stream (frame_codec_read_header()/FrameCodec::decode()).
+*/
+
+#define HISTORYRING_MAGIC	((unsigned int) 0x48697374)	// 'Hist'
+
+// record flags
+#define HISTORY_RECORD_CODED	((unsigned int) 1 )
+
+// arena allocation unit
+#define HISTORYRING_ALIGN	64
+
+// HistoryRing logging helpers
+#define HISTORYRING_WARNING_PREFIX	(" * WARNING - history_ring - ")
+
+// Used to be implemented using ACE helpers - need to switch to something else
+#define HISTORYRING_WARNING(x) {}
+
+
+struct HistoryRingConfig {
+	HistoryRingConfig() {
+		maxBytes = 64 * 1024 * 1024;
+		maxDurationUs = 0;
+		maxFrames = 4096;
+		codec = NULL;
+		lockMemory = false;
+	}
+
+	size_t maxBytes;		// arena size: the ring never uses more
+	unsigned long long maxDurationUs;	// keep at most this much time (0: as much as fits)
+	unsigned int maxFrames;		// max pictures in the ring
+	FrameCodec* codec;		// store FrameCodec streams instead of raw pictures (not owned; NULL: raw)
+	bool lockMemory;		// mlock() the arena (no page faults while grabbing)
+};
+
+struct HistoryRecord {
+	unsigned int magic;		// HISTORYRING_MAGIC
+	unsigned int flags;		// HISTORY_RECORD_*
+	unsigned int fmt;		// PixelBufferFormat
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	unsigned long long length;	// picture length
+	unsigned long long dataLength;	// bytes following this record
+	unsigned long long frame;	// PixelBuffer::meta.frame
+	long long sec;			// timestamp
+	long long usec;
+};
+
+struct HistoryRingStats {
+	unsigned long long stored;		// pictures put in the ring
+	unsigned long long evicted;		// pictures dropped as the oldest
+	unsigned long long droppedPinned;	// new pictures dropped because a flush pinned the room they needed
+	unsigned long long droppedTooBig;	// pictures that can't fit the arena (or couldn't be coded)
+	unsigned long long flushedFrames;	// pictures written by trigger()s
+	unsigned long long flushErrors;		// trigger()s that couldn't write everything
+};
+
+
+class HistoryRing : public FrameSink {
+public:
+	HistoryRing(const HistoryRingConfig& config);
+	~HistoryRing();
+
+	// allocate the arena; returns false on failure
+	bool init(void);
+
+	// producer: copy (or code) pb in the ring, dropping the oldest pictures if needed
+	// returns false when pb was dropped
+	bool store(PixelBuffer* pb);
+
+	// FrameSink: store every grabbed picture
+	void frame_grabbed(PixelBuffer* pb);
+
+	// save the ring to path from the flush thread, plus the pictures of the next postTriggerUs
+	// (by their timestamps); returns false when a flush is still running or path can't be created
+	bool trigger(const std::string& path, unsigned long long postTriggerUs = 0);
+	// true while a trigger() is writing
+	bool flush_running(void);
+	// wait for the running flush; returns false if it didn't write everything
+	bool wait_flush(void);
+
+	unsigned int get_num_frames(void);
+	// time between the oldest and the newest picture in the ring
+	unsigned long long get_span_us(void);
+	HistoryRingStats get_stats(void);
+
+private:
+	struct Entry {
+		size_t offset;			// in the arena
+		size_t size;			// rounded up to HISTORYRING_ALIGN
+		long long timeUs;
+		HistoryRecord record;
+	};
+
+	// make room for size bytes at mWritePos, evicting the oldest entries; under mLock
+	// returns false when pinned entries are in the way
+	bool internal_reserve(size_t size, size_t& offset);
+	bool internal_pinned(unsigned long long id) const { return id >= mPinFirst and id < mPinEnd; }
+	void internal_evict_oldest(void);
+	Entry& internal_entry(unsigned long long id) { return mEntries[(mFirst + (unsigned int) (id - mFirstId)) % mEntries.size()]; }
+
+	static void* flush_main(void* arg);
+	void internal_flush(void);
+	void internal_join(void);
+
+	HistoryRingConfig mConfig;
+
+	unsigned char* mArena;
+	size_t mArenaSize;
+	size_t mWritePos;			// where the next picture goes
+
+	std::vector<Entry> mEntries;		// circular, mFirst is the oldest
+	unsigned int mFirst;
+	unsigned int mCount;
+	unsigned long long mFirstId;		// id of the oldest entry
+	std::vector<unsigned char> mCoded;	// codec output (grows to the largest coded picture only)
+
+	pthread_mutex_t mLock;			// entries and pins are shared with the flush thread
+	pthread_cond_t mCond;			// signalled when an entry is stored while a flush waits for more
+	pthread_t mThread;
+	bool mThreadRunning;
+	bool mFlushing;
+	FILE* mOut;
+	unsigned long long mPinFirst;		// entries [mPinFirst, mPinEnd) are still to be written
+	unsigned long long mPinEnd;
+	bool mPostActive;			// pictures up to mPostUntilUs are added to the flush
+	unsigned long long mPostUs;
+	long long mPostUntilUs;			// 0 until the first picture after an empty ring trigger()
+	bool mFlushOk;
+
+	HistoryRingStats mStats;		// under mLock
+};
+
+#endif /*HistoryRing_HH*/
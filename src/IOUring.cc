@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include "IOUring.hh"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+extern "C" {
+#include <linux/io_uring.h>
+}
+
+static int sys_io_uring_setup(unsigned int entries, io_uring_params* p) {
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags) {
+	return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+
+IOUring::IOUring(unsigned int entries) {
+	mEntries = entries;
+	mFd = -1;
+	mSqMap = mCqMap = mSqes = MAP_FAILED;
+	mSqMapSize = mCqMapSize = mSqesSize = 0;
+	memset (&mSq, 0, sizeof(IOUringSQ));
+	memset (&mCq, 0, sizeof(IOUringCQ));
+	mSqTail = 0;
+	mToSubmit = 0;
+}
+
+
+IOUring::~IOUring() {
+	internal_reset();
+}
+
+
+bool IOUring::init(void) {
+	if (mFd!=-1) return true;
+
+	io_uring_params p;
+	memset (&p, 0, sizeof(io_uring_params));
+	mFd = sys_io_uring_setup(mEntries, &p);
+	if (mFd < 0) { mFd = -1; return false; }
+
+	mSqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	mCqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (mCqMapSize > mSqMapSize) mSqMapSize = mCqMapSize;
+		mCqMapSize = mSqMapSize;
+	}
+	mSqMap = mmap(NULL, mSqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+	if (mSqMap==MAP_FAILED) { internal_reset(); return false; }
+	if (p.features & IORING_FEAT_SINGLE_MMAP) mCqMap = mSqMap;
+	else {
+		mCqMap = mmap(NULL, mCqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+		if (mCqMap==MAP_FAILED) { internal_reset(); return false; }
+	}
+	mSqesSize = p.sq_entries * sizeof(io_uring_sqe);
+	mSqes = mmap(NULL, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES);
+	if (mSqes==MAP_FAILED) { internal_reset(); return false; }
+
+	char* sq = (char*) mSqMap;
+	mSq.head    = (unsigned int*) (sq + p.sq_off.head);
+	mSq.tail    = (unsigned int*) (sq + p.sq_off.tail);
+	mSq.mask    = (unsigned int*) (sq + p.sq_off.ring_mask);
+	mSq.entries = (unsigned int*) (sq + p.sq_off.ring_entries);
+	mSq.array   = (unsigned int*) (sq + p.sq_off.array);
+	char* cq = (char*) mCqMap;
+	mCq.head = (unsigned int*) (cq + p.cq_off.head);
+	mCq.tail = (unsigned int*) (cq + p.cq_off.tail);
+	mCq.mask = (unsigned int*) (cq + p.cq_off.ring_mask);
+	mCq.cqes = cq + p.cq_off.cqes;
+
+	mSqTail = *mSq.tail;
+	mToSubmit = 0;
+	return true;
+}
+
+
+void IOUring::internal_reset(void) {
+	if (mSqes!=MAP_FAILED) munmap(mSqes, mSqesSize);
+	if (mCqMap!=MAP_FAILED and mCqMap!=mSqMap) munmap(mCqMap, mCqMapSize);
+	if (mSqMap!=MAP_FAILED) munmap(mSqMap, mSqMapSize);
+	if (mFd!=-1) close(mFd);
+	mFd = -1;
+	mSqMap = mCqMap = mSqes = MAP_FAILED;
+	mSqMapSize = mCqMapSize = mSqesSize = 0;
+}
+
+
+void* IOUring::internal_get_sqe(void) {
+	unsigned int head = __atomic_load_n(mSq.head, __ATOMIC_ACQUIRE);
+	if (mSqTail - head >= *mSq.entries) {
+		if (!submit()) return NULL;				// full: flush and retry once
+		head = __atomic_load_n(mSq.head, __ATOMIC_ACQUIRE);
+		if (mSqTail - head >= *mSq.entries) return NULL;
+	}
+	unsigned int idx = mSqTail & *mSq.mask;
+	io_uring_sqe* sqe = ((io_uring_sqe*) mSqes) + idx;
+	memset (sqe, 0, sizeof(io_uring_sqe));
+	mSq.array[idx] = idx;
+	mSqTail++;
+	mToSubmit++;
+	return sqe;
+}
+
+
+bool IOUring::queue_read(int fd, void* buf, size_t len, IOUringRequest* req) {
+	if (mFd==-1) return false;
+	io_uring_sqe* sqe = (io_uring_sqe*) internal_get_sqe();
+	if (sqe==NULL) return false;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) buf;
+	sqe->len = (unsigned int) len;
+	sqe->off = (unsigned long long) -1;			// current file position, like read()
+	sqe->user_data = (unsigned long) req;
+	return true;
+}
+
+
+bool IOUring::queue_cancel(IOUringRequest* req) {
+	if (mFd==-1) return false;
+	io_uring_sqe* sqe = (io_uring_sqe*) internal_get_sqe();
+	if (sqe==NULL) return false;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (unsigned long) req;
+	sqe->user_data = 0;					// completion of the cancel itself is ignored
+	return true;
+}
+
+
+bool IOUring::submit(void) {
+	if (mFd==-1) return false;
+	if (mToSubmit==0) return true;
+	__atomic_store_n(mSq.tail, mSqTail, __ATOMIC_RELEASE);
+	while (mToSubmit) {
+		int res = sys_io_uring_enter(mFd, mToSubmit, 0, 0);
+		if (res < 0) {
+			if (errno==EINTR) continue;
+			return false;
+		}
+		mToSubmit -= (res > (int) mToSubmit) ? mToSubmit : (unsigned int) res;
+		if (res==0) break;
+	}
+	return true;
+}
+
+
+int IOUring::internal_dispatch(void) {
+	int n = 0;
+	unsigned int head = *mCq.head;
+	while (true) {
+		unsigned int tail = __atomic_load_n(mCq.tail, __ATOMIC_ACQUIRE);
+		if (head==tail) break;
+		io_uring_cqe* cqe = ((io_uring_cqe*) mCq.cqes) + (head & *mCq.mask);
+		IOUringRequest* req = (IOUringRequest*) (unsigned long) cqe->user_data;
+		int res = cqe->res;
+		head++;
+		__atomic_store_n(mCq.head, head, __ATOMIC_RELEASE);	// free the cqe before the callback queues more work
+		if (req==NULL) continue;
+		req->client->io_completed(req->tag, res);
+		n++;
+	}
+	return n;
+}
+
+
+int IOUring::run(int timeoutMs) {
+	if (mFd==-1) return -1;
+	if (!submit()) return -1;
+
+	int n = internal_dispatch();
+	if (n==0 and timeoutMs!=0) {
+		// the ring fd is readable when completions are pending
+		pollfd pfd;
+		pfd.fd = mFd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int res;
+		do { res = poll(&pfd, 1, timeoutMs); } while (res < 0 and errno==EINTR);
+		if (res < 0) return -1;
+		n = internal_dispatch();
+	}
+	submit();						// requests queued by the callbacks
+	return n;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#ifndef IOUring_HH
+#define IOUring_HH
+
+#include <stddef.h>
+
+#include "Debug.hh"
+
+/*
+  Minimal io_uring wrapper (raw syscalls, no liburing) used by the grabbers for read() IO:
+  a grabber keeps one read() in flight for every free PixelBuffer and completions are
+  harvested in batches. A single IOUring can be shared by several grabbers: whoever calls
+  run() (a grabber's grab() or the application) dispatches the completions of every
+  device to its owner.
+
+  Not thread safe: all grabbers sharing a ring must be driven from the same thread.
+*/
+
+// receives completions of the requests it submitted
+class IOUringClient {
+public:
+	virtual ~IOUringClient() {}
+
+	// res is what read() would have returned (-errno on failure)
+	virtual void io_completed(unsigned int tag, int res) = 0;
+};
+
+// one in-flight request; its address is the io_uring user_data so it must stay put until completion
+struct IOUringRequest {
+	IOUringClient* client;
+	unsigned int tag;
+};
+
+
+class IOUring {
+public:
+	IOUring(unsigned int entries = 64);
+	~IOUring();
+
+	// create the ring; returns false when io_uring is not available (old kernel, seccomp...)
+	bool init(void);
+	bool is_inited(void) const { return mFd!=-1; }
+
+	// queue a read() of len bytes from fd into buf; submitted at the next submit()/run()
+	// returns false when the submission queue is full even after flushing it
+	bool queue_read(int fd, void* buf, size_t len, IOUringRequest* req);
+
+	// queue the cancellation of req (its completion is still delivered, with res -ECANCELED)
+	bool queue_cancel(IOUringRequest* req);
+
+	// submit queued requests; returns false on error
+	bool submit(void);
+
+	// submit, wait up to timeoutMs (-1 forever, 0 don't wait) for at least one completion,
+	// then dispatch every available completion to its client
+	// returns the number of completions dispatched (-1 on error)
+	int run(int timeoutMs);
+
+private:
+	struct IOUringSQ {
+		volatile unsigned int* head;
+		volatile unsigned int* tail;
+		unsigned int* mask;
+		unsigned int* entries;
+		unsigned int* array;
+	};
+	struct IOUringCQ {
+		volatile unsigned int* head;
+		volatile unsigned int* tail;
+		unsigned int* mask;
+		void* cqes;
+	};
+
+	void* internal_get_sqe(void);
+	int internal_dispatch(void);
+	void internal_reset(void);
+
+	unsigned int mEntries;
+	int mFd;
+	void* mSqMap;
+	size_t mSqMapSize;
+	void* mCqMap;
+	size_t mCqMapSize;
+	void* mSqes;
+	size_t mSqesSize;
+
+	IOUringSQ mSq;
+	IOUringCQ mCq;
+	unsigned int mSqTail;		// local tail: published to the kernel by submit()
+	unsigned int mToSubmit;
+};
+
+#endif /*IOUring_HH*/
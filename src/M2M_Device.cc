@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "M2M_Device.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "Grabber_Helpers.hh"
+#include "V4L2_Helpers.hh"
+
+// ioctl restarted on EINTR
+static int m2m_xioctl(int fd, unsigned long request, void* arg) {
+	int res;
+	do {
+		res = ioctl(fd, request, arg);
+	} while (res==-1 and errno==EINTR);
+	return res;
+}
+
+
+M2M_Device::M2M_Device() {
+	mFd = -1;
+	mUserPtr = false;
+	mStreaming = false;
+	pthread_mutex_init(&mLock, NULL);
+	mMaxInPlace = M2M_MAX_IN_PLACE;
+	mInPlace = 0;
+	mInPlaceRefused = false;
+	memset(&mSrcFormat, 0, sizeof(v4l2_format));
+	memset(&mDstFormat, 0, sizeof(v4l2_format));
+	mSrcFmt = PIXELBUFFER_FMT_NONE;
+	mDstFmt = PIXELBUFFER_FMT_NONE;
+	mDstWidth = 0;
+	mDstHeight = 0;
+}
+
+
+M2M_Device::~M2M_Device() {
+	close();
+	pthread_mutex_destroy(&mLock);
+}
+
+
+bool M2M_Device::open(const std::string& path,
+		      PixelBufferFormat srcFmt, unsigned int srcWidth, unsigned int srcHeight, unsigned int srcStride,
+		      PixelBufferFormat dstFmt, unsigned int dstWidth, unsigned int dstHeight,
+		      unsigned int numBuffers) {
+	close();
+	mFd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);		// waits are done with poll()
+	if (mFd==-1) {
+		M2MDEV_WARNING("cannot open device\n");
+		return false;
+	}
+
+	v4l2_capability cap;
+	memset(&cap, 0, sizeof(v4l2_capability));
+	if (m2m_xioctl(mFd, VIDIOC_QUERYCAP, &cap)==-1) {
+		M2MDEV_WARNING("VIDIOC_QUERYCAP failed\n");
+		close();
+		return false;
+	}
+	unsigned int caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+	if (!(caps & V4L2_CAP_VIDEO_M2M) or !(caps & V4L2_CAP_STREAMING)) {
+		// V4L2_CAP_VIDEO_M2M_MPLANE nodes need the multiplanar api: not handled
+		M2MDEV_WARNING("not a single planar mem2mem device\n");
+		close();
+		return false;
+	}
+
+	if (srcStride==0) {
+		PixelBuffer probe;
+		memset(&probe, 0, sizeof(PixelBuffer));
+		probe.fmt = srcFmt;
+		probe.width = srcWidth;
+		srcStride = pixelbuffer_stride(&probe);
+	}
+	// the source must be taken as it is: it is the grabber's format
+	if (!internal_set_format(V4L2_BUF_TYPE_VIDEO_OUTPUT, srcFmt, srcWidth, srcHeight, srcStride, mSrcFormat) or
+	    mSrcFormat.fmt.pix.pixelformat!=pixelbuffer_fmt_to_v4l2_pix_fmt(srcFmt) or
+	    mSrcFormat.fmt.pix.width!=srcWidth or mSrcFormat.fmt.pix.height!=srcHeight) {
+		M2MDEV_WARNING("source format not supported\n");
+		close();
+		return false;
+	}
+	mSrcFmt = srcFmt;
+
+	// the destination is whatever the driver can do nearest to the request
+	if (!internal_set_format(V4L2_BUF_TYPE_VIDEO_CAPTURE, dstFmt, dstWidth, dstHeight, 0, mDstFormat)) {
+		close();
+		return false;
+	}
+	mDstFmt = v4l2_pix_fmt_to_pixelbuffer_fmt(mDstFormat.fmt.pix.pixelformat);
+	mDstWidth = mDstFormat.fmt.pix.width;
+	mDstHeight = mDstFormat.fmt.pix.height;
+	if (mDstFmt==PIXELBUFFER_FMT_NONE) {
+		M2MDEV_WARNING("unknown destination pixelbuffer fmt\n");
+		close();
+		return false;
+	}
+
+	// sources in place only when their lines are where the driver expects them
+	bool tryUserPtr = (mSrcFormat.fmt.pix.bytesperline==srcStride);
+	if (!(tryUserPtr and internal_request_src(numBuffers, true)) and !internal_request_src(numBuffers, false)) {
+		close();
+		return false;
+	}
+	if (!internal_request_dst(numBuffers)) {
+		close();
+		return false;
+	}
+
+	for (unsigned int i=0; i< mDst.size(); i++) {
+		if (!internal_qbuf_dst(i)) {
+			close();
+			return false;
+		}
+	}
+	v4l2_buf_type outType = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	v4l2_buf_type capType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (m2m_xioctl(mFd, VIDIOC_STREAMON, &outType)==-1 or m2m_xioctl(mFd, VIDIOC_STREAMON, &capType)==-1) {
+		M2MDEV_WARNING("VIDIOC_STREAMON failed\n");
+		close();
+		return false;
+	}
+	mStreaming = true;
+	return true;
+}
+
+
+void M2M_Device::close(void) {
+	if (mFd==-1) return;
+	if (mStreaming) {
+		// STREAMOFF gives every buffer back
+		v4l2_buf_type outType = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		v4l2_buf_type capType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		m2m_xioctl(mFd, VIDIOC_STREAMOFF, &outType);
+		m2m_xioctl(mFd, VIDIOC_STREAMOFF, &capType);
+		mStreaming = false;
+	}
+	for (unsigned int i=0; i< mSrcInFlight.size(); i++) {
+		if (mSrcInFlight[i]!=NULL) CLEARPIXELBUFFERFLAG(mSrcInFlight[i],PIXEL_BUFFER_INUSE_M2M);
+	}
+	mSrcInFlight.clear();
+	mSrcBusy.clear();
+	mPending.clear();
+	mInPlace = 0;
+	mInPlaceRefused = false;
+
+	for (unsigned int i=0; i< mSrcStaging.size(); i++) free(mSrcStaging[i]);
+	mSrcStaging.clear();
+	for (unsigned int i=0; i< mSrcBufs.size(); i++) munmap(mSrcBufs[i], mSrcLengths[i]);
+	for (unsigned int i=0; i< mDst.size(); i++) {
+		CLEARPIXELBUFFERFLAG(mDst[i],PIXEL_BUFFER_INUSE_GRABBER_Q);		// not in the driver any more
+		while (PIXELBUFFERISLOCKED(mDst[i])) {usleep(100);}			// leased: wait for its consumer
+		munmap(mDst[i]->buf, mDst[i]->length);
+		delete mDst[i];
+	}
+	bool hadSrc = !mSrcLengths.empty() or mUserPtr;
+	bool hadDst = !mDst.empty();
+	mSrcBufs.clear();
+	mSrcLengths.clear();
+	mDst.clear();
+
+	v4l2_requestbuffers reqBufs;				// give buffers back (after munmap!)
+	if (hadSrc) {
+		memset(&reqBufs, 0, sizeof(v4l2_requestbuffers));
+		reqBufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		reqBufs.memory = mUserPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+		m2m_xioctl(mFd, VIDIOC_REQBUFS, &reqBufs);
+	}
+	if (hadDst) {
+		memset(&reqBufs, 0, sizeof(v4l2_requestbuffers));
+		reqBufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		reqBufs.memory = V4L2_MEMORY_MMAP;
+		m2m_xioctl(mFd, VIDIOC_REQBUFS, &reqBufs);
+	}
+	mUserPtr = false;
+
+	::close(mFd);
+	mFd = -1;
+}
+
+
+bool M2M_Device::internal_set_format(v4l2_buf_type type, PixelBufferFormat fmt, unsigned int width,
+				     unsigned int height, unsigned int stride, v4l2_format& result) {
+	memset(&result, 0, sizeof(v4l2_format));
+	result.type = type;
+	result.fmt.pix.width = width;
+	result.fmt.pix.height = height;
+	result.fmt.pix.pixelformat = pixelbuffer_fmt_to_v4l2_pix_fmt(fmt);
+	result.fmt.pix.bytesperline = stride;
+	result.fmt.pix.field = V4L2_FIELD_NONE;
+	if (m2m_xioctl(mFd, VIDIOC_S_FMT, &result)==-1) {
+		M2MDEV_WARNING("VIDIOC_S_FMT failed\n");
+		return false;
+	}
+	return true;
+}
+
+
+bool M2M_Device::internal_request_src(unsigned int numBuffers, bool userPtr) {
+	v4l2_requestbuffers reqBufs;
+	memset(&reqBufs, 0, sizeof(v4l2_requestbuffers));
+	reqBufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	reqBufs.memory = userPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+	reqBufs.count = numBuffers;
+	if (m2m_xioctl(mFd, VIDIOC_REQBUFS, &reqBufs)==-1 or reqBufs.count==0) {
+		M2MDEV_WARNING("VIDIOC_REQBUFS failed\n");
+		return false;
+	}
+	mUserPtr = userPtr;
+	mSrcInFlight.assign(reqBufs.count, (PixelBuffer*) NULL);
+	mSrcBusy.assign(reqBufs.count, false);
+	if (userPtr) {
+		mSrcStaging.assign(reqBufs.count, (void*) NULL);
+		return true;
+	}
+
+	for (unsigned int i=0; i< reqBufs.count; i++) {
+		v4l2_buffer queryBuf;
+		memset(&queryBuf, 0, sizeof(v4l2_buffer));
+		queryBuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		queryBuf.memory = V4L2_MEMORY_MMAP;
+		queryBuf.index = i;
+		if (m2m_xioctl(mFd, VIDIOC_QUERYBUF, &queryBuf)==-1) {
+			M2MDEV_WARNING("VIDIOC_QUERYBUF failed\n");
+			return false;
+		}
+		void* buf = mmap(NULL, queryBuf.length, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, queryBuf.m.offset);
+		if (buf==MAP_FAILED) {
+			M2MDEV_WARNING("mmap failed\n");
+			return false;
+		}
+		mSrcBufs.push_back(buf);
+		mSrcLengths.push_back(queryBuf.length);
+	}
+	return true;
+}
+
+
+bool M2M_Device::internal_request_dst(unsigned int numBuffers) {
+	v4l2_requestbuffers reqBufs;
+	memset(&reqBufs, 0, sizeof(v4l2_requestbuffers));
+	reqBufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	reqBufs.memory = V4L2_MEMORY_MMAP;
+	reqBufs.count = numBuffers;
+	if (m2m_xioctl(mFd, VIDIOC_REQBUFS, &reqBufs)==-1 or reqBufs.count==0) {
+		M2MDEV_WARNING("VIDIOC_REQBUFS failed\n");
+		return false;
+	}
+
+	unsigned int mMaxWidth = mDstWidth;			// used by PIXELBUFFERCLEARSTRUCT
+	unsigned int mMaxHeight = mDstHeight;
+	for (unsigned int i=0; i< reqBufs.count; i++) {
+		v4l2_buffer queryBuf;
+		memset(&queryBuf, 0, sizeof(v4l2_buffer));
+		queryBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		queryBuf.memory = V4L2_MEMORY_MMAP;
+		queryBuf.index = i;
+		if (m2m_xioctl(mFd, VIDIOC_QUERYBUF, &queryBuf)==-1) {
+			M2MDEV_WARNING("VIDIOC_QUERYBUF failed\n");
+			return false;
+		}
+		void* buf = mmap(NULL, queryBuf.length, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, queryBuf.m.offset);
+		if (buf==MAP_FAILED) {
+			M2MDEV_WARNING("mmap failed\n");
+			return false;
+		}
+		PixelBuffer* pb = new PixelBuffer();
+		PIXELBUFFERCLEARSTRUCT(pb);
+		pb->buf = buf;
+		pb->length = queryBuf.length;
+		pb->fmt = mDstFmt;
+		pb->stride = mDstFormat.fmt.pix.bytesperline;		// 0 when the driver doesn't tell
+		mDst.push_back(pb);
+	}
+	return true;
+}
+
+
+bool M2M_Device::internal_qbuf_dst(unsigned int index) {
+	v4l2_buffer qBuf;
+	memset(&qBuf, 0, sizeof(v4l2_buffer));
+	qBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	qBuf.memory = V4L2_MEMORY_MMAP;
+	qBuf.index = index;
+	SETPIXELBUFFERFLAG(mDst[index],PIXEL_BUFFER_INUSE_GRABBER_Q);
+	if (m2m_xioctl(mFd, VIDIOC_QBUF, &qBuf)==-1) {
+		M2MDEV_WARNING("VIDIOC_QBUF failed\n");
+		CLEARPIXELBUFFERFLAG(mDst[index],PIXEL_BUFFER_INUSE_GRABBER_Q);
+		return false;
+	}
+	return true;
+}
+
+
+void M2M_Device::internal_queue_free_dst(void) {
+	for (unsigned int i=0; i< mDst.size(); i++) {
+		if (PIXELBUFFERISLOCKED(mDst[i])) continue;		// in the driver already or leased
+		internal_qbuf_dst(i);
+	}
+}
+
+
+void M2M_Device::internal_reclaim_src(void) {
+	for (;;) {
+		v4l2_buffer dqBuf;
+		memset(&dqBuf, 0, sizeof(v4l2_buffer));
+		dqBuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		dqBuf.memory = mUserPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+		if (m2m_xioctl(mFd, VIDIOC_DQBUF, &dqBuf)==-1) return;		// EAGAIN: the driver still reads the others
+		if (dqBuf.index >= mSrcBusy.size()) continue;
+		mSrcBusy[dqBuf.index] = false;
+		if (mSrcInFlight[dqBuf.index]!=NULL) {
+			CLEARPIXELBUFFERFLAG(mSrcInFlight[dqBuf.index],PIXEL_BUFFER_INUSE_M2M);
+			mSrcInFlight[dqBuf.index] = NULL;
+			mInPlace--;
+		}
+	}
+}
+
+
+bool M2M_Device::internal_copy_src(unsigned int index, const PixelBuffer* pb) {
+	PixelBuffer slot;
+	memset(&slot, 0, sizeof(PixelBuffer));
+	if (mUserPtr) {
+		if (mSrcStaging[index]==NULL and
+		    posix_memalign(&mSrcStaging[index], sysconf(_SC_PAGESIZE), mSrcFormat.fmt.pix.sizeimage)!=0) {
+			mSrcStaging[index] = NULL;
+			M2MDEV_WARNING("cannot allocate staging buffer\n");
+			return false;
+		}
+		slot.buf = mSrcStaging[index];
+		slot.length = mSrcFormat.fmt.pix.sizeimage;
+	}
+	else {
+		slot.buf = mSrcBufs[index];
+		slot.length = mSrcLengths[index];
+	}
+	slot.width = pb->width;
+	slot.height = pb->height;
+	slot.stride = mSrcFormat.fmt.pix.bytesperline;
+	slot.fmt = pb->fmt;
+	return pixelbuffer_copy(pb, &slot);
+}
+
+
+bool M2M_Device::internal_qbuf_src(unsigned int index, PixelBuffer* pb, bool inPlace) {
+	v4l2_buffer qBuf;
+	memset(&qBuf, 0, sizeof(v4l2_buffer));
+	qBuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	qBuf.index = index;
+	qBuf.field = V4L2_FIELD_NONE;
+	qBuf.bytesused = mSrcFormat.fmt.pix.sizeimage;
+	qBuf.timestamp.tv_sec = pb->sec;				// copied to the converted picture
+	qBuf.timestamp.tv_usec = pb->usec;
+	if (!mUserPtr) qBuf.memory = V4L2_MEMORY_MMAP;
+	else if (inPlace) {
+		qBuf.memory = V4L2_MEMORY_USERPTR;
+		qBuf.m.userptr = (unsigned long) pb->buf;
+		qBuf.length = pb->length;
+		SETPIXELBUFFERFLAG(pb,PIXEL_BUFFER_INUSE_M2M);		// the driver reads it until it gives the slot back
+	}
+	else {
+		qBuf.memory = V4L2_MEMORY_USERPTR;
+		qBuf.m.userptr = (unsigned long) mSrcStaging[index];
+		qBuf.length = mSrcFormat.fmt.pix.sizeimage;
+	}
+	if (m2m_xioctl(mFd, VIDIOC_QBUF, &qBuf)==-1) {
+		M2MDEV_WARNING("VIDIOC_QBUF failed\n");
+		if (inPlace) CLEARPIXELBUFFERFLAG(pb,PIXEL_BUFFER_INUSE_M2M);
+		return false;
+	}
+	mSrcBusy[index] = true;
+	if (inPlace) {
+		mSrcInFlight[index] = pb;
+		mInPlace++;
+	}
+	return true;
+}
+
+
+bool M2M_Device::internal_submit(PixelBuffer* pb) {
+	internal_reclaim_src();
+	internal_queue_free_dst();
+
+	unsigned int index = 0;
+	while (index < mSrcBusy.size() and mSrcBusy[index]) index++;
+	if (index==mSrcBusy.size()) return false;			// the driver is behind
+
+	// in place when the driver takes it as it is, and the grabber is left with buffers of its own
+	bool inPlace = mUserPtr and !mInPlaceRefused and mInPlace < mMaxInPlace and
+		       (pb->stride==0 or pb->stride==mSrcFormat.fmt.pix.bytesperline) and
+		       pb->length >= mSrcFormat.fmt.pix.sizeimage;
+	bool queued = false;
+	if (inPlace) {
+		queued = internal_qbuf_src(index, pb, true);
+		// the pages can't be pinned (ie. another device's MMAP buffer): copy from now on
+		if (!queued) mInPlaceRefused = true;
+	}
+	if (!queued) {
+		if (!internal_copy_src(index, pb) or !internal_qbuf_src(index, pb, false)) return false;
+	}
+
+	SourceInfo info;
+	info.sec = pb->sec;
+	info.usec = pb->usec;
+	info.meta = pb->meta;
+	info.meta.valid &= ~FRAME_META_STREAM;			// the metadata stream buffer belongs to the grabber
+	info.meta.stream = NULL;
+	info.meta.streamLength = 0;
+	mPending.push_back(info);
+	return true;
+}
+
+
+bool M2M_Device::submit(PixelBuffer* pb) {
+	if (mFd==-1 or pb==NULL or pb->buf==NULL) return false;
+	if (pb->fmt!=mSrcFmt or pb->width!=mSrcFormat.fmt.pix.width or pb->height!=mSrcFormat.fmt.pix.height) return false;
+	pthread_mutex_lock(&mLock);
+	bool ok = internal_submit(pb);
+	pthread_mutex_unlock(&mLock);
+	return ok;
+}
+
+
+PixelBuffer* M2M_Device::get_converted(int timeoutMs) {
+	if (mFd==-1) return NULL;
+	pthread_mutex_lock(&mLock);
+	internal_queue_free_dst();
+
+	v4l2_buffer dqBuf;
+	for (unsigned int attempt=0; ; attempt++) {
+		memset(&dqBuf, 0, sizeof(v4l2_buffer));
+		dqBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		dqBuf.memory = V4L2_MEMORY_MMAP;
+		if (m2m_xioctl(mFd, VIDIOC_DQBUF, &dqBuf)!=-1) break;
+		if (errno!=EAGAIN or attempt==1) {
+			if (errno!=EAGAIN) M2MDEV_WARNING("VIDIOC_DQBUF failed\n");
+			internal_reclaim_src();
+			pthread_mutex_unlock(&mLock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&mLock);				// submit() goes on meanwhile
+		pollfd pfd;
+		pfd.fd = mFd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int res;
+		do {
+			res = poll(&pfd, 1, timeoutMs);
+		} while (res==-1 and errno==EINTR);
+		pthread_mutex_lock(&mLock);
+		if (res <= 0) {
+			internal_reclaim_src();
+			pthread_mutex_unlock(&mLock);
+			return NULL;
+		}
+	}
+	internal_reclaim_src();
+	if (dqBuf.index >= mDst.size()) {
+		pthread_mutex_unlock(&mLock);
+		return NULL;
+	}
+	PixelBuffer* pb = mDst[dqBuf.index];
+
+	// converted pictures come back in submit order: the oldest source whose timestamp matches is this one's
+	// (older ones were dropped by the driver)
+	FrameMetadata* meta = &pb->meta;
+	FRAMEMETADATACLEARSTRUCT(meta)
+	pb->sec = dqBuf.timestamp.tv_sec;
+	pb->usec = dqBuf.timestamp.tv_usec;
+	unsigned int match = 0;
+	while (match < mPending.size() and (mPending[match].sec!=pb->sec or mPending[match].usec!=pb->usec)) match++;
+	if (match==mPending.size()) match = 0;				// timestamps not copied: in order anyway
+	if (!mPending.empty()) {
+		pb->meta = mPending[match].meta;
+		mPending.erase(mPending.begin(), mPending.begin() + match + 1);
+	}
+
+	if (dqBuf.flags & V4L2_BUF_FLAG_ERROR) {				// the picture is garbage: back to the driver
+		CLEARPIXELBUFFERFLAG(pb,PIXEL_BUFFER_INUSE_GRABBER_Q);
+		internal_qbuf_dst(dqBuf.index);
+		pthread_mutex_unlock(&mLock);
+		return NULL;
+	}
+	pb->width = mDstWidth;
+	pb->height = mDstHeight;
+	CLEARPIXELBUFFERFLAG(pb,PIXEL_BUFFER_INUSE_GRABBER_Q);		// leased: the caller locks it to keep it
+	pthread_mutex_unlock(&mLock);
+	return pb;
+}
+
+
+PixelBuffer* M2M_Device::convert(PixelBuffer* pb, int timeoutMs) {
+	if (!submit(pb)) return NULL;
+	return get_converted(timeoutMs);
+}
+
+
+void M2M_Device::frame_grabbed(PixelBuffer* pb) {
+	submit(pb);
+}
+
+
+void M2M_Device::buffers_exhausted(void) {
+	if (mFd==-1) return;
+	pthread_mutex_lock(&mLock);
+	internal_reclaim_src();
+	pthread_mutex_unlock(&mLock);
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef M2M_Device_HH
+#define M2M_Device_HH
+
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <pthread.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FrameSink.hh"
+
+// A memory to memory V4L2 node (V4L2_CAP_VIDEO_M2M: SoC scalers and color converters, vim2m...)
+// converts pictures: sources are queued on its OUTPUT queue, converted pictures come back on
+// its CAPTURE queue.
+// Sources are given to the driver by pointer (USERPTR) when it takes them: the PixelBuffer is then
+// locked with PIXEL_BUFFER_INUSE_M2M until the driver is done with it, so a grabber doesn't requeue
+// it meanwhile. At most get_max_in_place() sources are read in place at once, the others are copied:
+// the grabber must keep buffers of its own. Drivers that only take MMAP buffers, or refuse the
+// grabber's buffers (ie. another device's MMAP buffers can't be pinned), get a copy of the source.
+// Sources read in place are given back when the driver is done with them, at the next submit() or
+// get_converted() or when the grabber runs out of buffers (buffers_exhausted()).
+// Converted pictures are PixelBuffers owned by the device, leased like grabber buffers: they go back
+// to the driver at the next submit()/get_converted() unless locked.
+// submit() and get_converted() may be called from different threads; open() and close() may not
+// race with them.
+
+// default number of driver buffers on each queue
+#define M2M_NUM_BUFFERS 4
+// default number of sources read in place at once: less than the grabber's buffers
+#define M2M_MAX_IN_PLACE 2
+
+// M2M device logging helpers
+#define M2MDEV_WARNING_PREFIX	(" * WARNING - m2m_dev - ")
+
+// Used to be implemented using ACE helpers - need to switch to something else
+#define M2MDEV_WARNING(x) {}
+
+class M2M_Device : public FrameSink {
+public:
+	M2M_Device();
+	~M2M_Device();
+
+	// open path and set it up to convert srcWidth x srcHeight srcFmt pictures (lines srcStride bytes apart,
+	// 0: packed) into dstWidth x dstHeight dstFmt ones; the driver may adjust the destination (see get_dst_*())
+	// returns false (and leaves the device closed) on failure
+	bool open(const std::string& path,
+		  PixelBufferFormat srcFmt, unsigned int srcWidth, unsigned int srcHeight, unsigned int srcStride,
+		  PixelBufferFormat dstFmt, unsigned int dstWidth, unsigned int dstHeight,
+		  unsigned int numBuffers = M2M_NUM_BUFFERS);
+	void close(void);
+	bool is_open(void) const { return mFd!=-1; }
+
+	// sources are read in place by the driver (no copy)
+	bool is_zero_copy(void) const { return mUserPtr and !mInPlaceRefused and mMaxInPlace>0; }
+	// at most max sources read in place at once (0: always copy); keep it below the number of buffers
+	// of the grabber (Grabber::get_num_buffers()), it is left with the others
+	void set_max_in_place(unsigned int max) { mMaxInPlace = max; }
+	unsigned int get_max_in_place(void) const { return mMaxInPlace; }
+	// readable when get_converted() won't block (-1 when closed)
+	int get_poll_fd(void) const { return mFd; }
+
+	PixelBufferFormat get_dst_format(void) const { return mDstFmt; }
+	unsigned int get_dst_width(void) const { return mDstWidth; }
+	unsigned int get_dst_height(void) const { return mDstHeight; }
+
+	// queue a source picture (its timestamp and metadata go to the converted picture)
+	// returns false when every source slot is in the driver, the picture doesn't match the open()
+	// format or the driver refuses it
+	bool submit(PixelBuffer* pb);
+
+	// next converted picture, waiting up to timeoutMs (-1: forever); NULL on timeout or error
+	PixelBuffer* get_converted(int timeoutMs);
+
+	// submit() and wait for its converted picture
+	PixelBuffer* convert(PixelBuffer* pb, int timeoutMs);
+
+	// FrameSink: submit every grabbed picture (take them with get_converted())
+	void frame_grabbed(PixelBuffer* pb);
+	// FrameSink: give back the sources the driver is done with
+	void buffers_exhausted(void);
+
+private:
+	// source pictures in flight, to give their timestamp and metadata to the converted ones
+	struct SourceInfo {
+		time_t sec;
+		suseconds_t usec;
+		FrameMetadata meta;
+	};
+
+	bool internal_set_format(v4l2_buf_type type, PixelBufferFormat fmt, unsigned int width,
+				 unsigned int height, unsigned int stride, v4l2_format& result);
+	// source slots, read in place (USERPTR) or MMAP buffers the sources are copied in
+	bool internal_request_src(unsigned int numBuffers, bool userPtr);
+	bool internal_request_dst(unsigned int numBuffers);
+	// queue a destination buffer / every destination buffer without locks
+	bool internal_qbuf_dst(unsigned int index);
+	void internal_queue_free_dst(void);
+	// submit() under mLock
+	bool internal_submit(PixelBuffer* pb);
+	// dequeue the sources the driver is done with (without waiting) and unlock them
+	void internal_reclaim_src(void);
+	// copy pb in the source slot index (MMAP buffer, or staging buffer with USERPTR), line by line
+	bool internal_copy_src(unsigned int index, const PixelBuffer* pb);
+	// queue the source slot index, holding pb (in place) or a copy of it; false when the driver refuses it
+	bool internal_qbuf_src(unsigned int index, PixelBuffer* pb, bool inPlace);
+
+	int mFd;
+	bool mUserPtr;					// OUTPUT queue takes user pointers
+	bool mStreaming;
+	pthread_mutex_t mLock;				// source slots, destination queue and mPending: submit() and
+							// get_converted() may run in different threads
+
+	unsigned int mMaxInPlace;
+	unsigned int mInPlace;				// sources read in place now
+	bool mInPlaceRefused;				// the driver refused a source in place: copy them all
+
+	v4l2_format mSrcFormat;				// as the driver took them
+	v4l2_format mDstFormat;
+	PixelBufferFormat mSrcFmt;
+	PixelBufferFormat mDstFmt;
+	unsigned int mDstWidth;
+	unsigned int mDstHeight;
+
+	std::vector<PixelBuffer*> mSrcInFlight;		// per source slot: the PixelBuffer read in place, NULL when free
+	std::vector<bool> mSrcBusy;			// per source slot: in the driver
+	std::vector<void*> mSrcBufs;			// MMAP source buffers
+	std::vector<void*> mSrcStaging;			// USERPTR: per source slot, buffer sources are copied in (allocated on use)
+	std::vector<unsigned int> mSrcLengths;
+	std::deque<SourceInfo> mPending;		// sources queued, oldest first
+
+	std::vector<PixelBuffer*> mDst;			// mmapped destination buffers
+};
+
+#endif /*M2M_Device_HH*/
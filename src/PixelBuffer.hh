@@ -25,8 +25,11 @@
 #ifndef PixelBuffer_HH
 #define PixelBuffer_HH
 
+#include <stddef.h>
 #include <sys/time.h>
 
+#include "FrameMetadata.hh"
+
 
 // locks in PixelBuffer struct are used to lock the struct while any part of the program is working on it.
 // For example when the image processor receives a PixelBuffer from a grabber rises flag PIXEL_BUFFER_INUSE_IMG_PROC
@@ -40,18 +43,26 @@
 
 #define PIXEL_BUFFER_INUSE_GRABBER_Q	((unsigned int) 1 )
 #define PIXEL_BUFFER_INUSE_IMG_PROC	((unsigned int) 1 << 1 )
+#define PIXEL_BUFFER_INUSE_M2M		((unsigned int) 1 << 2 )	// read in place by a mem2mem device (see M2M_Device.hh)
+#define PIXEL_BUFFER_INUSE_OUTPUT	((unsigned int) 1 << 3 )	// read in place by an output device (see V4L2_OutputDevice.hh)
 
 #define PIXEL_BUFFER_INUSE_GRABBER_DESTROY ((unsigned int) 1 << 31 )
 
+// flags are set and cleared atomically: the grabbing thread and consumers change them at the same time
+
 // sets the value of flag y for a PixelBuffer* passed as x
-#define SETPIXELBUFFERFLAG(x,y) x->locks = x->locks | y
+#define SETPIXELBUFFERFLAG(x,y) __atomic_fetch_or(&(x)->locks, (unsigned int) (y), __ATOMIC_ACQ_REL)
 
 // clears the value of flag y for a PixelBuffer* passed as x
-#define CLEARPIXELBUFFERFLAG(x,y) x->locks = ((x->locks) & (0xFFFFFFFF - y))
+#define CLEARPIXELBUFFERFLAG(x,y) __atomic_fetch_and(&(x)->locks, ~((unsigned int) (y)), __ATOMIC_ACQ_REL)
 
 // returns true if any of 32 flags is set for a PixelBuffer* x
 //  " " "  false if all 32 flags are 0
-#define PIXELBUFFERISLOCKED(x) ( (x->locks) & 0xFFFFFFFF )
+#define PIXELBUFFERISLOCKED(x) ( __atomic_load_n(&(x)->locks, __ATOMIC_ACQUIRE) & 0xFFFFFFFF )
+
+// sets flag y for a PixelBuffer* x only if it has no flags at all: returns true when y was set
+// (test and set in one step, so that two threads can't both think they have the buffer)
+#define PIXELBUFFERTRYLOCK(x,y) pixelbuffer_try_lock(x, y)
 
 
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
@@ -59,7 +70,7 @@
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 // gets the value of flag y for a PixelBuffer* x
 // returns a bool
-#define GETPIXELBUFFERFLAG(x,y) (x->locks & y)
+#define GETPIXELBUFFERFLAG(x,y) (__atomic_load_n(&(x)->locks, __ATOMIC_ACQUIRE) & (y))
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 
 // completely reset a PixelBuffer struct passed as ptr x
@@ -67,10 +78,12 @@
 	x->length = 0;					\
 	x->width  = mMaxWidth;				\
 	x->height = mMaxHeight;				\
+	x->stride = 0;					\
 	x->locks  = (unsigned int) 0x00000000;		\
 	x->fmt    = PIXELBUFFER_FMT_NONE;		\
 	x->sec    = 0;					\
-	x->usec   = 0; 
+	x->usec   = 0;					\
+	{ FrameMetadata* xMeta = &x->meta; FRAMEMETADATACLEARSTRUCT(xMeta) }
 
 enum PixelBufferFormat {
 	PIXELBUFFER_FMT_NONE,
@@ -108,6 +121,7 @@ struct PixelBuffer {
 
 	unsigned int width;		// pixel buffer width  (= mLenght/height)
 	unsigned int height;		// pixel buffer height (= mLenght/width)
+	unsigned int stride;		// bytes between two lines of plane 0 (0 means packed lines, see pixelbuffer_stride())
 
 	unsigned int locks;		// flags used as locks
 
@@ -117,6 +131,13 @@ struct PixelBuffer {
 	// ! valid only when sec > 0;
 	time_t  sec;  		// seconds
 	suseconds_t usec; 		// microseconds
+
+	FrameMetadata meta;		// driver data and controls in effect for this picture
 };
 
+static inline bool pixelbuffer_try_lock(PixelBuffer* pb, unsigned int lock) {
+	unsigned int unlocked = 0;
+	return __atomic_compare_exchange_n(&pb->locks, &unlocked, lock, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
 #endif /*PixelBuffer_HH*/
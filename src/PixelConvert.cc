@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include "PixelConvert.hh"
+
+#include <string.h>
+#include <vector>
+
+// pointers to the samples of one source row
+struct YUVRow {
+	const unsigned char* y;
+	const unsigned char* u;
+	const unsigned char* v;
+};
+
+static const unsigned char gNeutralChroma[1] = { 128 };
+
+
+// bytes between two chroma samples of a row (0: no chroma, ie. GREY)
+template <PixelBufferFormat F> struct ChromaStep {
+	typedef FormatTraits<F> T;
+	static const unsigned int value = (T::numPlanes==3) ? 1 : (T::numPlanes==2) ? 2 : (T::bitsPerPixel0==16) ? 4 : 0;
+};
+
+
+static inline unsigned char clamp_u8(int v) {
+	return (unsigned char) (v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+
+// one destination row; every template argument is a compile time constant for the inner loop
+template <unsigned int YSTEP, unsigned int CSTEP, unsigned int HSHIFT, PixelBufferFormat D>
+static void convert_row(const YUVRow& r, unsigned char* out, unsigned int w) {
+	if (D==PIXELBUFFER_FMT_GREY) {
+		for (unsigned int x = 0; x < w; x++) out[x] = r.y[x*YSTEP];
+		return;
+	}
+	for (unsigned int x = 0; x < w; x++) {
+		unsigned int cx = x >> HSHIFT;
+		int c = 298 * ((int) r.y[x*YSTEP] - 16) + 128;
+		int d = (int) r.u[cx*CSTEP] - 128;
+		int e = (int) r.v[cx*CSTEP] - 128;
+		unsigned char R = clamp_u8((c + 409*e) >> 8);
+		unsigned char G = clamp_u8((c - 100*d - 208*e) >> 8);
+		unsigned char B = clamp_u8((c + 516*d) >> 8);
+		if (D==PIXELBUFFER_FMT_RGB3) { out[3*x] = R; out[3*x+1] = G; out[3*x+2] = B; }
+		else                         { out[3*x] = B; out[3*x+1] = G; out[3*x+2] = R; }
+	}
+}
+
+
+// one scaled destination row: luma is the mean of the source pixels of columns [xmap[x], xmap[x+1]) on the
+// numRows rows from luma row y0 (lines stride bytes apart), chroma the sample of row c at the center of them
+template <unsigned int YSTEP, unsigned int CSTEP, unsigned int HSHIFT, PixelBufferFormat D>
+static void convert_row_scaled(const unsigned char* y0, unsigned int stride, unsigned int numRows, const YUVRow& c,
+			       const unsigned int* xmap, unsigned char* out, unsigned int w) {
+	for (unsigned int x = 0; x < w; x++) {
+		unsigned int sx0 = xmap[x], sx1 = xmap[x+1];
+		if (sx1 <= sx0) sx1 = sx0 + 1;					// enlarging: columns are repeated
+		unsigned int sum = 0;
+		const unsigned char* line = y0;
+		for (unsigned int k = 0; k < numRows; k++, line += stride) {
+			for (unsigned int sx = sx0; sx < sx1; sx++) sum += line[sx*YSTEP];
+		}
+		unsigned int n = numRows * (sx1 - sx0);
+		int y = (int) ((sum + n/2) / n);
+		if (D==PIXELBUFFER_FMT_GREY) { out[x] = (unsigned char) y; continue; }
+		unsigned int cx = ((sx0 + sx1 - 1) >> 1) >> HSHIFT;
+		int cc = 298 * (y - 16) + 128;
+		int d = (int) c.u[cx*CSTEP] - 128;
+		int e = (int) c.v[cx*CSTEP] - 128;
+		unsigned char R = clamp_u8((cc + 409*e) >> 8);
+		unsigned char G = clamp_u8((cc - 100*d - 208*e) >> 8);
+		unsigned char B = clamp_u8((cc + 516*d) >> 8);
+		if (D==PIXELBUFFER_FMT_RGB3) { out[3*x] = R; out[3*x+1] = G; out[3*x+2] = B; }
+		else                         { out[3*x] = B; out[3*x+1] = G; out[3*x+2] = R; }
+	}
+}
+
+
+// first source row (or column) of destination row d when n source rows are scaled to dn
+static inline unsigned int scale_first(unsigned int d, unsigned int n, unsigned int dn) {
+	return (unsigned int) (((unsigned long long) d * n) / dn);
+}
+
+
+// end of the source rows of destination row d (at least one row, also when enlarging)
+static inline unsigned int scale_end(unsigned int d, unsigned int n, unsigned int dn) {
+	unsigned int first = scale_first(d, n, dn);
+	unsigned int end = scale_first(d + 1, n, dn);
+	return (end > first) ? end : first + 1;
+}
+
+
+// rows of a YUV source, instantiated per source format by pixelbuffer_dispatch()
+struct ConvertRowsKernel {
+	PixelBuffer* dst;
+	unsigned int y0, y1;
+	const unsigned int* xmap;		// PixelScaleMap::x, NULL when not scaling
+	const unsigned char* base;
+	bool ok;
+
+	template <PixelBufferFormat F> void run(PixelBuffer* src) {
+		typedef FormatTraits<F> T;
+		const unsigned int CSTEP = ChromaStep<F>::value;
+		if (T::family!=PIXEL_FAMILY_YUV or T::lumaStep==0) return;		// Y41P has no constant luma step
+
+		unsigned int w = src->width, h = src->height;
+		unsigned int stride = pixelbuffer_stride(src);
+		unsigned int cStride = (unsigned int) (((unsigned long long) stride * T::line_lengthC(w)) / T::line_length0(w));
+		unsigned int plane1 = stride * h;
+		unsigned int plane2 = plane1 + cStride * T::chroma_height(h);
+		unsigned int needed = (T::numPlanes==3) ? plane2 + cStride * T::chroma_height(h)
+							: (T::numPlanes==2) ? plane2 : plane1;
+		if (src->length < needed) return;
+
+		// chroma order inside the buffer
+		bool vFirst = (F==PIXELBUFFER_FMT_YV12) or (F==PIXELBUFFER_FMT_YVU9) or (F==PIXELBUFFER_FMT_NV21);
+
+		base = (const unsigned char*) src->buf;
+		unsigned char* out = (unsigned char*) dst->buf;
+		unsigned int outStride = pixelbuffer_stride(dst);
+
+		if (xmap!=NULL) {
+			// scaled: the destination rows whose first source row is in [y0, y1)
+			unsigned int dh = dst->height, dw = dst->width;
+			unsigned int dy = (unsigned int) (((unsigned long long) y0 * dh + h - 1) / h);
+			for (; dy < dh; dy++) {
+				unsigned int sy0 = scale_first(dy, h, dh);
+				if (sy0 >= y1) break;
+				unsigned int sy1 = scale_end(dy, h, dh);
+				YUVRow r0, c;
+				row<F>(sy0, stride, cStride, plane1, plane2, vFirst, r0);
+				row<F>((sy0 + sy1 - 1) >> 1, stride, cStride, plane1, plane2, vFirst, c);
+				unsigned char* o = out + dy*outStride;
+				switch (dst->fmt) {
+				case (PIXELBUFFER_FMT_RGB3) : convert_row_scaled<T::lumaStep, CSTEP, T::chromaHShift, PIXELBUFFER_FMT_RGB3>(r0.y, stride, sy1 - sy0, c, xmap, o, dw); break;
+				case (PIXELBUFFER_FMT_BGR3) : convert_row_scaled<T::lumaStep, CSTEP, T::chromaHShift, PIXELBUFFER_FMT_BGR3>(r0.y, stride, sy1 - sy0, c, xmap, o, dw); break;
+				case (PIXELBUFFER_FMT_GREY) : convert_row_scaled<T::lumaStep, CSTEP, T::chromaHShift, PIXELBUFFER_FMT_GREY>(r0.y, stride, sy1 - sy0, c, xmap, o, dw); break;
+				default : return;
+				}
+			}
+			ok = true;
+			return;
+		}
+
+		for (unsigned int y = y0; y < y1; y++) {
+			YUVRow r;
+			row<F>(y, stride, cStride, plane1, plane2, vFirst, r);
+			unsigned char* o = out + y*outStride;
+			switch (dst->fmt) {
+			case (PIXELBUFFER_FMT_RGB3) : convert_row<T::lumaStep, CSTEP, T::chromaHShift, PIXELBUFFER_FMT_RGB3>(r, o, w); break;
+			case (PIXELBUFFER_FMT_BGR3) : convert_row<T::lumaStep, CSTEP, T::chromaHShift, PIXELBUFFER_FMT_BGR3>(r, o, w); break;
+			case (PIXELBUFFER_FMT_GREY) : convert_row<T::lumaStep, CSTEP, T::chromaHShift, PIXELBUFFER_FMT_GREY>(r, o, w); break;
+			default : return;
+			}
+		}
+		ok = true;
+	}
+
+	// samples of source row y
+	template <PixelBufferFormat F> void row(unsigned int y, unsigned int stride, unsigned int cStride,
+						unsigned int plane1, unsigned int plane2, bool vFirst, YUVRow& r) {
+		typedef FormatTraits<F> T;
+		const unsigned int CSTEP = ChromaStep<F>::value;
+		const unsigned char* line = base + y*stride;
+		r.y = line + T::lumaOffset;
+		if (CSTEP==0) {
+			r.u = r.v = gNeutralChroma;
+		}
+		else if (T::numPlanes==1) {				// packed YUYV/UYVY
+			r.u = line + (T::lumaOffset ? 0 : 1);
+			r.v = r.u + 2;
+		}
+		else {
+			const unsigned char* c1 = base + plane1 + (y >> T::chromaVShift) * cStride;
+			const unsigned char* c2 = (T::numPlanes==3) ? base + plane2 + (y >> T::chromaVShift) * cStride : c1 + 1;
+			r.u = vFirst ? c2 : c1;
+			r.v = vFirst ? c1 : c2;
+		}
+	}
+};
+
+
+bool pixel_convert_supported(PixelBufferFormat from, PixelBufferFormat to) {
+	const PixelFormatInfo* info = pixel_format_info(from);
+	if (info==NULL or info->family!=PIXEL_FAMILY_YUV or info->lumaStep==0) return false;
+	return (to==PIXELBUFFER_FMT_RGB3) or (to==PIXELBUFFER_FMT_BGR3) or (to==PIXELBUFFER_FMT_GREY);
+}
+
+
+void pixel_scale_map_init(PixelScaleMap& map, unsigned int srcWidth, unsigned int dstWidth) {
+	map.srcWidth = srcWidth;
+	map.dstWidth = dstWidth;
+	map.x.resize(dstWidth + 1);
+	for (unsigned int d=0; d<= dstWidth; d++) map.x[d] = scale_first(d, srcWidth, dstWidth);
+}
+
+
+bool pixel_convert_rows(PixelBuffer* src, PixelBuffer* dst, unsigned int y0, unsigned int y1, const PixelScaleMap* map) {
+	if (src==NULL or dst==NULL or src->buf==NULL or dst->buf==NULL) return false;
+	if (!pixel_convert_supported(src->fmt, dst->fmt)) return false;
+	if (src->width==0 or src->height==0 or dst->width==0 or dst->height==0) return false;
+	if (y1 > src->height) y1 = src->height;
+	if (dst->length < pixelbuffer_stride(dst) * dst->height) return false;
+
+	ConvertRowsKernel k;
+	k.dst = dst;
+	k.y0 = y0;
+	k.y1 = y1;
+	k.xmap = NULL;
+	k.ok = false;
+	PixelScaleMap local;
+	if (src->width!=dst->width or src->height!=dst->height) {
+		if (map==NULL or map->srcWidth!=src->width or map->dstWidth!=dst->width or map->x.size()!=dst->width + 1) {
+			pixel_scale_map_init(local, src->width, dst->width);		// one-off: callers converting streams keep one
+			map = &local;
+		}
+		k.xmap = &map->x[0];
+	}
+	pixelbuffer_dispatch(src, k);
+	return k.ok;
+}
+
+
+bool pixel_convert(PixelBuffer* src, PixelBuffer* dst) {
+	if (!pixel_convert_rows(src, dst, 0, src ? src->height : 0)) return false;
+	dst->sec = src->sec;
+	dst->usec = src->usec;
+	return true;
+}
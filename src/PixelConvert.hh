@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#ifndef PixelConvert_HH
+#define PixelConvert_HH
+
+#include <vector>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FormatTraits.hh"
+#include "Grabber_Helpers.hh"
+#include "FrameExecutor.hh"
+
+// YUV -> RGB/grey conversion (ITU-R BT.601, limited range input)
+// sources: GREY YUYV UYVY YV12 YU12 YVU9 YUV9 422P 411P NV12 NV21
+// destinations: RGB3 BGR3 GREY
+// dst must be allocated by the caller; when its size differs from src the picture is scaled in the
+// same pass (box filter: each destination pixel takes the mean luma of the source pixels it covers,
+// chroma is sampled at the center of them)
+
+bool pixel_convert_supported (PixelBufferFormat from, PixelBufferFormat to);
+
+// source columns of every destination column when scaling srcWidth to dstWidth: build it once per size
+struct PixelScaleMap {
+	unsigned int srcWidth;
+	unsigned int dstWidth;
+	std::vector<unsigned int> x;		// destination column d covers source columns [x[d], x[d+1]) (x[d] alone when empty)
+};
+void pixel_scale_map_init (PixelScaleMap& map, unsigned int srcWidth, unsigned int dstWidth);
+
+// convert rows [y0, y1) of src into the same rows of dst
+// (scaling: into the rows of dst whose first source row is in [y0, y1), so bands of src can be converted apart;
+// map is used when it was built for these widths, else one is built for the call)
+// returns false for unsupported formats or buffers too short for their format
+bool pixel_convert_rows (PixelBuffer* src, PixelBuffer* dst, unsigned int y0, unsigned int y1,
+			 const PixelScaleMap* map = NULL);
+
+// whole picture (timestamp is copied too)
+bool pixel_convert (PixelBuffer* src, PixelBuffer* dst);
+
+
+// band-safe conversion for FrameExecutor::run(src, kernel)
+class PixelConvertKernel : public BandKernel {
+public:
+	// map (may be NULL) as pixel_convert_rows() takes it
+	PixelConvertKernel(PixelBuffer* dst, const PixelScaleMap* map = NULL) { mDst = dst; mMap = map; mFailed = 0; }
+
+	bool band_safe(void) const { return true; }
+	void process_band(PixelBuffer* pb, unsigned int y0, unsigned int y1) {
+		if (!pixel_convert_rows(pb, mDst, y0, y1, mMap)) __atomic_store_n(&mFailed, 1, __ATOMIC_RELAXED);
+	}
+	// a band could not be converted (read after FrameExecutor::run() returned)
+	bool failed(void) const { return __atomic_load_n(&mFailed, __ATOMIC_RELAXED)!=0; }
+
+private:
+	PixelBuffer* mDst;
+	const PixelScaleMap* mMap;
+	int mFailed;			// set by any band, bands run in parallel
+};
+
+#endif /*PixelConvert_HH*/
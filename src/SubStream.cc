@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "SubStream.hh"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Grabber_Helpers.hh"
+#include "PixelConvert.hh"
+
+
+SubStream::SubStream(PixelBufferFormat fmt, unsigned int width, unsigned int height,
+		     unsigned int numBuffers, FrameExecutor* executor) {
+	mFmt = fmt;
+	mWidth = width;
+	mHeight = height;
+	mNumBuffers = numBuffers ? numBuffers : 1;
+	mExecutor = executor;
+	mScaleMap.srcWidth = 0;
+	mScaleMap.dstWidth = 0;
+	pthread_mutex_init(&mOrderLock, NULL);
+	mProduced = 0;
+	mDropped = 0;
+}
+
+
+SubStream::~SubStream() {
+	for (unsigned int i=0; i< mPixelBuffers.size(); i++) {
+		while (PIXELBUFFERISLOCKED(mPixelBuffers[i])) {usleep(100);}		// if something works on mPixelBuffers[i] we must wait
+		free(mPixelBuffers[i]->buf);
+		delete mPixelBuffers[i];
+	}
+	pthread_mutex_destroy(&mOrderLock);
+}
+
+
+bool SubStream::init(void) {
+	if (!mPixelBuffers.empty()) return true;
+	if (mWidth==0 or mHeight==0 or !pixel_convert_supported(PIXELBUFFER_FMT_YUYV, mFmt)) return false;
+	unsigned int length = pixelbuffer_length(mFmt, mWidth, mHeight);
+	unsigned int mMaxWidth = mWidth;				// used by PIXELBUFFERCLEARSTRUCT
+	unsigned int mMaxHeight = mHeight;
+	for (unsigned int i=0; i< mNumBuffers; i++) {
+		PixelBuffer* pb = new PixelBuffer();
+		PIXELBUFFERCLEARSTRUCT(pb);
+		pb->buf = malloc(length);
+		if (pb->buf==NULL) {
+			SUBSTREAM_WARNING("out of memory\n");
+			delete pb;
+			// no short pool: the next init() starts over (nothing was handed out yet)
+			for (unsigned int j=0; j< mPixelBuffers.size(); j++) {
+				free(mPixelBuffers[j]->buf);
+				delete mPixelBuffers[j];
+			}
+			mPixelBuffers.clear();
+			return false;
+		}
+		pb->length = length;
+		pb->fmt = mFmt;
+		mPixelBuffers.push_back(pb);
+	}
+	return true;
+}
+
+
+bool SubStream::process(PixelBuffer* src) {
+	if (mPixelBuffers.empty() or src==NULL or !pixel_convert_supported(src->fmt, mFmt)) return false;
+
+	// the oldest picture without locks leaves the order list while it is written
+	// (test and set at once: a consumer may be locking it right now)
+	pthread_mutex_lock(&mOrderLock);
+	int index = -1;
+	for (unsigned int i=0; i< mPixelBuffers.size() and index==-1; i++) {
+		bool listed = false;
+		for (std::list<int>::const_iterator it = mBuffersOrder.begin(); it!=mBuffersOrder.end(); it++) if (*it==(int) i) listed = true;
+		if (!listed and PIXELBUFFERTRYLOCK(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_Q)) index = i;	// never handed out yet
+	}
+	for (std::list<int>::reverse_iterator it = mBuffersOrder.rbegin(); it!=mBuffersOrder.rend() and index==-1; it++) {
+		if (PIXELBUFFERTRYLOCK(mPixelBuffers[*it],PIXEL_BUFFER_INUSE_GRABBER_Q)) index = *it;
+	}
+	if (index==-1) {
+		pthread_mutex_unlock(&mOrderLock);
+		mDropped++;
+		return false;
+	}
+	mBuffersOrder.remove(index);
+	PixelBuffer* dst = mPixelBuffers[index];
+	pthread_mutex_unlock(&mOrderLock);
+
+	if (mScaleMap.srcWidth!=src->width or mScaleMap.dstWidth!=mWidth) pixel_scale_map_init(mScaleMap, src->width, mWidth);
+	bool ok;
+	if (mExecutor!=NULL) {
+		PixelPlane planes[3];
+		ok = (src->buf!=NULL and pixelbuffer_planes(src, planes)!=0);
+		PixelConvertKernel kernel(dst, &mScaleMap);
+		if (ok) {
+			mExecutor->run(src, kernel);
+			ok = !kernel.failed();
+		}
+	}
+	else ok = pixel_convert_rows(src, dst, 0, src->height, &mScaleMap);
+	dst->sec = src->sec;
+	dst->usec = src->usec;
+	dst->meta = src->meta;
+	dst->meta.valid &= ~FRAME_META_STREAM;			// the metadata stream buffer belongs to the grabber
+	dst->meta.stream = NULL;
+	dst->meta.streamLength = 0;
+
+	pthread_mutex_lock(&mOrderLock);
+	CLEARPIXELBUFFERFLAG(dst,PIXEL_BUFFER_INUSE_GRABBER_Q);
+	if (ok) mBuffersOrder.push_front(index);
+	pthread_mutex_unlock(&mOrderLock);
+	if (!ok) {
+		mDropped++;
+		return false;
+	}
+	mProduced++;
+	return true;
+}
+
+
+PixelBuffer* SubStream::get_last_grabbed(void) {
+	return internal_last_grabbed(0);
+}
+
+
+PixelBuffer* SubStream::acquire_last_grabbed(unsigned int lock) {
+	if (lock==0) return NULL;
+	return internal_last_grabbed(lock);
+}
+
+
+PixelBuffer* SubStream::internal_last_grabbed(unsigned int lock) {
+	pthread_mutex_lock(&mOrderLock);
+	for (std::list<int>::const_iterator it = mBuffersOrder.begin(); it!=mBuffersOrder.end(); it++) {
+		// test and set at once: process() may be picking the same picture
+		if ( (lock==0) ? !PIXELBUFFERISLOCKED(mPixelBuffers[*it]) : PIXELBUFFERTRYLOCK(mPixelBuffers[*it], lock) ) {
+			PixelBuffer* pb = mPixelBuffers[*it];
+			pthread_mutex_unlock(&mOrderLock);
+			return pb;
+		}
+	}
+	pthread_mutex_unlock(&mOrderLock);
+	return NULL;
+}
+
+
+void SubStream::frame_grabbed(PixelBuffer* pb) {
+	process(pb);
+}
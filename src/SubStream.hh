@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef SubStream_HH
+#define SubStream_HH
+
+#include <pthread.h>
+#include <list>
+#include <vector>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FrameSink.hh"
+#include "FrameExecutor.hh"
+#include "PixelConvert.hh"
+
+/*
+  A SubStream derives a smaller (or otherwise converted) stream from every grabbed picture,
+  ie. a preview next to the full resolution capture, in a single scale + convert pass
+  (see pixel_convert_rows()). Add one SubStream per output to the grabber with add_sink().
+
+  Each SubStream has its own pool of PixelBuffers, handed out like the grabber's:
+  get_last_grabbed() gives the newest picture without locks; consumers lock what they keep
+  (PIXEL_BUFFER_INUSE_IMG_PROC) and the substream never writes a locked picture. From other
+  threads than the grabbing one use acquire_last_grabbed(), that hands the picture out locked.
+  When every picture is locked the new one is dropped (see get_dropped()).
+*/
+
+// default pool size: one being written, one newest, one held by a consumer
+#define SUBSTREAM_NUM_BUFFERS 3
+
+// SubStream logging helpers
+#define SUBSTREAM_WARNING_PREFIX	(" * WARNING - substream - ")
+
+// Used to be implemented using ACE helpers - need to switch to something else
+#define SUBSTREAM_WARNING(x) {}
+
+class SubStream : public FrameSink {
+public:
+	// width x height pictures in fmt (a destination of pixel_convert_supported())
+	// executor (not owned, may be NULL) splits the conversion in bands over its threads
+	SubStream(PixelBufferFormat fmt, unsigned int width, unsigned int height,
+		  unsigned int numBuffers = SUBSTREAM_NUM_BUFFERS, FrameExecutor* executor = NULL);
+	~SubStream();
+
+	// allocate the pool; false when out of memory or fmt isn't a conversion destination
+	bool init(void);
+
+	// scale and convert src into the pool (timestamp and metadata follow)
+	// returns false when src can't be converted or every picture of the pool is locked
+	bool process(PixelBuffer* src);
+
+	// newest picture without locks (NULL when none)
+	PixelBuffer* get_last_grabbed(void);
+	// same, with lock (ie. PIXEL_BUFFER_INUSE_IMG_PROC) already set so that process() can't write it
+	// before the caller gives it back with CLEARPIXELBUFFERFLAG(pb, lock)
+	PixelBuffer* acquire_last_grabbed(unsigned int lock);
+
+	unsigned long long get_produced(void) const { return mProduced; }
+	unsigned long long get_dropped(void) const { return mDropped; }
+
+	// FrameSink
+	void frame_grabbed(PixelBuffer* pb);
+
+private:
+	// the newest picture without locks, with lock set when not 0
+	PixelBuffer* internal_last_grabbed(unsigned int lock);
+
+	PixelBufferFormat mFmt;
+	unsigned int mWidth;
+	unsigned int mHeight;
+	unsigned int mNumBuffers;
+	FrameExecutor* mExecutor;
+
+	PixelScaleMap mScaleMap;		// for the last source width (process() only)
+
+	std::vector<PixelBuffer*> mPixelBuffers;
+	std::list<int> mBuffersOrder;		// indexes of mPixelBuffers holding pictures, newest first
+	pthread_mutex_t mOrderLock;
+
+	unsigned long long mProduced;
+	unsigned long long mDropped;
+};
+
+#endif /*SubStream_HH*/
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include "ThreadHelpers.hh"
+
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// struct sched_attr of sched_setattr(2): glibc has no wrapper
+struct GrabberSchedAttr {
+	unsigned int size;
+	unsigned int sched_policy;
+	unsigned long long sched_flags;
+	int sched_nice;
+	unsigned int sched_priority;
+	unsigned long long sched_runtime;
+	unsigned long long sched_deadline;
+	unsigned long long sched_period;
+};
+
+bool grabber_thread_set_affinity(pthread_t t, const std::vector<int>& cpus) {
+	if (cpus.size()==0) return true;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (unsigned int i=0; i< cpus.size(); i++) {
+		if (cpus[i] < 0 or cpus[i] >= CPU_SETSIZE) return false;
+		CPU_SET(cpus[i], &set);
+	}
+	return pthread_setaffinity_np(t, sizeof(cpu_set_t), &set) == 0;
+}
+
+
+bool grabber_thread_set_name(pthread_t t, const char* name) {
+	if (name==NULL) return false;
+	char shortName[16];
+	strncpy(shortName, name, sizeof(shortName) - 1);
+	shortName[sizeof(shortName) - 1] = '\0';
+	return pthread_setname_np(t, shortName) == 0;
+}
+
+
+unsigned int grabber_thread_num_cpus(void) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &set)!=0) return 1;
+	int n = CPU_COUNT(&set);
+	return (n > 0) ? (unsigned int) n : 1;
+}
+
+
+bool grabber_thread_apply_config(const GrabberThreadConfig& cfg) {
+	bool ok = true;
+	pthread_t self = pthread_self();
+	if (cfg.name.size()!=0 and !grabber_thread_set_name(self, cfg.name.c_str())) ok = false;
+	if (!grabber_thread_set_affinity(self, cfg.cpus)) ok = false;
+
+	if (cfg.policy==SCHED_DEADLINE) {
+		GrabberSchedAttr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.sched_policy = SCHED_DEADLINE;
+		attr.sched_runtime = cfg.dlRuntimeNs;
+		attr.sched_deadline = cfg.dlDeadlineNs ? cfg.dlDeadlineNs : cfg.dlPeriodNs;
+		attr.sched_period = cfg.dlPeriodNs;
+		if (syscall(__NR_sched_setattr, 0, &attr, 0)!=0) ok = false;
+	}
+	else if (cfg.policy!=SCHED_OTHER) {
+		sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = cfg.priority;
+		if (pthread_setschedparam(self, cfg.policy, &param)!=0) ok = false;
+	}
+
+	if (cfg.lockMemory and mlockall(MCL_CURRENT | MCL_FUTURE)!=0) ok = false;
+	return ok;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#ifndef ThreadHelpers_HH
+#define ThreadHelpers_HH
+
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+#include <string>
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// how a thread spun by the library runs (see GrabberInitData::captureThread)
+struct GrabberThreadConfig {
+	GrabberThreadConfig() {
+		policy = SCHED_OTHER;
+		priority = 0;
+		dlRuntimeNs = 0;
+		dlDeadlineNs = 0;
+		dlPeriodNs = 0;
+		lockMemory = false;
+	}
+
+	std::vector<int> cpus;		// cpus the thread may run on (empty: any)
+	int policy;			// SCHED_OTHER, SCHED_FIFO, SCHED_RR or SCHED_DEADLINE
+	int priority;			// SCHED_FIFO/SCHED_RR priority (1-99)
+	unsigned long long dlRuntimeNs;	// SCHED_DEADLINE budget: dlRuntimeNs of cpu every dlPeriodNs,
+	unsigned long long dlDeadlineNs;// to be used within dlDeadlineNs from the period start
+	unsigned long long dlPeriodNs;	// ie. the frame period
+	bool lockMemory;		// mlockall() the process so page faults don't stall capture
+	std::string name;		// thread name (empty: leave it)
+};
+
+// apply cfg to the calling thread: name, affinity, scheduling policy and memory lock
+// every step is tried; returns false if any of them failed (ie. no CAP_SYS_NICE for real-time policies)
+bool grabber_thread_apply_config (const GrabberThreadConfig& cfg);
+
+// pin thread t to the cpus listed in cpus (an empty list leaves the affinity alone)
+// returns false when the kernel refuses the set
+bool grabber_thread_set_affinity (pthread_t t, const std::vector<int>& cpus);
+
+// set the name shown by top/ps/perf (truncated to 15 chars)
+bool grabber_thread_set_name (pthread_t t, const char* name);
+
+// number of cpus the calling thread may run on
+unsigned int grabber_thread_num_cpus (void);
+
+#endif /*ThreadHelpers_HH*/
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include "Trace.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <vector>
+
+volatile int gTraceEnabled = 0;
+__thread TraceRing* gTraceRing = NULL;
+static __thread char gTraceThreadName[16];			// grabber_trace_set_thread_name() before the ring exists
+
+// rings of live threads, and of exited ones until their events are flushed (under gTraceRingsLock:
+// only ring creation, thread exit and flushes take it, never the recording)
+static TraceRing* gTraceRings = NULL;
+static pthread_mutex_t gTraceRingsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t gTraceRingKey;				// its destructor orphans the ring of an exiting thread
+static pthread_once_t gTraceRingKeyOnce = PTHREAD_ONCE_INIT;
+static unsigned int gTraceRingSize = 65536;
+
+// calibration: (ts, ns) sampled once, ns per tick in 32.32 fixed point
+static unsigned long long gTraceTs0 = 0, gTraceNs0 = 0;
+static volatile unsigned long long gTraceNsPerTickQ32 = 0;
+
+
+static unsigned long long trace_monotonic_ns(void) {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+
+static void trace_calibrate(void) {
+	if (gTraceNsPerTickQ32) return;
+#if defined(__x86_64__) || defined(__i386__)
+	// spin ~1ms once: good enough for durations; files get an exact calibration at flush time
+	unsigned long long ts0 = grabber_trace_now(), ns0 = trace_monotonic_ns();
+	unsigned long long ts1, ns1;
+	do { ts1 = grabber_trace_now(); ns1 = trace_monotonic_ns(); } while (ns1 - ns0 < 1000000ULL);
+	gTraceTs0 = ts0;
+	gTraceNs0 = ns0;
+	unsigned long long q = ((ns1 - ns0) << 32) / (ts1 - ts0 ? ts1 - ts0 : 1);
+	__atomic_store_n(&gTraceNsPerTickQ32, q ? q : 1, __ATOMIC_RELEASE);
+#else
+	gTraceTs0 = gTraceNs0 = trace_monotonic_ns();
+	__atomic_store_n(&gTraceNsPerTickQ32, 1ULL << 32, __ATOMIC_RELEASE);
+#endif
+}
+
+
+static void trace_free_ring(TraceRing* r) {
+	free(r->events);
+	delete r;
+}
+
+
+// unlink r from gTraceRings (under gTraceRingsLock)
+static void trace_unlink_ring(TraceRing* r) {
+	TraceRing** link = &gTraceRings;
+	while (*link and *link!=r) link = &(*link)->next;
+	if (*link) *link = r->next;
+}
+
+
+static void trace_thread_exit(void* ring) {
+	TraceRing* r = (TraceRing*) ring;
+	pthread_mutex_lock(&gTraceRingsLock);
+	if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE)==r->tail) {	// nothing left to flush
+		trace_unlink_ring(r);
+		trace_free_ring(r);
+	}
+	else r->orphan = true;
+	pthread_mutex_unlock(&gTraceRingsLock);
+}
+
+
+static void trace_create_key(void) {
+	pthread_key_create(&gTraceRingKey, trace_thread_exit);
+}
+
+
+unsigned long long grabber_trace_ticks_to_ns(unsigned long long ticks) {
+	unsigned long long q = gTraceNsPerTickQ32;
+	if (!q) { trace_calibrate(); q = gTraceNsPerTickQ32; }
+	// (ticks * q) >> 32 without overflowing for durations up to ~2^32 ticks
+	return ((ticks >> 32) * q) + (((ticks & 0xFFFFFFFFULL) * q) >> 32);
+}
+
+
+void grabber_trace_set_ring_size(unsigned int numEvents) {
+	unsigned int size = 1;
+	while (size < numEvents) size <<= 1;
+	gTraceRingSize = size;
+}
+
+
+TraceRing* grabber_trace_thread_ring(void) {
+	if (gTraceRing) return gTraceRing;
+	trace_calibrate();
+
+	TraceRing* r = new TraceRing();
+	unsigned int size = gTraceRingSize;
+	r->events = (TraceEvent*) calloc(size, sizeof(TraceEvent));
+	if (r->events==NULL) { delete r; return NULL; }
+	r->mask = size - 1;
+	r->head = 0;
+	r->tail = 0;
+	r->lost = 0;
+	r->tid = (int) syscall(SYS_gettid);
+	memset (r->name, 0, sizeof(r->name));
+	if (gTraceThreadName[0]) memcpy (r->name, gTraceThreadName, sizeof(r->name));
+	else prctl(PR_GET_NAME, r->name, 0, 0, 0);
+	r->orphan = false;
+
+	pthread_once(&gTraceRingKeyOnce, trace_create_key);
+	pthread_mutex_lock(&gTraceRingsLock);
+	r->next = gTraceRings;
+	gTraceRings = r;
+	pthread_mutex_unlock(&gTraceRingsLock);
+	pthread_setspecific(gTraceRingKey, r);				// given back when the thread exits
+
+	gTraceRing = r;
+	return r;
+}
+
+
+void grabber_trace_set_thread_name(const char* name) {
+	if (name==NULL) return;
+	strncpy(gTraceThreadName, name, sizeof(gTraceThreadName) - 1);
+	gTraceThreadName[sizeof(gTraceThreadName) - 1] = '\0';
+	TraceRing* r = gTraceRing;						// no ring yet: it takes the name when created
+	if (r!=NULL) memcpy(r->name, gTraceThreadName, sizeof(r->name));
+}
+
+
+bool grabber_trace_flush(const char* path) {
+	FILE* out = fopen(path, "wb");
+	if (out==NULL) return false;
+	trace_calibrate();
+
+	TraceFileHeader hdr;
+	memset (&hdr, 0, sizeof(TraceFileHeader));
+	hdr.magic = TRACE_FILE_MAGIC;
+	hdr.version = TRACE_FILE_VERSION;
+#if defined(__x86_64__) || defined(__i386__)
+	hdr.tsIsTSC = 1;
+#else
+	hdr.tsIsTSC = 0;
+#endif
+	hdr.ts0 = gTraceTs0;
+	hdr.ns0 = gTraceNs0;
+	hdr.ts1 = grabber_trace_now();
+	hdr.ns1 = trace_monotonic_ns();
+	pthread_mutex_lock(&gTraceRingsLock);		// threads exiting meanwhile keep their ring
+	TraceRing* first = gTraceRings;
+	for (TraceRing* r = first; r; r = r->next) hdr.numRings++;
+	bool ok = (fwrite(&hdr, sizeof(TraceFileHeader), 1, out) == 1);
+
+	std::vector<TraceEvent> copy;
+	for (TraceRing* r = first; r; r = r->next) {
+		unsigned long long size = (unsigned long long) r->mask + 1;
+		unsigned long long h = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		unsigned long long start = r->tail;
+		if (h - start > size) start = h - size;			// overwritten before we got there
+
+		copy.clear();
+		for (unsigned long long i = start; i < h; i++) copy.push_back(r->events[i & r->mask]);
+
+		// the owner kept writing while we copied: drop what may have been overwritten
+		unsigned long long h2 = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		unsigned long long validStart = start;
+		if (h2 + 1 > size and h2 + 1 - size > validStart) validStart = h2 + 1 - size;
+		if (validStart > h) validStart = h;
+
+		r->lost += validStart - r->tail;
+		r->tail = h;
+
+		TraceFileRing fr;
+		memset (&fr, 0, sizeof(TraceFileRing));
+		fr.tid = r->tid;
+		memcpy (fr.name, r->name, sizeof(fr.name));
+		fr.numEvents = (unsigned int) (h - validStart);
+		fr.lost = r->lost;
+		ok = ok and (fwrite(&fr, sizeof(TraceFileRing), 1, out) == 1);
+		if (fr.numEvents)
+			ok = ok and (fwrite(&copy[validStart - start], sizeof(TraceEvent), fr.numEvents, out) == fr.numEvents);
+	}
+	// rings of exited threads are done with
+	TraceRing** link = &gTraceRings;
+	while (*link) {
+		TraceRing* r = *link;
+		if (r->orphan) {
+			*link = r->next;
+			trace_free_ring(r);
+		}
+		else link = &r->next;
+	}
+	pthread_mutex_unlock(&gTraceRingsLock);
+	if (fclose(out)!=0) ok = false;
+	return ok;
+}
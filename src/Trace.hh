@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#ifndef Trace_HH
+#define Trace_HH
+
+#include <time.h>
+
+#include "Debug.hh"
+
+/*
+  Binary event tracing for the capture path.
+
+  Tracing is off until the application sets gTraceEnabled to 1: a trace point then costs
+  a load and a branch.
+  Every thread that records an event gets its own ring of TraceEvent (allocated on the
+  first event): recording is a store of 24 bytes plus a timestamp read, no locks, no
+  syscalls, no string building, so it can stay enabled in production.
+  The ring of a thread that exits is freed once its events are flushed (right away when
+  there is nothing left to flush).
+  Timestamps are raw TSC ticks on x86 (CLOCK_MONOTONIC ns elsewhere); the file written by
+  grabber_trace_flush() carries the tick/ns calibration.
+  When a ring is full the oldest events are overwritten and counted as lost.
+
+  Use tracetool to convert a flushed file to Chrome trace / Perfetto JSON.
+
+  Tracing is compiled in when Grabber_Trace is defined (see Debug.hh); use the
+  GRABBER_TRACE* macros so that call sites vanish when it isn't.
+*/
+
+// event types (TraceEvent::type) - arg0/arg1 meaning for each one
+enum TraceEventType {
+	TRACE_EV_NONE,
+	TRACE_EV_QBUF,		// arg0: buffer index
+	TRACE_EV_DQBUF,		// arg0: buffer index, arg1: ns spent in VIDIOC_DQBUF (event ts is the end)
+	TRACE_EV_READ,		// arg0: buffer index, arg1: ns spent in read() (event ts is the end)
+	TRACE_EV_MCAPTURE,	// arg0: buffer index, arg1: ns spent in VIDIOCMCAPTURE+VIDIOCSYNC (event ts is the end)
+	TRACE_EV_HANDOUT,	// arg0: buffer index given away by get_last_grabbed()
+	TRACE_EV_LOCKED,	// arg0: buffer index skipped because a consumer holds it
+	TRACE_EV_DROP,		// arg0: drop reason (TraceDropReason), arg1: frames dropped (see reasons)
+	TRACE_EV_ERRNO,		// arg0: source line, arg1: errno
+	TRACE_EV_USER,		// free for applications: arg0/arg1 are theirs
+	TRACE_EV_NUM_TYPES
+};
+
+enum TraceDropReason {
+	TRACE_DROP_NO_BUFFER,	// every PixelBuffer was locked
+	TRACE_DROP_DRIVER,	// the driver skipped frames (sequence gap)
+	TRACE_DROP_OLDEST,	// a queued frame was skipped for a newer one
+	TRACE_DROP_TIMEOUT,	// grab() gave up waiting: arg1 is the wait in us
+	TRACE_DROP_STALE,	// get_latest() refused a frame: arg1 is its age in us
+	TRACE_DROP_DECIMATED	// a frame was skipped to keep the frame rate (set_frame_rate())
+};
+
+struct TraceEvent {
+	unsigned long long ts;		// TSC ticks or ns, see TraceFileHeader
+	unsigned int type;		// TraceEventType
+	unsigned int arg0;
+	unsigned long long arg1;
+};
+
+struct TraceRing {
+	TraceEvent* events;
+	unsigned int mask;			// size-1 (size is a power of 2)
+	volatile unsigned long long head;	// written by the owner thread only
+	unsigned long long tail;		// first event not yet flushed (flusher only)
+	unsigned long long lost;		// events overwritten before being flushed
+	int tid;
+	char name[16];
+	bool orphan;				// the owner thread exited: freed by the next flush
+	TraceRing* next;			// rings list (see Trace.cc)
+};
+
+// trace file layout:
+//  TraceFileHeader
+//  for every ring: TraceFileRing followed by numEvents TraceEvent
+#define TRACE_FILE_MAGIC	((unsigned int) 0x47545243)	// 'GTRC'
+#define TRACE_FILE_VERSION	((unsigned int) 1)
+
+struct TraceFileHeader {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int numRings;
+	unsigned int tsIsTSC;		// 1: ts are TSC ticks, 0: ts are CLOCK_MONOTONIC ns
+	// two (ts, CLOCK_MONOTONIC ns) samples used to convert ts to ns
+	unsigned long long ts0, ns0;
+	unsigned long long ts1, ns1;
+};
+
+struct TraceFileRing {
+	int tid;
+	char name[16];
+	unsigned int numEvents;
+	unsigned long long lost;
+};
+
+
+// runtime switch (0 by default: set it to 1 to record events)
+extern volatile int gTraceEnabled;
+extern __thread TraceRing* gTraceRing;
+
+// size of rings created from now on (rounded up to a power of 2); default 65536 events
+void grabber_trace_set_ring_size(unsigned int numEvents);
+
+// name the ring of the calling thread (shows up as thread name in the converted trace)
+void grabber_trace_set_thread_name(const char* name);
+
+// create (on first use) the ring of the calling thread; NULL when out of memory
+TraceRing* grabber_trace_thread_ring(void);
+
+// append all events recorded since the last flush to the file at path
+// (a new file with its own header is written; returns false on I/O errors)
+bool grabber_trace_flush(const char* path);
+
+
+static inline unsigned long long grabber_trace_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long) hi << 32) | lo;
+#else
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long) t.tv_sec * 1000000000ULL + t.tv_nsec;
+#endif
+}
+
+// ticks -> ns using a rough calibration done on first use (good for durations in events)
+unsigned long long grabber_trace_ticks_to_ns(unsigned long long ticks);
+
+static inline void grabber_trace(unsigned int type, unsigned int arg0, unsigned long long arg1) {
+	if (!gTraceEnabled) return;
+	TraceRing* r = gTraceRing;
+	if (r==NULL) {
+		r = grabber_trace_thread_ring();
+		if (r==NULL) return;
+	}
+	unsigned long long h = r->head;
+	TraceEvent* e = &r->events[h & r->mask];
+	e->ts = grabber_trace_now();
+	e->type = type;
+	e->arg0 = arg0;
+	e->arg1 = arg1;
+	__atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);	// publish to the flusher
+}
+
+
+#ifdef Grabber_Trace
+#define GRABBER_TRACE(type, arg0, arg1)	grabber_trace((type), (arg0), (arg1))
+// GRABBER_TRACE_BEGIN(t0) ... GRABBER_TRACE_END(t0, type, arg0) records the duration of ... in arg1
+#define GRABBER_TRACE_BEGIN(t0)		unsigned long long t0 = grabber_trace_now()
+#define GRABBER_TRACE_END(t0, type, arg0) \
+	grabber_trace((type), (arg0), grabber_trace_ticks_to_ns(grabber_trace_now() - (t0)))
+#else
+#define GRABBER_TRACE(type, arg0, arg1)
+#define GRABBER_TRACE_BEGIN(t0)
+#define GRABBER_TRACE_END(t0, type, arg0)
+#endif
+
+#endif /*Trace_HH*/
@@ -45,6 +45,7 @@ V4L1_Device::V4L1_Device(GrabberInitData* initData) : Grabber(initData) {
 
 
 V4L1_Device::~V4L1_Device() {
+	stop_capture_thread();					// grab() must not run while we free everything
 	internal_reset();
 }
 
@@ -68,6 +69,7 @@ bool V4L1_Device::set_ctrl_value(GrabberControlID id, short newValue) {
 		V4L1DEV_WARNING("VIDIOCSPICT failed\n");
 		return false;
 	}
+	internal_ctrl_applied(pos, newValue);					// frames keep the old value until it is in effect
 	mGrabberControls[pos]->value= (__u32) newValue;
 	return true;
 }
@@ -105,7 +107,8 @@ bool V4L1_Device::init() {
 	// Set up best IO method
 	// try first with mmap, if it doesn't succeds than try with read()
 	if (! (internal_setup_io_MMAP()) ) {
-		mBuffersOrder.clear();
+		std::vector<PixelBuffer*> failed = internal_take_buffers();	// mmap failed: start over with read()
+		for (unsigned int i=0; i< failed.size(); i++) delete failed[i];
 		internal_setup_io_READ ();
 	}
 	// check if any IO method was set
@@ -121,6 +124,9 @@ bool V4L1_Device::init() {
 	else if (GET_V4L1DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE)) std::cout << "READ/WRITE\n";
 #endif
 
+	// read() IO: keep a read in flight on every buffer when an io_uring was given
+	if (GET_V4L1DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE) and internal_uring_start(mDevID)) internal_uring_queue_reads();
+
 	/* device inited successfully! */
 	return true;
 }
@@ -129,17 +135,15 @@ bool V4L1_Device::init() {
 void V4L1_Device::grab() {
 	if (mDevID<0) {	// check if this grabber was inited
 		V4L1DEV_WARNING("device not inited!\n");
+		GRABBERSTATSADD(mStats.ioErrors, 1);
 		return;
 	}
-	// search a buffer without locks
-	unsigned int pos = -1;
-	for (unsigned int index = 0; index < mPixelBuffers.size(); index++) {
-		if ( ! PIXELBUFFERISLOCKED(mPixelBuffers[index]) ) {			// if PixelBuffer has some locks than don't touch it
-			pos = index;
-			SETPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
-			break;
-		}
+	if (internal_uring_in_use()) {			// reads are already in flight, just reap one
+		internal_uring_grab();
+		return;
 	}
+	// search a buffer without locks (V4L1 has no driver queue: whatever the policy the picture is lost when none is free)
+	int pos = internal_get_free_buffer();
 	if (pos == -1)  { // if we get here or mPixelBuffers.size()==0 or no buffer with no lock was available
 		V4L1DEV_CRITICAL("no buffers available\n");
 		return;  
@@ -152,36 +156,48 @@ void V4L1_Device::grab() {
 		mVMMAP.width  = mMaxWidth;
 		mVMMAP.height = mMaxHeight;
 
-		if (xioctl( mDevID, VIDIOCMCAPTURE, &mVMMAP) <0) {
-			V4L1DEV_WARNING("VIDIOCMCAPTURE failed\n");
-			CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
-			return;
-		} 
-
-		if (xioctl( mDevID, VIDIOCSYNC, &pos) < 0) {
-			V4L1DEV_WARNING("VIDIOCSYNC failed\n");
-			CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
-			return;
-		} 
-		mBuffersOrder.push_front(pos);						// say to the grabber what is the actual PixelBuffer
+		do {									// V4L1 has no frame rate request: capture again over skipped frames
+			GRABBER_TRACE_BEGIN(capT0);
+			if (xioctl( mDevID, VIDIOCMCAPTURE, &mVMMAP) <0) {
+				V4L1DEV_WARNING("VIDIOCMCAPTURE failed\n");
+				GRABBERSTATSADD(mStats.ioErrors, 1);
+				CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
+				return;
+			} 
+
+			if (xioctl( mDevID, VIDIOCSYNC, &pos) < 0) {
+				V4L1DEV_WARNING("VIDIOCSYNC failed\n");
+				GRABBERSTATSADD(mStats.ioErrors, 1);
+				CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
+				return;
+			} 
+			GRABBER_TRACE_END(capT0, TRACE_EV_MCAPTURE, pos);
+			internal_stamp_now(pos);					// V4L1 gives no timestamp: use sync time
+		} while (internal_decimate(mPixelBuffers[pos]->sec, mPixelBuffers[pos]->usec));
 		CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
-		mBuffersOrder.pop_back();						// so that mBuffersOrder.size() is never > mPixelBuffers.size()
-		mPixelBuffers[pos]->sec = 0;						// set timestamp
-		mPixelBuffers[pos]->usec = 0;
-  
+		internal_frame_grabbed(pos);						// say to the grabber what is the actual PixelBuffer
 		return;
 	}
 
 	/*** READ/WRITE STREAMING ***/
 	else if (GET_V4L1DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE)) {
-		if (read(mDevID, mPixelBuffers[pos]->buf, mPixelBuffers[pos]->length) <0) {
-			CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
-			V4L1DEV_WARNING("read() error\n");
-			return;
-		}
-		mBuffersOrder.push_front(pos);						// say to the grabber what is the actual PixelBuffer
+		do {									// read again over frames skipped by decimation
+			if (!internal_wait_readable(mDevID)) {
+				CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
+				return;
+			}
+			GRABBER_TRACE_BEGIN(rdT0);
+			if (read(mDevID, mPixelBuffers[pos]->buf, mPixelBuffers[pos]->length) <0) {
+				CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
+				V4L1DEV_WARNING("read() error\n");
+				GRABBERSTATSADD(mStats.ioErrors, 1);
+				return;
+			}
+			GRABBER_TRACE_END(rdT0, TRACE_EV_READ, pos);
+			internal_stamp_now(pos);					// read() carries no timestamp
+		} while (internal_decimate(mPixelBuffers[pos]->sec, mPixelBuffers[pos]->usec));
 		CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
-		mBuffersOrder.pop_back();						// so that mBuffersOrder.size() is never > mPixelBuffers.size()
+		internal_frame_grabbed(pos);						// say to the grabber what is the actual PixelBuffer
 		return;
 	}
 	// if we get here this is very bad ...
@@ -189,6 +205,12 @@ void V4L1_Device::grab() {
 }
 
 
+int V4L1_Device::get_poll_fd(void) {
+	if (mDevID<0 or internal_uring_in_use() or !GET_V4L1DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE)) return -1;
+	return mDevID;
+}
+
+
 bool V4L1_Device::internal_setup_io_MMAP () {
 	if (mDevID<0) {	// if device is not yet open
 		V4L1DEV_WARNING("device not inited!\n");
@@ -224,18 +246,14 @@ bool V4L1_Device::internal_setup_io_MMAP () {
 		PIXELBUFFERCLEARSTRUCT(newBuf);				// reset PixelBuffer struct
 		newBuf->width = mMaxWidth;
 		newBuf->height = mMaxHeight;
-		mPixelBuffers.push_back(newBuf);			// push new buffer in the vector
-		mBuffersOrder.push_front(-1);				// make mBuffersOrder.size() = mPixelBuffers.size()
-		// -1 means that PixelBuffers are not yet valid
+		newBuf->fmt = v4l1_palette_to_pixelbuffer_fmt(mPicture.palette);
+		internal_add_buffer(newBuf);				// not valid yet
 	}
 
 	// mmap and assing start of mmapped buffer to the first PixelBuffer
 	mPixelBuffers[0]->buf = (unsigned char*)mmap(NULL, mBuf.size, PROT_READ|PROT_WRITE, MAP_SHARED, mDevID, 0);
 	if (mPixelBuffers[0]->buf == MAP_FAILED) {
-		CLEAR_V4L1DEV_FLAG(VIDEO_CAPTURE_USING_MMAP);
-		while (mPixelBuffers.size()!=0)  {
-			mPixelBuffers.erase(mPixelBuffers.begin());		// erase all entries in mPixelBuffers
-		}
+		CLEAR_V4L1DEV_FLAG(VIDEO_CAPTURE_USING_MMAP);		// init() frees the PixelBuffers
 		V4L1DEV_WARNING("mmap failed\n");
 		return false;
 	}
@@ -267,15 +285,14 @@ bool V4L1_Device::internal_setup_io_READ () {
 		PIXELBUFFERCLEARSTRUCT(newBuf);					// reset PixelBuffer struct
 		newBuf->width = mMaxWidth;
 		newBuf->height = mMaxHeight;
+		newBuf->fmt = v4l1_palette_to_pixelbuffer_fmt(mPicture.palette);
 		newBuf->length =  pixelbuffer_length ( v4l1_palette_to_pixelbuffer_fmt(mPicture.palette), mMaxWidth, mMaxHeight);
 		newBuf->buf = (void*) malloc( newBuf->length );			// malloc memory in respect to format, width and height
 		if (newBuf->buf==NULL) {
 			V4L1DEV_CRITICAL("out of memory\n");
 			return false;
 		}
-		mPixelBuffers.push_back(newBuf);					// push new buffer in the vector
-		mBuffersOrder.push_front(-1);					// make mBuffersOrder.size() = mPixelBuffers.size()
-		// -1 means that PixelBuffers are not yet valid
+		internal_add_buffer(newBuf);						// not valid yet
 	}
 	return true;
 }
@@ -283,29 +300,30 @@ bool V4L1_Device::internal_setup_io_READ () {
 
 
 void V4L1_Device::internal_reset () {
-	mBuffersOrder.clear();		 // avoid grabber to give away a bad PixelBuffer
+	internal_invalidate_frames();	 // avoid grabber to give away a bad PixelBuffer
 
 	if(mDevID>-1) {			// if video device was opened...
+		internal_uring_stop();		// reads in flight would be never unlocked
+		std::vector<PixelBuffer*> pixelBuffers = internal_take_buffers();	// nobody can get them from now on
 		// wait to acquire exclusive lock over PixelBuffers
-		for (int i=0; i< mPixelBuffers.size(); i++) {
-			assert(mPixelBuffers[i]);
-			while (PIXELBUFFERISLOCKED(mPixelBuffers[i])) {usleep(100);}			// if something is still working on pixbuf we must wait
-			SETPIXELBUFFERFLAG(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_DESTROY);
+		for (unsigned int i=0; i< pixelBuffers.size(); i++) {
+			assert(pixelBuffers[i]);
+			while (PIXELBUFFERISLOCKED(pixelBuffers[i])) {usleep(100);}			// if something is still working on pixbuf we must wait
+			SETPIXELBUFFERFLAG(pixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_DESTROY);
 		}
 
 		// free memory of mPixelBuffers
 		if (GET_V4L1DEV_FLAG(VIDEO_CAPTURE_USING_MMAP)) {					// mmap streaming case
-			if (mPixelBuffers[0]->buf != MAP_FAILED)
+			if (pixelBuffers.size()!=0 and pixelBuffers[0]->buf != MAP_FAILED)
 				if (mMMAPSize>-1)
-					munmap (mPixelBuffers[0]->buf, mMMAPSize);	// unmap memory
+					munmap (pixelBuffers[0]->buf, mMMAPSize);	// unmap memory
 		}
 		else if (GET_V4L1DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE)) {			// read()/write() streaming case
-			for (int i=0; i< mPixelBuffers.size(); i++) {
-				if (mPixelBuffers[i]->buf != NULL)  free (mPixelBuffers[i]->buf);	// free memory
-				delete mPixelBuffers[i];
+			for (unsigned int i=0; i< pixelBuffers.size(); i++) {
+				if (pixelBuffers[i]->buf != NULL)  free (pixelBuffers[i]->buf);	// free memory
 			}
 		}
-		while (mPixelBuffers.size()!=0) mPixelBuffers.erase(mPixelBuffers.begin());	// erase all entries in mPixelBuffers
+		for (unsigned int i=0; i< pixelBuffers.size(); i++) delete pixelBuffers[i];
 
 		close(mDevID);								// close device
 		mDevID = -1;								// reset device fd value
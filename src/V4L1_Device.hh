@@ -45,6 +45,7 @@ extern "C" {
 
 #include "Defaults.hh"
 #include "Grabber.hh"
+#include "Trace.hh"
 #include "GrabberInitData.hh"
 #include "GrabberControlData.hh"
 #include "Grabber_Helpers.hh"
@@ -97,10 +98,11 @@ extern "C" {
 #define V4L1DEV_CRITICAL_PREFIX	(" * !!! CRITICAL !!! - V4L1_dev - ")
 
 // Used to be implemented using ACE helpers - need to switch to something else
+// warnings and critical errors leave a TRACE_EV_ERRNO event (source line + errno) in the trace
 #define V4L1DEV_DEBUG(x) {}
 #define V4L1DEV_NOTICE(x) {}
-#define V4L1DEV_WARNING(x) {}
-#define V4L1DEV_CRITICAL(x) {}
+#define V4L1DEV_WARNING(x) { GRABBER_TRACE(TRACE_EV_ERRNO, __LINE__, errno); }
+#define V4L1DEV_CRITICAL(x) { GRABBER_TRACE(TRACE_EV_ERRNO, __LINE__, errno); }
 
 
 static int xioctl (int fd, int request, void *arg);
@@ -114,6 +116,8 @@ public:
 	bool set_ctrl_value(GrabberControlID id, short newValue);
 	bool init(void);
 	void grab(void);
+	// only read() io can be polled: VIDIOCSYNC has no fd to wait on
+	int get_poll_fd(void);
 
 	bool set_crop(CropData &cas);
 	bool get_crop(CropData &cas);
@@ -50,24 +50,15 @@ std::string v4l1_capabilities_to_string(video_capability &cap) {
 #endif
 
 
+// the format table (FormatTraits.hh) carries its own copy of the palette values
+#if (VIDEO_PALETTE_GREY != PIXEL_V4L1_GREY) || (VIDEO_PALETTE_RGB565 != PIXEL_V4L1_RGB565) || \
+    (VIDEO_PALETTE_RGB24 != PIXEL_V4L1_RGB24) || (VIDEO_PALETTE_RGB32 != PIXEL_V4L1_RGB32) || \
+    (VIDEO_PALETTE_RGB555 != PIXEL_V4L1_RGB555) || (VIDEO_PALETTE_YUYV != PIXEL_V4L1_YUYV) || \
+    (VIDEO_PALETTE_UYVY != PIXEL_V4L1_UYVY) || (VIDEO_PALETTE_YUV420 != PIXEL_V4L1_YUV420) || \
+    (VIDEO_PALETTE_YUV422P != PIXEL_V4L1_YUV422P) || (VIDEO_PALETTE_YUV411P != PIXEL_V4L1_YUV411P)
+#error "PIXEL_V4L1_* palettes don't match linux/videodev.h"
+#endif
+
 PixelBufferFormat v4l1_palette_to_pixelbuffer_fmt(unsigned int palette) {
-	switch (palette) {
-// RGB
-	case (VIDEO_PALETTE_RGB555)   :  return PIXELBUFFER_FMT_RGBO;
-	case (VIDEO_PALETTE_RGB565)   :  return PIXELBUFFER_FMT_RGBP;
-	case (VIDEO_PALETTE_RGB24)    :  return PIXELBUFFER_FMT_RGB3;
-	case (VIDEO_PALETTE_RGB32)    :  return PIXELBUFFER_FMT_RGB4;
-// YUV
-	case (VIDEO_PALETTE_GREY)     :  return PIXELBUFFER_FMT_GREY;
-	case (VIDEO_PALETTE_YUYV)     :  return PIXELBUFFER_FMT_YUYV;
-	case (VIDEO_PALETTE_UYVY)     :  return PIXELBUFFER_FMT_UYVY;
-	case (VIDEO_PALETTE_YUV420)   :  return PIXELBUFFER_FMT_YU12;
-	case (VIDEO_PALETTE_YUV422P)  :  return PIXELBUFFER_FMT_422P;
-	case (VIDEO_PALETTE_YUV411P)  :  return PIXELBUFFER_FMT_411P;
-	default : {
-		// if we get here fmt has bad value and this should never happen
-		return PIXELBUFFER_FMT_NONE;
-	}
-	}
+	return pixel_format_from_v4l1(palette);
 }
-
@@ -43,10 +43,27 @@ V4L2_Device::V4L2_Device(GrabberInitData* initData) : Grabber(initData) {
 	memset (&mV4L2Buf, 0, sizeof(v4l2_buffer));
 	mBuffersOrder.clear();			 		// avoid grabber to give away a bad PixelBuffer
 	mMaxNumBuffers = initData->maxNumBuffers;
+	mNumBuffers = mMaxNumBuffers;
+	mPathToMetaDev = initData->pathToMetaDev;
+
+	mAutoTune = initData->autoTuneBuffers;
+	mMinNumBuffers = initData->minNumBuffers;
+	if (mMinNumBuffers < V4L2_MIN_NUM_BUFFERS) mMinNumBuffers = V4L2_MIN_NUM_BUFFERS;
+	if (mMinNumBuffers > mMaxNumBuffers) mMinNumBuffers = mMaxNumBuffers;
+	mTargetDropRate = initData->targetDropRate;
+	if (mAutoTune) mNumBuffers = mMinNumBuffers;		// start small, grab() grows the set when needed
+	mCanCreateBufs = true;
+	mPrefault = initData->prefaultBuffers;
+	mHugePages = initData->hugePageBuffers;
+	mBufferAccess = initData->bufferAccess;
+	mCacheHints = false;
+	mTuneQuietWindows = 0;
+	internal_tune_start_window();
 }
 
 
 V4L2_Device::~V4L2_Device() {
+	stop_capture_thread();					// grab() must not run while we free everything
 	internal_reset();						// reset device state and free all memory on the heap
 }	
 
@@ -68,6 +85,7 @@ bool V4L2_Device::set_ctrl_value(GrabberControlID id, short newValue) {
 		return false;
 	}
 
+	internal_ctrl_applied(pos, newValue);					// frames keep the old value until it is in effect
 	mGrabberControls[pos]->value=newValue;
 	return true;
 }
@@ -161,6 +179,9 @@ bool V4L2_Device::init() {
 		return false;
 	}
 
+	// frame rate from GrabberInitData: before streaming, when drivers take it best
+	if (mFrameRate > 0) set_frame_rate(mFrameRate);
+
 	// activate streaming
 	// on fatal error reset grabber state
 	if (! (internal_activate_streaming(true)) ) {
@@ -168,6 +189,12 @@ bool V4L2_Device::init() {
 		return false;
 	}
 
+	// read() IO: keep a read in flight on every buffer when an io_uring was given
+	if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE) and internal_uring_start(mDevID)) internal_uring_queue_reads();
+
+	// driver metadata stream: frames are still fine without it
+	if (mPathToMetaDev.size()!=0 and !mMetaStream.open(mPathToMetaDev)) V4L2DEV_WARNING("cannot stream metadata device\n");
+
 	/* device inited successfully! */
 	return true;
 }
@@ -178,106 +205,96 @@ void V4L2_Device::grab() {
 
 	if (mDevID<0) {	// check if this grabber was inited
 		V4L2DEV_WARNING("device not inited!\n");
+		GRABBERSTATSADD(mStats.ioErrors, 1);
 		return;
 	}
 
-/*** MMAP STREAMING ***/
-	if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP)) {
-		// queue buffers
-		for (unsigned int i = 0; i < mPixelBuffers.size(); i++) {
-			if ( PIXELBUFFERISLOCKED(mPixelBuffers[i]) ) continue;			// if PixelBuffer has some locks than don't touch it
-			memset (&mV4L2Buf, 0, sizeof(v4l2_buffer));				// reset struct to 0s
-			mV4L2Buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			mV4L2Buf.memory = V4L2_MEMORY_MMAP;
-			mV4L2Buf.index = i;
-
-			SETPIXELBUFFERFLAG(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_Q);
-			if ( xioctl( mDevID, VIDIOC_QBUF, &mV4L2Buf) == -1) {
-				V4L2DEV_WARNING("VIDIOC_QBUF failed\n");
-				CLEARPIXELBUFFERFLAG(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_Q);	// clear in use flag as the pixbuf was not queued
-			}
-		}
-		// dequeue a filled PixelBuffer from driver
-		memset (&mV4L2Buf, 0, sizeof(v4l2_buffer));					// reset struct to 0s
-		mV4L2Buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		mV4L2Buf.memory = V4L2_MEMORY_MMAP;
-		if ( xioctl(mDevID, VIDIOC_DQBUF, &mV4L2Buf) == -1) {
-			V4L2DEV_WARNING("VIDIOC_DQBUF failed\n");
-			return;
+/*** MMAP and PTRS STREAMING ***/
+	if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP) or GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS)) {
+		internal_tune_buffers();
+		if (mDevID<0) return;						// a failed restream resets the device
+
+		unsigned int queued = internal_queue_free();
+		if (queued==0) {						// DQBUF would block forever
+			int pos = internal_get_free_buffer();			// waits with GRABBER_OVERRUN_BLOCK, counts the drop
+			if (pos < 0) return;
+			if (!internal_qbuf(pos)) return;
+			queued = 1;
 		}
-		else {
-			mBuffersOrder.push_front(mV4L2Buf.index);					// say to the grabber what is the actual PixelBuffer
-			CLEARPIXELBUFFERFLAG(mPixelBuffers[mV4L2Buf.index],PIXEL_BUFFER_INUSE_GRABBER_Q);
-			mBuffersOrder.pop_back();							// so that mBuffersOrder.size() is never > mPixelBuffers.size()
-			mPixelBuffers[mV4L2Buf.index]->sec = mV4L2Buf.timestamp.tv_sec;		// set timestamp
-			mPixelBuffers[mV4L2Buf.index]->usec = mV4L2Buf.timestamp.tv_usec;
 
-		}
-		return;
-	}
-/*** PTRS STREAMING ***/
-	else if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS)) {
-		// queue buffers
-		for (unsigned int index = 0; index < mPixelBuffers.size(); index++) {
-			if ( PIXELBUFFERISLOCKED(mPixelBuffers[index]) ) continue;		// if PixelBuffer has some locks than don't touch it
-
-			memset (&mV4L2Buf, 0, sizeof(v4l2_buffer));				// reset struct to 0s
-			mV4L2Buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			mV4L2Buf.memory = V4L2_MEMORY_USERPTR;
-			mV4L2Buf.m.userptr = (unsigned long) mPixelBuffers[index]->buf;
-			mV4L2Buf.length = mPixelBuffers[index]->length;
-
-			SETPIXELBUFFERFLAG(mPixelBuffers[index],PIXEL_BUFFER_INUSE_GRABBER_Q);
-			if ( xioctl( mDevID, VIDIOC_QBUF, &mV4L2Buf) == -1) {
-				V4L2DEV_WARNING("VIDIOC_QBUF failed\n");
-				CLEARPIXELBUFFERFLAG(mPixelBuffers[index],PIXEL_BUFFER_INUSE_GRABBER_Q);
+		while (true) {
+			// dequeue a filled PixelBuffer from driver
+			if (!internal_wait_readable(mDevID)) return;
+			GRABBER_TRACE_BEGIN(dqT0);
+			if (!internal_dqbuf(mV4L2Buf)) return;
+			GRABBER_TRACE_END(dqT0, TRACE_EV_DQBUF, mV4L2Buf.index);
+
+			if (mOverrunPolicy==GRABBER_OVERRUN_DROP_OLDEST) {
+				// more pictures ready: hand out the newest one and give the older ones back to the driver
+				v4l2_buffer newer;
+				pollfd pfd;
+				pfd.fd = mDevID;
+				pfd.events = POLLIN;
+				pfd.revents = 0;
+				while (poll(&pfd, 1, 0) > 0 and (pfd.revents & POLLIN)) {
+					if (!internal_dqbuf(newer)) break;		// keep the one we have
+					internal_account_sequence(mV4L2Buf.sequence);
+					CLEARPIXELBUFFERFLAG(mPixelBuffers[mV4L2Buf.index],PIXEL_BUFFER_INUSE_GRABBER_Q);
+					if (internal_qbuf(mV4L2Buf.index)) GRABBERSTATSADD(mStats.droppedOldest, 1);
+					else {						// left free: internal_queue_free() retries it
+						queued--;
+						GRABBERSTATSADD(mStats.ioErrors, 1);
+					}
+					mFrameCount++;
+					GRABBER_TRACE(TRACE_EV_DROP, TRACE_DROP_OLDEST, 1);
+					mV4L2Buf = newer;
+					pfd.revents = 0;
+				}
 			}
-		}
-
-		// dequeue a filled PixelBuffer from driver
-		memset (&mV4L2Buf, 0, sizeof(v4l2_buffer));					// reset struct to 0s
-		mV4L2Buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		mV4L2Buf.memory = V4L2_MEMORY_USERPTR;
-		if ( xioctl(mDevID, VIDIOC_DQBUF, &mV4L2Buf) == -1) {
-			V4L2DEV_WARNING("VIDIOC_DQBUF failed\n");
-			return;
-		}
-		else {
+			if (!internal_decimate(mV4L2Buf.timestamp.tv_sec, mV4L2Buf.timestamp.tv_usec)) break;
+			// not wanted at this rate: straight back to the driver, untouched
+			internal_account_sequence(mV4L2Buf.sequence);
 			CLEARPIXELBUFFERFLAG(mPixelBuffers[mV4L2Buf.index],PIXEL_BUFFER_INUSE_GRABBER_Q);
-			mBuffersOrder.push_front(mV4L2Buf.index);					// say to the grabber what is the actual PixelBuffer
-			mBuffersOrder.pop_back();							// so that mBuffersOrder.size() is never > mPixelBuffers.size()
-			mPixelBuffers[mV4L2Buf.index]->sec = mV4L2Buf.timestamp.tv_sec;		// set timestamp
-			mPixelBuffers[mV4L2Buf.index]->usec = mV4L2Buf.timestamp.tv_usec;
+			if (!internal_qbuf(mV4L2Buf.index)) queued--;
+			if (queued==0) return;
 		}
+		internal_tune_account(queued - 1);
+		internal_dqbuf_done(mV4L2Buf);
 		return;
 	}
 /*** READ/WRITE STREAMING ***/
 	else if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE)) {
-		// search a buffer without locks
-		unsigned int pos = -1;
-		for (unsigned int index = 0; index < mPixelBuffers.size(); index++) {
-			if ( ! PIXELBUFFERISLOCKED(mPixelBuffers[index]) ) {			// if PixelBuffer has some locks than don't touch it
-				pos = index;
-				SETPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
-				break;
-			}
+		if (internal_uring_in_use()) {
+			internal_uring_grab();
+			return;
 		}
+		// search a buffer without locks
+		int pos = internal_get_free_buffer();
 		if (pos == -1)  { // if we get here: no buffer is available or mPixelBuffers.size()==0 
 			V4L2DEV_CRITICAL("no buffers available\n");
 			return;  
 		}
+		do {									// read again over frames skipped by decimation
+			if (!internal_wait_readable(mDevID)) {
+				CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
+				return;
+			}
 
-		if (read(mDevID, mPixelBuffers[pos]->buf, mPixelBuffers[pos]->length) <0) {
-			CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
-			V4L2DEV_WARNING("read() error\n");
+			GRABBER_TRACE_BEGIN(rdT0);
+			if (read(mDevID, mPixelBuffers[pos]->buf, mPixelBuffers[pos]->length) <0) {
+				CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
+				V4L2DEV_WARNING("read() error\n");
+				GRABBERSTATSADD(mStats.ioErrors, 1);
 #ifdef V4L2_Device_Verbose
-			std::cout << "on grab() - read : errno : "<< errnoToString(errno) << "\n";
+				std::cout << "on grab() - read : errno : "<< errnoToString(errno) << "\n";
 #endif
-			return;
-		}
+				return;
+			}
+			GRABBER_TRACE_END(rdT0, TRACE_EV_READ, pos);
+			internal_stamp_now(pos);					// read() carries no timestamp
+		} while (internal_decimate(mPixelBuffers[pos]->sec, mPixelBuffers[pos]->usec));
 		CLEARPIXELBUFFERFLAG(mPixelBuffers[pos],PIXEL_BUFFER_INUSE_GRABBER_Q);
-		mBuffersOrder.push_front(pos);					// say to the grabber what is the actual PixelBuffer
-		mBuffersOrder.pop_back();						// so that mBuffersOrder.size() is never > mPixelBuffers.size()
+		internal_frame_grabbed(pos);					// say to the grabber what is the actual PixelBuffer
 		return;
 	}
 	// if we get here this is very bad ...
@@ -285,6 +302,463 @@ void V4L2_Device::grab() {
 }
 
 
+unsigned int V4L2_Device::grab_all(std::vector<PixelBuffer*>& frames, bool releaseOlder) {
+	frames.clear();
+	if (mDevID<0) {
+		V4L2DEV_WARNING("device not inited!\n");
+		return 0;
+	}
+	if (!(GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP) or GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS)))
+		return Grabber::grab_all(frames, releaseOlder);
+
+	internal_tune_buffers();
+	if (mDevID<0) return 0;
+	unsigned int queued = internal_queue_free();
+	if (queued==0) {
+		int pos = internal_get_free_buffer();
+		if (pos < 0) return 0;
+		if (!internal_qbuf(pos)) return 0;
+		queued = 1;
+	}
+
+	unsigned int kept = 0;
+	while (kept==0) {
+		// wait for the first picture, then take whatever else is ready without blocking
+		mReady.clear();
+		if (!internal_wait_readable(mDevID)) return 0;
+		v4l2_buffer buf;
+		GRABBER_TRACE_BEGIN(dqT0);
+		if (!internal_dqbuf(buf)) return 0;
+		GRABBER_TRACE_END(dqT0, TRACE_EV_DQBUF, buf.index);
+		mReady.push_back(buf);
+		pollfd pfd;
+		pfd.fd = mDevID;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		while (mReady.size() < queued and poll(&pfd, 1, 0) > 0 and (pfd.revents & POLLIN)) {
+			if (!internal_dqbuf(buf)) break;
+			mReady.push_back(buf);
+			pfd.revents = 0;
+		}
+		internal_tune_account(queued - mReady.size());
+
+		// frames over the set_frame_rate() rate go back right away
+		for (unsigned int i=0; i< mReady.size(); i++) {
+			if (internal_decimate(mReady[i].timestamp.tv_sec, mReady[i].timestamp.tv_usec)) {
+				internal_account_sequence(mReady[i].sequence);
+				CLEARPIXELBUFFERFLAG(mPixelBuffers[mReady[i].index],PIXEL_BUFFER_INUSE_GRABBER_Q);
+				if (!internal_qbuf(mReady[i].index)) queued--;
+			}
+			else mReady[kept++] = mReady[i];
+		}
+		if (kept==0 and queued==0) return 0;
+	}
+
+	for (unsigned int i=0; i< kept; i++) {
+		if (releaseOlder and i + 1 < kept) {
+			internal_account_sequence(mReady[i].sequence);
+			CLEARPIXELBUFFERFLAG(mPixelBuffers[mReady[i].index],PIXEL_BUFFER_INUSE_GRABBER_Q);
+			if (internal_qbuf(mReady[i].index)) GRABBERSTATSADD(mStats.droppedOldest, 1);
+			else GRABBERSTATSADD(mStats.ioErrors, 1);		// left free: internal_queue_free() retries it
+			mFrameCount++;
+			GRABBER_TRACE(TRACE_EV_DROP, TRACE_DROP_OLDEST, 1);
+			continue;
+		}
+		internal_dqbuf_done(mReady[i]);
+		frames.push_back(mPixelBuffers[mReady[i].index]);
+	}
+	mV4L2Buf = mReady[kept - 1];
+	return frames.size();
+}
+
+
+unsigned int V4L2_Device::internal_queue_free(void) {
+	unsigned int queued = 0;
+	for (unsigned int i = 0; i < mPixelBuffers.size(); i++) {
+		if (GETPIXELBUFFERFLAG(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_Q)) { queued++; continue; }	// already in the driver
+		// if PixelBuffer has some locks than don't touch it (test and set: a consumer may be taking it right now)
+		if ( !PIXELBUFFERTRYLOCK(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_Q) ) continue;
+		if (internal_qbuf(i)) queued++;
+	}
+	return queued;
+}
+
+
+int V4L2_Device::get_poll_fd(void) {
+	if (mDevID<0 or internal_uring_in_use()) return -1;			// io_uring reads complete on the ring
+	return mDevID;
+}
+
+
+bool V4L2_Device::arm(void) {
+	if (mDevID<0) return false;
+	if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP) or GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS)) {
+		internal_tune_buffers();						// like grab(): only between two pictures
+		if (mDevID<0) return false;
+		unsigned int queued = internal_queue_free();
+		if (queued==0) {						// sinks may hold some
+			internal_buffers_exhausted();
+			queued = internal_queue_free();
+		}
+		return queued > 0;
+	}
+	return true;
+}
+
+
+bool V4L2_Device::internal_qbuf(unsigned int index) {
+	v4l2_buffer qBuf;
+	memset (&qBuf, 0, sizeof(v4l2_buffer));					// reset struct to 0s
+	qBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	qBuf.index = index;
+	if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP)) {
+		qBuf.memory = V4L2_MEMORY_MMAP;
+		qBuf.flags = internal_cache_hints();
+	}
+	else {
+		qBuf.memory = V4L2_MEMORY_USERPTR;
+		qBuf.m.userptr = (unsigned long) mPixelBuffers[index]->buf;
+		qBuf.length = mPixelBuffers[index]->length;
+	}
+
+	SETPIXELBUFFERFLAG(mPixelBuffers[index],PIXEL_BUFFER_INUSE_GRABBER_Q);
+	if ( xioctl( mDevID, VIDIOC_QBUF, &qBuf) == -1) {
+		V4L2DEV_WARNING("VIDIOC_QBUF failed\n");
+		CLEARPIXELBUFFERFLAG(mPixelBuffers[index],PIXEL_BUFFER_INUSE_GRABBER_Q);	// clear in use flag as the pixbuf was not queued
+		return false;
+	}
+	GRABBER_TRACE(TRACE_EV_QBUF, index, 0);
+	return true;
+}
+
+
+bool V4L2_Device::internal_dqbuf(v4l2_buffer &dqBuf) {
+	memset (&dqBuf, 0, sizeof(v4l2_buffer));					// reset struct to 0s
+	dqBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP)) dqBuf.memory = V4L2_MEMORY_MMAP;
+	else dqBuf.memory = V4L2_MEMORY_USERPTR;
+	if ( xioctl(mDevID, VIDIOC_DQBUF, &dqBuf) == -1) {
+		V4L2DEV_WARNING("VIDIOC_DQBUF failed\n");
+		if (errno!=EAGAIN) GRABBERSTATSADD(mStats.ioErrors, 1);
+		return false;
+	}
+	// wall clock timestamps (old drivers) can't be compared with CLOCK_MONOTONIC
+	if ((dqBuf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) mTimestampClock = CLOCK_MONOTONIC;
+	else mTimestampClock = CLOCK_REALTIME;
+	// copied timestamps (mem2mem) come from whoever queued the source: their clock is unknown
+	mDriverClock = ((dqBuf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_COPY) ? -1 : (int) mTimestampClock;
+	return true;
+}
+
+
+void V4L2_Device::internal_dqbuf_done(const v4l2_buffer &dqBuf) {
+	internal_account_sequence(dqBuf.sequence);
+	CLEARPIXELBUFFERFLAG(mPixelBuffers[dqBuf.index],PIXEL_BUFFER_INUSE_GRABBER_Q);
+	mPixelBuffers[dqBuf.index]->sec = dqBuf.timestamp.tv_sec;		// set timestamp
+	mPixelBuffers[dqBuf.index]->usec = dqBuf.timestamp.tv_usec;
+
+	FrameMetadata* meta = &mPixelBuffers[dqBuf.index]->meta;
+	meta->valid = FRAME_META_DRIVER;
+	meta->sequence = dqBuf.sequence;
+	meta->flags = dqBuf.flags;
+	meta->field = dqBuf.field;
+	meta->bytesused = dqBuf.bytesused;
+	if (dqBuf.flags & V4L2_BUF_FLAG_TIMECODE) {
+		meta->valid |= FRAME_META_TIMECODE;
+		meta->tcType = dqBuf.timecode.type;
+		meta->tcFlags = dqBuf.timecode.flags;
+		meta->tcFrames = dqBuf.timecode.frames;
+		meta->tcSeconds = dqBuf.timecode.seconds;
+		meta->tcMinutes = dqBuf.timecode.minutes;
+		meta->tcHours = dqBuf.timecode.hours;
+	}
+	meta->stream = NULL;
+	meta->streamLength = 0;
+	if (mMetaStream.is_open()) {
+		if (mMetaStore.size() < mPixelBuffers.size()) mMetaStore.resize(mPixelBuffers.size());
+		if (mMetaStream.collect(dqBuf.timestamp, mMetaStore[dqBuf.index]) > 0) {
+			meta->valid |= FRAME_META_STREAM;
+			meta->stream = &mMetaStore[dqBuf.index][0];
+			meta->streamLength = mMetaStore[dqBuf.index].size();
+		}
+	}
+	internal_frame_grabbed(dqBuf.index);					// say to the grabber what is the actual PixelBuffer
+}
+
+
+void V4L2_Device::internal_tune_start_window(void) {
+	mTuneFrames = 0;
+	mTuneDrops0 = GRABBERSTATSGET(mStats.droppedNewest) + GRABBERSTATSGET(mStats.droppedTimeout);
+	mTuneMinQueued = (unsigned int) -1;
+}
+
+
+void V4L2_Device::internal_tune_account(unsigned int queued) {
+	if (!mAutoTune) return;
+	mTuneFrames++;
+	if (queued < mTuneMinQueued) mTuneMinQueued = queued;		// buffers held by consumers show up here too
+}
+
+
+void V4L2_Device::internal_tune_buffers(void) {
+	if (!mAutoTune or mTuneFrames < V4L2_TUNE_WINDOW_FRAMES) return;
+
+	unsigned long long dropsNow = GRABBERSTATSGET(mStats.droppedNewest) + GRABBERSTATSGET(mStats.droppedTimeout);
+	unsigned long long drops = (dropsNow >= mTuneDrops0) ? dropsNow - mTuneDrops0 : dropsNow;	// reset_stats() meanwhile
+	float dropRate = (float) drops / (float) (mTuneFrames + drops);
+	unsigned int numBuffers = mPixelBuffers.size();
+
+	if (dropRate > mTargetDropRate and numBuffers < mMaxNumBuffers) {
+		mTuneQuietWindows = 0;
+		// adding a buffer while streaming doesn't lose frames, restreaming does
+		if (!mCanCreateBufs or !internal_create_buffers(1)) {
+			mCanCreateBufs = false;
+			if (!internal_consumers_hold_buffers()) internal_restream(numBuffers + 1);	// else next window
+		}
+	}
+	else if (drops==0 and mTuneMinQueued >= 2 and numBuffers > mMinNumBuffers) {
+		// V4L2 can't free a single buffer: shrinking needs a restream, so be sure first
+		if (++mTuneQuietWindows >= V4L2_TUNE_SHRINK_WINDOWS) {
+			// a consumer keeping a picture would stall capture: postpone to a window where none does
+			if (internal_consumers_hold_buffers() or !internal_restream(numBuffers - 1))
+				mTuneQuietWindows = V4L2_TUNE_SHRINK_WINDOWS - 1;
+			else mTuneQuietWindows = 0;
+		}
+	}
+	else mTuneQuietWindows = 0;
+
+	internal_tune_start_window();
+}
+
+
+bool V4L2_Device::internal_create_buffers(unsigned int count) {
+	v4l2_create_buffers createBufs;
+	memset (&createBufs, 0, sizeof(v4l2_create_buffers));
+	createBufs.count = count;
+	createBufs.format = mImageFormat;
+	if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP)) {
+		createBufs.memory = V4L2_MEMORY_MMAP;
+		createBufs.flags = internal_memory_flags();			// must match the buffers of REQBUFS
+	}
+	else createBufs.memory = V4L2_MEMORY_USERPTR;
+
+	if (xioctl (mDevID, VIDIOC_CREATE_BUFS, &createBufs) == -1 or createBufs.count==0) {
+		V4L2DEV_NOTICE("VIDIOC_CREATE_BUFS failed\n");
+		return false;
+	}
+	if (createBufs.index != mPixelBuffers.size()) {			// indexes must follow ours
+		V4L2DEV_WARNING("VIDIOC_CREATE_BUFS returned unexpected indexes\n");
+		return false;
+	}
+
+	for (unsigned int bufIndex = createBufs.index; bufIndex < createBufs.index + createBufs.count; bufIndex++) {
+		PixelBuffer* newBuf = new PixelBuffer();
+		PIXELBUFFERCLEARSTRUCT(newBuf);						// reset PixelBuffer struct
+		newBuf->width = mMaxWidth;
+		newBuf->height = mMaxHeight;
+		newBuf->fmt = v4l2_pix_fmt_to_pixelbuffer_fmt(mImageFormat.fmt.pix.pixelformat);
+		newBuf->stride = mImageFormat.fmt.pix.bytesperline;			// 0 when the driver doesn't tell
+
+		if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP)) {
+			v4l2_buffer queryBuf;
+			memset (&queryBuf, 0 , sizeof(v4l2_buffer));
+			queryBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			queryBuf.memory = V4L2_MEMORY_MMAP;
+			queryBuf.index = bufIndex;
+			if (xioctl ( mDevID, VIDIOC_QUERYBUF, &queryBuf) == -1) {
+				V4L2DEV_WARNING("VIDIOC_QUERYBUF failed\n");
+				delete newBuf;
+				return false;
+			}
+			newBuf->length = queryBuf.length;
+			newBuf->buf = internal_map_buffer (queryBuf.length, queryBuf.m.offset);
+			if (newBuf->buf == MAP_FAILED) {
+				V4L2DEV_WARNING("mmap failed\n");
+				delete newBuf;
+				return false;
+			}
+		}
+		else {
+			newBuf->length =  pixelbuffer_length (newBuf->fmt, mMaxWidth, mMaxHeight);
+			newBuf->buf = internal_alloc_buffer( newBuf->length );
+			if (newBuf->buf==NULL) {
+				V4L2DEV_CRITICAL("out of memory\n");
+				delete newBuf;
+				return false;
+			}
+		}
+		internal_add_buffer(newBuf);						// queued by the next grab()
+	}
+	mNumBuffers = mPixelBuffers.size();
+	return true;
+}
+
+
+bool V4L2_Device::internal_consumers_hold_buffers(void) {
+	for (unsigned int i=0; i< mPixelBuffers.size(); i++) {
+		if (PIXELBUFFERISLOCKED(mPixelBuffers[i]) & ~PIXEL_BUFFER_INUSE_GRABBER_Q) return true;
+	}
+	return false;
+}
+
+
+bool V4L2_Device::internal_restream(unsigned int numBuffers) {
+	bool useMMAP = GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP);
+
+	internal_invalidate_frames();						// no new consumers from now on
+	for (unsigned int waitedUs = 0; internal_consumers_hold_buffers(); waitedUs += 100) {
+		if (waitedUs >= V4L2_TUNE_RELEASE_US) return false;		// still streaming: grab() goes on
+		usleep(100);
+	}
+	internal_activate_streaming(false);
+	internal_free_pixbufs_mem ();						// waits for consumers to release their buffers
+
+	v4l2_requestbuffers reqBuf;						// give buffers back to the driver (after munmap!)
+	memset (&reqBuf, 0, sizeof (reqBuf));
+	reqBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	reqBuf.memory = useMMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+	reqBuf.count = 0;
+	if (xioctl (mDevID, VIDIOC_REQBUFS, &reqBuf) == -1) V4L2DEV_WARNING("VIDIOC_REQBUFS failed\n");
+
+	mNumBuffers = numBuffers;
+	mHaveSequence = false;							// sequence numbers restart with streaming
+	mClock.reset();								// and so may an unknown driver clock
+	bool done = useMMAP ? internal_setup_io_MMAP() : internal_setup_io_PTRS();
+	if (!done or !internal_activate_streaming(true)) {
+		V4L2DEV_CRITICAL("restream failed\n");
+		internal_reset();
+		return false;
+	}
+	mNumBuffers = mPixelBuffers.size();					// the driver may give more
+	return true;
+}
+
+
+bool V4L2_Device::reconfigure(const GrabberReconfig &config) {
+	if (mDevID==-1) return false;
+	bool useMMAP = GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP);
+	bool usePTRS = GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS);
+	bool useRing = internal_uring_in_use();
+
+	internal_uring_stop();							// reads in flight would land in resized buffers
+	internal_activate_streaming(false);
+	internal_invalidate_frames();						// no old picture is handed out from now on
+	for (unsigned int i = 0; i < mPixelBuffers.size(); i++)		// consumers may still look at the old picture
+		while (PIXELBUFFERISLOCKED(mPixelBuffers[i])) {usleep(100);}
+
+	// drivers refuse S_FMT while buffers are requested (EBUSY): give them back first
+	v4l2_requestbuffers reqBuf;
+	memset (&reqBuf, 0, sizeof (reqBuf));
+	reqBuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	reqBuf.count = 0;
+	if (useMMAP) {
+		internal_free_pixbufs_mem ();					// driver memory: can't be kept (munmap before REQBUFS)
+		reqBuf.memory = V4L2_MEMORY_MMAP;
+		if (xioctl (mDevID, VIDIOC_REQBUFS, &reqBuf) == -1) V4L2DEV_WARNING("VIDIOC_REQBUFS failed\n");
+	}
+	else if (usePTRS) {
+		reqBuf.memory = V4L2_MEMORY_USERPTR;
+		if (xioctl (mDevID, VIDIOC_REQBUFS, &reqBuf) == -1) V4L2DEV_WARNING("VIDIOC_REQBUFS failed\n");
+		CLEAR_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS);		// not streaming until buffers are back
+	}
+
+	// format, then crop (drivers may adjust the format to it), then the interval (it may depend on both)
+	bool taken = internal_reconfigure_format(config);
+	if (config.setCrop) {
+		CropData crop = config.crop;
+		if (!set_crop(crop)) taken = false;
+	}
+	if (!internal_get_image_format()) taken = false;
+	mMaxWidth = mImageFormat.fmt.pix.width;					// PixelBuffers follow what the driver gives now
+	mMaxHeight = mImageFormat.fmt.pix.height;
+	if (config.frameRate >= 0 and !set_frame_rate(config.frameRate)) taken = false;
+	if (mDevID==-1) return false;						// reset while asking for the rate
+
+	bool done;
+	if (useMMAP) done = internal_setup_io_MMAP();
+	else if (usePTRS) {
+		reqBuf.count = mPixelBuffers.size();
+		done = (xioctl (mDevID, VIDIOC_REQBUFS, &reqBuf) != -1) and internal_refit_pixbufs();
+		SET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS);
+	}
+	else done = internal_refit_pixbufs();
+
+	mHaveSequence = false;							// sequence numbers restart with streaming
+	mClock.reset();								// and so may an unknown driver clock
+	mIntegrity.reset();							// a new size is not a repeated picture
+	if (!done or !internal_activate_streaming(true)) {
+		V4L2DEV_CRITICAL("reconfigure failed\n");
+		internal_reset();
+		return false;
+	}
+	mNumBuffers = mPixelBuffers.size();					// the driver may give more
+	internal_tune_start_window();
+	if (useRing and internal_uring_start(mDevID)) internal_uring_queue_reads();
+	return taken;
+}
+
+
+bool V4L2_Device::internal_reconfigure_format(const GrabberReconfig &config) {
+	if (config.fmt==PIXELBUFFER_FMT_NONE and config.width==0 and config.height==0) return true;
+	if (!internal_get_image_format()) return false;
+
+	v4l2_format request = mImageFormat;
+	if (config.fmt!=PIXELBUFFER_FMT_NONE) request.fmt.pix.pixelformat = pixelbuffer_fmt_to_v4l2_pix_fmt(config.fmt);
+	if (config.width!=0) request.fmt.pix.width = config.width;
+	if (config.height!=0) request.fmt.pix.height = config.height;
+	request.fmt.pix.bytesperline = 0;					// let the driver pick line length and size
+	request.fmt.pix.sizeimage = 0;
+	if ( xioctl(mDevID, VIDIOC_S_FMT, &request) == -1) {
+		V4L2DEV_WARNING("VIDIOC_S_FMT failed\n");
+		return false;
+	}
+	// the driver answers with the nearest format it can give: one we can't handle is no use
+	if (v4l2_pix_fmt_to_pixelbuffer_fmt(request.fmt.pix.pixelformat) == PIXELBUFFER_FMT_NONE) {
+		V4L2DEV_WARNING("unknown pixelbuffer fmt\n");
+		if ( xioctl(mDevID, VIDIOC_S_FMT, &mImageFormat) == -1) V4L2DEV_WARNING("VIDIOC_S_FMT failed\n");
+		return false;
+	}
+	mImageFormat = request;
+	return (config.fmt==PIXELBUFFER_FMT_NONE or pixelbuffer_fmt_to_v4l2_pix_fmt(config.fmt)==request.fmt.pix.pixelformat)
+		and (config.width==0 or config.width==request.fmt.pix.width)
+		and (config.height==0 or config.height==request.fmt.pix.height);
+}
+
+
+bool V4L2_Device::internal_refit_pixbufs(void) {
+	PixelBufferFormat fmt = v4l2_pix_fmt_to_pixelbuffer_fmt(mImageFormat.fmt.pix.pixelformat);
+	if (fmt == PIXELBUFFER_FMT_NONE) {
+		V4L2DEV_CRITICAL("unknown pixelbuffer fmt\n");
+		return false;
+	}
+	unsigned int length = pixelbuffer_length (fmt, mMaxWidth, mMaxHeight);
+	if (length < mImageFormat.fmt.pix.sizeimage) length = mImageFormat.fmt.pix.sizeimage;	// padded lines
+
+	for (unsigned int i = 0; i < mPixelBuffers.size(); i++) {
+		PixelBuffer* pb = mPixelBuffers[i];
+		std::map<const PixelBuffer*, size_t>::iterator it = mCapacities.find(pb);
+		size_t capacity = (it!=mCapacities.end()) ? it->second : pb->length;
+		if (capacity < length) {						// only grow: a smaller picture fits as it is
+			free (pb->buf);							// the old picture is no use anymore
+			pb->buf = internal_alloc_buffer( length );
+			capacity = (pb->buf!=NULL) ? length : 0;
+		}
+		mCapacities[pb] = capacity;
+		pb->length = (pb->buf!=NULL) ? length : 0;				// read() and USERPTR QBUF take the picture size
+		if (pb->buf==NULL) {
+			V4L2DEV_CRITICAL("out of memory\n");
+			return false;
+		}
+		pb->width = mMaxWidth;
+		pb->height = mMaxHeight;
+		pb->fmt = fmt;
+		pb->stride = mImageFormat.fmt.pix.bytesperline;			// 0 when the driver doesn't tell
+	}
+	internal_invalidate_frames();						// not valid in the new format
+	return true;
+}
+
+
 bool V4L2_Device::internal_setup_io_MMAP (void) {
 	// check if set up was already done
 	if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP) or 
@@ -298,12 +772,14 @@ bool V4L2_Device::internal_setup_io_MMAP (void) {
 		memset (&reqBufs, 0 , sizeof(v4l2_requestbuffers));
 		reqBufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;	
 		reqBufs.memory = V4L2_MEMORY_MMAP;
-		reqBufs.count = mMaxNumBuffers;					// number of buffers we want to allocate
+		reqBufs.count = mNumBuffers;					// number of buffers we want to allocate
+		reqBufs.flags = internal_memory_flags();
 
 		if (xioctl (mDevID, VIDIOC_REQBUFS, &reqBufs) == -1) {
 			V4L2DEV_WARNING("VIDIOC_REQBUFS failed\n");
 			return false;
 		}
+		mCacheHints = (reqBufs.capabilities & V4L2_BUF_CAP_SUPPORTS_MMAP_CACHE_HINTS);	// flags are ignored otherwise
 
 		if (reqBufs.count < V4L2_MIN_NUM_BUFFERS) {
 			V4L2DEV_WARNING("couldn't allocate all necessary buffers\n");
@@ -321,9 +797,9 @@ bool V4L2_Device::internal_setup_io_MMAP (void) {
 			PIXELBUFFERCLEARSTRUCT(newBuf);						// reset PixelBuffer struct
 			newBuf->width = mMaxWidth;
 			newBuf->height = mMaxHeight;
-			mPixelBuffers.push_back(newBuf);					// push new buffer in the vector
-			mBuffersOrder.push_front(-1);						// make mBuffersOrder.size() = mPixelBuffers.size()
-			// -1 means that PixelBuffers are not yet valid
+			newBuf->fmt = v4l2_pix_fmt_to_pixelbuffer_fmt(mImageFormat.fmt.pix.pixelformat);
+			newBuf->stride = mImageFormat.fmt.pix.bytesperline;			// 0 when the driver doesn't tell
+			internal_add_buffer(newBuf);						// not valid yet
 		}
 
 		for (unsigned int bufIndex = 0; bufIndex < reqBufs.count; bufIndex++) {
@@ -339,7 +815,7 @@ bool V4L2_Device::internal_setup_io_MMAP (void) {
 			}
       
 			mPixelBuffers[bufIndex]->length = queryBuf.length;			// driver allocates memory in respect to the format
-			mPixelBuffers[bufIndex]->buf = mmap ( NULL, queryBuf.length, PROT_READ | PROT_WRITE, MAP_SHARED, mDevID, queryBuf.m.offset);
+			mPixelBuffers[bufIndex]->buf = internal_map_buffer (queryBuf.length, queryBuf.m.offset);
       
 			if ( mPixelBuffers[bufIndex]->buf == MAP_FAILED) {
 				V4L2DEV_WARNING("mmap failed\n");
@@ -377,7 +853,7 @@ bool V4L2_Device::internal_setup_io_PTRS (void) {
 
 		SET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS);			// set that we use this method
 		// if VIDIOC_REQBUFS request was successful create the desidered number of PixelBuffers
-		while (mPixelBuffers.size()!= mMaxNumBuffers) {				// push reqBufs.count new PixelBuffers in vector mPixelBuffers
+		while (mPixelBuffers.size()!= mNumBuffers) {				// push reqBufs.count new PixelBuffers in vector mPixelBuffers
 			PixelBuffer* newBuf = new PixelBuffer();
 			if (newBuf==NULL) {
 				V4L2DEV_CRITICAL("out of memory\n");
@@ -386,15 +862,15 @@ bool V4L2_Device::internal_setup_io_PTRS (void) {
 			PIXELBUFFERCLEARSTRUCT(newBuf);						// reset PixelBuffer struct
 			newBuf->width = mMaxWidth;
 			newBuf->height = mMaxHeight;
+			newBuf->fmt = v4l2_pix_fmt_to_pixelbuffer_fmt(mImageFormat.fmt.pix.pixelformat);
+			newBuf->stride = mImageFormat.fmt.pix.bytesperline;			// 0 when the driver doesn't tell
 			newBuf->length =  pixelbuffer_length ( v4l2_pix_fmt_to_pixelbuffer_fmt(mImageFormat.fmt.pix.pixelformat), mMaxWidth, mMaxHeight);
-			newBuf->buf = (void*) malloc( newBuf->length );				// malloc memory in respect to format, width and height
+			newBuf->buf = internal_alloc_buffer( newBuf->length );			// malloc memory in respect to format, width and height
 			if (newBuf->buf==NULL) {
 				V4L2DEV_CRITICAL("out of memory\n");
 				return false;
 			}
-			mPixelBuffers.push_back(newBuf);						// push new buffer in the vector
-			mBuffersOrder.push_front(-1);						// make mBuffersOrder.size() = mPixelBuffers.size()
-			// -1 means that PixelBuffers are not yet valid
+			internal_add_buffer(newBuf);						// not valid yet
 		}
 		return true;
 	}
@@ -419,7 +895,7 @@ bool V4L2_Device::internal_setup_io_READ (void) {
 		SET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE);			// set that we use this method
 
 		// create the desidered number of PixelBuffers (in read write not many buffers are necessary)
-		while (mPixelBuffers.size()!= mMaxNumBuffers) {			// push V4L2_RWMODEBUFFERS new PixelBuffers in vector mPixelBuffers
+		while (mPixelBuffers.size()!= mNumBuffers) {			// push V4L2_RWMODEBUFFERS new PixelBuffers in vector mPixelBuffers
 			PixelBuffer* newBuf = new PixelBuffer();
 			if (newBuf==NULL) {
 				V4L2DEV_CRITICAL("out of memory\n");
@@ -428,15 +904,15 @@ bool V4L2_Device::internal_setup_io_READ (void) {
 			PIXELBUFFERCLEARSTRUCT(newBuf);						// reset PixelBuffer struct
 			newBuf->width = mMaxWidth;
 			newBuf->height = mMaxHeight;
+			newBuf->fmt = v4l2_pix_fmt_to_pixelbuffer_fmt(mImageFormat.fmt.pix.pixelformat);
+			newBuf->stride = mImageFormat.fmt.pix.bytesperline;			// 0 when the driver doesn't tell
 			newBuf->length =  pixelbuffer_length ( v4l2_pix_fmt_to_pixelbuffer_fmt(mImageFormat.fmt.pix.pixelformat), mMaxWidth, mMaxHeight);
-			newBuf->buf = (void*) malloc( newBuf->length );	// malloc memory in respect to format, width and height
+			newBuf->buf = internal_alloc_buffer( newBuf->length );	// malloc memory in respect to format, width and height
 			if (newBuf->buf==NULL) {
 				V4L2DEV_CRITICAL("out of memory\n");
 				return false;
 			}
-			mPixelBuffers.push_back(newBuf);					// push new buffer in the vector
-			mBuffersOrder.push_front(-1);						// make mBuffersOrder.size() = mPixelBuffers.size()
-			// -1 means that PixelBuffers are not yet valid
+			internal_add_buffer(newBuf);						// not valid yet
 		}
 		return true;
 	}
@@ -444,37 +920,78 @@ bool V4L2_Device::internal_setup_io_READ (void) {
 
 
 void V4L2_Device::internal_free_pixbufs_mem (void) {
+	internal_uring_stop();							// reads in flight would be never unlocked
+	std::vector<PixelBuffer*> pixelBuffers = internal_take_buffers();	// nobody can get them from now on
 	// free memory for vector mPixelBuffers
-	for (int i=0; i< mPixelBuffers.size(); i++) {
-		assert(mPixelBuffers[i]);
-		while (PIXELBUFFERISLOCKED(mPixelBuffers[i])) {usleep(100);}		// if something works on mPixelBuffers[i] we must wait
-		SETPIXELBUFFERFLAG(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_DESTROY);	// so that nobody can get again control on the PixelBuffer
+	for (unsigned int i=0; i< pixelBuffers.size(); i++) {
+		assert(pixelBuffers[i]);
+		while (PIXELBUFFERISLOCKED(pixelBuffers[i])) {usleep(100);}		// if something works on pixelBuffers[i] we must wait
+		SETPIXELBUFFERFLAG(pixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_DESTROY);	// so that nobody can get again control on the PixelBuffer
 
 		if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP)) {		// mmap streaming case
-			if (mPixelBuffers[i]->buf!=MAP_FAILED and mPixelBuffers[i]->buf!=NULL)
-				munmap (mPixelBuffers[i]->buf, mPixelBuffers[i]->length);		// unmap memory
+			if (pixelBuffers[i]->buf!=MAP_FAILED and pixelBuffers[i]->buf!=NULL)
+				munmap (pixelBuffers[i]->buf, pixelBuffers[i]->length);		// unmap memory
 		}
 		else if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS)) {	// ptrs streaming case
-			if (mPixelBuffers[i]->buf!=NULL)
-				free (mPixelBuffers[i]->buf);						// free memory
+			if (pixelBuffers[i]->buf!=NULL)
+				free (pixelBuffers[i]->buf);						// free memory
 		}
 		else if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE)) {		// read()/write() streaming case
-			if (mPixelBuffers[i]->buf!=NULL)
-				free (mPixelBuffers[i]->buf);						// free memory
+			if (pixelBuffers[i]->buf!=NULL)
+				free (pixelBuffers[i]->buf);						// free memory
 		}
-		delete mPixelBuffers[i];
+		delete pixelBuffers[i];
 	}
-	while (mPixelBuffers.size()!=0) mPixelBuffers.erase(mPixelBuffers.begin());	// erase all entries in mPixelBuffers
+	mCapacities.clear();
 	CLEAR_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP);
 	CLEAR_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS);
 	CLEAR_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_READWRITE);
-}  
+}
+
+
+void* V4L2_Device::internal_alloc_buffer(unsigned int length) {
+	void* buf = NULL;
+	if (mHugePages) {
+		// aligned to a huge page so that the kernel can back it with whole huge pages (free() still frees it)
+		if (posix_memalign(&buf, V4L2_HUGE_PAGE_SIZE, length) != 0) return NULL;
+		if (madvise(buf, length, MADV_HUGEPAGE) == -1) V4L2DEV_NOTICE("madvise(MADV_HUGEPAGE) failed\n");
+	}
+	else buf = malloc( length );
+	if (buf!=NULL and mPrefault) memset(buf, 0, length);			// fault every page in now, not on the first frames
+	return buf;
+}
+
+
+void* V4L2_Device::internal_map_buffer(unsigned int length, unsigned int offset) {
+	// driver memory: huge pages don't apply, MAP_POPULATE builds the page tables now
+	return mmap ( NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | (mPrefault ? MAP_POPULATE : 0), mDevID, offset);
+}
+
+
+unsigned char V4L2_Device::internal_memory_flags(void) {
+	// non coherent memory lets the cache maintenance follow the QBUF hints (drivers without hints ignore it)
+	return (mBufferAccess!=GRABBER_ACCESS_CPU_READWRITE) ? V4L2_MEMORY_FLAG_NON_COHERENT : 0;
+}
+
+
+unsigned int V4L2_Device::internal_cache_hints(void) {
+	if (!mCacheHints) return 0;
+	switch (mBufferAccess) {
+		case GRABBER_ACCESS_CPU_READ:	return V4L2_BUF_FLAG_NO_CACHE_CLEAN;	// nothing dirty to write back, still invalidate for the cpu
+		case GRABBER_ACCESS_DMA:	return V4L2_BUF_FLAG_NO_CACHE_CLEAN | V4L2_BUF_FLAG_NO_CACHE_INVALIDATE;
+		default:			return 0;
+	}
+}
 
 
 void V4L2_Device::internal_reset () {
 
-	mBuffersOrder.clear();		 // avoid grabber to give away a bad PixelBuffer
+	internal_invalidate_frames();		 // avoid grabber to give away a bad PixelBuffer
 	mStreamFreq = -1.0f;
+	mHaveSequence = false;		 // sequence numbers restart with streaming
+	mClock.reset();								// and so may an unknown driver clock
+	mMetaStream.close();
+	mMetaStore.clear();
 
 	if(mDevID>-1) {			// if video device was opened...
 		// if streaming IO method were used before calling internal_reset() than streaming must be stopped
@@ -482,9 +999,6 @@ void V4L2_Device::internal_reset () {
 			internal_activate_streaming(false);
 		}
 
-		// free memory for vector mPixelBuffers
-		internal_free_pixbufs_mem ();
-
 		// say to the driver we don't need anymore buffers (must be done after munmap!)
 		v4l2_requestbuffers reqBuf;
 		memset (&reqBuf, 0, sizeof (reqBuf));
@@ -492,6 +1006,10 @@ void V4L2_Device::internal_reset () {
 		if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP)) reqBuf.memory = V4L2_MEMORY_MMAP;
 		else if (GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS)) reqBuf.memory = V4L2_MEMORY_USERPTR;
 		reqBuf.count = 0;	// !
+
+		// free memory for vector mPixelBuffers (this clears the IO flags: memory type was read before)
+		internal_free_pixbufs_mem ();
+
 		if (xioctl (mDevID, VIDIOC_REQBUFS, &reqBuf) == -1) V4L2DEV_CRITICAL("VIDIOC_REQBUFS failed\n");
 
 		close(mDevID);								// close device
@@ -531,7 +1049,11 @@ bool V4L2_Device::internal_get_device_capabilities () {
 #endif
 
 	// check for capture capablities
-	if (!(mCapability.capabilities & V4L2_CAP_VIDEO_CAPTURE)) return false; 	// VIDEO_CAPTURE is necessary!
+	if (!(mCapability.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {			// VIDEO_CAPTURE is necessary!
+		if (mCapability.capabilities & (V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))
+			V4L2DEV_WARNING("mem2mem device: open it with M2M_Device\n");
+		return false;
+	}
 	// check for read()/write() IO
 	if (mCapability.capabilities & V4L2_CAP_READWRITE) SET_V4L2DEV_FLAG(VIDEO_CAPTURE_READWRITE);
 	// check for streaming IO capabilities, and if any for what kind of streaming
@@ -644,6 +1166,59 @@ void V4L2_Device::internal_addCtrlIfAny (unsigned int V4L2_ctrlID) {
 
 
 
+bool V4L2_Device::set_frame_rate(float fps) {
+	if (fps < 0) return false;
+	mFrameRate = fps;
+	if (mDevID>=0 and GET_V4L2DEV_FLAG(VIDEO_CAPTURE_HAS_FRAME_SKIPPING_SUPPORT) and !internal_set_frame_interval(fps)) {
+		if (mDevID==-1) return false;					// restarting streaming failed: the device was reset
+	}
+	// drivers without V4L2_CAP_TIMEPERFRAME, or with a slowest rate still above fps: skip what's left
+	internal_set_decimation(fps, (mStreamFreq > 0) ? mStreamFreq : 0);
+	return true;
+}
+
+
+bool V4L2_Device::internal_set_frame_interval(float fps) {
+	v4l2_streamparm streamP;
+	memset (&streamP, 0 , sizeof(v4l2_streamparm));
+	streamP.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (xioctl(mDevID, VIDIOC_G_PARM, &streamP)== -1) {
+		V4L2DEV_WARNING("VIDIOC_G_PARM failed\n");
+		return false;
+	}
+	// 0/0 asks for the nominal frame interval
+	streamP.parm.capture.timeperframe.numerator = (fps > 0) ? 1000 : 0;
+	streamP.parm.capture.timeperframe.denominator = (fps > 0) ? (unsigned int) (fps * 1000.0f + 0.5f) : 0;
+	v4l2_streamparm request = streamP;
+
+	if (xioctl(mDevID, VIDIOC_S_PARM, &streamP)== -1) {
+		bool streaming = GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_MMAP) or GET_V4L2DEV_FLAG(VIDEO_CAPTURE_USING_STREAMING_PTRS);
+		if (errno!=EBUSY or !streaming) {
+			V4L2DEV_WARNING("VIDIOC_S_PARM failed\n");
+			return false;
+		}
+		// most drivers only change the interval while stopped: buffers are queued again by the next grab()
+		streamP = request;
+		internal_activate_streaming(false);
+		bool done = (xioctl(mDevID, VIDIOC_S_PARM, &streamP)!= -1);
+		if (!done) V4L2DEV_WARNING("VIDIOC_S_PARM failed\n");
+		mHaveSequence = false;							// sequence numbers restart with streaming
+		mClock.reset();								// and so may an unknown driver clock
+		if (!internal_activate_streaming(true)) {
+			V4L2DEV_CRITICAL("restarting streaming failed\n");
+			internal_reset();
+			return false;
+		}
+		if (!done) return false;
+	}
+
+	// the driver answers with the interval it picked
+	if (streamP.parm.capture.timeperframe.numerator!=0)
+		mStreamFreq = (float) streamP.parm.capture.timeperframe.denominator / (float) streamP.parm.capture.timeperframe.numerator;
+	return true;
+}
+
+
 bool V4L2_Device::internal_get_streaming_params() {
 	v4l2_streamparm streamP;
 	memset (&streamP, 0 , sizeof(v4l2_streamparm));		// reset struct to 0s
@@ -697,9 +1272,13 @@ bool V4L2_Device::internal_activate_streaming (bool activate) {
 			return false;
 		}
 	}
-	else if ( xioctl( mDevID, VIDIOC_STREAMOFF, &bufType) == -1) {	// this also dequeues buffers from driver
-		V4L2DEV_WARNING("VIDIOC_STREAMOFF failed\n");
-		return false;
+	else {
+		if ( xioctl( mDevID, VIDIOC_STREAMOFF, &bufType) == -1) {	// this also dequeues buffers from driver
+			V4L2DEV_WARNING("VIDIOC_STREAMOFF failed\n");
+			return false;
+		}
+		for (unsigned int i = 0; i < mPixelBuffers.size(); i++)		// so nothing is in the driver anymore
+			CLEARPIXELBUFFERFLAG(mPixelBuffers[i],PIXEL_BUFFER_INUSE_GRABBER_Q);
 	}
 	return true;
 } 
@@ -38,18 +38,22 @@ extern "C" {
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <poll.h>
 #include <iostream>
 #include <list>
+#include <map>
 
 #include "Debug.hh"
 
 #include "Defaults.hh"
 #include "Grabber.hh"
+#include "Trace.hh"
 #include "GrabberInitData.hh"
 #include "GrabberControlData.hh"
 #include "Grabber_Helpers.hh"
 #include "V4L2_Helpers.hh"
 #include "CropData.hh"
+#include "V4L2_MetaStream.hh"
 
 
 // flags in V4L2_Device are used instead of many booleans; they are stored in mInternalFlags
@@ -91,6 +95,19 @@ extern "C" {
 // if the driver cannot allocate at least V4L2_MINNUMBUFFERS buffers than initing the driver will fail
 #define V4L2_MIN_NUM_BUFFERS 2
 
+// buffer count tuning (see GrabberInitData::autoTuneBuffers):
+// drops and driver queue occupancy are looked at every V4L2_TUNE_WINDOW_FRAMES frames;
+// a buffer is added when the drop rate is above target, one is removed after
+// V4L2_TUNE_SHRINK_WINDOWS windows without drops in which the driver never had less than 2 buffers queued;
+// changes that need a restream wait for pictures held by consumers, at most V4L2_TUNE_RELEASE_US (then they
+// are tried again later)
+#define V4L2_TUNE_WINDOW_FRAMES 128
+#define V4L2_TUNE_SHRINK_WINDOWS 8
+#define V4L2_TUNE_RELEASE_US 20000
+
+// alignment of malloc'd buffers with GrabberInitData::hugePageBuffers (transparent huge pages of x86-64 and arm64)
+#define V4L2_HUGE_PAGE_SIZE ((unsigned int) 1 << 21)
+
 // max number of times we iterate in our custom xioctl
 // [sometimes ioctl can return -1 when some interrupt occurs, as this isn't an error
 //  we try V4L2_MAX_IOCTL_TIMES to see if we can get something usefull from ioctl]
@@ -104,10 +121,11 @@ extern "C" {
 #define V4L2DEV_CRITICAL_PREFIX	(" * !!! CRITICAL !!! - v4l2_dev - ")
 
 // Used to be implemented using ACE helpers - need to switch to something else
+// warnings and critical errors leave a TRACE_EV_ERRNO event (source line + errno) in the trace
 #define V4L2DEV_DEBUG(x) {}
 #define V4L2DEV_NOTICE(x) {}
-#define V4L2DEV_WARNING(x) {}
-#define V4L2DEV_CRITICAL(x) {}
+#define V4L2DEV_WARNING(x) { GRABBER_TRACE(TRACE_EV_ERRNO, __LINE__, errno); }
+#define V4L2DEV_CRITICAL(x) { GRABBER_TRACE(TRACE_EV_ERRNO, __LINE__, errno); }
 
 
 static int xioctl (int fd, int request, void *arg);
@@ -121,10 +139,19 @@ public:
 	bool set_ctrl_value(GrabberControlID id, short newValue);
 	bool init(void);
 	void grab(void);
+	// streaming io: dequeue everything ready in one call
+	unsigned int grab_all(std::vector<PixelBuffer*>& frames, bool releaseOlder = false);
+
+	// VIDIOC_S_PARM timeperframe when the driver supports it, decimation for what it can't do
+	bool set_frame_rate(float fps);
+
+	int get_poll_fd(void);
+	bool arm(void);
 
 	bool set_crop(CropData &cas);
 	bool get_crop(CropData &cas);
 	PixelBufferFormat get_format(void);
+	bool reconfigure(const GrabberReconfig &config);
 
 private:
 	// set image format
@@ -138,6 +165,45 @@ private:
 
 	void internal_free_pixbufs_mem (void);
 
+	// memory of a PixelBuffer as GrabberInitData::prefaultBuffers and hugePageBuffers say
+	// malloc'd for ptrs and read() IO (NULL when out of memory, free() it), mapped from the driver for mmap IO (MAP_FAILED)
+	void* internal_alloc_buffer(unsigned int length);
+	void* internal_map_buffer(unsigned int length, unsigned int offset);
+	// mmap IO: V4L2_MEMORY_FLAG_NON_COHERENT for REQBUFS / CREATE_BUFS and V4L2_BUF_FLAG_NO_CACHE_* for QBUF
+	// as GrabberInitData::bufferAccess says
+	unsigned char internal_memory_flags(void);
+	unsigned int internal_cache_hints(void);
+
+	// streaming IO: queue every PixelBuffer without locks that isn't in the driver yet
+	// returns the number of buffers in the driver
+	unsigned int internal_queue_free(void);
+	// streaming IO: queue mPixelBuffers[index] / dequeue a filled buffer into dqBuf
+	// return false (and leave the buffer unqueued / nothing dequeued) on failure
+	bool internal_qbuf(unsigned int index);
+	bool internal_dqbuf(v4l2_buffer &dqBuf);
+	// a dequeued buffer is done: timestamp it, account its sequence and hand it to the grabber
+	void internal_dqbuf_done(const v4l2_buffer &dqBuf);
+
+	// buffer count tuning
+	// account a dequeued frame: queued is the number of buffers left in the driver
+	void internal_tune_account(unsigned int queued);
+	// at the end of a window grow or shrink the buffer set (only between two grabs: it may restream)
+	void internal_tune_buffers(void);
+	void internal_tune_start_window(void);
+	// add count buffers while streaming (VIDIOC_CREATE_BUFS); false when the driver can't
+	bool internal_create_buffers(unsigned int count);
+	// a consumer holds some PixelBuffer (any lock but PIXEL_BUFFER_INUSE_GRABBER_Q)
+	bool internal_consumers_hold_buffers(void);
+	// stop streaming, reallocate numBuffers buffers and restart; on failure the device is reset
+	// returns false without restreaming when consumers still hold pictures after V4L2_TUNE_RELEASE_US
+	// (none can be taken meanwhile: the grabbed pictures are invalidated)
+	bool internal_restream(unsigned int numBuffers);
+	// reconfigure(): give the driver the new format (fmt NONE / 0 sizes keep the current ones)
+	bool internal_reconfigure_format(const GrabberReconfig &config);
+	// reconfigure(): resize and retag the malloc'd PixelBuffers of ptrs / read IO to mImageFormat
+	// (memory only grows, see mCapacities; length always becomes the new picture size)
+	bool internal_refit_pixbufs(void);
+
 
 	// reset completely device and this class
 	void internal_reset(void);
@@ -155,6 +221,9 @@ private:
 	void internal_addCtrlIfAny (unsigned int V4L2_ctrlID);
 
 	bool internal_get_streaming_params (void);  
+	// ask the driver for fps frames per second (0: its nominal rate) and update mStreamFreq
+	// streaming is stopped and restarted around the request if the driver refuses it while streaming
+	bool internal_set_frame_interval (float fps);
 
 	bool internal_get_image_format (void);  
 
@@ -163,8 +232,25 @@ private:
 	bool internal_activate_streaming (bool activate);  
 
 
-	unsigned char mMaxNumBuffers;			// number of buffers used in streaming mode
-	v4l2_buffer mV4L2Buf;				// v4l2 buffer used for streaming
+	unsigned char mMaxNumBuffers;			// max number of buffers used in streaming mode
+	unsigned int mNumBuffers;			// number of buffers to allocate (mMaxNumBuffers unless tuning)
+
+	bool mAutoTune;					// see GrabberInitData::autoTuneBuffers
+	unsigned int mMinNumBuffers;
+	float mTargetDropRate;
+	bool mCanCreateBufs;				// VIDIOC_CREATE_BUFS worked (or wasn't tried yet)
+	bool mPrefault;					// see GrabberInitData::prefaultBuffers
+	bool mHugePages;				// see GrabberInitData::hugePageBuffers
+	GrabberBufferAccess mBufferAccess;		// see GrabberInitData::bufferAccess
+	bool mCacheHints;				// the driver takes V4L2_BUF_FLAG_NO_CACHE_* on mmap buffers
+	std::map<const PixelBuffer*, size_t> mCapacities;	// ptrs / read IO, after reconfigure(): bytes malloc'd at buf
+							// (length is the picture size, maybe less)
+	unsigned int mTuneFrames;			// frames in the current window
+	unsigned long long mTuneDrops0;			// drop counters at the beginning of the window
+	unsigned int mTuneMinQueued;			// least buffers left in the driver after a DQBUF in the window
+	unsigned int mTuneQuietWindows;			// consecutive windows where a buffer less would have been enough
+	v4l2_buffer mV4L2Buf;				// last buffer dequeued in streaming mode
+	std::vector<v4l2_buffer> mReady;		// buffers dequeued by one grab_all()
 	v4l2_control mV4L2Ctrl;			// used to change controls values without need of malloc everytime
 
 	int mDevID;					// V4L2 device id
@@ -174,7 +260,11 @@ private:
 	v4l2_format mImageFormat;			// used to retrieve and switch drivers image format
 
   
-	float mStreamFreq;			// used (maybe) in some streaming tecniches
+	float mStreamFreq;			// frames per second the driver streams at (timeperframe), -1 unknown
+
+	std::string mPathToMetaDev;			// see GrabberInitData::pathToMetaDev
+	V4L2_MetaStream mMetaStream;
+	std::vector< std::vector<unsigned char> > mMetaStore;	// metadata stream buffer of each PixelBuffer
 
 };
 
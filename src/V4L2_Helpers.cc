@@ -112,6 +112,9 @@ std::string v4l2_capabilities_to_string(unsigned int cap) {
 	s += " - video capture: ";
 	if ( cap & V4L2_CAP_VIDEO_CAPTURE) s += "YES\n"; else s += "NO\n";
 
+	s += " - mem2mem: ";
+	if ( cap & V4L2_CAP_VIDEO_M2M) s += "YES\n"; else s += "NO\n";
+
 	s += " - read() I/O: ";
 	if ( cap & V4L2_CAP_READWRITE) s += "YES\n"; else s += "NO\n";
 
@@ -190,76 +193,14 @@ GrabberControlID v4l2_ctrl_id_to_grabber_ctrl_id (unsigned int id) {
 
 
 unsigned int pixelbuffer_fmt_to_v4l2_pix_fmt(PixelBufferFormat fmt) {
-	switch (fmt) {
-	case (PIXELBUFFER_FMT_RGB1)  :  return V4L2_PIX_FMT_RGB332;
-	case (PIXELBUFFER_FMT_RGBO)  :  return V4L2_PIX_FMT_RGB555;
-	case (PIXELBUFFER_FMT_RGBP)  :  return V4L2_PIX_FMT_RGB565;
-	case (PIXELBUFFER_FMT_R444)  :  return V4L2_PIX_FMT_RGB444;
-	case (PIXELBUFFER_FMT_RGBQ)  :  return V4L2_PIX_FMT_RGB555X;
-	case (PIXELBUFFER_FMT_RGBR)  :  return V4L2_PIX_FMT_RGB565X;
-	case (PIXELBUFFER_FMT_BGR3)  :  return V4L2_PIX_FMT_BGR24;
-	case (PIXELBUFFER_FMT_RGB3)  :  return V4L2_PIX_FMT_RGB24;
-	case (PIXELBUFFER_FMT_BGR4)  :  return V4L2_PIX_FMT_BGR32;
-	case (PIXELBUFFER_FMT_RGB4)  :  return V4L2_PIX_FMT_RGB32;
-// RGB bayern
-	case (PIXELBUFFER_FMT_BA81)  :  return V4L2_PIX_FMT_SBGGR8;
-// YUV
-	case (PIXELBUFFER_FMT_GREY)  :  return V4L2_PIX_FMT_GREY;
-	case (PIXELBUFFER_FMT_YUYV)  :  return V4L2_PIX_FMT_YUYV;
-	case (PIXELBUFFER_FMT_UYVY)  :  return V4L2_PIX_FMT_UYVY;
-	case (PIXELBUFFER_FMT_Y41P)  :  return V4L2_PIX_FMT_Y41P;
-	case (PIXELBUFFER_FMT_YV12)  :  return V4L2_PIX_FMT_YVU420;
-	case (PIXELBUFFER_FMT_YU12)  :  return V4L2_PIX_FMT_YUV420;
-	case (PIXELBUFFER_FMT_YVU9)  :  return V4L2_PIX_FMT_YVU410;
-	case (PIXELBUFFER_FMT_YUV9)  :  return V4L2_PIX_FMT_YUV410;
-	case (PIXELBUFFER_FMT_422P)  :  return V4L2_PIX_FMT_YUV422P;
-	case (PIXELBUFFER_FMT_411P)  :  return V4L2_PIX_FMT_YUV411P;
-	case (PIXELBUFFER_FMT_NV12)  :  return V4L2_PIX_FMT_NV12;
-	case (PIXELBUFFER_FMT_NV21)  :  return V4L2_PIX_FMT_NV21;
-	default : {
-		// if we get here fmt has bad value and this should never happen
-		// we return one of the formats wich wants more memory and cross fingers :)
-		return V4L2_PIX_FMT_RGB24;
-	}
-	}
+	const PixelFormatInfo* info = pixel_format_info(fmt);
+	// if fmt has bad value (this should never happen)
+	// we return one of the formats wich wants more memory and cross fingers :)
+	if (info==NULL) return V4L2_PIX_FMT_RGB24;
+	return info->v4l2Fourcc;
 }
 
 
 PixelBufferFormat v4l2_pix_fmt_to_pixelbuffer_fmt(unsigned int fmt) {
-	switch (fmt) {
-	case (V4L2_PIX_FMT_RGB332)   :  return PIXELBUFFER_FMT_RGB1;
-	case (V4L2_PIX_FMT_RGB555)   :  return PIXELBUFFER_FMT_RGBO;
-	case (V4L2_PIX_FMT_RGB565)   :  return PIXELBUFFER_FMT_RGBP;
-	case (V4L2_PIX_FMT_RGB444)   :  return PIXELBUFFER_FMT_R444;
-	case (V4L2_PIX_FMT_RGB555X)  :  return PIXELBUFFER_FMT_RGBQ;
-	case (V4L2_PIX_FMT_RGB565X)  :  return PIXELBUFFER_FMT_RGBR;
-	case (V4L2_PIX_FMT_BGR24)    :  return PIXELBUFFER_FMT_BGR3;
-	case (V4L2_PIX_FMT_RGB24)    :  return PIXELBUFFER_FMT_RGB3;
-	case (V4L2_PIX_FMT_BGR32)    :  return PIXELBUFFER_FMT_BGR4;
-	case (V4L2_PIX_FMT_RGB32)    :  return PIXELBUFFER_FMT_RGB4;
-// RGB bayern
-	case (V4L2_PIX_FMT_SBGGR8)   :  return PIXELBUFFER_FMT_BA81;
-// YUV
-	case (V4L2_PIX_FMT_GREY)     :  return PIXELBUFFER_FMT_GREY;
-	case (V4L2_PIX_FMT_YUYV)     :  return PIXELBUFFER_FMT_YUYV;
-	case (V4L2_PIX_FMT_UYVY)     :  return PIXELBUFFER_FMT_UYVY;
-	case (V4L2_PIX_FMT_Y41P)     :  return PIXELBUFFER_FMT_Y41P;
-	case (V4L2_PIX_FMT_YVU420)   :  return PIXELBUFFER_FMT_YV12;
-	case (V4L2_PIX_FMT_YUV420)   :  return PIXELBUFFER_FMT_YU12;
-	case (V4L2_PIX_FMT_YVU410)   :  return PIXELBUFFER_FMT_YVU9;
-	case (V4L2_PIX_FMT_YUV410)   :  return PIXELBUFFER_FMT_YUV9;
-	case (V4L2_PIX_FMT_YUV422P)  :  return PIXELBUFFER_FMT_422P;
-	case (V4L2_PIX_FMT_YUV411P)  :  return PIXELBUFFER_FMT_411P;
-	case (V4L2_PIX_FMT_NV12)     :  return PIXELBUFFER_FMT_NV12;
-	case (V4L2_PIX_FMT_NV21)     :  return PIXELBUFFER_FMT_NV21;
-	default : {
-		// if we get here fmt has bad value and this should never happen
-		return PIXELBUFFER_FMT_NONE;
-	}
-	}
+	return pixel_format_from_v4l2(fmt);
 }
-
-
-
-
-
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "V4L2_MetaStream.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+// ioctl restarted on EINTR
+static int meta_xioctl(int fd, unsigned long request, void* arg) {
+	int res;
+	do {
+		res = ioctl(fd, request, arg);
+	} while (res==-1 and errno==EINTR);
+	return res;
+}
+
+
+V4L2_MetaStream::V4L2_MetaStream() {
+	mFd = -1;
+	mHistoryNext = 0;
+	mHistorySize = 0;
+}
+
+
+V4L2_MetaStream::~V4L2_MetaStream() {
+	close();
+}
+
+
+bool V4L2_MetaStream::open(const std::string& path) {
+	close();
+	mFd = ::open(path.c_str(), O_RDWR);
+	if (mFd==-1) {
+		V4L2META_WARNING("cannot open device\n");
+		return false;
+	}
+
+	v4l2_capability cap;
+	memset(&cap, 0, sizeof(v4l2_capability));
+	if (meta_xioctl(mFd, VIDIOC_QUERYCAP, &cap)==-1) {
+		V4L2META_WARNING("VIDIOC_QUERYCAP failed\n");
+		close();
+		return false;
+	}
+	unsigned int caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+	if (!(caps & V4L2_CAP_META_CAPTURE) or !(caps & V4L2_CAP_STREAMING)) {
+		V4L2META_WARNING("not a metadata capture device\n");
+		close();
+		return false;
+	}
+
+	v4l2_requestbuffers reqBufs;
+	memset(&reqBufs, 0, sizeof(v4l2_requestbuffers));
+	reqBufs.type = V4L2_BUF_TYPE_META_CAPTURE;
+	reqBufs.memory = V4L2_MEMORY_MMAP;
+	reqBufs.count = V4L2_META_NUM_BUFFERS;
+	if (meta_xioctl(mFd, VIDIOC_REQBUFS, &reqBufs)==-1 or reqBufs.count==0) {
+		V4L2META_WARNING("VIDIOC_REQBUFS failed\n");
+		close();
+		return false;
+	}
+
+	for (unsigned int i=0; i< reqBufs.count; i++) {
+		v4l2_buffer queryBuf;
+		memset(&queryBuf, 0, sizeof(v4l2_buffer));
+		queryBuf.type = V4L2_BUF_TYPE_META_CAPTURE;
+		queryBuf.memory = V4L2_MEMORY_MMAP;
+		queryBuf.index = i;
+		if (meta_xioctl(mFd, VIDIOC_QUERYBUF, &queryBuf)==-1) {
+			V4L2META_WARNING("VIDIOC_QUERYBUF failed\n");
+			close();
+			return false;
+		}
+		void* buf = mmap(NULL, queryBuf.length, PROT_READ, MAP_SHARED, mFd, queryBuf.m.offset);
+		if (buf==MAP_FAILED) {
+			V4L2META_WARNING("mmap failed\n");
+			close();
+			return false;
+		}
+		mBufs.push_back(buf);
+		mLengths.push_back(queryBuf.length);
+		if (!internal_qbuf(i)) {
+			close();
+			return false;
+		}
+	}
+
+	v4l2_buf_type bufType = V4L2_BUF_TYPE_META_CAPTURE;
+	if (meta_xioctl(mFd, VIDIOC_STREAMON, &bufType)==-1) {
+		V4L2META_WARNING("VIDIOC_STREAMON failed\n");
+		close();
+		return false;
+	}
+	return true;
+}
+
+
+void V4L2_MetaStream::close(void) {
+	if (mFd==-1) return;
+	v4l2_buf_type bufType = V4L2_BUF_TYPE_META_CAPTURE;
+	meta_xioctl(mFd, VIDIOC_STREAMOFF, &bufType);
+	for (unsigned int i=0; i< mBufs.size(); i++) munmap(mBufs[i], mLengths[i]);
+	mBufs.clear();
+	mLengths.clear();
+
+	v4l2_requestbuffers reqBufs;				// give buffers back (after munmap!)
+	memset(&reqBufs, 0, sizeof(v4l2_requestbuffers));
+	reqBufs.type = V4L2_BUF_TYPE_META_CAPTURE;
+	reqBufs.memory = V4L2_MEMORY_MMAP;
+	meta_xioctl(mFd, VIDIOC_REQBUFS, &reqBufs);
+
+	::close(mFd);
+	mFd = -1;
+	mHistoryNext = 0;
+	mHistorySize = 0;
+}
+
+
+bool V4L2_MetaStream::internal_qbuf(unsigned int index) {
+	v4l2_buffer qBuf;
+	memset(&qBuf, 0, sizeof(v4l2_buffer));
+	qBuf.type = V4L2_BUF_TYPE_META_CAPTURE;
+	qBuf.memory = V4L2_MEMORY_MMAP;
+	qBuf.index = index;
+	if (meta_xioctl(mFd, VIDIOC_QBUF, &qBuf)==-1) {
+		V4L2META_WARNING("VIDIOC_QBUF failed\n");
+		return false;
+	}
+	return true;
+}
+
+
+unsigned int V4L2_MetaStream::collect(const timeval& ts, std::vector<unsigned char>& dst) {
+	if (mFd==-1) return 0;
+
+	// take every buffer ready (never wait: metadata must not slow down capture)
+	pollfd pfd;
+	pfd.fd = mFd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	while (poll(&pfd, 1, 0) > 0 and (pfd.revents & POLLIN)) {
+		v4l2_buffer dqBuf;
+		memset(&dqBuf, 0, sizeof(v4l2_buffer));
+		dqBuf.type = V4L2_BUF_TYPE_META_CAPTURE;
+		dqBuf.memory = V4L2_MEMORY_MMAP;
+		if (meta_xioctl(mFd, VIDIOC_DQBUF, &dqBuf)==-1) break;
+		if (dqBuf.index < mBufs.size()) {
+			unsigned int len = dqBuf.bytesused;
+			if (len > mLengths[dqBuf.index]) len = mLengths[dqBuf.index];
+			const unsigned char* src = (const unsigned char*) mBufs[dqBuf.index];
+			mHistory[mHistoryNext].assign(src, src + len);
+			mHistoryTs[mHistoryNext] = dqBuf.timestamp;
+			mHistoryNext = (mHistoryNext + 1) % V4L2_META_HISTORY;
+			if (mHistorySize < V4L2_META_HISTORY) mHistorySize++;
+			internal_qbuf(dqBuf.index);
+		}
+		pfd.revents = 0;
+	}
+	if (mHistorySize==0) return 0;
+
+	// nearest timestamp
+	unsigned int best = 0;
+	long long bestDiff = -1;
+	for (unsigned int i=0; i< mHistorySize; i++) {
+		long long diff = ((long long) mHistoryTs[i].tv_sec - ts.tv_sec) * 1000000LL + (mHistoryTs[i].tv_usec - ts.tv_usec);
+		if (diff < 0) diff = -diff;
+		if (bestDiff < 0 or diff < bestDiff) {
+			bestDiff = diff;
+			best = i;
+		}
+	}
+	dst = mHistory[best];
+	return dst.size();
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef V4L2_MetaStream_HH
+#define V4L2_MetaStream_HH
+
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "Debug.hh"
+
+// Some sensors (ie. uvc cameras) have a second video node streaming a metadata buffer per frame
+// (V4L2_BUF_TYPE_META_CAPTURE). V4L2_MetaStream streams such a node next to a V4L2_Device and
+// finds the metadata buffer of each frame by timestamp.
+
+// number of driver buffers, and of the latest metadata buffers kept to match frames with
+#define V4L2_META_NUM_BUFFERS 8
+#define V4L2_META_HISTORY 4
+
+// V4L2 metadata stream logging helpers
+#define V4L2META_WARNING_PREFIX	(" * WARNING - v4l2_meta - ")
+
+// Used to be implemented using ACE helpers - need to switch to something else
+#define V4L2META_WARNING(x) {}
+
+class V4L2_MetaStream {
+public:
+	V4L2_MetaStream();
+	~V4L2_MetaStream();
+
+	// open path, check it is a metadata capture node and start streaming
+	// returns false (and leaves the stream closed) on failure
+	bool open(const std::string& path);
+	void close(void);
+	bool is_open(void) const { return mFd!=-1; }
+
+	// dequeue every metadata buffer ready and copy in dst the one whose timestamp is nearest to ts
+	// returns the number of bytes copied (0 when no metadata buffer was seen yet)
+	unsigned int collect(const timeval& ts, std::vector<unsigned char>& dst);
+
+private:
+	bool internal_qbuf(unsigned int index);
+
+	int mFd;
+	std::vector<void*> mBufs;			// mmapped driver buffers
+	std::vector<unsigned int> mLengths;
+
+	std::vector<unsigned char> mHistory[V4L2_META_HISTORY];	// copies of the latest buffers
+	timeval mHistoryTs[V4L2_META_HISTORY];
+	unsigned int mHistoryNext;
+	unsigned int mHistorySize;
+};
+
+#endif /*V4L2_MetaStream_HH*/
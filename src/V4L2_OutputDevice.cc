@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#include "V4L2_OutputDevice.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "Grabber_Helpers.hh"
+#include "V4L2_Helpers.hh"
+
+// ioctl restarted on EINTR
+static int out_xioctl(int fd, unsigned long request, void* arg) {
+	int res;
+	do {
+		res = ioctl(fd, request, arg);
+	} while (res==-1 and errno==EINTR);
+	return res;
+}
+
+
+V4L2_OutputDevice::V4L2_OutputDevice() {
+	mFd = -1;
+	mIO = V4L2_OUTPUT_IO_NONE;
+	mStreaming = false;
+	memset(&mFormat, 0, sizeof(v4l2_format));
+	mFmt = PIXELBUFFER_FMT_NONE;
+	mMaxInPlace = V4L2_OUTPUT_MAX_IN_PLACE;
+	mInPlace = 0;
+	mPublished = 0;
+	mDropped = 0;
+}
+
+
+V4L2_OutputDevice::~V4L2_OutputDevice() {
+	close();
+}
+
+
+bool V4L2_OutputDevice::open(const std::string& path, PixelBufferFormat fmt, unsigned int width, unsigned int height,
+			     unsigned int stride, unsigned int numBuffers, bool zeroCopy) {
+	close();
+	mFd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);		// publish() never waits for the driver
+	if (mFd==-1) {
+		V4L2OUT_WARNING("cannot open device\n");
+		return false;
+	}
+
+	v4l2_capability cap;
+	memset(&cap, 0, sizeof(v4l2_capability));
+	if (out_xioctl(mFd, VIDIOC_QUERYCAP, &cap)==-1) {
+		V4L2OUT_WARNING("VIDIOC_QUERYCAP failed\n");
+		close();
+		return false;
+	}
+	unsigned int caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+	if (!(caps & V4L2_CAP_VIDEO_OUTPUT) or !(caps & (V4L2_CAP_STREAMING | V4L2_CAP_READWRITE))) {
+		V4L2OUT_WARNING("not a video output device\n");
+		close();
+		return false;
+	}
+
+	PixelBuffer probe;
+	memset(&probe, 0, sizeof(PixelBuffer));
+	probe.fmt = fmt;
+	probe.width = width;
+	probe.stride = stride;
+	stride = pixelbuffer_stride(&probe);
+
+	mFormat.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	mFormat.fmt.pix.width = width;
+	mFormat.fmt.pix.height = height;
+	mFormat.fmt.pix.pixelformat = pixelbuffer_fmt_to_v4l2_pix_fmt(fmt);
+	mFormat.fmt.pix.bytesperline = stride;
+	mFormat.fmt.pix.field = V4L2_FIELD_NONE;
+	if (out_xioctl(mFd, VIDIOC_S_FMT, &mFormat)==-1 or
+	    mFormat.fmt.pix.pixelformat!=pixelbuffer_fmt_to_v4l2_pix_fmt(fmt) or
+	    mFormat.fmt.pix.width!=width or mFormat.fmt.pix.height!=height) {
+		V4L2OUT_WARNING("format not supported\n");
+		close();
+		return false;
+	}
+	mFmt = fmt;
+
+	if (caps & V4L2_CAP_STREAMING) {
+		// in place only when the lines are where the driver expects them
+		bool inPlace = zeroCopy and mFormat.fmt.pix.bytesperline==stride;
+		if (!(inPlace and internal_request_buffers(numBuffers, V4L2_OUTPUT_IO_USERPTR)) and
+		    !internal_request_buffers(numBuffers, V4L2_OUTPUT_IO_MMAP)) {
+			internal_release_buffers();
+		}
+	}
+	if (mIO==V4L2_OUTPUT_IO_NONE and (caps & V4L2_CAP_READWRITE)) mIO = V4L2_OUTPUT_IO_WRITE;
+	if (mIO==V4L2_OUTPUT_IO_NONE) {
+		V4L2OUT_WARNING("no IO methods available\n");
+		close();
+		return false;
+	}
+
+	if (mIO!=V4L2_OUTPUT_IO_WRITE) {
+		v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		if (out_xioctl(mFd, VIDIOC_STREAMON, &bufType)==-1) {
+			V4L2OUT_WARNING("VIDIOC_STREAMON failed\n");
+			close();
+			return false;
+		}
+		mStreaming = true;
+	}
+	return true;
+}
+
+
+void V4L2_OutputDevice::close(void) {
+	if (mFd==-1) return;
+	if (mStreaming) {
+		v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_OUTPUT;	// STREAMOFF gives every buffer back
+		out_xioctl(mFd, VIDIOC_STREAMOFF, &bufType);
+		mStreaming = false;
+	}
+	internal_release_buffers();
+	::close(mFd);
+	mFd = -1;
+}
+
+
+void V4L2_OutputDevice::internal_release_buffers(void) {
+	for (unsigned int i=0; i< mInFlight.size(); i++) {
+		if (mInFlight[i]!=NULL) CLEARPIXELBUFFERFLAG(mInFlight[i],PIXEL_BUFFER_INUSE_OUTPUT);
+	}
+	for (unsigned int i=0; i< mStaging.size(); i++) free(mStaging[i]);
+	for (unsigned int i=0; i< mBufs.size(); i++) munmap(mBufs[i], mLengths[i]);
+	if (mIO==V4L2_OUTPUT_IO_USERPTR or mIO==V4L2_OUTPUT_IO_MMAP) {
+		v4l2_requestbuffers reqBufs;			// give buffers back (after munmap!)
+		memset(&reqBufs, 0, sizeof(v4l2_requestbuffers));
+		reqBufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		reqBufs.memory = (mIO==V4L2_OUTPUT_IO_USERPTR) ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+		out_xioctl(mFd, VIDIOC_REQBUFS, &reqBufs);
+	}
+	mInFlight.clear();
+	mInPlace = 0;
+	mBusy.clear();
+	mStaging.clear();
+	mBufs.clear();
+	mLengths.clear();
+	std::vector<unsigned char>().swap(mScratch);
+	mIO = V4L2_OUTPUT_IO_NONE;
+}
+
+
+bool V4L2_OutputDevice::internal_switch_to_mmap(void) {
+	unsigned int numBuffers = mBusy.size();
+	v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	out_xioctl(mFd, VIDIOC_STREAMOFF, &bufType);			// gives every buffer back
+	mStreaming = false;
+	internal_release_buffers();
+	if (!internal_request_buffers(numBuffers, V4L2_OUTPUT_IO_MMAP) or out_xioctl(mFd, VIDIOC_STREAMON, &bufType)==-1) {
+		V4L2OUT_WARNING("cannot switch to MMAP buffers\n");
+		internal_release_buffers();
+		return false;
+	}
+	mStreaming = true;
+	return true;
+}
+
+
+bool V4L2_OutputDevice::internal_request_buffers(unsigned int numBuffers, V4L2_OutputIO io) {
+	v4l2_requestbuffers reqBufs;
+	memset(&reqBufs, 0, sizeof(v4l2_requestbuffers));
+	reqBufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	reqBufs.memory = (io==V4L2_OUTPUT_IO_USERPTR) ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+	reqBufs.count = numBuffers;
+	if (out_xioctl(mFd, VIDIOC_REQBUFS, &reqBufs)==-1 or reqBufs.count==0) {
+		V4L2OUT_WARNING("VIDIOC_REQBUFS failed\n");
+		return false;
+	}
+	mIO = io;
+	mBusy.assign(reqBufs.count, false);
+	mInFlight.assign(reqBufs.count, (PixelBuffer*) NULL);
+	if (io==V4L2_OUTPUT_IO_USERPTR) {
+		mStaging.assign(reqBufs.count, (void*) NULL);
+		return true;
+	}
+
+	for (unsigned int i=0; i< reqBufs.count; i++) {
+		v4l2_buffer queryBuf;
+		memset(&queryBuf, 0, sizeof(v4l2_buffer));
+		queryBuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		queryBuf.memory = V4L2_MEMORY_MMAP;
+		queryBuf.index = i;
+		if (out_xioctl(mFd, VIDIOC_QUERYBUF, &queryBuf)==-1) {
+			V4L2OUT_WARNING("VIDIOC_QUERYBUF failed\n");
+			return false;
+		}
+		void* buf = mmap(NULL, queryBuf.length, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, queryBuf.m.offset);
+		if (buf==MAP_FAILED) {
+			V4L2OUT_WARNING("mmap failed\n");
+			return false;
+		}
+		mBufs.push_back(buf);
+		mLengths.push_back(queryBuf.length);
+	}
+	return true;
+}
+
+
+void V4L2_OutputDevice::internal_reclaim(void) {
+	for (;;) {
+		v4l2_buffer dqBuf;
+		memset(&dqBuf, 0, sizeof(v4l2_buffer));
+		dqBuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		dqBuf.memory = (mIO==V4L2_OUTPUT_IO_USERPTR) ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+		if (out_xioctl(mFd, VIDIOC_DQBUF, &dqBuf)==-1) return;		// EAGAIN: the driver still holds the others
+		if (dqBuf.index >= mBusy.size()) continue;
+		mBusy[dqBuf.index] = false;
+		if (mInFlight[dqBuf.index]!=NULL) {
+			CLEARPIXELBUFFERFLAG(mInFlight[dqBuf.index],PIXEL_BUFFER_INUSE_OUTPUT);
+			mInFlight[dqBuf.index] = NULL;
+			mInPlace--;
+		}
+	}
+}
+
+
+bool V4L2_OutputDevice::internal_copy(unsigned int index, const PixelBuffer* pb) {
+	PixelBuffer slot = *pb;
+	if (mIO==V4L2_OUTPUT_IO_USERPTR) {
+		if (mStaging[index]==NULL and
+		    posix_memalign(&mStaging[index], sysconf(_SC_PAGESIZE), mFormat.fmt.pix.sizeimage)!=0) {
+			mStaging[index] = NULL;
+			V4L2OUT_WARNING("cannot allocate staging buffer\n");
+			return false;
+		}
+		slot.buf = mStaging[index];
+		slot.length = mFormat.fmt.pix.sizeimage;
+	}
+	else {
+		slot.buf = mBufs[index];
+		slot.length = mLengths[index];
+	}
+	slot.stride = mFormat.fmt.pix.bytesperline;
+	return pixelbuffer_copy(pb, &slot);
+}
+
+
+bool V4L2_OutputDevice::internal_qbuf(unsigned int index, PixelBuffer* pb, bool inPlace) {
+	v4l2_buffer qBuf;
+	memset(&qBuf, 0, sizeof(v4l2_buffer));
+	qBuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	qBuf.index = index;
+	qBuf.field = V4L2_FIELD_NONE;
+	qBuf.bytesused = mFormat.fmt.pix.sizeimage;
+	qBuf.timestamp.tv_sec = pb->sec;
+	qBuf.timestamp.tv_usec = pb->usec;
+	if (mIO==V4L2_OUTPUT_IO_MMAP) qBuf.memory = V4L2_MEMORY_MMAP;
+	else if (inPlace) {
+		qBuf.memory = V4L2_MEMORY_USERPTR;
+		qBuf.m.userptr = (unsigned long) pb->buf;
+		qBuf.length = pb->length;
+		SETPIXELBUFFERFLAG(pb,PIXEL_BUFFER_INUSE_OUTPUT);		// the driver reads it until it gives the buffer back
+	}
+	else {
+		qBuf.memory = V4L2_MEMORY_USERPTR;
+		qBuf.m.userptr = (unsigned long) mStaging[index];
+		qBuf.length = mFormat.fmt.pix.sizeimage;
+	}
+	if (out_xioctl(mFd, VIDIOC_QBUF, &qBuf)==-1) {
+		V4L2OUT_WARNING("VIDIOC_QBUF failed\n");
+		if (inPlace) CLEARPIXELBUFFERFLAG(pb,PIXEL_BUFFER_INUSE_OUTPUT);
+		return false;
+	}
+	mBusy[index] = true;
+	if (inPlace) {
+		mInFlight[index] = pb;
+		mInPlace++;
+	}
+	return true;
+}
+
+
+bool V4L2_OutputDevice::publish(PixelBuffer* pb) {
+	if (mFd==-1 or pb==NULL or pb->buf==NULL) return false;
+	if (pb->fmt!=mFmt or pb->width!=mFormat.fmt.pix.width or pb->height!=mFormat.fmt.pix.height) {
+		mDropped++;
+		return false;
+	}
+
+	if (mIO==V4L2_OUTPUT_IO_WRITE) {
+		// write() takes packed lines
+		PixelBuffer packed = *pb;
+		packed.stride = mFormat.fmt.pix.bytesperline;
+		bool sameLayout = (pixelbuffer_stride(pb)==pixelbuffer_stride(&packed));
+		if (sameLayout and pb->length < mFormat.fmt.pix.sizeimage) {		// write() would read past the picture
+			mDropped++;
+			return false;
+		}
+		if (!sameLayout) {
+			if (mScratch.size() < mFormat.fmt.pix.sizeimage) mScratch.resize(mFormat.fmt.pix.sizeimage);
+			packed.buf = &mScratch[0];
+			packed.length = mScratch.size();
+			if (!pixelbuffer_copy(pb, &packed)) {
+				mDropped++;
+				return false;
+			}
+		}
+		ssize_t res;
+		do {
+			res = write(mFd, packed.buf, mFormat.fmt.pix.sizeimage);
+		} while (res==-1 and errno==EINTR);
+		if (res!=(ssize_t) mFormat.fmt.pix.sizeimage) {
+			mDropped++;
+			return false;
+		}
+		mPublished++;
+		return true;
+	}
+
+	if (mIO==V4L2_OUTPUT_IO_NONE) {					// switching to MMAP failed
+		mDropped++;
+		return false;
+	}
+	internal_reclaim();
+	unsigned int index = 0;
+	while (index < mBusy.size() and mBusy[index]) index++;
+	if (index==mBusy.size()) {						// readers are behind: drop rather than stall the grabber
+		mDropped++;
+		return false;
+	}
+
+	// in place when the driver takes it as it is, and the grabber is left with buffers of its own
+	bool inPlace = mIO==V4L2_OUTPUT_IO_USERPTR and mInPlace < mMaxInPlace and
+		       (pb->stride==0 or pb->stride==mFormat.fmt.pix.bytesperline) and
+		       pb->length >= mFormat.fmt.pix.sizeimage;
+	if (inPlace) {
+		if (internal_qbuf(index, pb, true)) {
+			mPublished++;
+			return true;
+		}
+		// the pages can't be pinned (ie. another device's MMAP buffer): copy from now on
+		if (!internal_switch_to_mmap()) {
+			mDropped++;
+			return false;
+		}
+		index = 0;							// every buffer is free again
+	}
+	if (!internal_copy(index, pb) or !internal_qbuf(index, pb, false)) {
+		mDropped++;
+		return false;
+	}
+	mPublished++;
+	return true;
+}
+
+
+void V4L2_OutputDevice::frame_grabbed(PixelBuffer* pb) {
+	publish(pb);
+}
+
+
+void V4L2_OutputDevice::buffers_exhausted(void) {
+	if (mFd==-1 or !mStreaming) return;
+	internal_reclaim();
+}
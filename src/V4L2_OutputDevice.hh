@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+
+#ifndef V4L2_OutputDevice_HH
+#define V4L2_OutputDevice_HH
+
+extern "C" {
+#include <linux/videodev2.h>
+}
+
+#include <string>
+#include <vector>
+
+#include "Debug.hh"
+#include "PixelBuffer.hh"
+#include "FrameSink.hh"
+
+// V4L2_OutputDevice pushes pictures into a V4L2 output node (v4l2loopback, vivid...) so that other
+// programs can capture them.
+// Pictures go to the driver, in order of preference:
+// - in place (USERPTR): the PixelBuffer is locked with PIXEL_BUFFER_INUSE_OUTPUT until the driver is
+//   done with it (a grabber doesn't requeue it meanwhile); no copy. At most get_max_in_place() pictures
+//   are read in place at once, the others are copied, so that the grabber keeps buffers of its own
+// - copied in a driver buffer (MMAP); also when the driver refuses a picture in place (ie. another
+//   device's MMAP buffers can't be pinned): the device switches to MMAP for good
+// - with write() when the node doesn't stream
+// publish() never waits for the driver: a picture that finds every buffer in use is dropped.
+// Pictures read in place are given back when the driver is done with them, at the next publish() or
+// when the grabber runs out of buffers (buffers_exhausted()).
+
+// default number of driver buffers
+#define V4L2_OUTPUT_NUM_BUFFERS 4
+// default number of pictures read in place at once: less than the grabber's buffers
+#define V4L2_OUTPUT_MAX_IN_PLACE 2
+
+// V4L2 output device logging helpers
+#define V4L2OUT_WARNING_PREFIX	(" * WARNING - v4l2_out - ")
+
+// Used to be implemented using ACE helpers - need to switch to something else
+#define V4L2OUT_WARNING(x) {}
+
+enum V4L2_OutputIO {
+	V4L2_OUTPUT_IO_NONE,
+	V4L2_OUTPUT_IO_USERPTR,
+	V4L2_OUTPUT_IO_MMAP,
+	V4L2_OUTPUT_IO_WRITE
+};
+
+class V4L2_OutputDevice : public FrameSink {
+public:
+	V4L2_OutputDevice();
+	~V4L2_OutputDevice();
+
+	// open path for width x height fmt pictures whose lines are stride bytes apart (0: packed)
+	// zeroCopy false never reads pictures in place (their buffers are released as soon as publish() returns)
+	// returns false (and leaves the device closed) when the node can't take the format as it is
+	bool open(const std::string& path, PixelBufferFormat fmt, unsigned int width, unsigned int height,
+		  unsigned int stride = 0, unsigned int numBuffers = V4L2_OUTPUT_NUM_BUFFERS, bool zeroCopy = true);
+	void close(void);
+	bool is_open(void) const { return mFd!=-1; }
+
+	V4L2_OutputIO get_io_method(void) const { return mIO; }
+
+	// at most max pictures read in place at once (0: always copy); keep it below the number of buffers
+	// of the grabber (Grabber::get_num_buffers()), it is left with the others
+	void set_max_in_place(unsigned int max) { mMaxInPlace = max; }
+	unsigned int get_max_in_place(void) const { return mMaxInPlace; }
+
+	// hand pb to the driver (its timestamp goes with it)
+	// returns false when it was dropped: format mismatch, no free driver buffer or driver error
+	bool publish(PixelBuffer* pb);
+
+	unsigned long long get_published(void) const { return mPublished; }
+	unsigned long long get_dropped(void) const { return mDropped; }
+
+	// FrameSink: publish every grabbed picture
+	void frame_grabbed(PixelBuffer* pb);
+	// FrameSink: give back the pictures the driver is done with
+	void buffers_exhausted(void);
+
+private:
+	bool internal_request_buffers(unsigned int numBuffers, V4L2_OutputIO io);
+	// dequeue the buffers the driver is done with (without waiting) and unlock their pictures
+	void internal_reclaim(void);
+	void internal_release_buffers(void);
+	// the driver refused a picture in place: stream MMAP buffers instead
+	bool internal_switch_to_mmap(void);
+	// copy pb in the buffer index (MMAP buffer, or staging buffer with USERPTR), line by line
+	bool internal_copy(unsigned int index, const PixelBuffer* pb);
+	bool internal_qbuf(unsigned int index, PixelBuffer* pb, bool inPlace);
+
+	int mFd;
+	V4L2_OutputIO mIO;
+	bool mStreaming;
+	v4l2_format mFormat;				// as the driver took it
+	PixelBufferFormat mFmt;
+
+	std::vector<bool> mBusy;			// per driver buffer: queued
+	std::vector<PixelBuffer*> mInFlight;		// USERPTR: picture read in place, NULL when free
+	std::vector<void*> mBufs;			// MMAP buffers
+	std::vector<unsigned int> mLengths;
+	std::vector<void*> mStaging;			// USERPTR: per driver buffer, buffer pictures are copied in (allocated on use)
+	std::vector<unsigned char> mScratch;		// write(): pictures repacked to the driver's layout
+	unsigned int mMaxInPlace;
+	unsigned int mInPlace;				// pictures read in place now
+
+	unsigned long long mPublished;
+	unsigned long long mDropped;
+};
+
+#endif /*V4L2_OutputDevice_HH*/
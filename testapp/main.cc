@@ -42,6 +42,7 @@ int main(int argc, char **argv) {
 	d.maxWidth = 640;
 	d.maxHeight = 480;
 	d.maxNumBuffers = 6;
+	d.frameRate = 10.0f;		// the driver (or the grabber) paces grab(): no need to sleep
 	
 	Grabber* dev2=new V4L2_Device(&d);
 	dev2->init();
@@ -92,8 +93,6 @@ int main(int argc, char **argv) {
 			}
 			fclose(out);
 #endif
-			
-			usleep(100000);
 		}
 	}
 
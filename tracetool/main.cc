@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2007 Riccardo Lucchese, riccardo.lucchese at gmail.com
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ *    1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 
+ *    2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 
+ *    3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+// tracetool: converts a file written by grabber_trace_flush() to Chrome trace JSON
+// (chrome://tracing, https://ui.perfetto.dev)
+// usage: tracetool <trace file> [<json file>]   (json goes to stdout when omitted)
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "Trace.hh"
+
+static const char* event_name(unsigned int type) {
+	switch (type) {
+	case (TRACE_EV_QBUF)      :  return "QBUF";
+	case (TRACE_EV_DQBUF)     :  return "DQBUF";
+	case (TRACE_EV_READ)      :  return "read";
+	case (TRACE_EV_MCAPTURE)  :  return "MCAPTURE";
+	case (TRACE_EV_HANDOUT)   :  return "handout";
+	case (TRACE_EV_LOCKED)    :  return "locked";
+	case (TRACE_EV_DROP)      :  return "drop";
+	case (TRACE_EV_ERRNO)     :  return "error";
+	case (TRACE_EV_USER)      :  return "user";
+	default : return "unknown";
+	}
+}
+
+// events whose arg1 is the duration of the operation ending at ts
+static bool event_has_duration(unsigned int type) {
+	return (type==TRACE_EV_DQBUF) or (type==TRACE_EV_READ) or (type==TRACE_EV_MCAPTURE);
+}
+
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <trace file> [<json file>]\n", argv[0]);
+		return 1;
+	}
+	FILE* in = fopen(argv[1], "rb");
+	if (in==NULL) { perror(argv[1]); return 1; }
+	FILE* out = stdout;
+	if (argc > 2) {
+		out = fopen(argv[2], "w");
+		if (out==NULL) { perror(argv[2]); return 1; }
+	}
+
+	TraceFileHeader hdr;
+	if (fread(&hdr, sizeof(TraceFileHeader), 1, in)!=1 or hdr.magic!=TRACE_FILE_MAGIC or hdr.version!=TRACE_FILE_VERSION) {
+		fprintf(stderr, "%s: not a trace file\n", argv[1]);
+		return 1;
+	}
+	// ts -> ns using the two calibration samples in the header
+	double nsPerTick = 1.0;
+	if (hdr.ts1 > hdr.ts0) nsPerTick = (double)(hdr.ns1 - hdr.ns0) / (double)(hdr.ts1 - hdr.ts0);
+
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	bool first = true;
+	std::vector<TraceEvent> events;
+	for (unsigned int r = 0; r < hdr.numRings; r++) {
+		TraceFileRing fr;
+		if (fread(&fr, sizeof(TraceFileRing), 1, in)!=1) { fprintf(stderr, "truncated file\n"); break; }
+		events.resize(fr.numEvents);
+		if (fr.numEvents and fread(&events[0], sizeof(TraceEvent), fr.numEvents, in)!=fr.numEvents) {
+			fprintf(stderr, "truncated file\n");
+			break;
+		}
+		char name[sizeof(fr.name) + 1];
+		memcpy (name, fr.name, sizeof(fr.name));
+		name[sizeof(fr.name)] = '\0';
+		for (char* c = name; *c; c++) if (*c=='"' or *c=='\\') *c = '_';
+
+		fprintf(out, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\",\"lost\":%llu}}",
+			first ? "" : ",\n", fr.tid, name, fr.lost);
+		first = false;
+
+		for (unsigned int i = 0; i < fr.numEvents; i++) {
+			const TraceEvent& e = events[i];
+			double us = (hdr.ns0 + ((double) e.ts - (double) hdr.ts0) * nsPerTick) / 1000.0;
+			if (event_has_duration(e.type)) {
+				double durUs = e.arg1 / 1000.0;
+				fprintf(out, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"buffer\":%u}}",
+					fr.tid, event_name(e.type), us - durUs, durUs, e.arg0);
+			}
+			else {
+				fprintf(out, ",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"name\":\"%s\",\"ts\":%.3f,\"args\":{\"arg0\":%u,\"arg1\":%llu}}",
+					fr.tid, event_name(e.type), us, e.arg0, e.arg1);
+			}
+		}
+	}
+	fprintf(out, "\n]}\n");
+	fclose(in);
+	if (out!=stdout) fclose(out);
+	return 0;
+}